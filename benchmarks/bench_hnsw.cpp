@@ -0,0 +1,500 @@
+// Native HNSW benchmark. Drives HNSWIndex directly, without the Python
+// bindings, and reports build time, recall@k and QPS over an ef_search sweep,
+// single-query latency percentiles, batched-search thread scaling and peak
+// RSS. Results go to stdout (or --json) as one JSON document; a readable
+// summary goes to stderr.
+//
+//   bench_hnsw --base sift_base.fvecs --query sift_query.fvecs --gt sift_groundtruth.ivecs
+//   bench_hnsw --synthetic 100000x128 --queries 1000 --json results.json
+//
+// Without --gt the ground truth is computed by brute force.
+//
+//   bench_hnsw --check-kernels
+//
+// checks the fixed-dimension distance kernels against the generic ones and
+// exits non-zero on a mismatch.
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "distance.hpp"
+#include "hnsw_index.hpp"
+#include "parallel.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string base_path, query_path, gt_path, json_path, name;
+    size_t synthetic_n = 0, synthetic_dim = 0, synthetic_queries = 1000;
+    size_t max_queries = 0;
+    std::string metric = "l2", storage = "float";
+    size_t M = 16, ef_construction = 200, k = 10, build_threads = 0;
+    std::vector<size_t> ef_sweep = {10, 20, 40, 80, 160, 320};
+    std::vector<size_t> threads;
+    size_t patience = 0, max_ef = 0;  // SearchOptions for every search
+    size_t scaling_ef = 0;        // 0: smallest swept ef reaching recall 0.9
+    double min_seconds = 1.0;     // per thread-scaling run
+    bool check_kernels = false;
+};
+
+// Row-major vectors read from an .fvecs/.ivecs file or generated.
+template <typename T>
+struct Matrix {
+    std::vector<T> data;
+    size_t rows = 0, dim = 0;
+    const T* row(size_t i) const { return data.data() + i * dim; }
+};
+
+[[noreturn]] void usage(const char* error = nullptr) {
+    if (error) std::cerr << "error: " << error << "\n\n";
+    std::cerr <<
+        "usage: bench_hnsw (--base FILE.fvecs --query FILE.fvecs [--gt FILE.ivecs] | --synthetic NxDIM)\n"
+        "       bench_hnsw --check-kernels\n"
+        "  --queries N          synthetic query count (default 1000)\n"
+        "  --max-queries N      use only the first N queries\n"
+        "  --metric NAME        l2, cosine or dot (default l2)\n"
+        "  --storage NAME       float, int8 or pq (default float)\n"
+        "  --M N                (default 16)\n"
+        "  --ef-construction N  (default 200)\n"
+        "  --build-threads N    add_batch threads, 0 = all cores (default 0)\n"
+        "  --k N                (default 10)\n"
+        "  --ef LIST            ef_search sweep (default 10,20,40,80,160,320)\n"
+        "  --patience N         adaptive termination patience (default 0, off)\n"
+        "  --max-ef N           widen still-improving queries up to this ef (default 0)\n"
+        "  --threads LIST       thread-scaling sweep (default 1,2,4,... up to all cores)\n"
+        "  --scaling-ef N       ef_search for thread scaling (default: first swept ef with recall >= 0.9)\n"
+        "  --min-seconds S      minimum duration of each thread-scaling run (default 1)\n"
+        "  --name LABEL         dataset label in the output\n"
+        "  --json FILE          write JSON here instead of stdout\n";
+    std::exit(error ? 2 : 0);
+}
+
+size_t parse_size(const std::string& s) {
+    char* end = nullptr;
+    unsigned long long v = std::strtoull(s.c_str(), &end, 10);
+    if (s.empty() || *end != '\0') usage(("not a number: " + s).c_str());
+    return static_cast<size_t>(v);
+}
+
+std::vector<size_t> parse_list(const std::string& s) {
+    std::vector<size_t> out;
+    std::stringstream in(s);
+    for (std::string item; std::getline(in, item, ',');) out.push_back(parse_size(item));
+    if (out.empty()) usage(("empty list: " + s).c_str());
+    return out;
+}
+
+Options parse_args(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") usage();
+        if (arg == "--check-kernels") {
+            o.check_kernels = true;
+            continue;
+        }
+        if (i + 1 >= argc) usage(("missing value for " + arg).c_str());
+        std::string value = argv[++i];
+        if (arg == "--base") o.base_path = value;
+        else if (arg == "--query") o.query_path = value;
+        else if (arg == "--gt") o.gt_path = value;
+        else if (arg == "--json") o.json_path = value;
+        else if (arg == "--name") o.name = value;
+        else if (arg == "--synthetic") {
+            size_t x = value.find('x');
+            if (x == std::string::npos) usage("--synthetic expects NxDIM");
+            o.synthetic_n = parse_size(value.substr(0, x));
+            o.synthetic_dim = parse_size(value.substr(x + 1));
+        }
+        else if (arg == "--queries") o.synthetic_queries = parse_size(value);
+        else if (arg == "--max-queries") o.max_queries = parse_size(value);
+        else if (arg == "--metric") o.metric = value;
+        else if (arg == "--storage") o.storage = value;
+        else if (arg == "--M") o.M = parse_size(value);
+        else if (arg == "--ef-construction") o.ef_construction = parse_size(value);
+        else if (arg == "--build-threads") o.build_threads = parse_size(value);
+        else if (arg == "--k") o.k = parse_size(value);
+        else if (arg == "--ef") o.ef_sweep = parse_list(value);
+        else if (arg == "--threads") o.threads = parse_list(value);
+        else if (arg == "--patience") o.patience = parse_size(value);
+        else if (arg == "--max-ef") o.max_ef = parse_size(value);
+        else if (arg == "--scaling-ef") o.scaling_ef = parse_size(value);
+        else if (arg == "--min-seconds") o.min_seconds = std::atof(value.c_str());
+        else usage(("unknown option " + arg).c_str());
+    }
+    bool files = !o.base_path.empty() || !o.query_path.empty();
+    if (o.check_kernels) return o;
+    if (files == (o.synthetic_n > 0)) usage("give either --base and --query or --synthetic");
+    if (files && (o.base_path.empty() || o.query_path.empty())) usage("--base and --query go together");
+    if (!o.gt_path.empty() && !files) usage("--gt needs --base and --query");
+    if (o.k < 1) usage("--k must be >= 1");
+    if (o.threads.empty()) {
+        size_t hw = std::max<size_t>(1, std::thread::hardware_concurrency());
+        for (size_t t = 1; t < hw; t *= 2) o.threads.push_back(t);
+        o.threads.push_back(hw);
+    }
+    if (o.name.empty()) {
+        o.name = files ? o.base_path.substr(o.base_path.find_last_of('/') + 1)
+                       : "synthetic-" + std::to_string(o.synthetic_n) + "x" + std::to_string(o.synthetic_dim);
+    }
+    return o;
+}
+
+// .fvecs/.ivecs: each row is a little-endian int32 dimension followed by that
+// many 4-byte values.
+template <typename T>
+Matrix<T> read_vecs(const std::string& path, size_t max_rows = 0) {
+    static_assert(sizeof(T) == 4, "vecs rows hold 4-byte values");
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    Matrix<T> m;
+    int32_t dim;
+    while ((max_rows == 0 || m.rows < max_rows) && std::fread(&dim, sizeof(dim), 1, f) == 1) {
+        if (dim <= 0 || (m.dim && static_cast<size_t>(dim) != m.dim)) {
+            std::fclose(f);
+            throw std::runtime_error("Bad row dimension in " + path);
+        }
+        m.dim = static_cast<size_t>(dim);
+        m.data.resize((m.rows + 1) * m.dim);
+        if (std::fread(m.data.data() + m.rows * m.dim, sizeof(T), m.dim, f) != m.dim) {
+            std::fclose(f);
+            throw std::runtime_error("Truncated row in " + path);
+        }
+        ++m.rows;
+    }
+    std::fclose(f);
+    if (m.rows == 0) throw std::runtime_error("No rows in " + path);
+    return m;
+}
+
+Matrix<float> random_matrix(size_t rows, size_t dim, uint32_t seed) {
+    Matrix<float> m;
+    m.rows = rows;
+    m.dim = dim;
+    m.data.resize(rows * dim);
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> normal;
+    for (float& x : m.data) x = normal(rng);
+    return m;
+}
+
+// Exact k nearest base IDs per query under the index's metric.
+Matrix<int32_t> brute_force(const Matrix<float>& base, const Matrix<float>& queries, size_t k,
+                            const std::string& metric) {
+    auto dist = vecdb::get_distance_func(metric, vecdb::detect_simd_level());
+    k = std::min(k, base.rows);
+    Matrix<int32_t> gt;
+    gt.rows = queries.rows;
+    gt.dim = k;
+    gt.data.resize(queries.rows * k);
+    vecdb::parallel_for(queries.rows, 0, [&](size_t q) {
+        std::vector<std::pair<float, int32_t>> d(base.rows);
+        for (size_t i = 0; i < base.rows; ++i)
+            d[i] = {dist(queries.row(q), base.row(i), base.dim), static_cast<int32_t>(i)};
+        std::partial_sort(d.begin(), d.begin() + k, d.end());
+        for (size_t j = 0; j < k; ++j) gt.data[q * k + j] = d[j].second;
+    });
+    return gt;
+}
+
+size_t peak_rss_bytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Nearest-rank percentile of sorted values.
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+double recall_at_k(const int64_t* ids, const Matrix<int32_t>& gt, size_t q, size_t k) {
+    const int32_t* truth = gt.row(q);
+    size_t n = std::min(k, gt.dim), hits = 0;
+    for (size_t i = 0; i < k; ++i)
+        hits += std::find(truth, truth + n, ids[i]) != truth + n;
+    return static_cast<double>(hits) / n;
+}
+
+struct SweepPoint {
+    size_t ef;
+    double recall, qps, mean_us, p50_us, p99_us, p999_us;
+};
+
+struct ScalingPoint {
+    size_t threads;
+    double qps;
+};
+
+// Single-threaded loop of one search() per query, timed per query.
+SweepPoint run_sweep_point(const vecdb::HNSWIndex& index, const Matrix<float>& queries,
+                           const Matrix<int32_t>& gt, size_t k, size_t ef, const vecdb::SearchOptions& options) {
+    std::vector<double> latencies(queries.rows);
+    std::vector<int64_t> ids(k);
+    double recall = 0;
+    auto start = Clock::now();
+    for (size_t q = 0; q < queries.rows; ++q) {
+        auto t0 = Clock::now();
+        auto results = index.search(queries.row(q), k, ef, nullptr, nullptr, &options);
+        latencies[q] = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+        std::fill(ids.begin(), ids.end(), -1);
+        for (size_t i = 0; i < results.size(); ++i) ids[i] = results[i].first;
+        recall += recall_at_k(ids.data(), gt, q, k);
+    }
+    double total = seconds_since(start);
+    double sum = 0;
+    for (double l : latencies) sum += l;
+    std::sort(latencies.begin(), latencies.end());
+    return {ef, recall / queries.rows, queries.rows / total, sum / latencies.size(),
+            percentile(latencies, 50), percentile(latencies, 99), percentile(latencies, 99.9)};
+}
+
+// search_batch() over all queries on `threads` threads, repeated until
+// min_seconds have passed.
+ScalingPoint run_scaling_point(const vecdb::HNSWIndex& index, const Matrix<float>& queries, size_t k,
+                               size_t ef, size_t threads, double min_seconds, const vecdb::SearchOptions& options) {
+    std::vector<int64_t> ids(queries.rows * k);
+    std::vector<float> distances(queries.rows * k);
+    size_t searched = 0;
+    auto start = Clock::now();
+    do {
+        index.search_batch(queries.data.data(), queries.rows, k, ef, threads, ids.data(), distances.data(), nullptr,
+                           &options);
+        searched += queries.rows;
+    } while (seconds_since(start) < min_seconds);
+    return {threads, searched / seconds_since(start)};
+}
+
+std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+std::string json_number(double v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6g", v);
+    return buf;
+}
+
+// Compare each fixed-dimension kernel with the generic kernel of its metric,
+// at every SIMD level this CPU runs, on random vectors (unit length for
+// cosine). They sum in different orders, so they agree to within a rounding
+// tolerance scaled by the sum of the terms' magnitudes. Returns the number
+// of mismatches.
+size_t check_kernels() {
+    std::vector<vecdb::SimdLevel> levels = {vecdb::SimdLevel::Scalar};
+    vecdb::SimdLevel best = vecdb::detect_simd_level();
+    if (best == vecdb::SimdLevel::AVX512) levels.push_back(vecdb::SimdLevel::AVX2);
+    if (best != vecdb::SimdLevel::Scalar) levels.push_back(best);
+    size_t checked = 0, failed = 0;
+    for (size_t dim : {128, 384, 768, 1024, 1536}) {
+        Matrix<float> v = random_matrix(64, dim, static_cast<uint32_t>(dim));
+        for (const char* metric : {"l2", "cosine", "dot"}) {
+            Matrix<float> m = v;
+            if (std::string(metric) == "cosine") {
+                for (size_t r = 0; r < m.rows; ++r) vecdb::normalize_vector(m.data.data() + r * dim, dim);
+            }
+            for (vecdb::SimdLevel level : levels) {
+                vecdb::DistanceFunc generic = vecdb::get_index_distance_func(metric, level);
+                vecdb::DistanceFunc fixed = vecdb::get_index_distance_func(metric, level, dim);
+                if (fixed == generic) {
+                    std::cerr << metric << " " << dim << " " << vecdb::simd_level_name(level)
+                              << ": no fixed kernel\n";
+                    ++failed;
+                    continue;
+                }
+                for (size_t i = 0; i + 1 < m.rows; ++i) {
+                    const float* a = m.row(i);
+                    const float* b = m.row(i + 1);
+                    double scale = 0;
+                    for (size_t j = 0; j < dim; ++j)
+                        scale += std::string(metric) == "l2" ? (a[j] - b[j]) * double(a[j] - b[j])
+                                                             : std::fabs(double(a[j]) * b[j]);
+                    float want = generic(a, b, dim), got = fixed(a, b, dim);
+                    ++checked;
+                    if (std::fabs(double(got) - want) > 1e-5 * scale + 1e-6) {
+                        std::cerr << metric << " " << dim << " " << vecdb::simd_level_name(level) << ": fixed "
+                                  << got << ", generic " << want << "\n";
+                        ++failed;
+                    }
+                }
+            }
+        }
+    }
+    std::cerr << "kernels: " << checked << " checked, " << failed << " mismatched\n";
+    return failed;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options opt = parse_args(argc, argv);
+    if (opt.check_kernels) return check_kernels() == 0 ? 0 : 1;
+    try {
+        // Dataset
+        Matrix<float> base, queries;
+        Matrix<int32_t> gt;
+        std::string gt_source = opt.gt_path.empty() ? "brute_force" : opt.gt_path;
+        if (opt.synthetic_n) {
+            base = random_matrix(opt.synthetic_n, opt.synthetic_dim, 42);
+            queries = random_matrix(opt.synthetic_queries, opt.synthetic_dim, 123);
+        } else {
+            base = read_vecs<float>(opt.base_path);
+            queries = read_vecs<float>(opt.query_path, opt.max_queries);
+            if (queries.dim != base.dim) throw std::runtime_error("Query and base dimensions differ");
+        }
+        if (opt.max_queries && queries.rows > opt.max_queries) {
+            queries.rows = opt.max_queries;
+            queries.data.resize(queries.rows * queries.dim);
+        }
+        std::cerr << opt.name << ": " << base.rows << " x " << base.dim << ", " << queries.rows << " queries\n";
+        if (opt.gt_path.empty()) {
+            auto start = Clock::now();
+            gt = brute_force(base, queries, opt.k, opt.metric);
+            std::cerr << "ground truth: brute force in " << json_number(seconds_since(start)) << " s\n";
+        } else {
+            gt = read_vecs<int32_t>(opt.gt_path, queries.rows);
+            if (gt.rows < queries.rows) throw std::runtime_error("Ground truth has fewer rows than queries");
+        }
+        if (gt.dim < std::min(opt.k, base.rows)) throw std::runtime_error("Ground truth has fewer than k neighbors");
+        size_t rss_loaded = peak_rss_bytes();
+
+        // Build
+        vecdb::HNSWIndex index(base.dim, opt.metric, opt.M, opt.ef_construction, true, false, false,
+                               opt.storage, false, 8, "", base.rows);
+        std::vector<int64_t> ids(base.rows);
+        for (size_t i = 0; i < base.rows; ++i) ids[i] = static_cast<int64_t>(i);
+        auto build_start = Clock::now();
+        index.add_batch(ids.data(), base.data.data(), base.rows, opt.build_threads);
+        double build_seconds = seconds_since(build_start);
+        index.set_flat_threshold(0);  // measure the graph walk even on small sets
+        size_t rss_built = peak_rss_bytes();
+        std::cerr << "build: " << json_number(build_seconds) << " s ("
+                  << json_number(base.rows / build_seconds) << " vectors/s)\n";
+
+        vecdb::SearchOptions options;
+        options.patience = opt.patience;
+        options.max_ef = opt.max_ef;
+
+        // ef_search sweep, after one untimed pass to warm caches
+        for (size_t q = 0; q < std::min<size_t>(queries.rows, 100); ++q)
+            index.search(queries.row(q), opt.k, opt.ef_sweep.front());
+        std::vector<SweepPoint> sweep;
+        std::cerr << "      ef   recall        qps   mean_us    p50_us    p99_us   p999_us\n";
+        for (size_t ef : opt.ef_sweep) {
+            SweepPoint p = run_sweep_point(index, queries, gt, opt.k, ef, options);
+            sweep.push_back(p);
+            char line[128];
+            std::snprintf(line, sizeof(line), "%8zu %8.4f %10.0f %9.1f %9.1f %9.1f %9.1f\n",
+                          p.ef, p.recall, p.qps, p.mean_us, p.p50_us, p.p99_us, p.p999_us);
+            std::cerr << line;
+        }
+
+        // Thread scaling
+        size_t scaling_ef = opt.scaling_ef;
+        if (scaling_ef == 0) {
+            scaling_ef = sweep.back().ef;
+            for (const SweepPoint& p : sweep) {
+                if (p.recall >= 0.9) {
+                    scaling_ef = p.ef;
+                    break;
+                }
+            }
+        }
+        std::vector<ScalingPoint> scaling;
+        std::cerr << "scaling at ef=" << scaling_ef << ":\n threads        qps  speedup\n";
+        for (size_t t : opt.threads) {
+            scaling.push_back(run_scaling_point(index, queries, opt.k, scaling_ef, t, opt.min_seconds, options));
+            char line[64];
+            std::snprintf(line, sizeof(line), "%8zu %10.0f %8.2f\n", t, scaling.back().qps,
+                          scaling.back().qps / scaling.front().qps);
+            std::cerr << line;
+        }
+        size_t rss_end = peak_rss_bytes();
+        std::cerr << "peak RSS: " << rss_end / (1024 * 1024) << " MiB\n";
+
+        // JSON
+        std::ostringstream js;
+        js << "{\n"
+           << "  \"benchmark\": \"bench_hnsw\",\n"
+           << "  \"schema_version\": 1,\n"
+           << "  \"machine\": {\"hardware_threads\": " << std::thread::hardware_concurrency()
+           << ", \"simd\": " << json_string(vecdb::simd_level_name(vecdb::detect_simd_level())) << "},\n"
+           << "  \"dataset\": {\"name\": " << json_string(opt.name) << ", \"num_base\": " << base.rows
+           << ", \"num_queries\": " << queries.rows << ", \"dimension\": " << base.dim
+           << ", \"metric\": " << json_string(opt.metric) << ", \"ground_truth\": " << json_string(gt_source) << "},\n"
+           << "  \"params\": {\"M\": " << opt.M << ", \"ef_construction\": " << opt.ef_construction
+           << ", \"storage\": " << json_string(opt.storage) << ", \"k\": " << opt.k
+           << ", \"build_threads\": " << opt.build_threads << ", \"patience\": " << opt.patience
+           << ", \"max_ef\": " << opt.max_ef << "},\n"
+           << "  \"build\": {\"seconds\": " << json_number(build_seconds)
+           << ", \"vectors_per_second\": " << json_number(base.rows / build_seconds) << "},\n"
+           << "  \"search\": [\n";
+        for (size_t i = 0; i < sweep.size(); ++i) {
+            const SweepPoint& p = sweep[i];
+            js << "    {\"ef_search\": " << p.ef << ", \"recall\": " << json_number(p.recall)
+               << ", \"qps\": " << json_number(p.qps) << ", \"latency_us\": {\"mean\": " << json_number(p.mean_us)
+               << ", \"p50\": " << json_number(p.p50_us) << ", \"p99\": " << json_number(p.p99_us)
+               << ", \"p999\": " << json_number(p.p999_us) << "}}" << (i + 1 < sweep.size() ? "," : "") << "\n";
+        }
+        js << "  ],\n"
+           << "  \"scaling\": {\"ef_search\": " << scaling_ef << ", \"runs\": [\n";
+        for (size_t i = 0; i < scaling.size(); ++i) {
+            js << "    {\"threads\": " << scaling[i].threads << ", \"qps\": " << json_number(scaling[i].qps)
+               << ", \"speedup\": " << json_number(scaling[i].qps / scaling.front().qps) << "}"
+               << (i + 1 < scaling.size() ? "," : "") << "\n";
+        }
+        js << "  ]},\n"
+           << "  \"peak_rss_bytes\": {\"after_load\": " << rss_loaded << ", \"after_build\": " << rss_built
+           << ", \"end\": " << rss_end << "}\n"
+           << "}\n";
+
+        if (opt.json_path.empty()) {
+            std::cout << js.str();
+        } else {
+            std::FILE* f = std::fopen(opt.json_path.c_str(), "w");
+            if (!f || std::fputs(js.str().c_str(), f) < 0 || std::fclose(f) != 0)
+                throw std::runtime_error("Cannot write " + opt.json_path);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -7,7 +7,7 @@ Measures insert throughput, search latency, and recall for the HNSW implementati
 
 import time
 import numpy as np
-from typing import Tuple, List
+from typing import Tuple
 
 # Force mock import for comparison
 import sys
@@ -35,12 +35,6 @@ def generate_vectors(n: int, dim: int, seed: int = 42) -> np.ndarray:
     return vectors
 
 
-def brute_force_search(vectors: np.ndarray, query: np.ndarray, k: int) -> List[int]:
-    """Brute force k-NN search."""
-    distances = np.linalg.norm(vectors - query, axis=1)
-    return np.argsort(distances)[:k].tolist()
-
-
 def benchmark_insert(IndexClass, vectors: np.ndarray, name: str) -> Tuple[float, float]:
     """Benchmark insert throughput."""
     n, dim = vectors.shape
@@ -60,6 +54,7 @@ def benchmark_search(IndexClass, vectors: np.ndarray, n_queries: int, k: int, na
     """Benchmark search latency."""
     n, dim = vectors.shape
     index = IndexClass(dim, 'l2')
+    index.flat_threshold = 0  # time the graph walk, not the exact scan
 
     for i, vec in enumerate(vectors):
         index.add(i, vec.tolist())
@@ -77,23 +72,25 @@ def benchmark_search(IndexClass, vectors: np.ndarray, n_queries: int, k: int, na
 
 
 def benchmark_recall(IndexClass, vectors: np.ndarray, n_queries: int, k: int, name: str) -> float:
-    """Benchmark recall@k vs brute force."""
+    """Benchmark recall@k vs the index's exact scan."""
     n, dim = vectors.shape
     index = IndexClass(dim, 'l2')
+    index.flat_threshold = 0  # measure the graph walk, not the exact scan
 
     for i, vec in enumerate(vectors):
         index.add(i, vec.tolist())
 
     queries = generate_vectors(n_queries, dim, seed=123)
+    truth, _ = index.search_exact(queries, k)
 
     total_recall = 0.0
-    for query in queries:
+    for query, truth_ids in zip(queries, truth):
         # HNSW results
         hnsw_results = index.search(query.tolist(), k=k)
         hnsw_ids = set(r[0] for r in hnsw_results)
 
-        # Brute force ground truth
-        bf_ids = set(brute_force_search(vectors, query, k))
+        # Exact ground truth
+        bf_ids = set(truth_ids.tolist())
 
         # Recall
         recall = len(hnsw_ids & bf_ids) / k
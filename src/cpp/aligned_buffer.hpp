@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+namespace vecdb {
+
+// Growable, zero-initialized array of trivially copyable elements, aligned to a
+// cache line so vector slots and SIMD loads never straddle one. A buffer can
+// also be a view of memory it does not own, such as a mapped file; resizing a
+// view copies it into owned memory.
+template <typename T>
+class AlignedBuffer {
+    static_assert(std::is_trivially_copyable<T>::value, "AlignedBuffer requires trivial types");
+
+public:
+    static constexpr size_t kAlignment = 64;
+
+    AlignedBuffer() = default;
+    explicit AlignedBuffer(size_t n) { resize(n); }
+    ~AlignedBuffer() {
+        if (owned_) std::free(data_);
+    }
+
+    AlignedBuffer(const AlignedBuffer& other) {
+        resize(other.size_);
+        if (size_) std::memcpy(data_, other.data_, size_ * sizeof(T));
+    }
+    AlignedBuffer(AlignedBuffer&& other) noexcept : data_(other.data_), size_(other.size_), owned_(other.owned_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.owned_ = true;
+    }
+    AlignedBuffer& operator=(AlignedBuffer other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(owned_, other.owned_);
+        return *this;
+    }
+
+    // n elements at `data`, which must be kAlignment-aligned and outlive the view.
+    static AlignedBuffer view(T* data, size_t n) {
+        AlignedBuffer buf;
+        buf.data_ = n ? data : nullptr;
+        buf.size_ = n;
+        buf.owned_ = false;
+        return buf;
+    }
+
+    // Grow or shrink to n elements, keeping the common prefix and zeroing the rest.
+    void resize(size_t n) {
+        if (n == size_) return;
+        T* fresh = nullptr;
+        if (n > 0) {
+            size_t bytes = (n * sizeof(T) + kAlignment - 1) / kAlignment * kAlignment;
+            fresh = static_cast<T*>(std::aligned_alloc(kAlignment, bytes));
+            if (!fresh) throw std::bad_alloc();
+            std::memset(static_cast<void*>(fresh), 0, bytes);
+            size_t keep = n < size_ ? n : size_;
+            if (keep) std::memcpy(static_cast<void*>(fresh), data_, keep * sizeof(T));
+        }
+        if (owned_) std::free(data_);
+        data_ = fresh;
+        size_ = n;
+        owned_ = true;
+    }
+
+    T* data() { return data_; }
+    const T* data() const { return data_; }
+    size_t size() const { return size_; }
+    T& operator[](size_t i) { return data_[i]; }
+    const T& operator[](size_t i) const { return data_[i]; }
+    bool is_view() const { return !owned_; }
+
+private:
+    T* data_ = nullptr;
+    size_t size_ = 0;
+    bool owned_ = true;
+};
+
+// Hint that [p, p + bytes) is about to be read, one cache line at a time.
+inline void prefetch(const void* p, size_t bytes) {
+#if defined(__GNUC__) || defined(__clang__)
+    const char* c = static_cast<const char*>(p);
+    for (size_t off = 0; off < bytes; off += AlignedBuffer<char>::kAlignment) __builtin_prefetch(c + off, 0, 3);
+#else
+    (void)p;
+    (void)bytes;
+#endif
+}
+
+} // namespace vecdb
@@ -1,59 +1,567 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/numpy.h>
+#include "collection.hpp"
 #include "hnsw_index.hpp"
+#include "query_server.hpp"
+#include "sharded_collection.hpp"
+#include "wal.hpp"
 
 namespace py = pybind11;
 using namespace vecdb;
 
-// Convert Python list/numpy to vector<float>
-std::vector<float> to_vector(py::object obj, size_t expected_dim) {
-    std::vector<float> vec;
+using FloatArray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+// Set the vecdb.exceptions class of that name as the Python error, so callers
+// catch the same exceptions whether this module or the mock is in use.
+void set_vecdb_error(const char* name, const std::exception& e) {
+    py::object cls = py::module_::import("vecdb.exceptions").attr(name);
+    PyErr_SetString(cls.ptr(), e.what());
+}
+
+// A C-contiguous float32 array over `obj`, which must hold `dim` floats.
+// Such arrays are used in place; anything else is converted once, after
+// its length has been checked.
+FloatArray to_vector(const py::object& obj, size_t dim) {
+    auto mismatch = [dim](const std::string& got) {
+        return DimensionError("Expected dimension " + std::to_string(dim) + ", got " + got);
+    };
+    size_t got;
     if (py::isinstance<py::array>(obj)) {
-        auto arr = obj.cast<py::array_t<float, py::array::c_style | py::array::forcecast>>();
-        vec.assign(arr.data(), arr.data() + arr.size());
+        auto arr = py::reinterpret_borrow<py::array>(obj);
+        if (arr.ndim() != 1) throw mismatch("a " + std::to_string(arr.ndim()) + "-D array");
+        got = static_cast<size_t>(arr.shape(0));
     } else {
-        vec = obj.cast<std::vector<float>>();
+        got = py::len(obj);
     }
+    if (got != dim) throw mismatch(std::to_string(got));
+    auto vec = FloatArray::ensure(obj);
+    if (!vec) throw py::type_error("Expected a sequence of floats");
+    if (vec.ndim() != 1) throw mismatch("a " + std::to_string(vec.ndim()) + "-D array");
     return vec;
 }
 
+void check_rows(const py::array& arr, size_t dim, const char* what) {
+    if (arr.ndim() != 2 || static_cast<size_t>(arr.shape(1)) != dim)
+        throw DimensionError(std::string("Expected ") + what + " of shape (n, " + std::to_string(dim) + ")");
+}
+
+// A C-contiguous float32 (n, dim) array over `obj`, used in place when it
+// already is one. Arrays are checked before any conversion.
+FloatArray to_rows(const py::object& obj, size_t dim, const char* what) {
+    if (py::isinstance<py::array>(obj)) check_rows(py::reinterpret_borrow<py::array>(obj), dim, what);
+    auto rows = FloatArray::ensure(obj);
+    if (!rows) throw py::type_error(std::string("Expected ") + what + " as a 2-D array of floats");
+    check_rows(rows, dim, what);
+    return rows;
+}
+
+// The allow-list for a boolean mask over internal IDs, or none for None.
+std::unique_ptr<IdFilter> to_filter(const py::object& mask) {
+    if (mask.is_none()) return nullptr;
+    auto arr = py::array_t<uint8_t, py::array::c_style | py::array::forcecast>::ensure(mask);
+    if (!arr || arr.ndim() != 1) throw py::type_error("filter must be a 1-D boolean mask over internal IDs");
+    return std::make_unique<IdFilter>(IdFilter::from_mask(arr.data(), static_cast<size_t>(arr.shape(0))));
+}
+
+SearchOptions to_options(size_t patience, size_t max_ef, size_t max_distances, double target_recall) {
+    SearchOptions options;
+    options.patience = patience;
+    options.max_ef = max_ef;
+    options.max_distances = max_distances;
+    options.target_recall = target_recall;
+    return options;
+}
+
+// (ids, distances) arrays of shape (n, k) for n query rows, filled by
+// run(queries, n, ids, distances) with the GIL released.
+template <typename Run>
+py::tuple result_rows(py::object query_rows, size_t dim, size_t k, Run run) {
+    FloatArray queries = to_rows(query_rows, dim, "queries");
+    if (k < 1) throw std::invalid_argument("k must be >= 1");
+    std::vector<py::ssize_t> shape{queries.shape(0), static_cast<py::ssize_t>(k)};
+    py::array_t<int64_t> ids(shape);
+    py::array_t<float> distances(shape);
+    const float* q = queries.data();
+    int64_t* ids_out = ids.mutable_data();
+    float* dists_out = distances.mutable_data();
+    {
+        py::gil_scoped_release release;
+        run(q, static_cast<size_t>(shape[0]), ids_out, dists_out);
+    }
+    return py::make_tuple(ids, distances);
+}
+
+void require_stats() {
+    if (!kStatsEnabled) throw std::runtime_error("Search statistics need a build with VECDB_ENABLE_STATS");
+}
+
+py::dict stats_dict(const SearchStats& s, bool build) {
+    py::dict d;
+    d["distances"] = s.distances;
+    d["visited"] = s.visited;
+    d["heap_pushes"] = s.heap_pushes;
+    d["deleted_skipped"] = s.deleted_skipped;
+    if (build) d["prunes"] = s.prunes;
+    d["hops"] = s.hops;
+    return d;
+}
+
 PYBIND11_MODULE(_hnsw_cpp, m) {
     m.doc() = "HNSW C++ implementation for VecDB";
     m.attr("__version__") = "0.1.0";
     m.def("is_stub", []() { return false; });
+    m.def("simd_level", []() { return simd_level_name(detect_simd_level()); },
+          "Instruction set used by the distance kernels on this CPU");
 
-    // Register exceptions
-    py::register_exception<DimensionError>(m, "DimensionError", PyExc_ValueError);
-    py::register_exception<DuplicateIDError>(m, "DuplicateIDError", PyExc_ValueError);
-    py::register_exception<DeserializationError>(m, "DeserializationError", PyExc_ValueError);
+    // Map exceptions onto vecdb.exceptions
+    py::module_ exceptions = py::module_::import("vecdb.exceptions");
+    for (const char* name : {"DimensionError", "DuplicateIDError", "DeserializationError"})
+        m.attr(name) = exceptions.attr(name);
+    py::register_exception_translator([](std::exception_ptr p) {
+        try {
+            if (p) std::rethrow_exception(p);
+        } catch (const DimensionError& e) {
+            set_vecdb_error("DimensionError", e);
+        } catch (const DuplicateIDError& e) {
+            set_vecdb_error("DuplicateIDError", e);
+        } catch (const DeserializationError& e) {
+            set_vecdb_error("DeserializationError", e);
+        }
+    });
 
-    py::class_<HNSWIndex>(m, "HNSWIndex")
-        .def(py::init<size_t, const std::string&, size_t, size_t>(),
+    // Shared so a Collection can hold the index its Python owner also exposes
+    py::class_<HNSWIndex, std::shared_ptr<HNSWIndex>> cls(m, "HNSWIndex");
+    cls
+        .def(py::init<size_t, const std::string&, size_t, size_t, bool, bool, bool, const std::string&, bool,
+                      size_t, const std::string&, size_t>(),
              py::arg("dimension"), py::arg("metric"),
-             py::arg("M") = 16, py::arg("ef_construction") = 200)
+             py::arg("M") = 16, py::arg("ef_construction") = 200,
+             py::arg("heuristic") = true, py::arg("keep_pruned") = false,
+             py::arg("extend_candidates") = false,
+             py::arg("storage") = "float", py::arg("rerank") = false,
+             py::arg("pq_subspaces") = 8, py::arg("rerank_path") = "", py::arg("max_elements") = 0)
         .def("add", [](HNSWIndex& self, int64_t id, py::object vec) {
-            self.add(id, to_vector(vec, self.dimension()));
+            FloatArray v = to_vector(vec, self.dimension());
+            py::gil_scoped_release release;
+            self.add(id, v.data());
         }, py::arg("internal_id"), py::arg("vector"))
-        .def("search", [](HNSWIndex& self, py::object query, size_t k, size_t ef_search) {
-            auto results = self.search(to_vector(query, self.dimension()), k, ef_search);
+        .def("add_batch", [](HNSWIndex& self,
+                             py::array_t<int64_t, py::array::c_style | py::array::forcecast> ids,
+                             py::object vector_rows, size_t num_threads) {
+            FloatArray vectors = to_rows(vector_rows, self.dimension(), "vectors");
+            if (ids.ndim() != 1 || ids.shape(0) != vectors.shape(0))
+                throw std::invalid_argument("ids and vectors must have the same length");
+            const int64_t* id_ptr = ids.data();
+            const float* vec_ptr = vectors.data();
+            size_t n = static_cast<size_t>(ids.shape(0));
+            py::gil_scoped_release release;
+            self.add_batch(id_ptr, vec_ptr, n, num_threads);
+        }, py::arg("internal_ids"), py::arg("vectors"), py::arg("num_threads") = 0)
+        .def("search", [](const HNSWIndex& self, py::object query, size_t k, size_t ef_search, py::object mask,
+                          bool return_stats, size_t patience, size_t max_ef, size_t max_distances,
+                          double target_recall) -> py::object {
+            FloatArray q = to_vector(query, self.dimension());
+            auto filter = to_filter(mask);
+            if (return_stats) require_stats();
+            SearchOptions options = to_options(patience, max_ef, max_distances, target_recall);
+            std::vector<std::pair<int64_t, float>> results;
+            SearchStats stats;
+            {
+                py::gil_scoped_release release;
+                results = self.search(q.data(), k, ef_search, filter.get(), return_stats ? &stats : nullptr,
+                                      &options);
+            }
             py::list ret;
             for (auto& [id, dist] : results) ret.append(py::make_tuple(id, dist));
+            if (return_stats) return py::make_tuple(ret, stats_dict(stats, false));
+            return ret;
+        }, py::arg("query"), py::arg("k"), py::arg("ef_search") = 50, py::arg("filter") = py::none(),
+           py::arg("return_stats") = false, py::arg("patience") = 0, py::arg("max_ef") = 0,
+           py::arg("max_distances") = 0, py::arg("target_recall") = 0.0)
+        .def("search_batch", [](const HNSWIndex& self, py::object query_rows, size_t k, size_t ef_search,
+                                size_t num_threads, py::object mask, size_t patience, size_t max_ef,
+                                size_t max_distances, double target_recall) {
+            FloatArray queries = to_rows(query_rows, self.dimension(), "queries");
+            if (k < 1) throw std::invalid_argument("k must be >= 1");
+            auto filter = to_filter(mask);
+            SearchOptions options = to_options(patience, max_ef, max_distances, target_recall);
+            std::vector<py::ssize_t> shape{queries.shape(0), static_cast<py::ssize_t>(k)};
+            py::array_t<int64_t> ids(shape);
+            py::array_t<float> distances(shape);
+            const float* q = queries.data();
+            int64_t* ids_out = ids.mutable_data();
+            float* dists_out = distances.mutable_data();
+            {
+                py::gil_scoped_release release;
+                self.search_batch(q, static_cast<size_t>(shape[0]), k, ef_search, num_threads, ids_out, dists_out,
+                                  filter.get(), &options);
+            }
+            return py::make_tuple(ids, distances);
+        }, py::arg("queries"), py::arg("k"), py::arg("ef_search") = 50, py::arg("num_threads") = 0,
+           py::arg("filter") = py::none(), py::arg("patience") = 0, py::arg("max_ef") = 0,
+           py::arg("max_distances") = 0, py::arg("target_recall") = 0.0)
+        .def("search_exact", [](const HNSWIndex& self, py::object query_rows, size_t k, size_t num_threads,
+                                py::object mask) {
+            auto filter = to_filter(mask);
+            return result_rows(query_rows, self.dimension(), k, [&](const float* q, size_t n, int64_t* ids, float* d) {
+                self.search_exact_batch(q, n, k, num_threads, ids, d, filter.get());
+            });
+        }, py::arg("queries"), py::arg("k") = 10, py::arg("num_threads") = 0, py::arg("filter") = py::none())
+        .def("calibrate", [](HNSWIndex& self, py::object query_rows, size_t k, std::vector<size_t> ef_values,
+                             size_t patience, size_t max_ef, size_t max_distances, size_t num_threads) {
+            FloatArray queries = to_rows(query_rows, self.dimension(), "queries");
+            const float* q = queries.data();
+            size_t n = static_cast<size_t>(queries.shape(0));
+            std::vector<CalibrationPoint> curve;
+            {
+                py::gil_scoped_release release;
+                curve = self.calibrate(q, n, k, std::move(ef_values), to_options(patience, max_ef, max_distances, 0),
+                                       num_threads);
+            }
+            py::list ret;
+            for (const auto& p : curve) ret.append(py::make_tuple(p.ef_search, p.recall));
             return ret;
-        }, py::arg("query"), py::arg("k"), py::arg("ef_search") = 50)
-        .def("remove", &HNSWIndex::remove, py::arg("internal_id"))
+        }, py::arg("queries"), py::arg("k") = 10, py::arg("ef_values") = std::vector<size_t>(),
+           py::arg("patience") = 0, py::arg("max_ef") = 0, py::arg("max_distances") = 0, py::arg("num_threads") = 0)
+        .def("ef_for_recall", &HNSWIndex::ef_for_recall, py::arg("target"))
+        .def("remove", &HNSWIndex::remove, py::arg("internal_id"), py::call_guard<py::gil_scoped_release>())
+        .def("reserve", &HNSWIndex::reserve, py::arg("n"), py::call_guard<py::gil_scoped_release>())
+        .def("resize_index", &HNSWIndex::resize_index, py::arg("n"), py::call_guard<py::gil_scoped_release>())
+        .def("compact", [](HNSWIndex& self, size_t num_threads) {
+            py::gil_scoped_release release;
+            return self.compact(num_threads);
+        }, py::arg("num_threads") = 0)
+        .def("reorder", [](HNSWIndex& self) {
+            std::vector<int64_t> new_id;
+            {
+                py::gil_scoped_release release;
+                new_id = self.reorder();
+            }
+            return py::array_t<int64_t>(static_cast<py::ssize_t>(new_id.size()), new_id.data());
+        })
+        .def("train", [](HNSWIndex& self, py::object vectors) {
+            if (vectors.is_none()) return self.train();
+            FloatArray arr = to_rows(vectors, self.dimension(), "vectors");
+            const float* data = arr.data();
+            size_t n = static_cast<size_t>(arr.shape(0));
+            py::gil_scoped_release release;
+            self.train(data, n);
+        }, py::arg("vectors") = py::none())
         .def("serialize", [](const HNSWIndex& self) {
             auto data = self.serialize();
             return py::bytes(reinterpret_cast<const char*>(data.data()), data.size());
         })
         .def_static("deserialize", [](py::bytes data) {
-            std::string s = data;
-            std::vector<uint8_t> vec(s.begin(), s.end());
-            return HNSWIndex::deserialize(vec);
+            // Parse the bytes object's buffer in place rather than copying it
+            char* buf;
+            py::ssize_t len;
+            if (PyBytes_AsStringAndSize(data.ptr(), &buf, &len) != 0) throw py::error_already_set();
+            return HNSWIndex::deserialize(reinterpret_cast<const uint8_t*>(buf), static_cast<size_t>(len));
         }, py::arg("data"))
+        .def("save", [](const HNSWIndex& self, const std::string& path) {
+            py::gil_scoped_release release;
+            self.save(path);
+        }, py::arg("path"))
+        .def_static("open_mmap", &HNSWIndex::open_mmap, py::arg("path"))
+        .def_static("load", [](const std::string& path) {
+            py::gil_scoped_release release;
+            return HNSWIndex::load(path);
+        }, py::arg("path"))
+        .def("stats", [](const HNSWIndex& self) {
+            require_stats();
+            IndexStats s = self.stats();
+            py::dict d;
+            d["searches"] = s.searches;
+            d["inserts"] = s.inserts;
+            d["search"] = stats_dict(s.search, false);
+            d["build"] = stats_dict(s.build, true);
+            return d;
+        })
+        .def("reset_stats", &HNSWIndex::reset_stats)
+        .def("graph_health", [](const HNSWIndex& self) {
+            GraphHealth h;
+            {
+                py::gil_scoped_release release;
+                h = self.graph_health();
+            }
+            py::dict d;
+            d["nodes"] = h.nodes;
+            d["deleted"] = h.deleted;
+            d["unreachable"] = h.unreachable;
+            d["degree_histogram"] = h.degree_histogram;
+            d["level_counts"] = h.level_counts;
+            return d;
+        })
         .def("__len__", &HNSWIndex::count)
+        .def_property_readonly("capacity", &HNSWIndex::capacity)
         .def_property_readonly("dimension", &HNSWIndex::dimension)
         .def_property_readonly("metric", &HNSWIndex::metric)
         .def_property_readonly("M", &HNSWIndex::M)
-        .def_property_readonly("ef_construction", &HNSWIndex::ef_construction);
+        .def_property_readonly("ef_construction", &HNSWIndex::ef_construction)
+        .def_property_readonly("heuristic", &HNSWIndex::heuristic)
+        .def_property_readonly("keep_pruned", &HNSWIndex::keep_pruned)
+        .def_property_readonly("extend_candidates", &HNSWIndex::extend_candidates)
+        .def_property_readonly("storage", &HNSWIndex::storage)
+        .def_property_readonly("rerank", &HNSWIndex::rerank)
+        .def_property_readonly("is_trained", &HNSWIndex::is_trained)
+        .def_property_readonly("pq_subspaces", &HNSWIndex::pq_subspaces)
+        .def_property_readonly("rerank_path", &HNSWIndex::rerank_path)
+        .def_property("flat_threshold", &HNSWIndex::flat_threshold, &HNSWIndex::set_flat_threshold)
+        .def_property_readonly("simd_level", &HNSWIndex::simd_level);
+    cls.attr("MMAP_MAGIC") = py::bytes(HNSWIndex::kMmapMagic, 8);
+    cls.attr("STATS_ENABLED") = kStatsEnabled;
+    cls.attr("DEFAULT_FLAT_THRESHOLD") = HNSWIndex::kDefaultFlatThreshold;
+
+    py::class_<WriteAheadLog, std::shared_ptr<WriteAheadLog>> wal(m, "WriteAheadLog");
+    wal
+        .def(py::init<const std::string&, size_t, size_t, uint64_t>(), py::arg("path"), py::arg("dimension"),
+             py::arg("sync_bytes") = WriteAheadLog::kDefaultSyncBytes, py::arg("after_lsn") = 0)
+        .def("sync", &WriteAheadLog::sync, py::call_guard<py::gil_scoped_release>())
+        .def("truncate", &WriteAheadLog::truncate, py::arg("through_lsn"), py::call_guard<py::gil_scoped_release>())
+        .def_property_readonly("last_lsn", &WriteAheadLog::last_lsn)
+        .def_property_readonly("size", &WriteAheadLog::size)
+        .def_property_readonly("dimension", &WriteAheadLog::dimension)
+        .def_property_readonly("path", &WriteAheadLog::path);
+    wal.attr("DEFAULT_SYNC_BYTES") = WriteAheadLog::kDefaultSyncBytes;
+
+    // Shared so a ShardedCollection can hold shards Python also exposes
+    py::class_<Collection, std::shared_ptr<Collection>> col(m, "Collection");
+    col
+        .def(py::init<std::shared_ptr<HNSWIndex>>(), py::arg("index"))
+        .def("insert", [](Collection& self, int64_t user_id, py::object vector) {
+            FloatArray v = to_vector(vector, self.dimension());
+            py::gil_scoped_release release;
+            self.insert(user_id, v.data());
+        }, py::arg("user_id"), py::arg("vector"))
+        .def("insert_batch", [](Collection& self,
+                                py::array_t<int64_t, py::array::c_style | py::array::forcecast> user_ids,
+                                py::object vector_rows, size_t num_threads) {
+            FloatArray vectors = to_rows(vector_rows, self.dimension(), "vectors");
+            if (user_ids.ndim() != 1 || user_ids.shape(0) != vectors.shape(0))
+                throw std::invalid_argument("Got " + std::to_string(user_ids.size()) + " user IDs for " +
+                                            std::to_string(vectors.shape(0)) + " vectors");
+            const int64_t* id_ptr = user_ids.data();
+            const float* vec_ptr = vectors.data();
+            size_t n = static_cast<size_t>(user_ids.shape(0));
+            py::gil_scoped_release release;
+            self.insert_batch(id_ptr, vec_ptr, n, num_threads);
+        }, py::arg("user_ids"), py::arg("vectors"), py::arg("num_threads") = 0)
+        .def("search", [](const Collection& self, py::object query, size_t k, size_t ef_search, py::object allowed,
+                          size_t patience, size_t max_ef, size_t max_distances, double target_recall) {
+            FloatArray q = to_vector(query, self.dimension());
+            std::unique_ptr<IdFilter> filter;
+            if (!allowed.is_none()) {
+                auto ids = py::array_t<int64_t, py::array::c_style | py::array::forcecast>::ensure(allowed);
+                if (!ids || ids.ndim() != 1) throw py::type_error("filter must be a sequence of user IDs");
+                filter = std::make_unique<IdFilter>(self.allow(ids.data(), static_cast<size_t>(ids.shape(0))));
+            }
+            SearchOptions options = to_options(patience, max_ef, max_distances, target_recall);
+            std::vector<std::pair<int64_t, float>> results;
+            {
+                py::gil_scoped_release release;
+                results = self.search(q.data(), k, ef_search, filter.get(), &options);
+            }
+            py::list ret(results.size());
+            for (size_t i = 0; i < results.size(); ++i) ret[i] = py::make_tuple(results[i].first, results[i].second);
+            return ret;
+        }, py::arg("query"), py::arg("k") = 10, py::arg("ef_search") = 50, py::arg("filter") = py::none(),
+           py::arg("patience") = 0, py::arg("max_ef") = 0, py::arg("max_distances") = 0,
+           py::arg("target_recall") = 0.0)
+        .def("search_batch", [](const Collection& self, py::object query_rows, size_t k, size_t ef_search,
+                                size_t num_threads) {
+            return result_rows(query_rows, self.dimension(), k, [&](const float* q, size_t n, int64_t* ids, float* d) {
+                self.search_batch(q, n, k, ef_search, num_threads, ids, d);
+            });
+        }, py::arg("queries"), py::arg("k") = 10, py::arg("ef_search") = 50, py::arg("num_threads") = 0)
+        .def("search_exact", [](const Collection& self, py::object query_rows, size_t k, size_t num_threads) {
+            return result_rows(query_rows, self.dimension(), k, [&](const float* q, size_t n, int64_t* ids, float* d) {
+                self.search_exact(q, n, k, num_threads, ids, d);
+            });
+        }, py::arg("queries"), py::arg("k") = 10, py::arg("num_threads") = 0)
+        .def("remove", &Collection::remove, py::arg("user_id"), py::call_guard<py::gil_scoped_release>())
+        .def("reserve", &Collection::reserve, py::arg("n"), py::call_guard<py::gil_scoped_release>())
+        .def("compact", [](Collection& self, size_t num_threads) {
+            py::gil_scoped_release release;
+            return self.compact(num_threads);
+        }, py::arg("num_threads") = 0)
+        .def("reorder", &Collection::reorder, py::call_guard<py::gil_scoped_release>())
+        .def("get", [](const Collection& self, int64_t user_id) -> py::object {
+            std::vector<float> vec(self.dimension());
+            if (!self.get(user_id, vec.data())) return py::none();
+            py::list ret(vec.size());
+            for (size_t i = 0; i < vec.size(); ++i) ret[i] = py::float_(vec[i]);
+            return ret;
+        }, py::arg("user_id"))
+        .def("contains", &Collection::contains, py::arg("user_id"))
+        .def("__contains__", &Collection::contains)
+        .def("__len__", &Collection::count)
+        .def("user_ids", [](const Collection& self) {
+            auto ids = self.user_ids();
+            return py::array_t<int64_t>(static_cast<py::ssize_t>(ids.size()), ids.data());
+        }, "Every user ID present, in internal ID order")
+        .def("rows", [](const Collection& self) {
+            // Copies: the row buffers move when the collection grows
+            auto lock = self.lock_rows();
+            auto n = static_cast<py::ssize_t>(self.rows());
+            auto dim = static_cast<py::ssize_t>(self.dimension());
+            return py::make_tuple(py::array_t<int64_t>(n, self.internal_to_user()),
+                                  py::array_t<uint8_t>(n, self.live()),
+                                  py::array_t<float>(std::vector<py::ssize_t>{n, dim}, self.vectors()));
+        }, "Copies of the (internal_to_user, live, vectors) rows")
+        .def("set_rows", [](Collection& self,
+                            py::array_t<int64_t, py::array::c_style | py::array::forcecast> internal_to_user,
+                            py::array_t<uint8_t, py::array::c_style | py::array::forcecast> live,
+                            py::object vector_rows) {
+            FloatArray vectors = to_rows(vector_rows, self.dimension(), "vectors");
+            if (internal_to_user.ndim() != 1 || live.ndim() != 1 || internal_to_user.shape(0) != vectors.shape(0) ||
+                live.shape(0) != vectors.shape(0))
+                throw std::invalid_argument("internal_to_user, live and vectors must have the same length");
+            self.set_rows(internal_to_user.data(), live.data(), vectors.data(), static_cast<size_t>(vectors.shape(0)));
+        }, py::arg("internal_to_user"), py::arg("live"), py::arg("vectors"))
+        .def("save_vectors", [](const Collection& self, const std::string& path) {
+            py::gil_scoped_release release;
+            self.save_vectors(path);
+        }, py::arg("path"))
+        .def_static("open_vectors", [](std::shared_ptr<HNSWIndex> index, const std::string& path) {
+            py::gil_scoped_release release;
+            return Collection::open_vectors(std::move(index), path);
+        }, py::arg("index"), py::arg("path"))
+        .def("set_log", &Collection::set_log, py::arg("log").none(true), py::call_guard<py::gil_scoped_release>())
+        .def("replay_log", &Collection::replay_log, py::arg("path"), py::arg("after_lsn") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def_property_readonly("log", &Collection::log)
+        .def_property_readonly("index", &Collection::index)
+        .def_property_readonly("dimension", &Collection::dimension)
+        .def_property_readonly("next_internal_id", &Collection::rows);
+    col.attr("VECTORS_VERSION") = Collection::kVectorsVersion;
+
+    py::class_<ShardedCollection, std::shared_ptr<ShardedCollection>>(m, "ShardedCollection")
+        .def(py::init<std::vector<std::shared_ptr<Collection>>>(), py::arg("shards"))
+        .def("insert", [](ShardedCollection& self, int64_t user_id, py::object vector) {
+            FloatArray v = to_vector(vector, self.dimension());
+            py::gil_scoped_release release;
+            self.insert(user_id, v.data());
+        }, py::arg("user_id"), py::arg("vector"))
+        .def("insert_batch", [](ShardedCollection& self,
+                                py::array_t<int64_t, py::array::c_style | py::array::forcecast> user_ids,
+                                py::object vector_rows, size_t num_threads) {
+            FloatArray vectors = to_rows(vector_rows, self.dimension(), "vectors");
+            if (user_ids.ndim() != 1 || user_ids.shape(0) != vectors.shape(0))
+                throw std::invalid_argument("Got " + std::to_string(user_ids.size()) + " user IDs for " +
+                                            std::to_string(vectors.shape(0)) + " vectors");
+            const int64_t* id_ptr = user_ids.data();
+            const float* vec_ptr = vectors.data();
+            size_t n = static_cast<size_t>(user_ids.shape(0));
+            py::gil_scoped_release release;
+            self.insert_batch(id_ptr, vec_ptr, n, num_threads);
+        }, py::arg("user_ids"), py::arg("vectors"), py::arg("num_threads") = 0)
+        .def("search", [](const ShardedCollection& self, py::object query, size_t k, size_t ef_search,
+                          py::object allowed, size_t patience, size_t max_ef, size_t max_distances,
+                          double target_recall, size_t num_threads) {
+            FloatArray q = to_vector(query, self.dimension());
+            std::unique_ptr<std::vector<IdFilter>> filter;
+            if (!allowed.is_none()) {
+                auto ids = py::array_t<int64_t, py::array::c_style | py::array::forcecast>::ensure(allowed);
+                if (!ids || ids.ndim() != 1) throw py::type_error("filter must be a sequence of user IDs");
+                filter = std::make_unique<std::vector<IdFilter>>(
+                    self.allow(ids.data(), static_cast<size_t>(ids.shape(0))));
+            }
+            SearchOptions options = to_options(patience, max_ef, max_distances, target_recall);
+            std::vector<std::pair<int64_t, float>> results;
+            {
+                py::gil_scoped_release release;
+                results = self.search(q.data(), k, ef_search, filter.get(), &options, num_threads);
+            }
+            py::list ret(results.size());
+            for (size_t i = 0; i < results.size(); ++i) ret[i] = py::make_tuple(results[i].first, results[i].second);
+            return ret;
+        }, py::arg("query"), py::arg("k") = 10, py::arg("ef_search") = 50, py::arg("filter") = py::none(),
+           py::arg("patience") = 0, py::arg("max_ef") = 0, py::arg("max_distances") = 0,
+           py::arg("target_recall") = 0.0, py::arg("num_threads") = 0)
+        .def("search_batch", [](const ShardedCollection& self, py::object query_rows, size_t k, size_t ef_search,
+                                size_t num_threads) {
+            return result_rows(query_rows, self.dimension(), k, [&](const float* q, size_t n, int64_t* ids, float* d) {
+                self.search_batch(q, n, k, ef_search, num_threads, ids, d);
+            });
+        }, py::arg("queries"), py::arg("k") = 10, py::arg("ef_search") = 50, py::arg("num_threads") = 0)
+        .def("search_exact", [](const ShardedCollection& self, py::object query_rows, size_t k,
+                                size_t num_threads) {
+            return result_rows(query_rows, self.dimension(), k, [&](const float* q, size_t n, int64_t* ids, float* d) {
+                self.search_exact(q, n, k, num_threads, ids, d);
+            });
+        }, py::arg("queries"), py::arg("k") = 10, py::arg("num_threads") = 0)
+        .def("remove", &ShardedCollection::remove, py::arg("user_id"), py::call_guard<py::gil_scoped_release>())
+        .def("reserve", &ShardedCollection::reserve, py::arg("n"), py::call_guard<py::gil_scoped_release>())
+        .def("compact", &ShardedCollection::compact, py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def("reorder", &ShardedCollection::reorder, py::call_guard<py::gil_scoped_release>())
+        .def("get", [](const ShardedCollection& self, int64_t user_id) -> py::object {
+            std::vector<float> vec(self.dimension());
+            if (!self.get(user_id, vec.data())) return py::none();
+            py::list ret(vec.size());
+            for (size_t i = 0; i < vec.size(); ++i) ret[i] = py::float_(vec[i]);
+            return ret;
+        }, py::arg("user_id"))
+        .def("contains", &ShardedCollection::contains, py::arg("user_id"))
+        .def("__contains__", &ShardedCollection::contains)
+        .def("__len__", &ShardedCollection::count)
+        .def("user_ids", [](const ShardedCollection& self) {
+            auto ids = self.user_ids();
+            return py::array_t<int64_t>(static_cast<py::ssize_t>(ids.size()), ids.data());
+        }, "Every user ID present, shard by shard")
+        .def("shard_of", py::overload_cast<int64_t>(&ShardedCollection::shard_of, py::const_), py::arg("user_id"))
+        .def("set_numa_nodes", &ShardedCollection::set_numa_nodes, py::arg("nodes"))
+        .def_property_readonly("numa_nodes", &ShardedCollection::numa_nodes)
+        .def_static("online_numa_nodes", &online_numa_nodes, "NUMA nodes online on this machine")
+        .def_property_readonly("shards", &ShardedCollection::shards)
+        .def_property_readonly("dimension", &ShardedCollection::dimension);
+
+    py::class_<QueryServer> server(m, "QueryServer");
+    server
+        .def(py::init([](std::shared_ptr<Collection> collection, size_t max_batch, uint64_t max_wait_us,
+                         size_t num_threads) {
+            return std::make_unique<QueryServer>(std::shared_ptr<const Collection>(std::move(collection)), max_batch,
+                                                 max_wait_us, num_threads);
+        }), py::arg("collection"), py::arg("max_batch") = QueryServer::kDefaultMaxBatch,
+           py::arg("max_wait_us") = QueryServer::kDefaultMaxWaitUs, py::arg("num_threads") = 0)
+        .def(py::init([](std::shared_ptr<ShardedCollection> collection, size_t max_batch, uint64_t max_wait_us,
+                         size_t num_threads) {
+            return std::make_unique<QueryServer>(std::shared_ptr<const ShardedCollection>(std::move(collection)),
+                                                 max_batch, max_wait_us, num_threads);
+        }), py::arg("collection"), py::arg("max_batch") = QueryServer::kDefaultMaxBatch,
+           py::arg("max_wait_us") = QueryServer::kDefaultMaxWaitUs, py::arg("num_threads") = 0)
+        .def("submit", [](QueryServer& self, py::object query, size_t k, size_t ef_search) {
+            FloatArray q = to_vector(query, self.dimension());
+            return self.submit(q.data(), k, ef_search);
+        }, py::arg("query"), py::arg("k") = 10, py::arg("ef_search") = 50,
+           "Queue a query, returning its ticket")
+        .def("take_completed", [](QueryServer& self) {
+            std::vector<QueryServer::Completion> done;
+            self.take_completed(done);
+            py::list ret(done.size());
+            for (size_t i = 0; i < done.size(); ++i) {
+                const auto& c = done[i];
+                if (!c.error.empty()) {
+                    ret[i] = py::make_tuple(c.ticket, py::none(), c.error);
+                    continue;
+                }
+                py::list results(c.results.size());
+                for (size_t j = 0; j < c.results.size(); ++j)
+                    results[j] = py::make_tuple(c.results[j].first, c.results[j].second);
+                ret[i] = py::make_tuple(c.ticket, results, py::none());
+            }
+            return ret;
+        }, "(ticket, results, error) for each query finished since the last call")
+        .def("close", &QueryServer::close, py::call_guard<py::gil_scoped_release>())
+        .def_property_readonly("notify_fd", &QueryServer::notify_fd)
+        .def_property_readonly("dimension", &QueryServer::dimension)
+        .def_property_readonly("max_batch", &QueryServer::max_batch)
+        .def_property_readonly("max_wait_us", &QueryServer::max_wait_us)
+        .def_property_readonly("num_threads", &QueryServer::num_threads)
+        .def_property_readonly("queued", &QueryServer::queued)
+        .def_property_readonly("batches", &QueryServer::batches)
+        .def_property_readonly("batched_queries", &QueryServer::batched_queries);
+    server.attr("DEFAULT_MAX_BATCH") = QueryServer::kDefaultMaxBatch;
+    server.attr("DEFAULT_MAX_WAIT_US") = QueryServer::kDefaultMaxWaitUs;
 }
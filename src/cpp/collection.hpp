@@ -0,0 +1,486 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "aligned_buffer.hpp"
+#include "file_io.hpp"
+#include "flat_hash_map.hpp"
+#include "hnsw_index.hpp"
+#include "id_filter.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "wal.hpp"
+
+namespace vecdb {
+
+// The user-facing side of an HNSWIndex. User IDs map onto the dense internal
+// IDs the index is addressed by, handed out from 0 in insertion order, and
+// each vector is kept as given (the index normalizes cosine vectors and may
+// hold only codes). Rows are indexed by internal ID; deleting an ID leaves
+// its row in place, marked dead, until compact() drops the node from the
+// index and the row is handed out again.
+//
+// save_vectors() writes the rows as aligned blocks; open_vectors() maps them
+// back copy-on-write, so a loaded collection pages rows in as they are read
+// and only copies them out when it grows.
+//
+// Readers (search, get, contains) may run concurrently with one another and
+// with writers; writers (insert, remove, compact, set_rows) run one at a
+// time. A writer fills its rows before the index can return them and
+// publishes the user IDs afterwards, so a search running alongside an insert
+// may or may not see the new vectors. The raw row accessors are not
+// synchronized.
+//
+// With a WriteAheadLog attached, each insert and removal is logged before it
+// is applied, and replay_log() reapplies a log over a loaded snapshot.
+class Collection {
+public:
+    static constexpr uint32_t kVectorsVersion = 2;  // .vectors format written
+    static constexpr size_t kBlockAlignment = 64;
+
+    explicit Collection(std::shared_ptr<HNSWIndex> index) : index_(std::move(index)), dimension_(index_->dimension()) {}
+
+    // Insert one vector of dimension() floats.
+    void insert(int64_t user_id, const float* vec) { insert_batch(&user_id, vec, 1, 1); }
+
+    // Insert n row-major vectors, building the index on up to num_threads
+    // threads (0 = all cores). Nothing is inserted if any user ID is already
+    // present or repeats in the batch.
+    void insert_batch(const int64_t* user_ids, const float* vectors, size_t n, size_t num_threads = 0) {
+        if (n == 0) return;
+        // Only writers change the map, so it can be read here without rows_mutex_
+        std::lock_guard<MemberMutex> write(write_mutex_);
+        if (n > 1) {
+            FlatIdMap batch(n);
+            for (size_t i = 0; i < n; ++i) {
+                if (!batch.insert(user_ids[i], static_cast<int64_t>(i)))
+                    throw DuplicateIDError("Batch contains repeated user IDs");
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (user_to_internal_.contains(user_ids[i]))
+                throw DuplicateIDError("User ID " + std::to_string(user_ids[i]) + " already exists");
+        }
+
+        if (log_) log_->append_insert(user_ids, vectors, n);
+        std::vector<int64_t> internal_ids(n);
+        {
+            std::unique_lock<SharedMutex> lock(rows_mutex_);
+            assign_rows(n, internal_ids.data());
+            for (size_t i = 0; i < n; ++i) fill_row(internal_ids[i], user_ids[i], vectors + i * dimension_);
+        }
+        index_->add_batch(internal_ids.data(), vectors, n, num_threads);
+        std::unique_lock<SharedMutex> lock(rows_mutex_);
+        commit_rows(internal_ids.data(), n);
+        user_to_internal_.reserve(user_to_internal_.size() + n);
+        for (size_t i = 0; i < n; ++i) {
+            live_[static_cast<size_t>(internal_ids[i])] = 1;
+            user_to_internal_.insert(user_ids[i], internal_ids[i]);
+        }
+    }
+
+    // The k nearest user IDs to a query of dimension() floats, closest first,
+    // among those `filter` (from allow()) lets through if given, with the
+    // early exits of `options` (see SearchOptions).
+    std::vector<std::pair<int64_t, float>> search(const float* query, size_t k, size_t ef_search = 50,
+                                                  const IdFilter* filter = nullptr,
+                                                  const SearchOptions* options = nullptr) const {
+        // Held across the index search so reorder() cannot renumber in between
+        std::shared_lock<SharedMutex> lock(rows_mutex_);
+        auto results = index_->search(query, k, ef_search, filter, nullptr, options);
+        for (auto& r : results) r.first = internal_to_user_[static_cast<size_t>(r.first)];
+        return results;
+    }
+
+    // search() for each of n row-major queries on up to num_threads threads
+    // (see HNSWIndex::search_batch()). Row i of the n x k outputs holds query
+    // i's results, padded with -1 and +inf.
+    void search_batch(const float* queries, size_t n, size_t k, size_t ef_search, size_t num_threads,
+                      int64_t* user_ids, float* distances, const IdFilter* filter = nullptr,
+                      const SearchOptions* options = nullptr) const {
+        std::shared_lock<SharedMutex> lock(rows_mutex_);
+        index_->search_batch(queries, n, k, ef_search, num_threads, user_ids, distances, filter, options);
+        to_user_ids(user_ids, n * k);
+    }
+
+    // The exact k nearest user IDs to each of n row-major queries, by a scan
+    // on up to num_threads threads (see HNSWIndex::search_exact_batch()).
+    // Row i of the n x k outputs holds query i's, padded with -1 and +inf.
+    void search_exact(const float* queries, size_t n, size_t k, size_t num_threads, int64_t* user_ids,
+                      float* distances) const {
+        std::shared_lock<SharedMutex> lock(rows_mutex_);
+        index_->search_exact_batch(queries, n, k, num_threads, user_ids, distances);
+        to_user_ids(user_ids, n * k);
+    }
+
+    // An allow-list for search() holding the n user IDs given; IDs not in
+    // the collection are ignored.
+    IdFilter allow(const int64_t* user_ids, size_t n) const {
+        std::shared_lock<SharedMutex> lock(rows_mutex_);
+        IdFilter filter(rows_);
+        for (size_t i = 0; i < n; ++i) {
+            int64_t internal_id = user_to_internal_.find(user_ids[i]);
+            if (internal_id >= 0) filter.allow(static_cast<size_t>(internal_id));
+        }
+        return filter;
+    }
+
+    bool remove(int64_t user_id) {
+        std::lock_guard<MemberMutex> write(write_mutex_);
+        int64_t internal_id = user_to_internal_.find(user_id);
+        if (internal_id < 0) return false;
+        if (log_) log_->append_remove(&user_id, 1);
+        index_->remove(internal_id);
+        std::unique_lock<SharedMutex> lock(rows_mutex_);
+        user_to_internal_.erase(user_id);
+        live_[static_cast<size_t>(internal_id)] = 0;
+        return true;
+    }
+
+    // Compact the index (see HNSWIndex::compact()), after which the rows of
+    // deleted IDs are reused by later inserts. Returns the rows reclaimed.
+    size_t compact(size_t num_threads = 0) {
+        std::lock_guard<MemberMutex> write(write_mutex_);
+        size_t reclaimed = index_->compact(num_threads);
+        std::unique_lock<SharedMutex> lock(rows_mutex_);
+        find_free_rows();
+        return reclaimed;
+    }
+
+    // Log every later insert and removal to `log` before applying it; null
+    // stops logging.
+    void set_log(std::shared_ptr<WriteAheadLog> log) {
+        std::lock_guard<MemberMutex> write(write_mutex_);
+        log_ = std::move(log);
+    }
+    const std::shared_ptr<WriteAheadLog>& log() const { return log_; }
+
+    // Apply the records of the log at `path` with LSNs above after_lsn, the
+    // last LSN the loaded snapshot holds, without logging them again.
+    // Returns the log's last LSN, or after_lsn if that is higher.
+    uint64_t replay_log(const std::string& path, uint64_t after_lsn) {
+        std::shared_ptr<WriteAheadLog> log;
+        {
+            std::lock_guard<MemberMutex> write(write_mutex_);
+            log.swap(log_);
+        }
+        auto restore = [&] {
+            std::lock_guard<MemberMutex> write(write_mutex_);
+            log_ = std::move(log);
+        };
+        try {
+            uint64_t last = WriteAheadLog::replay(
+                path, dimension_, after_lsn,
+                [&](uint64_t lsn, const int64_t* user_ids, const float* vectors, size_t n) {
+                    try {
+                        insert_batch(user_ids, vectors, n);
+                    } catch (const DuplicateIDError& e) {
+                        throw DeserializationError("Log record " + std::to_string(lsn) + ": " + e.what());
+                    }
+                },
+                [&](uint64_t, const int64_t* user_ids, size_t n) {
+                    for (size_t i = 0; i < n; ++i) remove(user_ids[i]);
+                });
+            restore();
+            return last;
+        } catch (...) {
+            restore();
+            throw;
+        }
+    }
+
+    // Renumber the index by graph locality (see HNSWIndex::reorder()) and
+    // move the rows with their nodes. Filters from allow() made before it
+    // no longer apply.
+    void reorder() {
+        std::lock_guard<MemberMutex> write(write_mutex_);
+        std::unique_lock<SharedMutex> lock(rows_mutex_);
+        std::vector<int64_t> new_id = index_->reorder();
+        AlignedBuffer<int64_t> internal_to_user(capacity_);
+        AlignedBuffer<uint8_t> live(capacity_);
+        AlignedBuffer<float> vectors(capacity_ * dimension_);
+        for (size_t r = 0; r < rows_; ++r) {
+            size_t to = r < new_id.size() ? static_cast<size_t>(new_id[r]) : r;
+            internal_to_user[to] = internal_to_user_[r];
+            live[to] = live_[r];
+            std::memcpy(vectors.data() + to * dimension_, row(static_cast<int64_t>(r)), dimension_ * sizeof(float));
+        }
+        internal_to_user_ = std::move(internal_to_user);
+        live_ = std::move(live);
+        vectors_ = std::move(vectors);
+        file_.close();
+        build_map();
+    }
+
+    // Allocate rows, map entries and index slots for n vectors in all, so
+    // inserts up to that size do not reallocate.
+    void reserve(size_t n) {
+        std::lock_guard<MemberMutex> write(write_mutex_);
+        index_->reserve(n);
+        std::unique_lock<SharedMutex> lock(rows_mutex_);
+        if (n > capacity_) set_capacity(n);
+        user_to_internal_.reserve(n);
+    }
+
+    // Copy the dimension() floats stored for `user_id` to `out`; false if absent.
+    bool get(int64_t user_id, float* out) const {
+        std::shared_lock<SharedMutex> lock(rows_mutex_);
+        int64_t internal_id = user_to_internal_.find(user_id);
+        if (internal_id < 0) return false;
+        std::memcpy(out, row(internal_id), dimension_ * sizeof(float));
+        return true;
+    }
+
+    bool contains(int64_t user_id) const {
+        std::shared_lock<SharedMutex> lock(rows_mutex_);
+        return user_to_internal_.contains(user_id);
+    }
+
+    // Every user ID present, in internal ID order.
+    std::vector<int64_t> user_ids() const {
+        std::shared_lock<SharedMutex> lock(rows_mutex_);
+        std::vector<int64_t> ids;
+        ids.reserve(user_to_internal_.size());
+        for (size_t r = 0; r < rows_; ++r) {
+            if (live_[r]) ids.push_back(internal_to_user_[r]);
+        }
+        return ids;
+    }
+    size_t count() const {
+        std::shared_lock<SharedMutex> lock(rows_mutex_);
+        return user_to_internal_.size();
+    }
+    size_t dimension() const { return dimension_; }
+    const std::shared_ptr<HNSWIndex>& index() const { return index_; }
+
+    // Rows in use, including dead ones: one past the highest internal ID handed
+    // out. These accessors take no lock; hold lock_rows() while using them if
+    // writers may be running.
+    size_t rows() const { return rows_; }
+    const int64_t* internal_to_user() const { return internal_to_user_.data(); }
+    const uint8_t* live() const { return live_.data(); }
+    const float* vectors() const { return vectors_.data(); }
+    std::shared_lock<SharedMutex> lock_rows() const { return std::shared_lock<SharedMutex>(rows_mutex_); }
+
+    // Replace every row with n rows copied from the arrays given, for an
+    // index that already holds the live ones.
+    void set_rows(const int64_t* internal_to_user, const uint8_t* live, const float* vectors, size_t n) {
+        std::lock_guard<MemberMutex> write(write_mutex_);
+        Collection fresh(index_);
+        fresh.ensure_rows(n);
+        if (n) {
+            std::memcpy(fresh.internal_to_user_.data(), internal_to_user, n * sizeof(int64_t));
+            std::memcpy(fresh.live_.data(), live, n);
+            std::memcpy(fresh.vectors_.data(), vectors, n * dimension_ * sizeof(float));
+        }
+        fresh.rows_ = n;
+        fresh.build_map();
+        fresh.log_ = log_;
+        std::unique_lock<SharedMutex> lock(rows_mutex_);
+        *this = std::move(fresh);  // the locks themselves are not assigned
+    }
+
+    // Format (version 2), each block aligned to kBlockAlignment bytes:
+    //   [version u32][count u64][dimension u32][rows u64]
+    //   [internal_to_user u64 * rows][live u8 * rows][vectors f32 * rows * dim]
+    void save_vectors(const std::string& path) const {
+        std::shared_lock<SharedMutex> lock(rows_mutex_);
+        VectorsLayout layout(rows_, dimension_);
+        uint64_t count = user_to_internal_.size(), rows = rows_;
+        uint32_t version = kVectorsVersion, dimension = static_cast<uint32_t>(dimension_);
+        ChunkedWriter w(path);
+        w.write(&version, sizeof(version));
+        w.write(&count, sizeof(count));
+        w.write(&dimension, sizeof(dimension));
+        w.write(&rows, sizeof(rows));
+        w.pad_to(layout.ids);
+        w.write(internal_to_user_.data(), rows_ * sizeof(int64_t));
+        w.pad_to(layout.live);
+        w.write(live_.data(), rows_);
+        w.pad_to(layout.vectors);
+        w.write(vectors_.data(), rows_ * dimension_ * sizeof(float));
+        w.finish();
+    }
+
+    // Open a file written by save_vectors() (or the older one-record-per-vector
+    // version 1) for `index`, which must hold every live row of it.
+    static Collection open_vectors(std::shared_ptr<HNSWIndex> index, const std::string& path) {
+        Collection c(std::move(index));
+        try {
+            c.file_.open_private(path);
+        } catch (const std::runtime_error& e) {
+            throw DeserializationError(e.what());
+        }
+        uint8_t* data = c.file_.data();
+        size_t size = c.file_.size();
+        if (size < 16) throw DeserializationError("Vectors file too small");
+
+        uint32_t version, dimension;
+        uint64_t count;
+        std::memcpy(&version, data, 4);
+        std::memcpy(&count, data + 4, 8);
+        std::memcpy(&dimension, data + 12, 4);
+        if (version > kVectorsVersion)
+            throw DeserializationError("Vectors file version " + std::to_string(version) +
+                                       " is newer than supported " + std::to_string(kVectorsVersion));
+        if (dimension != c.dimension_)
+            throw DeserializationError("Dimension mismatch: file has " + std::to_string(dimension) + ", expected " +
+                                       std::to_string(c.dimension_));
+
+        if (version < 2) {
+            c.read_records(data + 16, count, size);
+        } else {
+            if (size < 24) throw DeserializationError("Vectors file too small");
+            uint64_t rows;
+            std::memcpy(&rows, data + 16, 8);
+            VectorsLayout layout(std::min<uint64_t>(rows, size), c.dimension_);
+            if (rows > size || size < layout.end)
+                throw DeserializationError("Vectors file truncated: expected " + std::to_string(layout.end) +
+                                           " bytes, got " + std::to_string(size));
+            c.rows_ = c.capacity_ = rows;
+            c.internal_to_user_ = AlignedBuffer<int64_t>::view(reinterpret_cast<int64_t*>(data + layout.ids), rows);
+            c.live_ = AlignedBuffer<uint8_t>::view(data + layout.live, rows);
+            c.vectors_ = AlignedBuffer<float>::view(reinterpret_cast<float*>(data + layout.vectors), rows * c.dimension_);
+            c.build_map();
+        }
+        if (c.user_to_internal_.size() != count)
+            throw DeserializationError("Vectors file corrupt: header has " + std::to_string(count) + " vectors, found " +
+                                       std::to_string(c.user_to_internal_.size()));
+        if (!c.internal_to_user_.is_view()) c.file_.close();
+        return c;
+    }
+
+private:
+    // Block offsets of a version 2 file.
+    struct VectorsLayout {
+        VectorsLayout(size_t rows, size_t dimension)
+            : ids(align(24)), live(align(ids + rows * 8)), vectors(align(live + rows)),
+              end(vectors + rows * dimension * sizeof(float)) {}
+        static size_t align(size_t offset) { return (offset + kBlockAlignment - 1) / kBlockAlignment * kBlockAlignment; }
+        size_t ids, live, vectors, end;
+    };
+
+    const float* row(int64_t internal_id) const { return vectors_.data() + static_cast<size_t>(internal_id) * dimension_; }
+
+    // Map n internal IDs from the index to user IDs, leaving -1 padding.
+    void to_user_ids(int64_t* ids, size_t n) const {
+        for (size_t i = 0; i < n; ++i) {
+            if (ids[i] >= 0) ids[i] = internal_to_user_[static_cast<size_t>(ids[i])];
+        }
+    }
+
+    // Write a row that is not yet live; insert_batch() publishes it.
+    void fill_row(int64_t internal_id, int64_t user_id, const float* vec) {
+        size_t r = static_cast<size_t>(internal_id);
+        std::memcpy(vectors_.data() + r * dimension_, vec, dimension_ * sizeof(float));
+        internal_to_user_[r] = user_id;
+    }
+
+    // Pick internal IDs for n new rows: reclaimed rows first, lowest first,
+    // then fresh ones. Nothing is claimed until commit_rows().
+    void assign_rows(size_t n, int64_t* ids) {
+        size_t reused = std::min(n, free_rows_.size());
+        for (size_t i = 0; i < reused; ++i) ids[i] = free_rows_[free_rows_.size() - 1 - i];
+        for (size_t i = reused; i < n; ++i) ids[i] = static_cast<int64_t>(rows_ + i - reused);
+        ensure_rows(rows_ + n - reused);
+    }
+
+    void commit_rows(const int64_t* ids, size_t n) {
+        size_t reused = std::min(n, free_rows_.size());
+        free_rows_.resize(free_rows_.size() - reused);
+        if (n > reused) rows_ = static_cast<size_t>(ids[n - 1]) + 1;
+    }
+
+    // Dead rows whose index slot is empty, highest first so the lowest is reused first.
+    void find_free_rows() {
+        free_rows_.clear();
+        for (size_t r = rows_; r-- > 0;) {
+            if (!live_[r] && !index_->contains_slot(static_cast<int64_t>(r))) free_rows_.push_back(static_cast<int64_t>(r));
+        }
+    }
+
+    // Grow row capacity to at least n, doubling it.
+    void ensure_rows(size_t n) {
+        if (n > capacity_) set_capacity(std::max<size_t>({n, capacity_ * 2, 16}));
+    }
+
+    // Reallocate the rows for `cap` of them. Rows mapped from a file are
+    // copied out, after which the file is released.
+    void set_capacity(size_t cap) {
+        bool mapped = internal_to_user_.is_view();
+        internal_to_user_.resize(cap);
+        live_.resize(cap);
+        vectors_.resize(cap * dimension_);
+        capacity_ = cap;
+        if (mapped) file_.close();
+    }
+
+    // Rebuild user_to_internal_ and the free rows from the live rows.
+    void build_map() {
+        user_to_internal_ = FlatIdMap(rows_);
+        for (size_t r = 0; r < rows_; ++r) {
+            if (!live_[r]) continue;
+            int64_t internal_id = static_cast<int64_t>(r);
+            if (!index_->contains(internal_id))
+                throw DeserializationError("Vectors file references a missing node");
+            if (!user_to_internal_.insert(internal_to_user_[r], internal_id))
+                throw DeserializationError("Vectors file repeats user ID " + std::to_string(internal_to_user_[r]));
+        }
+        find_free_rows();
+    }
+
+    // Version 1: [user_id u64][internal_id u64][vector f32 * dim] per vector.
+    void read_records(const uint8_t* p, uint64_t count, size_t size) {
+        size_t record = 16 + dimension_ * sizeof(float);
+        if (count > size / record || 16 + count * record > size)
+            throw DeserializationError("Vectors file truncated: expected " +
+                                       std::to_string(16 + std::min<uint64_t>(count, size) * record) + " bytes, got " +
+                                       std::to_string(size));
+        size_t rows = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            int64_t internal_id;
+            std::memcpy(&internal_id, p + i * record + 8, 8);
+            if (!index_->contains(internal_id)) throw DeserializationError("Vectors file references a missing node");
+            rows = std::max(rows, static_cast<size_t>(internal_id) + 1);
+        }
+        ensure_rows(rows);
+        for (uint64_t i = 0; i < count; ++i) {
+            const uint8_t* rec = p + i * record;
+            int64_t user_id, internal_id;
+            std::memcpy(&user_id, rec, 8);
+            std::memcpy(&internal_id, rec + 8, 8);
+            size_t r = static_cast<size_t>(internal_id);
+            if (live_[r]) throw DeserializationError("Vectors file repeats internal ID " + std::to_string(internal_id));
+            std::memcpy(vectors_.data() + r * dimension_, rec + 16, dimension_ * sizeof(float));
+            internal_to_user_[r] = user_id;
+            live_[r] = 1;
+            if (!user_to_internal_.insert(user_id, internal_id))
+                throw DeserializationError("Vectors file repeats user ID " + std::to_string(user_id));
+        }
+        rows_ = rows;
+        find_free_rows();
+    }
+
+    std::shared_ptr<HNSWIndex> index_;
+    size_t dimension_;
+    FlatIdMap user_to_internal_;
+    AlignedBuffer<int64_t> internal_to_user_;  // user ID per row; stale for dead rows
+    AlignedBuffer<uint8_t> live_;              // 1 while the row's user ID is present
+    AlignedBuffer<float> vectors_;             // rows * dimension_, unpadded
+    size_t rows_ = 0;
+    size_t capacity_ = 0;
+    std::vector<int64_t> free_rows_;  // reusable dead rows, highest first
+    MappedFile file_;  // backs the row buffers after open_vectors(), until they grow
+    std::shared_ptr<WriteAheadLog> log_;  // written under write_mutex_
+    MemberMutex write_mutex_;          // held by each writer throughout
+    mutable SharedMutex rows_mutex_;  // the map and rows, exclusive while they change
+};
+
+} // namespace vecdb
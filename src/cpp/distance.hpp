@@ -1,20 +1,45 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <cmath>
 #include <string>
 #include <stdexcept>
 
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__GNUC__) || defined(__clang__)
+#include <immintrin.h>
+#define VECDB_X86_DISPATCH 1
+#endif
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define VECDB_NEON 1
+#endif
+
 namespace vecdb {
 
-// L2 (Euclidean) distance
-inline float l2_distance(const float* a, const float* b, size_t dim) {
+// Squared L2 distance. The index ranks with this and only takes the square
+// root of the results it returns.
+inline float l2_sq_distance(const float* a, const float* b, size_t dim) {
     float sum = 0.0f;
     for (size_t i = 0; i < dim; ++i) {
         float diff = a[i] - b[i];
         sum += diff * diff;
     }
-    return std::sqrt(sum);
+    return sum;
+}
+
+// L2 (Euclidean) distance
+inline float l2_distance(const float* a, const float* b, size_t dim) {
+    return std::sqrt(l2_sq_distance(a, b, dim));
+}
+
+// 1 - dot / (|a| |b|), clamped to [0, 2]; zero vectors are at distance 1
+inline float cosine_from_parts(float dot, float norm_a_sq, float norm_b_sq) {
+    if (norm_a_sq == 0.0f || norm_b_sq == 0.0f) return 1.0f;
+    float sim = dot / (std::sqrt(norm_a_sq) * std::sqrt(norm_b_sq));
+    sim = std::max(-1.0f, std::min(1.0f, sim));
+    return 1.0f - sim;
 }
 
 // Cosine distance: 1 - cosine_similarity
@@ -25,12 +50,7 @@ inline float cosine_distance(const float* a, const float* b, size_t dim) {
         norm_a += a[i] * a[i];
         norm_b += b[i] * b[i];
     }
-    norm_a = std::sqrt(norm_a);
-    norm_b = std::sqrt(norm_b);
-    if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
-    float sim = dot / (norm_a * norm_b);
-    sim = std::max(-1.0f, std::min(1.0f, sim));
-    return 1.0f - sim;
+    return cosine_from_parts(dot, norm_a, norm_b);
 }
 
 // Dot distance: -dot_product (for MIPS)
@@ -42,14 +62,641 @@ inline float dot_distance(const float* a, const float* b, size_t dim) {
     return -dot;
 }
 
+// Cosine distance between unit-length vectors: 1 - dot. A zero vector (left
+// unnormalized) yields 1, matching cosine_distance.
+inline float unit_cosine_distance(const float* a, const float* b, size_t dim) {
+    return 1.0f + dot_distance(a, b, dim);
+}
+
+#if defined(VECDB_X86_DISPATCH)
+
+// AVX2 + FMA kernels: two 8-wide accumulators to hide FMA latency, scalar tail.
+
+__attribute__((target("avx2,fma"))) inline float hsum_avx2(__m256 v) {
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 0x55));
+    return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2,fma"))) inline float l2_sq_distance_avx2(const float* a, const float* b, size_t dim) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        s0 = _mm256_fmadd_ps(d0, d0, s0);
+        s1 = _mm256_fmadd_ps(d1, d1, s1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        s0 = _mm256_fmadd_ps(d0, d0, s0);
+    }
+    float sum = hsum_avx2(_mm256_add_ps(s0, s1));
+    for (; i < dim; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma"))) inline float dot_product_avx2(const float* a, const float* b, size_t dim) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+    }
+    float dot = hsum_avx2(_mm256_add_ps(s0, s1));
+    for (; i < dim; ++i) dot += a[i] * b[i];
+    return dot;
+}
+
+__attribute__((target("avx2,fma"))) inline float l2_distance_avx2(const float* a, const float* b, size_t dim) {
+    return std::sqrt(l2_sq_distance_avx2(a, b, dim));
+}
+
+__attribute__((target("avx2,fma"))) inline float dot_distance_avx2(const float* a, const float* b, size_t dim) {
+    return -dot_product_avx2(a, b, dim);
+}
+
+__attribute__((target("avx2,fma"))) inline float unit_cosine_distance_avx2(const float* a, const float* b, size_t dim) {
+    return 1.0f - dot_product_avx2(a, b, dim);
+}
+
+__attribute__((target("avx2,fma"))) inline float cosine_distance_avx2(const float* a, const float* b, size_t dim) {
+    __m256 dot = _mm256_setzero_ps(), na = _mm256_setzero_ps(), nb = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i), vb = _mm256_loadu_ps(b + i);
+        dot = _mm256_fmadd_ps(va, vb, dot);
+        na = _mm256_fmadd_ps(va, va, na);
+        nb = _mm256_fmadd_ps(vb, vb, nb);
+    }
+    float d = hsum_avx2(dot), sa = hsum_avx2(na), sb = hsum_avx2(nb);
+    for (; i < dim; ++i) {
+        d += a[i] * b[i];
+        sa += a[i] * a[i];
+        sb += b[i] * b[i];
+    }
+    return cosine_from_parts(d, sa, sb);
+}
+
+// AVX-512 kernels: 16-wide with a masked load for the tail, so no scalar loop.
+// GCC 12 flags its own _mm*_undefined_* helpers under -Wuninitialized here.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f"))) inline float l2_sq_distance_avx512(const float* a, const float* b, size_t dim) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        s0 = _mm512_fmadd_ps(d0, d0, s0);
+        s1 = _mm512_fmadd_ps(d1, d1, s1);
+    }
+    for (; i < dim; i += 16) {
+        __mmask16 m = dim - i >= 16 ? static_cast<__mmask16>(0xFFFF)
+                                    : static_cast<__mmask16>((1u << (dim - i)) - 1);
+        __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        s0 = _mm512_fmadd_ps(d0, d0, s0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+__attribute__((target("avx512f"))) inline float dot_product_avx512(const float* a, const float* b, size_t dim) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), s1);
+    }
+    for (; i < dim; i += 16) {
+        __mmask16 m = dim - i >= 16 ? static_cast<__mmask16>(0xFFFF)
+                                    : static_cast<__mmask16>((1u << (dim - i)) - 1);
+        s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), s0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+__attribute__((target("avx512f"))) inline float l2_distance_avx512(const float* a, const float* b, size_t dim) {
+    return std::sqrt(l2_sq_distance_avx512(a, b, dim));
+}
+
+__attribute__((target("avx512f"))) inline float dot_distance_avx512(const float* a, const float* b, size_t dim) {
+    return -dot_product_avx512(a, b, dim);
+}
+
+__attribute__((target("avx512f"))) inline float unit_cosine_distance_avx512(const float* a, const float* b, size_t dim) {
+    return 1.0f - dot_product_avx512(a, b, dim);
+}
+
+__attribute__((target("avx512f"))) inline float cosine_distance_avx512(const float* a, const float* b, size_t dim) {
+    __m512 dot = _mm512_setzero_ps(), na = _mm512_setzero_ps(), nb = _mm512_setzero_ps();
+    for (size_t i = 0; i < dim; i += 16) {
+        __mmask16 m = dim - i >= 16 ? static_cast<__mmask16>(0xFFFF)
+                                    : static_cast<__mmask16>((1u << (dim - i)) - 1);
+        __m512 va = _mm512_maskz_loadu_ps(m, a + i), vb = _mm512_maskz_loadu_ps(m, b + i);
+        dot = _mm512_fmadd_ps(va, vb, dot);
+        na = _mm512_fmadd_ps(va, va, na);
+        nb = _mm512_fmadd_ps(vb, vb, nb);
+    }
+    return cosine_from_parts(_mm512_reduce_add_ps(dot), _mm512_reduce_add_ps(na), _mm512_reduce_add_ps(nb));
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#elif defined(VECDB_NEON)
+
+// NEON kernels (baseline on AArch64): 4-wide, two accumulators, scalar tail.
+
+inline float l2_sq_distance_neon(const float* a, const float* b, size_t dim) {
+    float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        s0 = vfmaq_f32(s0, d0, d0);
+        s1 = vfmaq_f32(s1, d1, d1);
+    }
+    float sum = vaddvq_f32(vaddq_f32(s0, s1));
+    for (; i < dim; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+inline float dot_product_neon(const float* a, const float* b, size_t dim) {
+    float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        s0 = vfmaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+        s1 = vfmaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float dot = vaddvq_f32(vaddq_f32(s0, s1));
+    for (; i < dim; ++i) dot += a[i] * b[i];
+    return dot;
+}
+
+inline float l2_distance_neon(const float* a, const float* b, size_t dim) {
+    return std::sqrt(l2_sq_distance_neon(a, b, dim));
+}
+
+inline float dot_distance_neon(const float* a, const float* b, size_t dim) {
+    return -dot_product_neon(a, b, dim);
+}
+
+inline float unit_cosine_distance_neon(const float* a, const float* b, size_t dim) {
+    return 1.0f - dot_product_neon(a, b, dim);
+}
+
+inline float cosine_distance_neon(const float* a, const float* b, size_t dim) {
+    float32x4_t dot = vdupq_n_f32(0.0f), na = vdupq_n_f32(0.0f), nb = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t va = vld1q_f32(a + i), vb = vld1q_f32(b + i);
+        dot = vfmaq_f32(dot, va, vb);
+        na = vfmaq_f32(na, va, va);
+        nb = vfmaq_f32(nb, vb, vb);
+    }
+    float d = vaddvq_f32(dot), sa = vaddvq_f32(na), sb = vaddvq_f32(nb);
+    for (; i < dim; ++i) {
+        d += a[i] * b[i];
+        sa += a[i] * a[i];
+        sb += b[i] * b[i];
+    }
+    return cosine_from_parts(d, sa, sb);
+}
+
+#endif
+
 // Distance function type
 using DistanceFunc = float (*)(const float*, const float*, size_t);
 
+enum class SimdLevel { Scalar, NEON, AVX2, AVX512 };
+
+// Widest instruction set the running CPU supports; evaluated once per process.
+inline SimdLevel detect_simd_level() {
+    static const SimdLevel level = [] {
+#if defined(VECDB_X86_DISPATCH)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SimdLevel::AVX2;
+        return SimdLevel::Scalar;
+#elif defined(VECDB_NEON)
+        return SimdLevel::NEON;
+#else
+        return SimdLevel::Scalar;
+#endif
+    }();
+    return level;
+}
+
+inline const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX512: return "avx512";
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::NEON: return "neon";
+        default: return "scalar";
+    }
+}
+
+// Metric kernel for the given instruction set.
+inline DistanceFunc get_distance_func(const std::string& metric, SimdLevel level) {
+    if (metric != "l2" && metric != "cosine" && metric != "dot")
+        throw std::invalid_argument("Invalid metric: " + metric);
+    switch (level) {
+#if defined(VECDB_X86_DISPATCH)
+        case SimdLevel::AVX512:
+            if (metric == "l2") return l2_distance_avx512;
+            return metric == "cosine" ? cosine_distance_avx512 : dot_distance_avx512;
+        case SimdLevel::AVX2:
+            if (metric == "l2") return l2_distance_avx2;
+            return metric == "cosine" ? cosine_distance_avx2 : dot_distance_avx2;
+#elif defined(VECDB_NEON)
+        case SimdLevel::NEON:
+            if (metric == "l2") return l2_distance_neon;
+            return metric == "cosine" ? cosine_distance_neon : dot_distance_neon;
+#endif
+        default:
+            if (metric == "l2") return l2_distance;
+            return metric == "cosine" ? cosine_distance : dot_distance;
+    }
+}
+
+// Kernel HNSWIndex ranks with, for vectors in the form it stores them: squared
+// L2 (square root taken only on returned results), and 1 - dot for cosine
+// because stored vectors and queries are normalized up front.
+inline DistanceFunc get_index_distance_func(const std::string& metric, SimdLevel level) {
+    if (metric != "l2" && metric != "cosine" && metric != "dot")
+        throw std::invalid_argument("Invalid metric: " + metric);
+    switch (level) {
+#if defined(VECDB_X86_DISPATCH)
+        case SimdLevel::AVX512:
+            if (metric == "l2") return l2_sq_distance_avx512;
+            return metric == "cosine" ? unit_cosine_distance_avx512 : dot_distance_avx512;
+        case SimdLevel::AVX2:
+            if (metric == "l2") return l2_sq_distance_avx2;
+            return metric == "cosine" ? unit_cosine_distance_avx2 : dot_distance_avx2;
+#elif defined(VECDB_NEON)
+        case SimdLevel::NEON:
+            if (metric == "l2") return l2_sq_distance_neon;
+            return metric == "cosine" ? unit_cosine_distance_neon : dot_distance_neon;
+#endif
+        default:
+            if (metric == "l2") return l2_sq_distance;
+            return metric == "cosine" ? unit_cosine_distance : dot_distance;
+    }
+}
+
+// Ranking distances HNSWIndex uses, as template arguments for the
+// fixed-dimension kernels below.
+enum class IndexMetric { L2, Dot, UnitCosine };
+
+// The ranking distance from an accumulated squared L2 distance (L2) or dot
+// product (the others).
+template <IndexMetric M>
+inline float index_distance_from(float acc) {
+    if constexpr (M == IndexMetric::L2) return acc;
+    else if constexpr (M == IndexMetric::Dot) return -acc;
+    else return 1.0f - acc;
+}
+
+// Kernels for common embedding sizes (128, 384, 768, 1024 and 1536, all
+// multiples of 64 floats), specialized on the metric and dimension, so the
+// trip count is a compile-time constant. The AVX2, AVX-512 and NEON variants
+// below keep four accumulators and have no tail; this scalar fallback just
+// calls the generic kernel with the constant. The size_t argument is ignored.
+template <IndexMetric M, size_t Dim>
+inline float index_distance_fixed(const float* a, const float* b, size_t) {
+    if constexpr (M == IndexMetric::L2) return l2_sq_distance(a, b, Dim);
+    else return index_distance_from<M>(-dot_distance(a, b, Dim));
+}
+
+#if defined(VECDB_X86_DISPATCH)
+
+template <IndexMetric M>
+__attribute__((target("avx2,fma"))) inline __m256 accumulate_avx2(__m256 s, const float* a, const float* b) {
+    __m256 va = _mm256_loadu_ps(a), vb = _mm256_loadu_ps(b);
+    if constexpr (M == IndexMetric::L2) {
+        __m256 d = _mm256_sub_ps(va, vb);
+        return _mm256_fmadd_ps(d, d, s);
+    } else {
+        return _mm256_fmadd_ps(va, vb, s);
+    }
+}
+
+template <IndexMetric M, size_t Dim>
+__attribute__((target("avx2,fma"))) inline float index_distance_fixed_avx2(const float* a, const float* b, size_t) {
+    static_assert(Dim % 32 == 0, "fixed kernels take whole blocks");
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    for (size_t i = 0; i < Dim; i += 32) {
+        s0 = accumulate_avx2<M>(s0, a + i, b + i);
+        s1 = accumulate_avx2<M>(s1, a + i + 8, b + i + 8);
+        s2 = accumulate_avx2<M>(s2, a + i + 16, b + i + 16);
+        s3 = accumulate_avx2<M>(s3, a + i + 24, b + i + 24);
+    }
+    return index_distance_from<M>(hsum_avx2(_mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3))));
+}
+
+// GCC 12 flags its _mm*_undefined_* helpers here too, as above.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+template <IndexMetric M>
+__attribute__((target("avx512f"))) inline __m512 accumulate_avx512(__m512 s, const float* a, const float* b) {
+    __m512 va = _mm512_loadu_ps(a), vb = _mm512_loadu_ps(b);
+    if constexpr (M == IndexMetric::L2) {
+        __m512 d = _mm512_sub_ps(va, vb);
+        return _mm512_fmadd_ps(d, d, s);
+    } else {
+        return _mm512_fmadd_ps(va, vb, s);
+    }
+}
+
+template <IndexMetric M, size_t Dim>
+__attribute__((target("avx512f"))) inline float index_distance_fixed_avx512(const float* a, const float* b, size_t) {
+    static_assert(Dim % 64 == 0, "fixed kernels take whole blocks");
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    for (size_t i = 0; i < Dim; i += 64) {
+        s0 = accumulate_avx512<M>(s0, a + i, b + i);
+        s1 = accumulate_avx512<M>(s1, a + i + 16, b + i + 16);
+        s2 = accumulate_avx512<M>(s2, a + i + 32, b + i + 32);
+        s3 = accumulate_avx512<M>(s3, a + i + 48, b + i + 48);
+    }
+    return index_distance_from<M>(_mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3))));
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#elif defined(VECDB_NEON)
+
+template <IndexMetric M>
+inline float32x4_t accumulate_neon(float32x4_t s, const float* a, const float* b) {
+    float32x4_t va = vld1q_f32(a), vb = vld1q_f32(b);
+    if constexpr (M == IndexMetric::L2) {
+        float32x4_t d = vsubq_f32(va, vb);
+        return vfmaq_f32(s, d, d);
+    } else {
+        return vfmaq_f32(s, va, vb);
+    }
+}
+
+template <IndexMetric M, size_t Dim>
+inline float index_distance_fixed_neon(const float* a, const float* b, size_t) {
+    static_assert(Dim % 16 == 0, "fixed kernels take whole blocks");
+    float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f), s2 = vdupq_n_f32(0.0f), s3 = vdupq_n_f32(0.0f);
+    for (size_t i = 0; i < Dim; i += 16) {
+        s0 = accumulate_neon<M>(s0, a + i, b + i);
+        s1 = accumulate_neon<M>(s1, a + i + 4, b + i + 4);
+        s2 = accumulate_neon<M>(s2, a + i + 8, b + i + 8);
+        s3 = accumulate_neon<M>(s3, a + i + 12, b + i + 12);
+    }
+    return index_distance_from<M>(vaddvq_f32(vaddq_f32(vaddq_f32(s0, s1), vaddq_f32(s2, s3))));
+}
+
+#endif
+
+template <IndexMetric M, size_t Dim>
+inline DistanceFunc fixed_index_distance_func(SimdLevel level) {
+    switch (level) {
+#if defined(VECDB_X86_DISPATCH)
+        case SimdLevel::AVX512: return index_distance_fixed_avx512<M, Dim>;
+        case SimdLevel::AVX2: return index_distance_fixed_avx2<M, Dim>;
+#elif defined(VECDB_NEON)
+        case SimdLevel::NEON: return index_distance_fixed_neon<M, Dim>;
+#endif
+        default: return index_distance_fixed<M, Dim>;
+    }
+}
+
+// The fixed-dimension kernel for `dim`, or null if it has none.
+template <IndexMetric M>
+inline DistanceFunc fixed_index_distance_func(SimdLevel level, size_t dim) {
+    switch (dim) {
+        case 128: return fixed_index_distance_func<M, 128>(level);
+        case 384: return fixed_index_distance_func<M, 384>(level);
+        case 768: return fixed_index_distance_func<M, 768>(level);
+        case 1024: return fixed_index_distance_func<M, 1024>(level);
+        case 1536: return fixed_index_distance_func<M, 1536>(level);
+        default: return nullptr;
+    }
+}
+
+// As get_index_distance_func(metric, level), with the kernel specialized for
+// `dim` when it is one of the common sizes above. HNSWIndex picks it once at
+// construction.
+inline DistanceFunc get_index_distance_func(const std::string& metric, SimdLevel level, size_t dim) {
+    DistanceFunc generic = get_index_distance_func(metric, level);
+    DistanceFunc fixed = metric == "l2"       ? fixed_index_distance_func<IndexMetric::L2>(level, dim)
+                         : metric == "cosine" ? fixed_index_distance_func<IndexMetric::UnitCosine>(level, dim)
+                                              : fixed_index_distance_func<IndexMetric::Dot>(level, dim);
+    return fixed ? fixed : generic;
+}
+
+// Query-tile kernels for the flat scan: kTileQueries queries, stored at
+// q_stride floats apart, against one vector x, so x is loaded once per tile
+// instead of once per query. out[j] receives query j's squared L2 distance
+// (the l2 kernels) or dot product (the dot kernels).
+constexpr size_t kTileQueries = 4;
+using TileFunc = void (*)(const float* q, size_t q_stride, const float* x, size_t dim, float* out);
+
+inline void l2_sq_tile(const float* q, size_t q_stride, const float* x, size_t dim, float* out) {
+    float s[kTileQueries] = {};
+    for (size_t i = 0; i < dim; ++i) {
+        for (size_t j = 0; j < kTileQueries; ++j) {
+            float diff = q[j * q_stride + i] - x[i];
+            s[j] += diff * diff;
+        }
+    }
+    for (size_t j = 0; j < kTileQueries; ++j) out[j] = s[j];
+}
+
+inline void dot_tile(const float* q, size_t q_stride, const float* x, size_t dim, float* out) {
+    float s[kTileQueries] = {};
+    for (size_t i = 0; i < dim; ++i) {
+        for (size_t j = 0; j < kTileQueries; ++j) s[j] += q[j * q_stride + i] * x[i];
+    }
+    for (size_t j = 0; j < kTileQueries; ++j) out[j] = s[j];
+}
+
+#if defined(VECDB_X86_DISPATCH)
+
+__attribute__((target("avx2,fma"))) inline void l2_sq_tile_avx2(const float* q, size_t q_stride, const float* x,
+                                                                size_t dim, float* out) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 v = _mm256_loadu_ps(x + i);
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(q + i), v);
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(q + q_stride + i), v);
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(q + 2 * q_stride + i), v);
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(q + 3 * q_stride + i), v);
+        s0 = _mm256_fmadd_ps(d0, d0, s0);
+        s1 = _mm256_fmadd_ps(d1, d1, s1);
+        s2 = _mm256_fmadd_ps(d2, d2, s2);
+        s3 = _mm256_fmadd_ps(d3, d3, s3);
+    }
+    out[0] = hsum_avx2(s0);
+    out[1] = hsum_avx2(s1);
+    out[2] = hsum_avx2(s2);
+    out[3] = hsum_avx2(s3);
+    for (; i < dim; ++i) {
+        for (size_t j = 0; j < kTileQueries; ++j) {
+            float diff = q[j * q_stride + i] - x[i];
+            out[j] += diff * diff;
+        }
+    }
+}
+
+__attribute__((target("avx2,fma"))) inline void dot_tile_avx2(const float* q, size_t q_stride, const float* x,
+                                                              size_t dim, float* out) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 v = _mm256_loadu_ps(x + i);
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), v, s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + q_stride + i), v, s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(q + 2 * q_stride + i), v, s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(q + 3 * q_stride + i), v, s3);
+    }
+    out[0] = hsum_avx2(s0);
+    out[1] = hsum_avx2(s1);
+    out[2] = hsum_avx2(s2);
+    out[3] = hsum_avx2(s3);
+    for (; i < dim; ++i) {
+        for (size_t j = 0; j < kTileQueries; ++j) out[j] += q[j * q_stride + i] * x[i];
+    }
+}
+
+// GCC 12 flags its _mm*_undefined_* helpers here too, as above.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f"))) inline void l2_sq_tile_avx512(const float* q, size_t q_stride, const float* x,
+                                                                size_t dim, float* out) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    for (size_t i = 0; i < dim; i += 16) {
+        __mmask16 m = dim - i >= 16 ? static_cast<__mmask16>(0xFFFF)
+                                    : static_cast<__mmask16>((1u << (dim - i)) - 1);
+        __m512 v = _mm512_maskz_loadu_ps(m, x + i);
+        __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, q + i), v);
+        __m512 d1 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, q + q_stride + i), v);
+        __m512 d2 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, q + 2 * q_stride + i), v);
+        __m512 d3 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, q + 3 * q_stride + i), v);
+        s0 = _mm512_fmadd_ps(d0, d0, s0);
+        s1 = _mm512_fmadd_ps(d1, d1, s1);
+        s2 = _mm512_fmadd_ps(d2, d2, s2);
+        s3 = _mm512_fmadd_ps(d3, d3, s3);
+    }
+    out[0] = _mm512_reduce_add_ps(s0);
+    out[1] = _mm512_reduce_add_ps(s1);
+    out[2] = _mm512_reduce_add_ps(s2);
+    out[3] = _mm512_reduce_add_ps(s3);
+}
+
+__attribute__((target("avx512f"))) inline void dot_tile_avx512(const float* q, size_t q_stride, const float* x,
+                                                              size_t dim, float* out) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    for (size_t i = 0; i < dim; i += 16) {
+        __mmask16 m = dim - i >= 16 ? static_cast<__mmask16>(0xFFFF)
+                                    : static_cast<__mmask16>((1u << (dim - i)) - 1);
+        __m512 v = _mm512_maskz_loadu_ps(m, x + i);
+        s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q + i), v, s0);
+        s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q + q_stride + i), v, s1);
+        s2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q + 2 * q_stride + i), v, s2);
+        s3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q + 3 * q_stride + i), v, s3);
+    }
+    out[0] = _mm512_reduce_add_ps(s0);
+    out[1] = _mm512_reduce_add_ps(s1);
+    out[2] = _mm512_reduce_add_ps(s2);
+    out[3] = _mm512_reduce_add_ps(s3);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#elif defined(VECDB_NEON)
+
+inline void l2_sq_tile_neon(const float* q, size_t q_stride, const float* x, size_t dim, float* out) {
+    float32x4_t s[kTileQueries] = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f)};
+    size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t v = vld1q_f32(x + i);
+        for (size_t j = 0; j < kTileQueries; ++j) {
+            float32x4_t d = vsubq_f32(vld1q_f32(q + j * q_stride + i), v);
+            s[j] = vfmaq_f32(s[j], d, d);
+        }
+    }
+    for (size_t j = 0; j < kTileQueries; ++j) {
+        out[j] = vaddvq_f32(s[j]);
+        for (size_t t = i; t < dim; ++t) {
+            float diff = q[j * q_stride + t] - x[t];
+            out[j] += diff * diff;
+        }
+    }
+}
+
+inline void dot_tile_neon(const float* q, size_t q_stride, const float* x, size_t dim, float* out) {
+    float32x4_t s[kTileQueries] = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f)};
+    size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t v = vld1q_f32(x + i);
+        for (size_t j = 0; j < kTileQueries; ++j) s[j] = vfmaq_f32(s[j], vld1q_f32(q + j * q_stride + i), v);
+    }
+    for (size_t j = 0; j < kTileQueries; ++j) {
+        out[j] = vaddvq_f32(s[j]);
+        for (size_t t = i; t < dim; ++t) out[j] += q[j * q_stride + t] * x[t];
+    }
+}
+
+#endif
+
+// Tile kernel for the metric: l2 for "l2", dot for "cosine" and "dot".
+inline TileFunc get_tile_func(const std::string& metric, SimdLevel level) {
+    bool l2 = metric == "l2";
+    switch (level) {
+#if defined(VECDB_X86_DISPATCH)
+        case SimdLevel::AVX512: return l2 ? l2_sq_tile_avx512 : dot_tile_avx512;
+        case SimdLevel::AVX2: return l2 ? l2_sq_tile_avx2 : dot_tile_avx2;
+#elif defined(VECDB_NEON)
+        case SimdLevel::NEON: return l2 ? l2_sq_tile_neon : dot_tile_neon;
+#endif
+        default: return l2 ? l2_sq_tile : dot_tile;
+    }
+}
+
+// Scale v to unit length in place. Zero and already-unit vectors are left
+// untouched, so normalizing twice is a bit-exact no-op.
+inline void normalize_vector(float* v, size_t dim) {
+    float norm_sq = 0.0f;
+    for (size_t i = 0; i < dim; ++i) norm_sq += v[i] * v[i];
+    if (norm_sq == 0.0f || std::fabs(norm_sq - 1.0f) < 1e-6f) return;
+    float inv = 1.0f / std::sqrt(norm_sq);
+    for (size_t i = 0; i < dim; ++i) v[i] *= inv;
+}
+
 inline DistanceFunc get_distance_func(const std::string& metric) {
-    if (metric == "l2") return l2_distance;
-    if (metric == "cosine") return cosine_distance;
-    if (metric == "dot") return dot_distance;
-    throw std::invalid_argument("Invalid metric: " + metric);
+    return get_distance_func(metric, detect_simd_level());
 }
 
 } // namespace vecdb
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "distance.hpp"
+
+#if defined(VECDB_X86_DISPATCH)
+#include <nmmintrin.h>
+#endif
+
+namespace vecdb {
+
+// CRC-32C (Castagnoli) of n bytes, continuing from `crc` (0 to start).
+inline uint32_t crc32c_scalar(uint32_t crc, const uint8_t* p, size_t n) {
+    static const auto table = [] {
+        std::unique_ptr<uint32_t[]> t(new uint32_t[256]);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(VECDB_X86_DISPATCH)
+__attribute__((target("sse4.2"))) inline uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t n) {
+    uint64_t c = ~crc;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, p + i, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    uint32_t c32 = static_cast<uint32_t>(c);
+    for (; i < n; ++i) c32 = _mm_crc32_u8(c32, p[i]);
+    return ~c32;
+}
+#endif
+
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t n) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+#if defined(VECDB_X86_DISPATCH)
+    static const bool hw = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") != 0;
+    }();
+    if (hw) return crc32c_sse42(crc, p, n);
+#endif
+    return crc32c_scalar(crc, p, n);
+}
+
+// Writes a new file through a fixed-size buffer, so memory use stays at one
+// chunk however much is written. Keeps a CRC-32C of the bytes written since
+// the last take_checksum(). An unfinished file is left truncated.
+class ChunkedWriter {
+public:
+    static constexpr size_t kChunkSize = size_t(1) << 20;
+
+    explicit ChunkedWriter(const std::string& path) : path_(path), buf_(new uint8_t[kChunkSize]) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) fail("open");
+    }
+    ~ChunkedWriter() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+    ChunkedWriter(const ChunkedWriter&) = delete;
+    ChunkedWriter& operator=(const ChunkedWriter&) = delete;
+
+    void write(const void* data, size_t n) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        crc_ = crc32c(crc_, p, n);
+        offset_ += n;
+        while (n > 0) {
+            size_t take = std::min(n, kChunkSize - used_);
+            std::memcpy(buf_.get() + used_, p, take);
+            used_ += take;
+            p += take;
+            n -= take;
+            if (used_ == kChunkSize) flush();
+        }
+    }
+
+    // Zero-fill up to absolute file offset `to`.
+    void pad_to(size_t to) {
+        static const uint8_t zeros[64] = {};
+        while (offset_ < to) write(zeros, std::min(sizeof(zeros), to - offset_));
+    }
+
+    uint32_t take_checksum() {
+        uint32_t c = crc_;
+        crc_ = 0;
+        return c;
+    }
+
+    size_t offset() const { return offset_; }
+
+    // Overwrite bytes already written, e.g. a table filled in at the end.
+    void write_at(size_t at, const void* data, size_t n) {
+        flush();
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        while (n > 0) {
+            ssize_t w = ::pwrite(fd_, p, n, static_cast<off_t>(at));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) fail("write");
+            p += w;
+            at += static_cast<size_t>(w);
+            n -= static_cast<size_t>(w);
+        }
+    }
+
+    // Flush, sync to disk and close.
+    void finish() {
+        flush();
+        if (::fsync(fd_) != 0) fail("sync");
+        int fd = fd_;
+        fd_ = -1;
+        if (::close(fd) != 0) fail("close");
+    }
+
+private:
+    void flush() {
+        const uint8_t* p = buf_.get();
+        size_t n = used_;
+        while (n > 0) {
+            ssize_t w = ::write(fd_, p, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) fail("write");
+            p += w;
+            n -= static_cast<size_t>(w);
+        }
+        used_ = 0;
+    }
+
+    [[noreturn]] void fail(const char* what) const {
+        throw std::runtime_error(std::string("Cannot ") + what + " " + path_ + ": " + std::strerror(errno));
+    }
+
+    std::string path_;
+    std::unique_ptr<uint8_t[]> buf_;
+    int fd_ = -1;
+    size_t used_ = 0;
+    size_t offset_ = 0;
+    uint32_t crc_ = 0;
+};
+
+// Reads a file sequentially through a fixed-size buffer, keeping a CRC-32C of
+// the bytes read since the last take_checksum(). Reading past the end throws.
+class ChunkedReader {
+public:
+    static constexpr size_t kChunkSize = ChunkedWriter::kChunkSize;
+
+    explicit ChunkedReader(const std::string& path) : path_(path), buf_(new uint8_t[kChunkSize]) {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) fail("open");
+        struct stat st;
+        if (::fstat(fd_, &st) != 0) {
+            ::close(fd_);
+            fail("stat");
+        }
+        size_ = static_cast<size_t>(st.st_size);
+    }
+    ~ChunkedReader() { ::close(fd_); }
+    ChunkedReader(const ChunkedReader&) = delete;
+    ChunkedReader& operator=(const ChunkedReader&) = delete;
+
+    void read(void* data, size_t n) {
+        if (n > size_ - offset_) throw std::runtime_error("Unexpected end of data");
+        uint8_t* p = static_cast<uint8_t*>(data);
+        size_t left = n;
+        while (left > 0) {
+            if (pos_ == filled_) fill();
+            size_t take = std::min(left, filled_ - pos_);
+            std::memcpy(p, buf_.get() + pos_, take);
+            pos_ += take;
+            p += take;
+            left -= take;
+        }
+        crc_ = crc32c(crc_, data, n);
+        offset_ += n;
+    }
+
+    // Skip forward to absolute file offset `to`; skipped bytes are not checksummed.
+    void skip_to(size_t to) {
+        if (to < offset_ || to > size_) throw std::runtime_error("Unexpected end of data");
+        while (offset_ < to) {
+            if (pos_ == filled_) fill();
+            size_t take = std::min(to - offset_, filled_ - pos_);
+            pos_ += take;
+            offset_ += take;
+        }
+    }
+
+    uint32_t take_checksum() {
+        uint32_t c = crc_;
+        crc_ = 0;
+        return c;
+    }
+
+    size_t offset() const { return offset_; }
+    size_t size() const { return size_; }
+
+private:
+    void fill() {
+        for (;;) {
+            ssize_t r = ::read(fd_, buf_.get(), kChunkSize);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0) fail("read");
+            if (r == 0) throw std::runtime_error("Unexpected end of data");
+            pos_ = 0;
+            filled_ = static_cast<size_t>(r);
+            return;
+        }
+    }
+
+    [[noreturn]] void fail(const char* what) const {
+        throw std::runtime_error(std::string("Cannot ") + what + " " + path_ + ": " + std::strerror(errno));
+    }
+
+    std::string path_;
+    std::unique_ptr<uint8_t[]> buf_;
+    int fd_ = -1;
+    size_t size_ = 0;
+    size_t offset_ = 0;
+    size_t pos_ = 0, filled_ = 0;
+    uint32_t crc_ = 0;
+};
+
+} // namespace vecdb
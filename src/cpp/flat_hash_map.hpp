@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace vecdb {
+
+// Map from int64 keys to non-negative int64 values in one open-addressed
+// array with linear probing. A slot is empty when its value is negative.
+// Erasing shifts the rest of the probe run back instead of leaving
+// tombstones, so lookups never slow down after many deletes.
+class FlatIdMap {
+public:
+    explicit FlatIdMap(size_t expected = 0) : slots_(capacity_for(expected), Slot{0, -1}) {}
+
+    // Insert key -> value (value >= 0). Returns false, leaving the map
+    // unchanged, if the key is already present.
+    bool insert(int64_t key, int64_t value) {
+        if ((size_ + 1) * 4 > slots_.size() * 3) rehash(slots_.size() * 2);
+        size_t i = find_slot(key);
+        if (slots_[i].value >= 0) return false;
+        slots_[i] = Slot{key, value};
+        ++size_;
+        return true;
+    }
+
+    // The value stored for `key`, or -1.
+    int64_t find(int64_t key) const { return slots_[find_slot(key)].value; }
+    bool contains(int64_t key) const { return find(key) >= 0; }
+
+    bool erase(int64_t key) {
+        size_t i = find_slot(key);
+        if (slots_[i].value < 0) return false;
+        size_t mask = slots_.size() - 1;
+        for (size_t j = (i + 1) & mask; slots_[j].value >= 0; j = (j + 1) & mask) {
+            // The entry at j may fill the gap at i if i lies between its home slot and j
+            size_t home = hash(slots_[j].key) & mask;
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i].value = -1;
+        --size_;
+        return true;
+    }
+
+    // Make room for `n` keys without rehashing.
+    void reserve(size_t n) {
+        size_t cap = capacity_for(n);
+        if (cap > slots_.size()) rehash(cap);
+    }
+
+    void clear() {
+        for (auto& s : slots_) s.value = -1;
+        size_ = 0;
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    struct Slot {
+        int64_t key;
+        int64_t value;
+    };
+
+    // Smallest power of two keeping n keys under a 3/4 load factor.
+    static size_t capacity_for(size_t n) {
+        size_t cap = 16;
+        while (cap * 3 < n * 4) cap *= 2;
+        return cap;
+    }
+
+    // splitmix64 finalizer; user IDs are often sequential.
+    static size_t hash(int64_t key) {
+        uint64_t x = static_cast<uint64_t>(key);
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return static_cast<size_t>(x);
+    }
+
+    // The slot holding `key`, or the empty slot ending its probe run.
+    size_t find_slot(int64_t key) const {
+        size_t mask = slots_.size() - 1;
+        size_t i = hash(key) & mask;
+        while (slots_[i].value >= 0 && slots_[i].key != key) i = (i + 1) & mask;
+        return i;
+    }
+
+    void rehash(size_t cap) {
+        std::vector<Slot> old(cap, Slot{0, -1});
+        old.swap(slots_);
+        size_t mask = cap - 1;
+        for (const auto& s : old) {
+            if (s.value < 0) continue;
+            size_t i = hash(s.key) & mask;
+            while (slots_[i].value >= 0) i = (i + 1) & mask;
+            slots_[i] = s;
+        }
+    }
+
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+};
+
+} // namespace vecdb
@@ -1,14 +1,26 @@
 #pragma once
 
 #include <vector>
-#include <unordered_map>
 #include <unordered_set>
 #include <random>
 #include <queue>
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
+#include <limits>
+#include <shared_mutex>
 #include <stdexcept>
+#include "aligned_buffer.hpp"
 #include "distance.hpp"
+#include "file_io.hpp"
+#include "id_filter.hpp"
+#include "index_stats.hpp"
+#include "link_pool.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "quantization.hpp"
+#include "visited_list.hpp"
 
 namespace vecdb {
 
@@ -27,173 +39,1582 @@ public:
     explicit DeserializationError(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+// Per-query adaptive termination for search(). With `patience`, the
+// level-0 walk stops once that many node expansions in a row have left the
+// k nearest live nodes unchanged, so easy queries finish before the ef
+// bound. And when the ef bound is hit while those k were still changing
+// within the last `patience` expansions, ef doubles, up to `max_ef`, and
+// the walk goes on. `max_distances` stops the walk once it has computed
+// that many distances. `target_recall` replaces ef_search with the smallest
+// ef that reached that recall in the last calibrate(), and unset fields
+// with the options that calibration ran with. Filtered searches only honor
+// target_recall.
+struct SearchOptions {
+    size_t patience = 0;       // 0 = run to the ef bound
+    size_t max_ef = 0;         // widen hard queries up to this ef; 0 = never
+    size_t max_distances = 0;  // 0 = unlimited
+    double target_recall = 0;  // 0 = use ef_search as given
+};
+
+// One point of the ef_search-to-recall curve measured by calibrate().
+struct CalibrationPoint {
+    size_t ef_search;
+    double recall;  // mean recall@k over the sample queries
+};
+
+// Graph storage is indexed directly by internal ID, which Collection hands out
+// densely from 0. Vectors live in one aligned arena (one padded slot per ID),
+// level-0 adjacency in fixed-stride slots of M_max0_ links, and upper-layer
+// links in blocks of level * (M_ + 1) entries carved from one LinkPool slab.
+// Every link list is laid out as [count, id_1, ..., id_max] and has a fixed
+// capacity, so linking and pruning rewrite it in place.
+//
+// Links are chosen with the HNSW selection heuristic unless `heuristic` is
+// false, in which case a node simply keeps its closest candidates.
+// `keep_pruned` tops a heuristic selection back up to the limit with the
+// closest discarded candidates; `extend_candidates` also considers the
+// neighbors of each candidate when a node is inserted.
+//
+// With storage "int8" or "pq", vectors are kept as codes once the quantizer
+// is trained, either by train() or automatically when the index first holds
+// auto_train_size() vectors; until then they are stored as floats. "int8"
+// maps each dimension to a byte; "pq" splits vectors into pq_subspaces
+// sub-vectors coded against k-means codebooks. Graph walks rank codes only.
+// `rerank` also keeps the float vectors and re-scores the final ef
+// candidates with them; with a `rerank_path` those floats live in that file,
+// memory-mapped, instead of in RAM. A snapshot names the file, so once one
+// is written or loaded the file is left as it is: the first change after
+// that copies the floats to the next generation, "<rerank_path>.v<N>", and
+// the index carries on there.
+//
+// save() streams the arrays above as-is into one checksummed file.
+// open_mmap() serves searches straight from a copy-on-write mapping of it, and
+// load() reads it into memory. The upper-layer blocks are stored packed, and
+// the file's block section becomes the pool's slab.
+//
+// Searches may run concurrently with each other and with add() and
+// add_batch(). Node arrays only grow while graph_mutex_ is held exclusively;
+// searches hold it shared, as do inserts once their slots are filled, so new
+// nodes are linked while searches run. While any insert is linking, searches
+// read each link list under its node lock and entry_point_/max_level_ under
+// top_mutex_. remove(), compact(), train(), save() and serialize() take the
+// lock exclusively.
+//
+// Built with VECDB_STATS, searches and inserts count their distance
+// computations, visited nodes, heap pushes and hops per level into stats();
+// without it the counting compiles away.
 class HNSWIndex {
 public:
-    HNSWIndex(size_t dimension, const std::string& metric, size_t M = 16, size_t ef_construction = 200)
+    static constexpr size_t kAutoTrainSize = 1000;
+    static constexpr size_t kAutoTrainSizePQ = 10000;
+    static constexpr char kMmapMagic[] = "VECDBHNS";  // first 8 bytes of a save() file
+    static constexpr int64_t kMaxId = std::numeric_limits<LinkId>::max();  // links hold 32-bit IDs
+    static constexpr size_t kDefaultFlatThreshold = 2048;
+
+    // max_elements, if given, allocates node storage for that many IDs up front.
+    HNSWIndex(size_t dimension, const std::string& metric, size_t M = 16, size_t ef_construction = 200,
+              bool heuristic = true, bool keep_pruned = false, bool extend_candidates = false,
+              const std::string& storage = "float", bool rerank = false, size_t pq_subspaces = 8,
+              const std::string& rerank_path = "", size_t max_elements = 0)
         : dimension_(dimension), metric_(metric), M_(M), M_max0_(M * 2),
-          ef_construction_(ef_construction), entry_point_(-1), max_level_(0),
-          dist_func_(get_distance_func(metric)), rng_(42), level_mult_(1.0 / std::log(static_cast<double>(M))) {
+          ef_construction_(ef_construction), heuristic_(heuristic), keep_pruned_(keep_pruned),
+          extend_candidates_(extend_candidates), storage_(storage), rerank_(rerank),
+          use_pq_(storage == "pq"), rerank_path_(rerank_path),
+          entry_point_(-1), max_level_(0),
+          simd_level_(detect_simd_level()), dist_func_(get_index_distance_func(metric, simd_level_, dimension)),
+          normalize_(metric == "cosine"), sq_(dimension, metric, simd_level_),
+          pq_(dimension, pq_subspaces, metric),
+          rng_(42), level_mult_(1.0 / std::log(static_cast<double>(M))),
+          vec_stride_((dimension + kFloatsPerLine - 1) / kFloatsPerLine * kFloatsPerLine),
+          code_size_(use_pq_ ? pq_subspaces : dimension),
+          // PQ codes are read bytewise through lookup tables, so they are not padded
+          code_stride_(use_pq_ ? code_size_ : (dimension + kBytesPerLine - 1) / kBytesPerLine * kBytesPerLine),
+          links0_stride_(M_max0_ + 1), upper_pool_(M + 1) {
         if (dimension < 1) throw std::invalid_argument("Dimension must be >= 1");
+        if (storage != "float" && storage != "int8" && storage != "pq")
+            throw std::invalid_argument("Invalid storage: " + storage);
+        if (use_pq_ && (pq_subspaces < 1 || dimension % pq_subspaces != 0))
+            throw std::invalid_argument("pq_subspaces must divide the dimension");
+        if (max_elements > 0) set_capacity(max_elements);
     }
 
     void add(int64_t id, const std::vector<float>& vec) {
         if (vec.size() != dimension_)
             throw DimensionError("Expected " + std::to_string(dimension_) + ", got " + std::to_string(vec.size()));
-        if (vectors_.count(id) && !deleted_.count(id))
-            throw DuplicateIDError("ID " + std::to_string(id) + " already exists");
+        add(id, vec.data());
+    }
 
-        vectors_[id] = vec;
-        deleted_.erase(id);
-        int level = random_level();
-        levels_[id] = level;
-        neighbors_[id].assign(level + 1, std::vector<int64_t>());
+    // As above for a vector of dimension() floats, copied once into the index.
+    void add(int64_t id, const float* vec) { add_batch(&id, vec, 1, 1); }
 
-        if (entry_point_ < 0) {
-            entry_point_ = id;
-            max_level_ = level;
-            return;
+    // Insert n row-major vectors of dimension() floats on up to num_threads
+    // threads (0 = all cores). The whole batch is validated first, so nothing
+    // is inserted if any ID is negative, already present or repeated.
+    void add_batch(const int64_t* ids, const float* vectors, size_t n, size_t num_threads = 0) {
+        if (n == 0) return;
+        std::unique_lock<SharedMutex> exclusive(graph_mutex_);
+        std::unordered_set<int64_t> batch_ids;
+        int64_t max_id = 0;
+        for (size_t i = 0; i < n; ++i) {
+            int64_t id = ids[i];
+            if (id < 0) throw std::invalid_argument("Internal ID must be >= 0");
+            if (id > kMaxId) throw std::invalid_argument("Internal ID must be < 2^32");
+            if (contains(id) || (n > 1 && !batch_ids.insert(id).second))
+                throw DuplicateIDError("ID " + std::to_string(id) + " already exists");
+            max_id = std::max(max_id, id);
         }
 
-        int64_t curr = entry_point_;
-        // Traverse from top to insertion level
-        for (int l = max_level_; l > level; --l) {
-            curr = search_layer_single(vec.data(), curr, l);
+        // Slots are filled serially so workers only ever read finished vectors
+        ensure_slot(max_id);
+        bool entry_reinserted = false;
+        for (size_t i = 0; i < n; ++i) {
+            int64_t id = ids[i];
+            int level = random_level();
+            int old_level = levels_[id];
+            if (old_level >= 0) {
+                // Re-inserting a tombstoned ID rebuilds its links. Stale in-links
+                // may still reach it, so it keeps at least its old height.
+                level = std::max(level, old_level);
+                deleted_[id] = 0;
+                --num_deleted_;
+                entry_reinserted |= (id == entry_point_);
+            } else {
+                ++num_present_;
+            }
+            store_vector(id, vectors + i * dimension_);
+            levels_[id] = level;
+            links(id, 0)[0] = 0;
+            reset_upper_links(id, old_level, level);
+        }
+        // A re-inserted entry point has lost its links, so descend from another node
+        if (entry_reinserted) {
+            reset_entry_point([&](int64_t node) { return n > 1 ? !batch_ids.count(node) : node != ids[0]; });
         }
+        if (storage_ != "float" && !quantized_ && num_present_ >= auto_train_size()) train_stored();
 
-        // Insert at each level from min(level, max_level_) down to 0
-        for (int l = std::min(level, max_level_); l >= 0; --l) {
-            auto candidates = search_layer(vec.data(), curr, ef_construction_, l);
-            auto neighbors = select_neighbors(candidates, l == 0 ? M_max0_ : M_);
-            neighbors_[id][l] = neighbors;
+        // Link under a shared lock so searches can run meanwhile
+        ++linking_;
+        exclusive.release();
+        graph_mutex_.downgrade();
+        std::shared_lock<SharedMutex> shared(graph_mutex_, std::adopt_lock);
+        struct LinkingDone {
+            MemberCounter& linking;
+            ~LinkingDone() { --linking; }
+        } done{linking_};
+        parallel_for(n, num_threads, [&](size_t i) {
+#if defined(VECDB_STATS)
+            SearchStats counted;
+            insert_node(ids[i], &counted);
+            totals_.add_insert(counted);
+#else
+            insert_node(ids[i]);
+#endif
+        });
+    }
 
-            // Bidirectional connections
-            for (int64_t n : neighbors) {
-                neighbors_[n][l].push_back(id);
-                size_t max_conn = (l == 0 ? M_max0_ : M_);
-                if (neighbors_[n][l].size() > max_conn) {
-                    auto pruned = select_neighbors(
-                        get_neighbors_with_dist(vectors_[n].data(), neighbors_[n][l]), max_conn);
-                    neighbors_[n][l] = pruned;
+    std::vector<std::pair<int64_t, float>> search(const std::vector<float>& query, size_t k, size_t ef_search = 50) const {
+        if (query.size() != dimension_)
+            throw DimensionError("Expected " + std::to_string(dimension_) + ", got " + std::to_string(query.size()));
+        return search(query.data(), k, ef_search);
+    }
+
+    // As above for a query of dimension() floats. With a `filter`, only IDs it
+    // allows are returned: the graph walk passes through the others without
+    // counting them, so k results come back whenever k allowed nodes exist.
+    // A filter allowing few enough IDs is searched exactly by brute force, as
+    // is an index of at most flat_threshold() nodes, ignoring `options`.
+    // `stats`, if given, receives this search's counters; they stay zero
+    // unless built with VECDB_STATS. `options` enables early termination.
+    std::vector<std::pair<int64_t, float>> search(const float* query, size_t k, size_t ef_search = 50,
+                                                  const IdFilter* filter = nullptr,
+                                                  SearchStats* stats = nullptr,
+                                                  const SearchOptions* options = nullptr) const {
+        if (k < 1) throw std::invalid_argument("k must be >= 1");
+        std::shared_lock<SharedMutex> lock(graph_mutex_);
+        return search_unchecked(query, k, ef_search, filter, stats, options);
+    }
+
+    // Search n row-major queries of dimension() floats on up to num_threads
+    // threads (0 = all cores), each under `filter` if given. Row i of the
+    // n x k outputs holds query i's results in ascending distance, padded with
+    // id -1 and distance +inf.
+    void search_batch(const float* queries, size_t n, size_t k, size_t ef_search, size_t num_threads,
+                      int64_t* ids, float* distances, const IdFilter* filter = nullptr,
+                      const SearchOptions* options = nullptr) const {
+        if (k < 1) throw std::invalid_argument("k must be >= 1");
+        std::shared_lock<SharedMutex> lock(graph_mutex_);
+        // The same cut-off as search_unchecked(), whose flat scan this matches
+        // for every storage mode
+        if (!filter && count() <= flat_threshold_) {
+            return exact_batch_unchecked(queries, n, k, num_threads, ids, distances, nullptr);
+        }
+        parallel_for(n, num_threads, [&](size_t i) {
+            auto results = search_unchecked(queries + i * dimension_, k, ef_search, filter, nullptr, options);
+            write_row(results, k, ids + i * k, distances + i * k);
+        });
+    }
+
+    // The exact k nearest live nodes to each of n row-major queries, laid
+    // out as by search_batch(), by scanning every node (those `filter`
+    // allows, if given) on up to num_threads threads. Queries are scored in
+    // tiles of kTileQueries against cache-sized blocks of the stored floats,
+    // or one by one against the codes when floats are not kept. This is the
+    // ground truth for recall measurements.
+    void search_exact_batch(const float* queries, size_t n, size_t k, size_t num_threads,
+                            int64_t* ids, float* distances, const IdFilter* filter = nullptr) const {
+        if (k < 1) throw std::invalid_argument("k must be >= 1");
+        std::shared_lock<SharedMutex> lock(graph_mutex_);
+        exact_batch_unchecked(queries, n, k, num_threads, ids, distances, filter);
+    }
+
+    bool remove(int64_t id) {
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        if (!contains(id)) return false;
+        deleted_[id] = 1;
+        ++num_deleted_;
+        return true;
+    }
+
+    // Physically drop every removed node so add() can reuse its slot. Live
+    // nodes that linked to one are relinked with the neighbor selection
+    // heuristic, choosing from the live nodes within two hops (walking on
+    // through removed ones), and their new neighbors link back; a node left
+    // with no level-0 links is reinserted. Returns the number of nodes reclaimed. Repairs run on up to
+    // num_threads threads (0 = all cores); other calls wait until it is done.
+    size_t compact(size_t num_threads = 0) {
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        if (num_deleted_ == 0) return 0;
+        if (node_locks_.size() < capacity_) node_locks_ = LockTable(capacity_);
+
+        // Plan every repair against the old graph, then apply them
+        std::vector<std::pair<int64_t, int>> stale;
+        for (size_t id = 0; id < num_slots_; ++id) {
+            if (!contains(static_cast<int64_t>(id))) continue;
+            for (int l = 0; l <= levels_[id]; ++l) {
+                const LinkId* ll = links(static_cast<int64_t>(id), l);
+                for (int64_t i = 1; i <= ll[0]; ++i) {
+                    if (deleted_[ll[i]]) {
+                        stale.emplace_back(static_cast<int64_t>(id), l);
+                        break;
+                    }
                 }
             }
-            if (!candidates.empty()) curr = candidates[0].second;
         }
+        std::vector<std::vector<int64_t>> repaired(stale.size());
+        parallel_for(stale.size(), num_threads, [&](size_t i) {
+            repaired[i] = repaired_links(stale[i].first, stale[i].second);
+        });
+        for (size_t i = 0; i < stale.size(); ++i) set_links(links(stale[i].first, stale[i].second), repaired[i]);
+        // New links go both ways, as on insert
+        parallel_for(stale.size(), num_threads, [&](size_t i) {
+            for (int64_t n : repaired[i]) connect(n, stale[i].first, stale[i].second);
+        });
 
-        if (level > max_level_) {
-            max_level_ = level;
-            entry_point_ = id;
+        size_t reclaimed = 0;
+        bool entry_removed = entry_point_ >= 0 && deleted_[entry_point_];
+        for (size_t id = 0; id < num_slots_; ++id) {
+            if (levels_[id] < 0 || !deleted_[id]) continue;
+            reset_upper_links(static_cast<int64_t>(id), levels_[id], 0);
+            levels_[id] = -1;
+            deleted_[id] = 0;
+            links(static_cast<int64_t>(id), 0)[0] = 0;
+            ++reclaimed;
+        }
+        num_present_ -= reclaimed;
+        num_deleted_ = 0;
+        while (num_slots_ > 0 && levels_[num_slots_ - 1] < 0) --num_slots_;
+        if (entry_removed) reset_entry_point([](int64_t) { return true; });
+
+        if (num_present_ > 1) {
+            for (size_t id = 0; id < num_slots_; ++id) {
+                int64_t node = static_cast<int64_t>(id);
+                if (levels_[id] >= 0 && node != entry_point_ && links(node, 0)[0] == 0) insert_node(node);
+            }
         }
+        return reclaimed;
     }
 
-    std::vector<std::pair<int64_t, float>> search(const std::vector<float>& query, size_t k, size_t ef_search = 50) {
-        if (query.size() != dimension_)
-            throw DimensionError("Expected " + std::to_string(dimension_) + ", got " + std::to_string(query.size()));
+    // Renumber the stored nodes by graph locality, breadth-first over level 0
+    // from the entry point, so that neighbors sit in nearby slots and a walk
+    // touches fewer cache lines and pages. Nodes that walk misses follow, each
+    // starting a walk of its own, then the empty slots. Vectors, codes and
+    // link lists move with their nodes and keep their order, so a search
+    // finds the same nodes as before under their new IDs. Returns the new ID
+    // of each slot, indexed by its old one; anything holding internal IDs
+    // must remap them. Other calls wait until it is done.
+    std::vector<int64_t> reorder() {
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        std::vector<int64_t> order = locality_order();
+        std::vector<int64_t> new_id(order.size());
+        for (size_t i = 0; i < order.size(); ++i) new_id[static_cast<size_t>(order[i])] = static_cast<int64_t>(i);
+        permute(order, new_id);
+        return new_id;
+    }
+
+    // Fit the quantizer to n row-major sample vectors and encode every stored
+    // vector. Float vectors are released unless `rerank` is set.
+    void train(const float* vectors, size_t n) {
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        check_trainable();
+        if (n == 0) throw std::invalid_argument("Training requires at least one vector");
+        std::vector<float> sample(vectors, vectors + n * dimension_);
+        if (normalize_) {
+            for (size_t r = 0; r < n; ++r) normalize_vector(sample.data() + r * dimension_, dimension_);
+        }
+        fit(n, [&](size_t r) { return sample.data() + r * dimension_; });
+        encode_stored();
+    }
+
+    // Train on the vectors already stored, tombstones included.
+    void train() {
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        train_stored();
+    }
+
+    std::vector<uint8_t> serialize() const {
+        // Exclusive: inserts rewrite link lists under the shared lock
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        seal_rerank_file();
+        return serialize_unlocked();
+    }
+
+    static HNSWIndex deserialize(const std::vector<uint8_t>& data) { return deserialize(data.data(), data.size()); }
+
+    static HNSWIndex deserialize(const uint8_t* data, size_t data_size) {
+        size_t offset = 0;
+        auto read = [data, data_size, &offset](void* ptr, size_t size) {
+            if (offset + size > data_size) throw DeserializationError("Unexpected end of data");
+            std::memcpy(ptr, data + offset, size);
+            offset += size;
+        };
+        uint32_t version; read(&version, 4);
+        if (version < 1 || version > kSerialVersion) throw DeserializationError("Unsupported version");
+        HNSWIndex index = read_header(read, version);
+        size_t dim = index.dimension_;
+
+        uint64_t num_vectors; read(&num_vectors, 8);
+        for (uint64_t i = 0; i < num_vectors; ++i) {
+            int64_t id; read(&id, 8);
+            int level; read(&level, 4);
+            // Each of the level + 1 link lists takes at least a count byte,
+            // so a larger level is corrupt; reject it before allocating.
+            if (id < 0 || id > kMaxId || level < 0 || static_cast<size_t>(level) >= data_size - offset ||
+                index.contains_slot(id))
+                throw DeserializationError("Corrupt node record");
+            index.ensure_slot(id);
+            if (index.floats_in_index()) {
+                read(index.mutable_vector(id), dim * 4);
+                if (index.normalize_) normalize_vector(index.mutable_vector(id), dim);
+            }
+            if (index.quantized_) read(index.mutable_code(id), index.code_size_);
+            uint8_t is_del; read(&is_del, 1);
+            index.levels_[id] = level;
+            index.deleted_[id] = is_del ? 1 : 0;
+            ++index.num_present_;
+            if (is_del) ++index.num_deleted_;
+            index.reset_upper_links(id, -1, level);
+            for (int l = 0; l <= level; ++l) {
+                uint64_t nn;
+                if (version >= 5) {
+                    nn = read_varint(read);
+                } else {
+                    uint32_t nn32; read(&nn32, 4);
+                    nn = nn32;
+                }
+                if (nn > index.max_connections(l)) throw DeserializationError("Corrupt neighbor list");
+                LinkId* ll = index.links(id, l);
+                ll[0] = static_cast<LinkId>(nn);
+                uint64_t link = 0;
+                for (uint64_t j = 1; j <= nn; ++j) {
+                    if (version >= 5) {
+                        link += read_varint(read);
+                    } else {
+                        int64_t wide; read(&wide, 8);
+                        link = static_cast<uint64_t>(wide);
+                    }
+                    if (link > static_cast<uint64_t>(kMaxId)) throw DeserializationError("Corrupt neighbor list");
+                    ll[j] = static_cast<LinkId>(link);
+                }
+            }
+        }
+        index.validate();
+        index.check_rerank_file();
+        return index;
+    }
+
+    // Write the index to `path` in the layout open_mmap() and load() read:
+    //   [magic: 8 bytes][layout: u32][header as in serialize()]
+    //   [num_slots: u64][num_present: u64][num_deleted: u64]
+    //   [kNumSections x SectionEntry][header_crc: u32]
+    // followed by the sections, each starting on a cache line. Arrays are
+    // streamed through a fixed-size buffer, so saving allocates no more than
+    // one chunk beyond the header.
+    void save(const std::string& path) const {
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        seal_rerank_file();
+        std::vector<uint8_t> head;
+        auto write_head = [&head](const void* ptr, size_t size) {
+            const uint8_t* p = static_cast<const uint8_t*>(ptr);
+            head.insert(head.end(), p, p + size);
+        };
+        write_head(kMmapMagic, 8);
+        uint32_t layout = kMmapLayout;
+        write_head(&layout, 4);
+        write_header(write_head);
+        uint64_t counts[3] = {num_slots_, num_present_, num_deleted_};
+        write_head(counts, sizeof(counts));
+
+        size_t upper_entries = 0;
+        for (size_t id = 0; id < num_slots_; ++id) {
+            if (levels_[id] > 0) upper_entries += static_cast<size_t>(levels_[id]) * (M_ + 1);
+        }
+        SectionEntry sections[kNumSections] = {};
+        size_t bytes[kNumSections] = {};
+        section_bytes(num_slots_, bytes);
+        bytes[kUpperLinks] = upper_entries * sizeof(LinkId);
+        size_t offset = align_line(head.size() + sizeof(sections) + 4);
+        for (size_t i = 0; i < kNumSections; ++i) {
+            sections[i].offset = offset;
+            sections[i].bytes = bytes[i];
+            offset = align_line(offset + bytes[i]);
+        }
+
+        ChunkedWriter out(path);
+        out.write(head.data(), head.size());
+        // The table and header checksum are filled in once the sections are written
+        size_t table_at = out.offset();
+        out.write(sections, sizeof(sections));
+        uint32_t header_crc = 0;
+        out.write(&header_crc, 4);
+        const void* arrays[kNumSections] = {levels_.data(), deleted_.data(), vectors_.data(), codes_.data(),
+                                            links0_.data()};
+        for (size_t i = 0; i < kNumSections; ++i) {
+            out.pad_to(sections[i].offset);
+            out.take_checksum();
+            if (i < kUpperOffsets) {
+                out.write(arrays[i], bytes[i]);
+            } else if (i == kUpperOffsets) {
+                uint64_t upper_offset = 0;
+                for (size_t id = 0; id < num_slots_; ++id) {
+                    out.write(&upper_offset, 8);
+                    if (levels_[id] > 0) upper_offset += static_cast<uint64_t>(levels_[id]) * (M_ + 1);
+                }
+            } else {
+                for (size_t id = 0; id < num_slots_; ++id) {
+                    if (levels_[id] > 0)
+                        out.write(links(id, 1), static_cast<size_t>(levels_[id]) * (M_ + 1) * sizeof(LinkId));
+                }
+            }
+            sections[i].checksum = out.take_checksum();
+        }
+        header_crc = crc32c(crc32c(0, head.data(), head.size()), sections, sizeof(sections));
+        out.write_at(table_at, sections, sizeof(sections));
+        out.write_at(table_at + sizeof(sections), &header_crc, 4);
+        out.finish();
+    }
+
+    // Open a file written by save() without reading it: every array is a view
+    // into a private mapping, so pages are faulted in as searches touch them
+    // and writes never reach the file. The header and section bounds are
+    // checked, but section checksums and link lists are not; load() verifies both.
+    static HNSWIndex open_mmap(const std::string& path) {
+        MappedFile file;
+        try {
+            file.open_private(path);
+        } catch (const std::runtime_error& e) {
+            throw DeserializationError(e.what());
+        }
+        size_t offset = 0;
+        auto read = [&file, &offset](void* ptr, size_t size) {
+            if (offset + size > file.size()) throw DeserializationError("Unexpected end of data");
+            std::memcpy(ptr, file.data() + offset, size);
+            offset += size;
+        };
+        uint32_t layout;
+        uint64_t counts[3];
+        SectionEntry sections[kNumSections];
+        HNSWIndex index = read_saved_head(read, file.size(), layout, counts, sections);
+        // Earlier layouts store 64-bit links, which cannot be used in place
+        if (layout < 3) return load(path);
+
+        size_t n = counts[0];
+        auto section = [&](size_t i) { return file.data() + sections[i].offset; };
+        index.levels_ = AlignedBuffer<int>::view(reinterpret_cast<int*>(section(kLevels)), n);
+        index.deleted_ = AlignedBuffer<uint8_t>::view(section(kDeleted), n);
+        if (index.floats_in_index())
+            index.vectors_ = AlignedBuffer<float>::view(reinterpret_cast<float*>(section(kVectors)), n * index.vec_stride_);
+        if (index.quantized_) index.codes_ = AlignedBuffer<uint8_t>::view(section(kCodes), n * index.code_stride_);
+        index.links0_ = AlignedBuffer<LinkId>::view(reinterpret_cast<LinkId*>(section(kLinks0)), n * index.links0_stride_);
+        index.upper_offsets_ = AlignedBuffer<uint64_t>::view(reinterpret_cast<uint64_t*>(section(kUpperOffsets)), n);
+        index.upper_pool_.adopt(AlignedBuffer<LinkId>::view(reinterpret_cast<LinkId*>(section(kUpperLinks)),
+                                                            sections[kUpperLinks].bytes / sizeof(LinkId)));
+        index.capacity_ = index.num_slots_ = n;
+        index.num_present_ = counts[1];
+        index.num_deleted_ = counts[2];
+        if (index.num_present_ > 0 && !index.contains_slot(index.entry_point_))
+            throw DeserializationError("Invalid entry point");
+        index.check_rerank_file();
+        index.index_file_ = std::move(file);
+        return index;
+    }
+
+    // Read a file written by save() into memory in fixed-size chunks,
+    // verifying every section checksum (layout 2 on) and the whole graph as
+    // deserialize() does. The 64-bit links of layouts 1 and 2 are narrowed.
+    static HNSWIndex load(const std::string& path) {
+        try {
+            ChunkedReader in(path);
+            auto read = [&in](void* ptr, size_t size) { in.read(ptr, size); };
+            uint32_t layout;
+            uint64_t counts[3];
+            SectionEntry sections[kNumSections];
+            HNSWIndex index = read_saved_head(read, in.size(), layout, counts, sections);
+
+            size_t n = counts[0];
+            index.levels_ = AlignedBuffer<int>(n);
+            index.deleted_ = AlignedBuffer<uint8_t>(n);
+            if (index.floats_in_index()) index.vectors_ = AlignedBuffer<float>(n * index.vec_stride_);
+            if (index.quantized_) index.codes_ = AlignedBuffer<uint8_t>(n * index.code_stride_);
+            size_t link_bytes = layout < 3 ? sizeof(int64_t) : sizeof(LinkId);
+            index.links0_ = AlignedBuffer<LinkId>(n * index.links0_stride_);
+            index.upper_offsets_ = AlignedBuffer<uint64_t>(n);
+            AlignedBuffer<LinkId> upper(sections[kUpperLinks].bytes / link_bytes);
+            void* arrays[kNumSections] = {index.levels_.data(), index.deleted_.data(), index.vectors_.data(),
+                                          index.codes_.data(), index.links0_.data(), index.upper_offsets_.data(),
+                                          upper.data()};
+            for (size_t i = 0; i < kNumSections; ++i) {
+                in.skip_to(sections[i].offset);
+                in.take_checksum();
+                if (link_bytes != sizeof(LinkId) && (i == kLinks0 || i == kUpperLinks)) {
+                    read_wide_links(in, static_cast<LinkId*>(arrays[i]), sections[i].bytes / link_bytes);
+                } else {
+                    in.read(arrays[i], sections[i].bytes);
+                }
+                uint32_t crc = in.take_checksum();
+                if (layout >= 2 && crc != sections[i].checksum) throw DeserializationError("Checksum mismatch");
+            }
+            index.upper_pool_.adopt(std::move(upper));
+            index.capacity_ = index.num_slots_ = n;
+            for (size_t id = 0; id < n; ++id) {
+                if (index.levels_[id] < -1 || index.deleted_[id] > 1) throw DeserializationError("Corrupt node record");
+                if (index.levels_[id] < 0) continue;
+                ++index.num_present_;
+                index.num_deleted_ += index.deleted_[id];
+            }
+            if (index.num_present_ != counts[1] || index.num_deleted_ != counts[2])
+                throw DeserializationError("Corrupt node counts");
+            index.validate();
+            index.check_rerank_file();
+            return index;
+        } catch (const DeserializationError&) {
+            throw;
+        } catch (const std::runtime_error& e) {
+            throw DeserializationError(e.what());
+        }
+    }
+
+    // Allocate node storage for IDs below n now, so inserting them does not
+    // reallocate the per-node arrays. Never shrinks.
+    void reserve(size_t n) {
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        if (n > capacity_) set_capacity(n);
+    }
+
+    // Reallocate node storage for exactly n IDs, growing or trimming it; n
+    // must cover every stored ID. A mapped index is copied into memory.
+    void resize_index(size_t n) {
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        if (n < num_slots_)
+            throw std::invalid_argument("Cannot resize to " + std::to_string(n) + " slots: IDs up to " +
+                                        std::to_string(num_slots_ - 1) + " are stored");
+        if (n != capacity_) set_capacity(n);
+    }
+
+    size_t count() const { return num_present_ - num_deleted_; }
+    size_t capacity() const { return capacity_; }  // IDs addressable without reallocating
+    bool contains(int64_t id) const { return contains_slot(id) && !deleted_[id]; }
+
+    // Unfiltered searches of an index holding at most this many nodes scan
+    // it exactly instead of walking the graph, which is faster at that size;
+    // 0 always walks. Not saved with the index.
+    size_t flat_threshold() const { return flat_threshold_; }
+    void set_flat_threshold(size_t n) {
+        std::unique_lock<SharedMutex> lock(graph_mutex_);
+        flat_threshold_ = n;
+    }
+
+    // Measure the mean recall@k of n row-major sample queries against exact
+    // results for each ef in `ef_values` (empty: k, 2k, 4k, ... up to 1024),
+    // searching with `options` on up to num_threads threads. The curve and
+    // options are kept for SearchOptions::target_recall and the curve is
+    // returned; neither is saved with the index.
+    std::vector<CalibrationPoint> calibrate(const float* queries, size_t n, size_t k,
+                                            std::vector<size_t> ef_values = {},
+                                            SearchOptions options = SearchOptions(), size_t num_threads = 0) {
         if (k < 1) throw std::invalid_argument("k must be >= 1");
-        if (entry_point_ < 0 || count() == 0) return {};
+        if (n == 0) throw std::invalid_argument("Calibration requires at least one query");
+        if (ef_values.empty()) {
+            for (size_t ef = k; ef <= std::max<size_t>(1024, k); ef *= 2) ef_values.push_back(ef);
+        }
+        std::sort(ef_values.begin(), ef_values.end());
+        ef_values.erase(std::unique(ef_values.begin(), ef_values.end()), ef_values.end());
 
-        int64_t curr = entry_point_;
-        for (int l = max_level_; l > 0; --l) {
-            curr = search_layer_single(query.data(), curr, l);
+        std::vector<CalibrationPoint> curve;
+        {
+            std::shared_lock<SharedMutex> lock(graph_mutex_);
+            if (count() == 0) throw std::invalid_argument("Calibration requires a non-empty index");
+            std::vector<int64_t> truth_ids(n * k);
+            std::vector<float> truth_dists(n * k);
+            exact_batch_unchecked(queries, n, k, num_threads, truth_ids.data(), truth_dists.data(), nullptr);
+            std::vector<std::vector<int64_t>> truth(n);
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < k && truth_ids[i * k + j] >= 0; ++j) truth[i].push_back(truth_ids[i * k + j]);
+            }
+
+            options.target_recall = 0;
+            std::vector<double> recall(n);
+            for (size_t ef : ef_values) {
+                parallel_for(n, num_threads, [&](size_t i) {
+                    auto results = search_unchecked(queries + i * dimension_, k, ef, nullptr, nullptr, &options, false);
+                    size_t hits = 0;
+                    for (const auto& r : results)
+                        hits += std::find(truth[i].begin(), truth[i].end(), r.first) != truth[i].end();
+                    recall[i] = static_cast<double>(hits) / truth[i].size();
+                });
+                double sum = 0;
+                for (double r : recall) sum += r;
+                curve.push_back({ef, sum / n});
+            }
+        }
+        std::lock_guard<MemberMutex> lock(calibration_mutex_);
+        calibration_ = curve;
+        calibration_options_ = options;
+        return curve;
+    }
+
+    // The smallest calibrated ef_search whose recall reached `target`, or the
+    // largest calibrated one if none did.
+    size_t ef_for_recall(double target) const {
+        std::lock_guard<MemberMutex> lock(calibration_mutex_);
+        if (calibration_.empty()) throw std::runtime_error("target_recall needs calibrate() first");
+        for (const auto& p : calibration_) {
+            if (p.recall >= target) return p.ef_search;
         }
+        return calibration_.back().ef_search;
+    }
 
-        auto candidates = search_layer(query.data(), curr, std::max(ef_search, k), 0);
+    std::vector<CalibrationPoint> calibration() const {
+        std::lock_guard<MemberMutex> lock(calibration_mutex_);
+        return calibration_;
+    }
 
-        std::vector<std::pair<int64_t, float>> results;
-        for (auto& [dist, id] : candidates) {
-            if (!deleted_.count(id)) {
-                results.emplace_back(id, dist);
-                if (results.size() >= k) break;
+    // Counters summed over all searches and inserts; zero unless built with VECDB_STATS.
+    IndexStats stats() const { return totals_.snapshot(); }
+    void reset_stats() { totals_.reset(); }
+
+    // Level-0 degree histogram, top-level counts, and the live nodes a walk
+    // along level-0 links from the entry point cannot reach.
+    GraphHealth graph_health() const {
+        std::shared_lock<SharedMutex> lock(graph_mutex_);
+        bool locked = linking_.load() > 0;
+        int64_t entry_point;
+        {
+            std::unique_lock<MemberMutex> top_lock(top_mutex_, std::defer_lock);
+            if (locked) top_lock.lock();
+            entry_point = entry_point_;
+        }
+        GraphHealth h;
+        h.degree_histogram.assign(M_max0_ + 1, 0);
+        std::vector<LinkId> buf;
+        for (size_t id = 0; id < num_slots_; ++id) {
+            if (levels_[id] < 0) continue;
+            size_t top = static_cast<size_t>(levels_[id]);
+            if (h.level_counts.size() <= top) h.level_counts.resize(top + 1);
+            ++h.level_counts[top];
+            if (deleted_[id]) {
+                ++h.deleted;
+                continue;
             }
+            ++h.nodes;
+            ++h.degree_histogram[read_links(static_cast<int64_t>(id), 0, locked, buf)[0]];
         }
-        return results;
+        if (entry_point < 0) return h;
+
+        auto seen = visited_pool_.acquire(capacity_);
+        std::vector<int64_t> queue{entry_point};
+        seen->visit(entry_point);
+        size_t reached = 0;
+        for (size_t i = 0; i < queue.size(); ++i) {
+            int64_t n = queue[i];
+            if (!deleted_[n]) ++reached;
+            const LinkId* ll = read_links(n, 0, locked, buf);
+            for (int64_t j = 1; j <= ll[0]; ++j) {
+                if (seen->visit(ll[j])) queue.push_back(ll[j]);
+            }
+        }
+        h.unreachable = h.nodes - reached;
+        return h;
     }
 
-    bool remove(int64_t id) {
-        if (!vectors_.count(id) || deleted_.count(id)) return false;
-        deleted_.insert(id);
-        return true;
+    // Slot `id` holds a node, removed or not; compact() empties removed ones.
+    bool contains_slot(int64_t id) const {
+        return id >= 0 && static_cast<size_t>(id) < num_slots_ && levels_[id] >= 0;
     }
+    size_t dimension() const { return dimension_; }
+    const std::string& metric() const { return metric_; }
+    size_t M() const { return M_; }
+    size_t ef_construction() const { return ef_construction_; }
+    bool heuristic() const { return heuristic_; }
+    bool keep_pruned() const { return keep_pruned_; }
+    bool extend_candidates() const { return extend_candidates_; }
+    const std::string& storage() const { return storage_; }
+    bool rerank() const { return rerank_; }
+    bool is_trained() const { return quantized_; }
+    size_t pq_subspaces() const { return pq_.m(); }
+    const std::string& rerank_path() const { return rerank_path_; }
+    size_t auto_train_size() const { return use_pq_ ? kAutoTrainSizePQ : kAutoTrainSize; }
+    const char* simd_level() const { return simd_level_name(simd_level_); }
 
-    std::vector<uint8_t> serialize() const {
+private:
+    using DistIDPair = std::pair<float, int64_t>;
+
+    static constexpr size_t kFloatsPerLine = AlignedBuffer<float>::kAlignment / sizeof(float);
+    static constexpr size_t kBytesPerLine = AlignedBuffer<uint8_t>::kAlignment;
+
+    static constexpr uint32_t kSerialVersion = 5;  // serialize() format; 5 packs link lists as varints
+    static constexpr uint32_t kMmapLayout = 3;     // save() layout; 2 adds checksums, 3 has 32-bit links
+
+    // Sections of a save() file, in file order
+    enum Section : size_t { kLevels, kDeleted, kVectors, kCodes, kLinks0, kUpperOffsets, kUpperLinks, kNumSections };
+
+    // Section table entry; layout 1 stored only offset and bytes
+    struct SectionEntry {
+        uint64_t offset;
+        uint64_t bytes;
+        uint32_t checksum;  // CRC-32C of the section's bytes
+        uint32_t reserved;
+    };
+
+    static size_t align_line(size_t offset) { return (offset + kBytesPerLine - 1) / kBytesPerLine * kBytesPerLine; }
+
+    // train() under a lock already held; add_batch() auto-trains through it.
+    void train_stored() {
+        check_trainable();
+        std::vector<int64_t> stored;
+        for (size_t id = 0; id < num_slots_; ++id) {
+            if (levels_[id] >= 0) stored.push_back(static_cast<int64_t>(id));
+        }
+        if (stored.empty()) throw std::invalid_argument("Training requires at least one vector");
+        fit(stored.size(), [&](size_t r) { return get_vector(stored[r]); });
+        encode_stored();
+    }
+
+    std::vector<uint8_t> serialize_unlocked() const {
         std::vector<uint8_t> data;
         auto write = [&data](const void* ptr, size_t size) {
             const uint8_t* p = static_cast<const uint8_t*>(ptr);
             data.insert(data.end(), p, p + size);
         };
-        uint32_t version = 1;
+        uint32_t version = kSerialVersion;
         write(&version, 4);
-        write(&dimension_, 8);
-        uint32_t metric_len = static_cast<uint32_t>(metric_.size());
-        write(&metric_len, 4);
-        write(metric_.data(), metric_len);
-        write(&M_, 8); write(&ef_construction_, 8);
-        write(&entry_point_, 8); write(&max_level_, 4);
+        write_header(write);
 
-        uint64_t num_vectors = vectors_.size();
+        uint64_t num_vectors = num_present_;
         write(&num_vectors, 8);
-        for (const auto& [id, vec] : vectors_) {
+        std::vector<LinkId> sorted;
+        std::vector<uint8_t> packed;
+        for (int64_t id = 0; id < static_cast<int64_t>(num_slots_); ++id) {
+            int level = levels_[id];
+            if (level < 0) continue;
             write(&id, 8);
-            int level = levels_.at(id);
             write(&level, 4);
-            write(vec.data(), dimension_ * 4);
-            uint8_t is_del = deleted_.count(id) ? 1 : 0;
+            if (floats_in_index()) write(get_vector(id), dimension_ * 4);
+            if (quantized_) write(get_code(id), code_size_);
+            uint8_t is_del = deleted_[id];
             write(&is_del, 1);
+            // Each list: a varint count, then its IDs ascending as varint gaps
             for (int l = 0; l <= level; ++l) {
-                uint32_t nn = static_cast<uint32_t>(neighbors_.at(id)[l].size());
-                write(&nn, 4);
-                write(neighbors_.at(id)[l].data(), nn * 8);
+                const LinkId* ll = links(id, l);
+                sorted.assign(ll + 1, ll + 1 + ll[0]);
+                std::sort(sorted.begin(), sorted.end());
+                packed.clear();
+                put_varint(ll[0], packed);
+                LinkId prev = 0;
+                for (LinkId link : sorted) {
+                    put_varint(link - prev, packed);
+                    prev = link;
+                }
+                write(packed.data(), packed.size());
             }
         }
         return data;
     }
 
-    static HNSWIndex deserialize(const std::vector<uint8_t>& data) {
-        size_t offset = 0;
-        auto read = [&data, &offset](void* ptr, size_t size) {
-            if (offset + size > data.size()) throw DeserializationError("Unexpected end of data");
-            std::memcpy(ptr, data.data() + offset, size);
-            offset += size;
+    // LEB128: seven bits per byte, low bits first, high bit set on all but the last.
+    static void put_varint(uint64_t v, std::vector<uint8_t>& out) {
+        for (; v >= 0x80; v >>= 7) out.push_back(static_cast<uint8_t>(v | 0x80));
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    template <typename Read>
+    static uint64_t read_varint(Read&& read) {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b;
+            read(&b, 1);
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        throw DeserializationError("Corrupt neighbor list");
+    }
+
+    // Read n 64-bit link entries of a layout 1-2 file into `out`, narrowing them.
+    static void read_wide_links(ChunkedReader& in, LinkId* out, size_t n) {
+        int64_t wide[512];
+        for (size_t done = 0; done < n;) {
+            size_t step = std::min(n - done, sizeof(wide) / sizeof(wide[0]));
+            in.read(wide, step * sizeof(int64_t));
+            for (size_t i = 0; i < step; ++i) {
+                if (wide[i] < 0 || wide[i] > kMaxId) throw DeserializationError("Corrupt neighbor list");
+                out[done + i] = static_cast<LinkId>(wide[i]);
+            }
+            done += step;
+        }
+    }
+
+    // Byte sizes of the fixed-stride sections for n slots, with links of
+    // `link_bytes` each; kUpperLinks is left alone.
+    void section_bytes(size_t n, size_t* bytes, size_t link_bytes = sizeof(LinkId)) const {
+        bytes[kLevels] = n * sizeof(int);
+        bytes[kDeleted] = n;
+        bytes[kVectors] = floats_in_index() ? n * vec_stride_ * sizeof(float) : 0;
+        bytes[kCodes] = quantized_ ? n * code_stride_ : 0;
+        bytes[kLinks0] = n * links0_stride_ * link_bytes;
+        bytes[kUpperOffsets] = n * sizeof(uint64_t);
+    }
+
+    // Parameters, quantizer state and entry point, shared by both file formats.
+    template <typename Write>
+    void write_header(Write&& write) const {
+        write(&dimension_, 8);
+        uint32_t metric_len = static_cast<uint32_t>(metric_.size());
+        write(&metric_len, 4);
+        write(metric_.data(), metric_len);
+        write(&M_, 8); write(&ef_construction_, 8);
+        uint8_t flags[3] = {heuristic_, keep_pruned_, extend_candidates_};
+        write(flags, 3);
+        uint8_t storage[3] = {storage_code(storage_), rerank_, quantized_};
+        write(storage, 3);
+        uint64_t pq_m = pq_.m();
+        write(&pq_m, 8);
+        uint32_t path_len = static_cast<uint32_t>(rerank_path_.size());
+        write(&path_len, 4);
+        write(rerank_path_.data(), path_len);
+        if (quantized_ && use_pq_) {
+            uint32_t ksub = static_cast<uint32_t>(pq_.ksub());
+            write(&ksub, 4);
+            write(pq_.centroids().data(), pq_.centroids().size() * 4);
+        } else if (quantized_) {
+            write(sq_.min().data(), dimension_ * 4);
+            write(sq_.scale().data(), dimension_ * 4);
+        }
+        write(&entry_point_, 8); write(&max_level_, 4);
+    }
+
+    // The head of a save() file, read with `read` from a file of `file_size`
+    // bytes: fills `layout`, `counts` (slots, present, deleted) and `sections`,
+    // checks them against each other, and returns the index the header configures.
+    template <typename Read>
+    static HNSWIndex read_saved_head(Read&& read, size_t file_size, uint32_t& layout, uint64_t* counts,
+                                     SectionEntry* sections) {
+        uint32_t crc = 0;
+        auto read_crc = [&read, &crc](void* ptr, size_t size) {
+            read(ptr, size);
+            crc = crc32c(crc, ptr, size);
         };
-        uint32_t version; read(&version, 4);
-        if (version != 1) throw DeserializationError("Unsupported version");
+        char magic[8]; read_crc(magic, 8);
+        if (std::memcmp(magic, kMmapMagic, 8) != 0) throw DeserializationError("Not a mapped index file");
+        read_crc(&layout, 4);
+        if (layout < 1 || layout > kMmapLayout) throw DeserializationError("Unsupported version");
+        HNSWIndex index = read_header(read_crc, kSerialVersion);
+        read_crc(counts, 3 * sizeof(uint64_t));
+        for (size_t i = 0; i < kNumSections; ++i) {
+            sections[i] = SectionEntry{};
+            read_crc(&sections[i], layout == 1 ? 2 * sizeof(uint64_t) : sizeof(SectionEntry));
+        }
+        if (layout >= 2) {
+            uint32_t expected = crc, stored;
+            read(&stored, 4);
+            if (stored != expected) throw DeserializationError("Checksum mismatch");
+        }
+
+        size_t n = counts[0];
+        if (counts[1] > n || counts[2] > counts[1]) throw DeserializationError("Corrupt node counts");
+        size_t bytes[kNumSections] = {};
+        size_t link_bytes = layout < 3 ? sizeof(int64_t) : sizeof(LinkId);
+        index.section_bytes(n, bytes, link_bytes);
+        for (size_t i = 0; i < kNumSections; ++i) {
+            bool sized = i == kUpperLinks ? sections[i].bytes % link_bytes == 0 : sections[i].bytes == bytes[i];
+            if (!sized || sections[i].offset % kBytesPerLine != 0 || sections[i].offset > file_size ||
+                sections[i].bytes > file_size - sections[i].offset)
+                throw DeserializationError("Corrupt section table");
+        }
+        return index;
+    }
+
+    void check_rerank_file() const {
+        if (raw_file_.is_open() && raw_file_.size() < num_slots_ * dimension_ * sizeof(float))
+            throw DeserializationError("Rerank file " + rerank_path_ + " is too small");
+    }
+
+    // Throw DeserializationError unless the entry point is stored, every link
+    // list is in bounds and points at stored nodes that reach its level, and
+    // every PQ code names a trained centroid.
+    void validate() const {
+        if (num_present_ > 0 && !contains_slot(entry_point_)) throw DeserializationError("Invalid entry point");
+        for (size_t id = 0; id < num_slots_; ++id) {
+            int level = levels_[id];
+            if (level < 0) continue;
+            if (level > 0) {
+                size_t entries = static_cast<size_t>(level) * (M_ + 1);
+                if (upper_offsets_[id] > upper_pool_.size() || entries > upper_pool_.size() - upper_offsets_[id])
+                    throw DeserializationError("Corrupt neighbor list");
+            }
+            for (int l = 0; l <= level; ++l) {
+                const LinkId* ll = links(id, l);
+                if (ll[0] > max_connections(l))
+                    throw DeserializationError("Corrupt neighbor list");
+                for (int64_t i = 1; i <= ll[0]; ++i) {
+                    if (!contains_slot(ll[i]) || levels_[ll[i]] < l)
+                        throw DeserializationError("Neighbor list references a missing node");
+                }
+            }
+            if (quantized_ && use_pq_) {
+                const uint8_t* code = get_code(id);
+                for (size_t s = 0; s < code_size_; ++s) {
+                    if (code[s] >= pq_.ksub()) throw DeserializationError("Corrupt PQ code");
+                }
+            }
+        }
+    }
 
+    // An empty index configured by a header in serialize() format `version`,
+    // with its rerank file open if it has one.
+    template <typename Read>
+    static HNSWIndex read_header(Read&& read, uint32_t version) {
         size_t dim; read(&dim, 8);
         uint32_t metric_len; read(&metric_len, 4);
         std::string metric(metric_len, '\0');
         read(metric.data(), metric_len);
         size_t M, ef_c; read(&M, 8); read(&ef_c, 8);
+        // v1 predates the selection flags; such indexes keep growing with the defaults
+        uint8_t flags[3] = {1, 0, 0};
+        if (version >= 2) read(flags, 3);
+        // v3 adds [storage, rerank, trained]; older files hold floats only.
+        // v4 adds the PQ subspace count and the rerank file path.
+        uint8_t storage[3] = {0, 0, 0};
+        if (version >= 3) read(storage, 3);
+        if (storage[0] > 2) throw DeserializationError("Unknown storage");
+        uint64_t pq_m = 8;
+        std::string path;
+        if (version >= 4) {
+            read(&pq_m, 8);
+            uint32_t path_len; read(&path_len, 4);
+            path.resize(path_len);
+            read(path.data(), path_len);
+        }
 
-        HNSWIndex index(dim, metric, M, ef_c);
+        static const char* const kStorage[] = {"float", "int8", "pq"};
+        HNSWIndex index = [&] {
+            try {
+                return HNSWIndex(dim, metric, M, ef_c, flags[0] != 0, flags[1] != 0, flags[2] != 0,
+                                 kStorage[storage[0]], storage[1] != 0, pq_m, path);
+            } catch (const std::invalid_argument& e) {
+                throw DeserializationError(e.what());
+            }
+        }();
+        if (storage[2]) {
+            if (!storage[0]) throw DeserializationError("Quantizer data for float storage");
+            if (index.use_pq_) {
+                uint32_t ksub; read(&ksub, 4);
+                if (ksub == 0 || ksub > ProductQuantizer::kMaxCentroids) throw DeserializationError("Corrupt codebook");
+                std::vector<float> centroids(static_cast<size_t>(ksub) * dim);
+                read(centroids.data(), centroids.size() * 4);
+                index.pq_.set_params(ksub, std::move(centroids));
+            } else {
+                std::vector<float> lo(dim), scale(dim);
+                read(lo.data(), dim * 4);
+                read(scale.data(), dim * 4);
+                index.sq_.set_params(std::move(lo), std::move(scale));
+            }
+            index.quantized_ = true;
+        }
+        if (index.quantized_ && index.rerank_ && !path.empty()) {
+            try {
+                index.raw_file_.open_private(path);
+                index.rerank_file_saved_ = true;
+            } catch (const std::runtime_error& e) {
+                throw DeserializationError(e.what());
+            }
+        }
         read(&index.entry_point_, 8); read(&index.max_level_, 4);
+        return index;
+    }
 
-        uint64_t num_vectors; read(&num_vectors, 8);
-        for (uint64_t i = 0; i < num_vectors; ++i) {
-            int64_t id; read(&id, 8);
-            int level; read(&level, 4);
-            std::vector<float> vec(dim);
-            read(vec.data(), dim * 4);
-            uint8_t is_del; read(&is_del, 1);
-            index.vectors_[id] = vec;
-            index.levels_[id] = level;
-            if (is_del) index.deleted_.insert(id);
-            index.neighbors_[id].resize(level + 1);
-            for (int l = 0; l <= level; ++l) {
-                uint32_t nn; read(&nn, 4);
-                index.neighbors_[id][l].resize(nn);
-                read(index.neighbors_[id][l].data(), nn * 8);
+    // A vector in stored form (normalized for cosine), prepared for ranking
+    // against nodes with whichever kernel the storage uses.
+    // A stored PQ node instead ranks by its own code (`node_code`).
+    struct Query {
+        const float* vec = nullptr;
+        QuantizedQuery code;
+        const uint8_t* node_code = nullptr;
+    };
+
+    void prepare_query(const float* v, Query& q) const {
+        q.vec = v;
+        q.node_code = nullptr;
+        if (!quantized_) return;
+        if (use_pq_) pq_.prepare(v, q.code);
+        else sq_.prepare(v, q.code);
+    }
+
+    // Node `id` as a query; `buf` holds its decoded vector when floats are not
+    // kept. PQ nodes use symmetric code-to-code distances, which saves building
+    // a lookup table for every node the construction compares.
+    void node_query(int64_t id, std::vector<float>& buf, Query& q) const {
+        if (quantized_ && use_pq_) {
+            q.vec = nullptr;
+            q.node_code = get_code(id);
+            return;
+        }
+        if (keeps_floats()) return prepare_query(get_vector(id), q);
+        buf.resize(dimension_);
+        sq_.decode(get_code(id), buf.data());
+        prepare_query(buf.data(), q);
+    }
+
+    float distance(const Query& q, int64_t id) const {
+        if (!quantized_) return dist_func_(q.vec, get_vector(id), dimension_);
+        if (!use_pq_) return sq_.distance(q.code, get_code(id));
+        return q.node_code ? pq_.distance(q.node_code, get_code(id)) : pq_.distance(q.code, get_code(id));
+    }
+
+    // search() without argument checks; `query` holds dimension_ floats.
+    // `allow_flat` false always walks the graph, as calibrate() measures it.
+    std::vector<std::pair<int64_t, float>> search_unchecked(const float* query, size_t k, size_t ef_search,
+                                                            const IdFilter* filter = nullptr,
+                                                            SearchStats* stats = nullptr,
+                                                            const SearchOptions* options = nullptr,
+                                                            bool allow_flat = true) const {
+        if (stats) *stats = SearchStats();
+#if defined(VECDB_STATS)
+        SearchStats counted;
+        if (!stats) stats = &counted;
+#endif
+        // An insert that is linking rewrites lists and may raise the top level
+        bool locked = linking_.load() > 0;
+        int64_t entry_point;
+        int max_level;
+        {
+            std::unique_lock<MemberMutex> lock(top_mutex_, std::defer_lock);
+            if (locked) lock.lock();
+            entry_point = entry_point_;
+            max_level = max_level_;
+        }
+        if (entry_point < 0 || count() == 0) return {};
+        if (filter && filter->count() == 0) return {};
+
+        const float* q = query;
+        std::vector<float> unit_query;
+        if (normalize_) {
+            unit_query.assign(query, query + dimension_);
+            normalize_vector(unit_query.data(), dimension_);
+            q = unit_query.data();
+        }
+
+        SearchOptions tuned;
+        if (options && options->target_recall > 0) {
+            tuned = *options;
+            ef_search = ef_for_recall(options->target_recall);
+            std::lock_guard<MemberMutex> lock(calibration_mutex_);
+            if (tuned.patience == 0) tuned.patience = calibration_options_.patience;
+            if (tuned.max_ef == 0) tuned.max_ef = calibration_options_.max_ef;
+            if (tuned.max_distances == 0) tuned.max_distances = calibration_options_.max_distances;
+            options = &tuned;
+        }
+        bool adaptive = options && (options->patience > 0 || options->max_distances > 0);
+
+        Query prepared;
+        prepare_query(q, prepared);
+        size_t ef = std::max(ef_search, k);
+        std::vector<DistIDPair> candidates;
+        bool scored_floats = false;  // candidates already carry float distances
+        if (!filter && allow_flat && count() <= flat_threshold_) {
+            scored_floats = keeps_floats();
+            candidates = scan(prepared, scored_floats || !rerank_ ? k : ef, nullptr, scored_floats, stats);
+        } else if (filter && prefer_brute_force(filter->count(), ef)) {
+            candidates = scan(prepared, ef, filter, false, stats);
+        } else {
+            int64_t curr = entry_point;
+            for (int l = max_level; l > 0; --l) {
+                curr = search_layer_single(prepared, curr, l, locked, stats);
             }
+            if (filter) candidates = search_layer_filtered(prepared, curr, ef, *filter, locked, stats);
+            else if (adaptive) candidates = search_layer_adaptive(prepared, curr, ef, k, *options, locked, stats);
+            else candidates = search_layer(prepared, curr, ef, 0, locked, stats);
         }
-        return index;
+        if (quantized_ && rerank_ && !scored_floats) {
+            for (auto& c : candidates) c.first = dist_func_(q, get_vector(c.second), dimension_);
+            VECDB_STAT(stats, distances += candidates.size());
+            std::sort(candidates.begin(), candidates.end());
+        }
+
+        std::vector<std::pair<int64_t, float>> results;
+        for (auto& [dist, id] : candidates) {
+            if (!deleted_[id]) {
+                results.emplace_back(id, report_distance(dist));
+                if (results.size() >= k) break;
+            } else {
+                VECDB_STAT(stats, deleted_skipped++);
+            }
+        }
+#if defined(VECDB_STATS)
+        totals_.add_search(*stats);
+#endif
+        return results;
     }
 
-    size_t count() const { return vectors_.size() - deleted_.size(); }
-    size_t dimension() const { return dimension_; }
-    const std::string& metric() const { return metric_; }
-    size_t M() const { return M_; }
-    size_t ef_construction() const { return ef_construction_; }
+    // Row `results` of a search_batch() output, padded to k.
+    static void write_row(const std::vector<std::pair<int64_t, float>>& results, size_t k, int64_t* row_ids,
+                          float* row_dists) {
+        for (size_t j = 0; j < k; ++j) {
+            bool found = j < results.size();
+            row_ids[j] = found ? results[j].first : -1;
+            row_dists[j] = found ? results[j].second : std::numeric_limits<float>::infinity();
+        }
+    }
 
-private:
-    using DistIDPair = std::pair<float, int64_t>;
+    // search_exact_batch() under the caller's lock.
+    void exact_batch_unchecked(const float* queries, size_t n, size_t k, size_t num_threads, int64_t* ids,
+                               float* distances, const IdFilter* filter) const {
+        if (n == 0) return;
+        if (!keeps_floats()) {
+            parallel_for(n, num_threads, [&](size_t i) {
+                std::vector<float> unit_query;
+                const float* q = queries + i * dimension_;
+                if (normalize_) {
+                    unit_query.assign(q, q + dimension_);
+                    normalize_vector(unit_query.data(), dimension_);
+                    q = unit_query.data();
+                }
+                Query prepared;
+                prepare_query(q, prepared);
+                std::vector<std::pair<int64_t, float>> results;
+                for (auto& [dist, id] : scan(prepared, k, filter, false)) results.emplace_back(id, report_distance(dist));
+                write_row(results, k, ids + i * k, distances + i * k);
+            });
+            return;
+        }
+
+        std::vector<int64_t> live;
+        live.reserve(count());
+        auto add_live = [&](size_t id) {
+            if (contains(static_cast<int64_t>(id))) live.push_back(static_cast<int64_t>(id));
+        };
+        if (filter) filter->for_each(num_slots_, add_live);
+        else for (size_t id = 0; id < num_slots_; ++id) add_live(id);
+
+        // Queries in stored form, padded with zero rows to whole tiles
+        size_t padded = (n + kTileQueries - 1) / kTileQueries * kTileQueries;
+        std::vector<float> q(padded * dimension_, 0.0f);
+        std::copy(queries, queries + n * dimension_, q.begin());
+        if (normalize_) {
+            for (size_t i = 0; i < n; ++i) normalize_vector(q.data() + i * dimension_, dimension_);
+        }
+
+        // Each task scores a group of queries against the nodes a block at a
+        // time, the block sized to stay in L2 while every tile passes over it
+        constexpr size_t kGroupQueries = 16 * kTileQueries;
+        size_t block = std::max<size_t>(1, (size_t(256) << 10) / (dimension_ * sizeof(float)));
+        size_t groups = (n + kGroupQueries - 1) / kGroupQueries;
+        TileFunc tile = get_tile_func(metric_, simd_level_);
+        float sign = metric_ == "l2" ? 1.0f : -1.0f;  // ranking distance = bias + sign * tile output
+        float bias = normalize_ ? 1.0f : 0.0f;
+        parallel_for(groups, num_threads, [&](size_t g) {
+            size_t first = g * kGroupQueries;
+            size_t last = std::min(n, first + kGroupQueries);
+            std::vector<std::priority_queue<DistIDPair>> nearest(last - first);
+            float out[kTileQueries];
+            for (size_t b = 0; b < live.size(); b += block) {
+                size_t b_end = std::min(live.size(), b + block);
+                for (size_t t = first; t < last; t += kTileQueries) {
+                    const float* tq = q.data() + t * dimension_;
+                    size_t in_tile = std::min(kTileQueries, last - t);
+                    for (size_t r = b; r < b_end; ++r) {
+                        tile(tq, dimension_, get_vector(live[r]), dimension_, out);
+                        for (size_t j = 0; j < in_tile; ++j) {
+                            auto& heap = nearest[t - first + j];
+                            float d = bias + sign * out[j];
+                            if (heap.size() < k || d < heap.top().first) {
+                                heap.emplace(d, live[r]);
+                                if (heap.size() > k) heap.pop();
+                            }
+                        }
+                    }
+                }
+            }
+            for (size_t i = first; i < last; ++i) {
+                auto& heap = nearest[i - first];
+                std::vector<std::pair<int64_t, float>> results(heap.size());
+                for (size_t j = heap.size(); j-- > 0; heap.pop())
+                    results[j] = {heap.top().second, report_distance(heap.top().first)};
+                write_row(results, k, ids + i * k, distances + i * k);
+            }
+        });
+    }
+
+    // Convert a ranking distance back to the metric's reported value.
+    float report_distance(float d) const {
+        if (metric_ == "l2") return std::sqrt(d);
+        if (normalize_) return std::max(0.0f, std::min(2.0f, d));
+        return d;
+    }
+
+    size_t max_connections(int level) const { return level == 0 ? M_max0_ : M_; }
+
+    // Floats live in vectors_, or unpadded in raw_file_ when reranking from disk.
+    const float* get_vector(int64_t id) const {
+        if (raw_file_.is_open())
+            return reinterpret_cast<const float*>(raw_file_.data()) + static_cast<size_t>(id) * dimension_;
+        return vectors_.data() + static_cast<size_t>(id) * vec_stride_;
+    }
+    float* mutable_vector(int64_t id) { return const_cast<float*>(static_cast<const HNSWIndex*>(this)->get_vector(id)); }
+    const uint8_t* get_code(int64_t id) const { return codes_.data() + static_cast<size_t>(id) * code_stride_; }
+    uint8_t* mutable_code(int64_t id) { return codes_.data() + static_cast<size_t>(id) * code_stride_; }
+
+    bool keeps_floats() const { return !quantized_ || rerank_; }
+    // Floats are part of the index itself rather than the rerank file
+    bool floats_in_index() const { return keeps_floats() && !raw_file_.is_open(); }
+
+    // Make the rerank file writable and at least `rows` vectors long before
+    // its floats change. A file a snapshot names moves to a new generation
+    // first, so the snapshot stays consistent with it. Exclusive lock only.
+    void prepare_rerank_file(size_t rows) {
+        size_t bytes = rows * dimension_ * sizeof(float);
+        if (rerank_file_saved_) fork_rerank_file(std::max(bytes, raw_file_.size()));
+        else if (raw_file_.size() < bytes) raw_file_.resize(bytes);
+    }
+
+    // Copy the rerank floats into the next free generation of the file,
+    // `bytes` long, and switch to it; with `order`, row order[i] is copied to
+    // row i instead. The old file is deleted unless a snapshot names it.
+    void fork_rerank_file(size_t bytes, const std::vector<int64_t>* order = nullptr) {
+        MappedFile next;
+        std::string path = rerank_path_;
+        do {
+            path = next_rerank_path(path);
+        } while (!next.create(path));
+        next.resize(bytes);
+        if (order) {
+            const float* from = reinterpret_cast<const float*>(raw_file_.data());
+            float* to = reinterpret_cast<float*>(next.data());
+            for (size_t i = 0; i < order->size(); ++i)
+                std::copy_n(from + static_cast<size_t>((*order)[i]) * dimension_, dimension_, to + i * dimension_);
+        } else if (bytes > 0) {
+            std::memcpy(next.data(), raw_file_.data(), std::min(bytes, raw_file_.size()));
+        }
+        if (!rerank_file_saved_) ::unlink(rerank_path_.c_str());
+        raw_file_ = std::move(next);
+        rerank_path_ = path;
+        rerank_file_saved_ = false;
+    }
+
+    // "<base>.v<N+1>" for "<base>.v<N>", else "<path>.v1".
+    static std::string next_rerank_path(const std::string& path) {
+        size_t v = path.rfind(".v");
+        if (v != std::string::npos && v + 2 < path.size() && v + 12 > path.size() &&
+            path.find_first_not_of("0123456789", v + 2) == std::string::npos)
+            return path.substr(0, v + 2) + std::to_string(std::stoull(path.substr(v + 2)) + 1);
+        return path + ".v1";
+    }
+
+    // Called as a snapshot naming the rerank file is written: flush the file
+    // to disk and leave it unchanged from then on.
+    void seal_rerank_file() const {
+        if (!raw_file_.is_open()) return;
+        raw_file_.sync();
+        rerank_file_saved_ = true;
+    }
+
+    // Write node id's vector in stored form: normalized, then float and/or code.
+    void store_vector(int64_t id, const float* v) {
+        float* dst;
+        std::vector<float> scratch;
+        if (keeps_floats()) {
+            if (raw_file_.is_open()) prepare_rerank_file(capacity_);
+            dst = mutable_vector(id);
+        } else {
+            scratch.resize(dimension_);
+            dst = scratch.data();
+        }
+        std::copy(v, v + dimension_, dst);
+        if (normalize_) normalize_vector(dst, dimension_);
+        if (quantized_) encode(dst, mutable_code(id));
+    }
+
+    void encode(const float* v, uint8_t* code) const {
+        if (use_pq_) pq_.encode(v, code);
+        else sq_.encode(v, code);
+    }
+
+    static uint8_t storage_code(const std::string& storage) {
+        return storage == "pq" ? 2 : storage == "int8" ? 1 : 0;
+    }
+
+    void check_trainable() const {
+        if (storage_ == "float") throw std::runtime_error("train() requires int8 or pq storage");
+        if (quantized_) throw std::runtime_error("Quantizer is already trained");
+    }
+
+    template <typename Rows>
+    void fit(size_t n, Rows&& row) {
+        if (use_pq_) pq_.train(n, row);
+        else sq_.train(n, row);
+    }
+
+    // Switch to quantized storage once the quantizer has been fitted. Floats
+    // are dropped, kept in place, or moved out to the rerank file.
+    void encode_stored() {
+        codes_.resize(capacity_ * code_stride_);
+        for (size_t id = 0; id < num_slots_; ++id) {
+            if (levels_[id] >= 0) encode(get_vector(id), mutable_code(id));
+        }
+        if (rerank_ && !rerank_path_.empty()) {
+            raw_file_.open(rerank_path_, true);
+            raw_file_.resize(capacity_ * dimension_ * sizeof(float));
+            float* raw = reinterpret_cast<float*>(raw_file_.data());
+            for (size_t id = 0; id < num_slots_; ++id) {
+                if (levels_[id] >= 0) {
+                    const float* v = vectors_.data() + id * vec_stride_;
+                    std::copy(v, v + dimension_, raw + id * dimension_);
+                }
+            }
+        }
+        quantized_ = true;
+        if (!rerank_ || raw_file_.is_open()) vectors_ = AlignedBuffer<float>();
+    }
+
+    const LinkId* links(int64_t id, int level) const {
+        if (level == 0) return links0_.data() + static_cast<size_t>(id) * links0_stride_;
+        return upper_pool_.data() + upper_offsets_[id] + static_cast<size_t>(level - 1) * (M_ + 1);
+    }
+    LinkId* links(int64_t id, int level) {
+        return const_cast<LinkId*>(static_cast<const HNSWIndex*>(this)->links(id, level));
+    }
+
+    static void set_links(LinkId* ll, const std::vector<int64_t>& ids) {
+        ll[0] = static_cast<LinkId>(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) ll[1 + i] = static_cast<LinkId>(ids[i]);
+    }
+
+    // Give `id` empty upper-layer lists up to `level`, returning the block it
+    // held at `old_level` to the pool. The pool may move, so this runs only
+    // under the exclusive lock.
+    void reset_upper_links(int64_t id, int old_level, int level) {
+        if (old_level > 0) upper_pool_.release(upper_offsets_[id], old_level);
+        if (level > 0) upper_offsets_[id] = upper_pool_.allocate(level);
+    }
+
+    // Make slot `id` addressable, growing every per-node array geometrically.
+    void ensure_slot(int64_t id) {
+        size_t needed = static_cast<size_t>(id) + 1;
+        if (needed > capacity_) set_capacity(std::max<size_t>({needed, capacity_ * 2, 16}));
+        // Mapped indexes allocate their locks on the first insert
+        if (node_locks_.size() < capacity_) node_locks_ = LockTable(capacity_);
+        num_slots_ = std::max(num_slots_, needed);
+    }
+
+    // Reallocate every per-node array for `cap` slots, cap >= num_slots_.
+    // Resizing an array that is a view of a mapped file copies it into memory.
+    void set_capacity(size_t cap) {
+        // The rerank file grows as vectors are stored (see prepare_rerank_file())
+        if (floats_in_index()) vectors_.resize(cap * vec_stride_);
+        if (quantized_) codes_.resize(cap * code_stride_);
+        links0_.resize(cap * links0_stride_);
+        levels_.resize(cap);
+        if (cap > capacity_) std::fill(levels_.data() + capacity_, levels_.data() + cap, -1);
+        upper_offsets_.resize(cap);
+        deleted_.resize(cap);
+        capacity_ = cap;
+        if (node_locks_.size() < capacity_) node_locks_ = LockTable(capacity_);
+    }
+
+    // Point entry_point_ at the highest-level stored node accepted by `usable`.
+    template <typename Pred>
+    void reset_entry_point(Pred&& usable) {
+        entry_point_ = -1;
+        max_level_ = 0;
+        for (size_t n = 0; n < num_slots_; ++n) {
+            if (levels_[n] >= 0 && usable(static_cast<int64_t>(n)) &&
+                (entry_point_ < 0 || levels_[n] > max_level_)) {
+                entry_point_ = static_cast<int64_t>(n);
+                max_level_ = levels_[n];
+            }
+        }
+    }
+
+    // Stored slots in reorder() order: breadth-first over level 0 from the
+    // entry point, then from each stored slot not yet reached, then the
+    // empty slots.
+    std::vector<int64_t> locality_order() const {
+        std::vector<int64_t> order;
+        order.reserve(num_slots_);
+        std::vector<uint8_t> placed(num_slots_, 0);
+        auto walk_from = [&](int64_t seed) {
+            if (levels_[seed] < 0 || placed[seed]) return;
+            placed[seed] = 1;
+            order.push_back(seed);
+            // order doubles as the walk's queue
+            for (size_t head = order.size() - 1; head < order.size(); ++head) {
+                const LinkId* ll = links(order[head], 0);
+                for (int64_t i = 1; i <= ll[0]; ++i) {
+                    if (placed[ll[i]]) continue;
+                    placed[ll[i]] = 1;
+                    order.push_back(ll[i]);
+                }
+            }
+        };
+        if (entry_point_ >= 0) walk_from(entry_point_);
+        for (size_t id = 0; id < num_slots_; ++id) walk_from(static_cast<int64_t>(id));
+        for (size_t id = 0; id < num_slots_; ++id) {
+            if (!placed[id]) order.push_back(static_cast<int64_t>(id));
+        }
+        return order;
+    }
+
+    // Move the node in slot order[i] to slot i, for every i, rewriting each
+    // link through new_id. Runs under the exclusive lock.
+    void permute(const std::vector<int64_t>& order, const std::vector<int64_t>& new_id) {
+        size_t n = order.size();
+        auto moved = [&](auto& buf, size_t stride) {
+            std::remove_reference_t<decltype(buf)> out(buf.size());
+            for (size_t i = 0; i < n; ++i)
+                std::memcpy(out.data() + i * stride, buf.data() + static_cast<size_t>(order[i]) * stride,
+                            stride * sizeof(*buf.data()));
+            buf = std::move(out);
+        };
+        if (floats_in_index()) moved(vectors_, vec_stride_);
+        // Never in place: a crash part way through must not leave either the
+        // old snapshot or the new one pointing at half-permuted floats.
+        if (raw_file_.is_open()) fork_rerank_file(raw_file_.size(), &order);
+        if (quantized_) moved(codes_, code_stride_);
+
+        AlignedBuffer<LinkId> links0(links0_.size());
+        AlignedBuffer<uint64_t> upper_offsets(upper_offsets_.size());
+        AlignedBuffer<int> levels(levels_.size());
+        AlignedBuffer<uint8_t> deleted(deleted_.size());
+        std::fill(levels.data(), levels.data() + levels.size(), -1);
+        LinkPool upper_pool(M_ + 1);
+        for (size_t i = 0; i < n; ++i) {
+            int64_t old = order[i];
+            levels[i] = levels_[old];
+            deleted[i] = deleted_[old];
+            if (levels_[old] > 0) upper_offsets[i] = upper_pool.allocate(levels_[old]);
+            for (int l = 0; l <= levels_[old]; ++l) {
+                const LinkId* from = links(old, l);
+                LinkId* to = l == 0 ? links0.data() + i * links0_stride_
+                                    : upper_pool.data() + upper_offsets[i] + static_cast<size_t>(l - 1) * (M_ + 1);
+                to[0] = from[0];
+                for (int64_t j = 1; j <= from[0]; ++j) to[j] = static_cast<LinkId>(new_id[from[j]]);
+            }
+        }
+        links0_ = std::move(links0);
+        upper_offsets_ = std::move(upper_offsets);
+        upper_pool_ = std::move(upper_pool);
+        levels_ = std::move(levels);
+        deleted_ = std::move(deleted);
+        if (entry_point_ >= 0) entry_point_ = new_id[static_cast<size_t>(entry_point_)];
+        while (num_slots_ > 0 && levels_[num_slots_ - 1] < 0) --num_slots_;
+    }
+
+    // Link a node whose slot is already filled into the graph. Safe to run on
+    // several threads at once: link lists are only touched under their node's
+    // lock, and entry_point_/max_level_ under entry_mutex_, which is held for
+    // the whole insert when the node becomes the new top level. Its work is
+    // counted into `stats` if given.
+    void insert_node(int64_t id, SearchStats* stats = nullptr) {
+        int level = levels_[id];
+        std::unique_lock<MemberMutex> entry_lock(entry_mutex_);
+        if (entry_point_ < 0) {
+            std::lock_guard<MemberMutex> top_lock(top_mutex_);
+            entry_point_ = id;
+            max_level_ = level;
+            return;
+        }
+        int top = max_level_;
+        int64_t curr = entry_point_;
+        if (level <= top) entry_lock.unlock();
+
+        std::vector<float> buf;
+        Query v;
+        node_query(id, buf, v);
+        // Traverse from top to insertion level
+        for (int l = top; l > level; --l) {
+            curr = search_layer_single(v, curr, l, true, stats);
+        }
+
+        // Insert at each level from min(level, top) down to 0
+        for (int l = std::min(level, top); l >= 0; --l) {
+            auto candidates = search_layer(v, curr, ef_construction_, l, true, stats);
+            candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                            [id](const DistIDPair& c) { return c.second == id; }),
+                             candidates.end());
+            auto neighbors = select_neighbors(v, id, candidates, max_connections(l), l, extend_candidates_, stats);
+            {
+                std::lock_guard<std::mutex> lock(node_locks_[id]);
+                set_links(links(id, l), neighbors);
+            }
+
+            // Bidirectional connections
+            for (int64_t n : neighbors) connect(n, id, l, stats);
+            if (!candidates.empty()) curr = candidates[0].second;
+        }
+
+        if (level > top) {
+            std::lock_guard<MemberMutex> top_lock(top_mutex_);
+            max_level_ = level;
+            entry_point_ = id;
+        }
+    }
+
+    // Append `id` to n's list at `level`, re-pruning if it is already full.
+    void connect(int64_t n, int64_t id, int level, SearchStats* stats = nullptr) {
+        std::lock_guard<std::mutex> lock(node_locks_[n]);
+        LinkId* ll = links(n, level);
+        size_t cnt = static_cast<size_t>(ll[0]);
+        size_t max_conn = max_connections(level);
+        // Nodes relinked by compact() may still be listed
+        if (std::find(ll + 1, ll + 1 + cnt, id) != ll + 1 + cnt) return;
+        if (cnt < max_conn) {
+            ll[1 + cnt] = static_cast<LinkId>(id);
+            ll[0] = static_cast<LinkId>(cnt + 1);
+            return;
+        }
+        // Full: prune the current links plus id straight back into the list.
+        // No extension here: reading other nodes' lists under n's lock could deadlock
+        std::vector<float> buf;
+        Query q;
+        node_query(n, buf, q);
+        std::vector<DistIDPair> candidates;
+        candidates.reserve(cnt + 1);
+        for (size_t i = 1; i <= cnt; ++i) candidates.emplace_back(distance(q, ll[i]), ll[i]);
+        candidates.emplace_back(distance(q, id), id);
+        VECDB_STAT(stats, prunes++);
+        VECDB_STAT(stats, distances += cnt + 1);
+        std::sort(candidates.begin(), candidates.end());
+        ll[0] = static_cast<LinkId>(select_neighbors(q, n, std::move(candidates), max_conn, level, false, ll + 1,
+                                                     stats));
+    }
 
     int random_level() {
         std::uniform_real_distribution<> dist(0.0, 1.0);
@@ -201,14 +1622,62 @@ private:
         return std::max(0, level);
     }
 
-    int64_t search_layer_single(const float* q, int64_t ep, int level) {
-        float best_dist = dist_func_(q, vectors_[ep].data(), dimension_);
+    // n's list at `level`. With `locked` it is copied into `buf` under n's
+    // lock, so a concurrent insert can rewrite the list meanwhile.
+    const LinkId* read_links(int64_t n, int level, bool locked, std::vector<LinkId>& buf) const {
+        const LinkId* ll = links(n, level);
+        if (!locked) return ll;
+        std::lock_guard<std::mutex> lock(node_locks_[n]);
+        buf.assign(ll, ll + 1 + ll[0]);
+        return buf.data();
+    }
+
+    // Cache hints for the walks: neighbor vectors are fetched while earlier
+    // distances are computed, and the next node's level-0 list while the
+    // current one is evaluated.
+    void prefetch_vector(int64_t id) const {
+        if (quantized_) prefetch(get_code(id), code_size_);
+        else prefetch(get_vector(id), dimension_ * sizeof(float));
+    }
+    void prefetch_links0(int64_t id) const {
+        prefetch(links0_.data() + static_cast<size_t>(id) * links0_stride_, links0_stride_ * sizeof(LinkId));
+    }
+
+    // Mark the unvisited links of `ll` and copy them to `out`, prefetching
+    // their vectors, so the distances that follow run as one batch over data
+    // already on its way into cache. Returns how many were copied.
+    size_t take_unvisited(const LinkId* ll, VisitedList& visited, LinkId* out) const {
+        static constexpr LinkId kMarksAhead = 4;
+        LinkId count = ll[0];
+        for (LinkId i = 1; i <= std::min(count, kMarksAhead); ++i) visited.prefetch_mark(ll[i]);
+        size_t fresh = 0;
+        for (LinkId i = 1; i <= count; ++i) {
+            if (i + kMarksAhead <= count) visited.prefetch_mark(ll[i + kMarksAhead]);
+            if (!visited.visit(ll[i])) continue;
+            prefetch_vector(ll[i]);
+            out[fresh++] = ll[i];
+        }
+        return fresh;
+    }
+
+    // With `locked`, each link list is read under its node's lock so the walk
+    // can run alongside concurrent inserts.
+    int64_t search_layer_single(const Query& q, int64_t ep, int level, bool locked = false,
+                                SearchStats* stats = nullptr) const {
+        float best_dist = distance(q, ep);
+        VECDB_STAT(stats, distances++);
         int64_t best = ep;
         bool changed = true;
+        std::vector<LinkId> buf;
         while (changed) {
             changed = false;
-            for (int64_t n : neighbors_[best][level]) {
-                float d = dist_func_(q, vectors_[n].data(), dimension_);
+            const LinkId* ll = read_links(best, level, locked, buf);
+            VECDB_STAT(stats, hop(level));
+            VECDB_STAT(stats, distances += ll[0]);
+            for (int64_t i = 1; i <= ll[0]; ++i) prefetch_vector(ll[i]);
+            for (int64_t i = 1; i <= ll[0]; ++i) {
+                int64_t n = ll[i];
+                float d = distance(q, n);
                 if (d < best_dist) {
                     best_dist = d;
                     best = n;
@@ -219,31 +1688,201 @@ private:
         return best;
     }
 
-    std::vector<DistIDPair> search_layer(const float* q, int64_t ep, size_t ef, int level) {
-        std::unordered_set<int64_t> visited;
+    std::vector<DistIDPair> search_layer(const Query& q, int64_t ep, size_t ef, int level, bool locked = false,
+                                         SearchStats* stats = nullptr) const {
+        auto visited = visited_pool_.acquire(capacity_);
         // Min-heap for candidates to explore
         std::priority_queue<DistIDPair, std::vector<DistIDPair>, std::greater<DistIDPair>> candidates;
         // Max-heap for results (to easily remove worst)
         std::priority_queue<DistIDPair> results;
 
-        float d = dist_func_(q, vectors_[ep].data(), dimension_);
+        float d = distance(q, ep);
         candidates.emplace(d, ep);
         results.emplace(d, ep);
-        visited.insert(ep);
+        visited->visit(ep);
+        VECDB_STAT(stats, distances++);
+        VECDB_STAT(stats, visited++);
+        VECDB_STAT(stats, heap_pushes++);
 
+        std::vector<LinkId> buf, batch(M_max0_);
         while (!candidates.empty()) {
             auto [cd, cid] = candidates.top();
             candidates.pop();
 
             if (cd > results.top().first) break;
 
-            for (int64_t n : neighbors_[cid][level]) {
-                if (visited.insert(n).second) {
-                    float nd = dist_func_(q, vectors_[n].data(), dimension_);
-                    if (results.size() < ef || nd < results.top().first) {
-                        candidates.emplace(nd, n);
+            const LinkId* ll = read_links(cid, level, locked, buf);
+            VECDB_STAT(stats, hop(level));
+            if (level == 0 && !candidates.empty()) prefetch_links0(candidates.top().second);
+            size_t fresh = take_unvisited(ll, *visited, batch.data());
+            VECDB_STAT(stats, distances += fresh);
+            VECDB_STAT(stats, visited += fresh);
+            for (size_t j = 0; j < fresh; ++j) {
+                int64_t n = batch[j];
+                float nd = distance(q, n);
+                if (results.size() < ef || nd < results.top().first) {
+                    candidates.emplace(nd, n);
+                    VECDB_STAT(stats, heap_pushes++);
+                    results.emplace(nd, n);
+                    if (results.size() > ef) results.pop();
+                }
+            }
+        }
+
+        std::vector<DistIDPair> result;
+        while (!results.empty()) {
+            result.push_back(results.top());
+            results.pop();
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // search_layer() at level 0 with the adaptive termination of `opt` (see
+    // SearchOptions). Besides the ef nearest it tracks the k nearest live
+    // nodes, and `stale` counts the expansions since those last changed.
+    std::vector<DistIDPair> search_layer_adaptive(const Query& q, int64_t ep, size_t ef, size_t k,
+                                                  const SearchOptions& opt, bool locked = false,
+                                                  SearchStats* stats = nullptr) const {
+        auto visited = visited_pool_.acquire(capacity_);
+        std::priority_queue<DistIDPair, std::vector<DistIDPair>, std::greater<DistIDPair>> candidates;
+        std::priority_queue<DistIDPair> results;
+        std::priority_queue<float> top_k;  // distances of the k nearest live nodes so far
+
+        float d = distance(q, ep);
+        candidates.emplace(d, ep);
+        results.emplace(d, ep);
+        if (!deleted_[ep]) top_k.push(d);
+        visited->visit(ep);
+        VECDB_STAT(stats, distances++);
+        VECDB_STAT(stats, visited++);
+        VECDB_STAT(stats, heap_pushes++);
+
+        size_t computed = 1, stale = 0;
+        std::vector<LinkId> buf, batch(M_max0_);
+        while (!candidates.empty()) {
+            auto [cd, cid] = candidates.top();
+            if (results.size() >= ef && cd > results.top().first) {
+                // Still improving at the ef bound: a hard query, so widen
+                if (opt.patience == 0 || stale >= opt.patience || ef >= opt.max_ef) break;
+                ef = std::min(ef * 2, opt.max_ef);
+                continue;
+            }
+            if (opt.patience > 0 && stale >= opt.patience && top_k.size() >= k) break;
+            if (opt.max_distances > 0 && computed >= opt.max_distances) break;
+            candidates.pop();
+
+            const LinkId* ll = read_links(cid, 0, locked, buf);
+            VECDB_STAT(stats, hop(0));
+            if (!candidates.empty()) prefetch_links0(candidates.top().second);
+            size_t fresh = take_unvisited(ll, *visited, batch.data());
+            computed += fresh;
+            VECDB_STAT(stats, distances += fresh);
+            VECDB_STAT(stats, visited += fresh);
+            bool improved = false;
+            for (size_t j = 0; j < fresh; ++j) {
+                int64_t n = batch[j];
+                float nd = distance(q, n);
+                if (results.size() < ef || nd < results.top().first) {
+                    candidates.emplace(nd, n);
+                    results.emplace(nd, n);
+                    if (results.size() > ef) results.pop();
+                    VECDB_STAT(stats, heap_pushes++);
+                }
+                if (!deleted_[n] && (top_k.size() < k || nd < top_k.top())) {
+                    top_k.push(nd);
+                    if (top_k.size() > k) top_k.pop();
+                    improved = true;
+                }
+            }
+            stale = improved ? 0 : stale + 1;
+        }
+
+        std::vector<DistIDPair> result;
+        while (!results.empty()) {
+            result.push_back(results.top());
+            results.pop();
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // A filtered walk expands about ef / s nodes of M_max0_ links each when a
+    // fraction s of the index is allowed; scanning the allowed nodes costs
+    // s * N distances. The scan wins once allowed^2 <= ef * M_max0_ * N.
+    bool prefer_brute_force(size_t allowed, size_t ef) const {
+        return static_cast<double>(allowed) * allowed <= static_cast<double>(ef) * M_max0_ * num_present_;
+    }
+
+    // The n nearest live nodes, among those `filter` allows if given, by
+    // exhaustive scan: of the float vectors with `floats`, else as stored.
+    std::vector<DistIDPair> scan(const Query& q, size_t n, const IdFilter* filter, bool floats,
+                                 SearchStats* stats = nullptr) const {
+        std::priority_queue<DistIDPair> results;
+        auto visit = [&](size_t id) {
+            if (!contains(static_cast<int64_t>(id))) return;
+            float d = floats ? dist_func_(q.vec, get_vector(static_cast<int64_t>(id)), dimension_)
+                             : distance(q, static_cast<int64_t>(id));
+            VECDB_STAT(stats, distances++);
+            if (results.size() < n || d < results.top().first) {
+                results.emplace(d, static_cast<int64_t>(id));
+                if (results.size() > n) results.pop();
+            }
+        };
+        if (filter) filter->for_each(num_slots_, visit);
+        else for (size_t id = 0; id < num_slots_; ++id) visit(id);
+        std::vector<DistIDPair> result;
+        while (!results.empty()) {
+            result.push_back(results.top());
+            results.pop();
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // search_layer() at level 0 whose results hold only live nodes `filter`
+    // allows. Every node is still expanded as a candidate, so the walk crosses
+    // regions the filter excludes, and it runs until ef allowed nodes are
+    // found or nothing closer is left.
+    std::vector<DistIDPair> search_layer_filtered(const Query& q, int64_t ep, size_t ef, const IdFilter& filter,
+                                                  bool locked = false, SearchStats* stats = nullptr) const {
+        auto visited = visited_pool_.acquire(capacity_);
+        std::priority_queue<DistIDPair, std::vector<DistIDPair>, std::greater<DistIDPair>> candidates;
+        std::priority_queue<DistIDPair> results;
+        auto accepted = [&](int64_t id) { return filter.allows(static_cast<size_t>(id)) && !deleted_[id]; };
+
+        float d = distance(q, ep);
+        candidates.emplace(d, ep);
+        if (accepted(ep)) results.emplace(d, ep);
+        visited->visit(ep);
+        VECDB_STAT(stats, distances++);
+        VECDB_STAT(stats, visited++);
+        VECDB_STAT(stats, heap_pushes++);
+
+        std::vector<LinkId> buf, batch(M_max0_);
+        while (!candidates.empty()) {
+            auto [cd, cid] = candidates.top();
+            candidates.pop();
+
+            if (results.size() >= ef && cd > results.top().first) break;
+
+            const LinkId* ll = read_links(cid, 0, locked, buf);
+            VECDB_STAT(stats, hop(0));
+            if (!candidates.empty()) prefetch_links0(candidates.top().second);
+            size_t fresh = take_unvisited(ll, *visited, batch.data());
+            VECDB_STAT(stats, distances += fresh);
+            VECDB_STAT(stats, visited += fresh);
+            for (size_t j = 0; j < fresh; ++j) {
+                int64_t n = batch[j];
+                float nd = distance(q, n);
+                if (results.size() < ef || nd < results.top().first) {
+                    candidates.emplace(nd, n);
+                    VECDB_STAT(stats, heap_pushes++);
+                    if (accepted(n)) {
                         results.emplace(nd, n);
                         if (results.size() > ef) results.pop();
+                    } else {
+                        VECDB_STAT(stats, deleted_skipped += deleted_[n]);
                     }
                 }
             }
@@ -258,37 +1897,170 @@ private:
         return result;
     }
 
-    std::vector<DistIDPair> get_neighbors_with_dist(const float* q, const std::vector<int64_t>& ids) {
+    // New links at `level` for live node `id`, some of whose links are removed
+    // nodes: the live nodes within two hops, walking on through removed ones,
+    // narrowed with select_neighbors(). Reads the graph only.
+    std::vector<int64_t> repaired_links(int64_t id, int level) const {
+        auto seen = visited_pool_.acquire(capacity_);
+        seen->visit(id);
+        std::vector<int64_t> pool, hops;
+        auto gather = [&](int64_t node) {
+            const LinkId* ll = links(node, level);
+            for (int64_t i = 1; i <= ll[0]; ++i) {
+                if (!seen->visit(ll[i])) continue;
+                hops.push_back(ll[i]);
+                if (!deleted_[ll[i]]) pool.push_back(ll[i]);
+            }
+        };
+        gather(id);
+        for (size_t next = 0; next < hops.size() && pool.size() < 2 * ef_construction_; ++next) {
+            // Past the first ring only removed nodes are walked through
+            if (next >= static_cast<size_t>(links(id, level)[0]) && !deleted_[hops[next]]) continue;
+            gather(hops[next]);
+        }
+
+        std::vector<float> buf;
+        Query q;
+        node_query(id, buf, q);
+        return select_neighbors(q, id, get_neighbors_with_dist(q, pool), max_connections(level), level, false);
+    }
+
+    std::vector<DistIDPair> get_neighbors_with_dist(const Query& q, const std::vector<int64_t>& ids) const {
         std::vector<DistIDPair> result;
         for (int64_t id : ids) {
-            float d = dist_func_(q, vectors_[id].data(), dimension_);
+            float d = distance(q, id);
             result.emplace_back(d, id);
         }
         std::sort(result.begin(), result.end());
         return result;
     }
 
-    std::vector<int64_t> select_neighbors(const std::vector<DistIDPair>& candidates, size_t M_cur) {
-        std::vector<int64_t> result;
+    // Choose up to M_cur links at `level` for node `self` (query q) from
+    // `candidates`, sorted by ascending distance to q. With `extend`, the
+    // candidates' own neighbors join the pool; their lists are read under
+    // their node locks.
+    std::vector<int64_t> select_neighbors(const Query& q, int64_t self, std::vector<DistIDPair> candidates,
+                                          size_t M_cur, int level, bool extend, SearchStats* stats = nullptr) const {
+        std::vector<LinkId> picked(M_cur);
+        size_t n = select_neighbors(q, self, std::move(candidates), M_cur, level, extend, picked.data(), stats);
+        return std::vector<int64_t>(picked.begin(), picked.begin() + static_cast<std::ptrdiff_t>(n));
+    }
+
+    // As above, writing the selection to `out` (room for M_cur IDs) and
+    // returning its size. `out` may be the list the candidates were read from.
+    size_t select_neighbors(const Query& q, int64_t self, std::vector<DistIDPair> candidates, size_t M_cur, int level,
+                            bool extend, LinkId* out, SearchStats* stats = nullptr) const {
+        if (heuristic_ && extend) {
+            auto seen = visited_pool_.acquire(capacity_);
+            seen->visit(self);
+            for (const auto& c : candidates) seen->visit(c.second);
+            std::vector<int64_t> extra;
+            for (size_t i = 0, n = candidates.size(); i < n; ++i) {
+                extra.clear();
+                {
+                    std::lock_guard<std::mutex> lock(node_locks_[candidates[i].second]);
+                    const LinkId* ll = links(candidates[i].second, level);
+                    for (int64_t j = 1; j <= ll[0]; ++j) {
+                        if (seen->visit(ll[j])) extra.push_back(ll[j]);
+                    }
+                }
+                for (int64_t e : extra) candidates.emplace_back(distance(q, e), e);
+                VECDB_STAT(stats, distances += extra.size());
+            }
+            std::sort(candidates.begin(), candidates.end());
+        }
+
+        size_t kept = 0;
+        if (!heuristic_ || candidates.size() <= M_cur) {
+            for (; kept < candidates.size() && kept < M_cur; ++kept) out[kept] = static_cast<LinkId>(candidates[kept].second);
+            return kept;
+        }
+
+        // Keep a candidate only if it is closer to q than to every link kept so
+        // far, so links spread across directions instead of piling into one cluster
+        std::vector<int64_t> pruned;
+        std::vector<float> buf;
+        Query cq;
         for (const auto& [d, id] : candidates) {
-            if (result.size() >= M_cur) break;
-            result.push_back(id);
+            if (kept >= M_cur) break;
+            if (kept > 0) node_query(id, buf, cq);
+            bool diverse = true;
+            for (size_t r = 0; r < kept; ++r) {
+                VECDB_STAT(stats, distances++);
+                if (distance(cq, out[r]) < d) {
+                    diverse = false;
+                    break;
+                }
+            }
+            if (diverse) {
+                out[kept++] = static_cast<LinkId>(id);
+            } else if (keep_pruned_) {
+                pruned.push_back(id);
+            }
         }
-        return result;
+        for (size_t i = 0; i < pruned.size() && kept < M_cur; ++i) out[kept++] = static_cast<LinkId>(pruned[i]);
+        return kept;
     }
 
     size_t dimension_;
     std::string metric_;
     size_t M_, M_max0_, ef_construction_;
+    bool heuristic_, keep_pruned_, extend_candidates_;
+    std::string storage_;     // "float", "int8" or "pq"
+    bool rerank_;
+    bool use_pq_;
+    std::string rerank_path_;
     int64_t entry_point_;
     int max_level_;
-    DistanceFunc dist_func_;
+    SimdLevel simd_level_;
+    DistanceFunc dist_func_;  // ranking distance: squared for l2, 1 - dot for cosine; see get_index_distance_func
+    bool normalize_;          // cosine: vectors and queries are stored/used at unit length
+    ScalarQuantizer sq_;
+    ProductQuantizer pq_;
+    bool quantized_ = false;  // int8 storage with a trained quantizer: codes_ hold the vectors
+    size_t flat_threshold_ = kDefaultFlatThreshold;
     std::mt19937 rng_;
     double level_mult_;
-    std::unordered_map<int64_t, std::vector<float>> vectors_;
-    std::unordered_map<int64_t, int> levels_;
-    std::unordered_map<int64_t, std::vector<std::vector<int64_t>>> neighbors_;
-    std::unordered_set<int64_t> deleted_;
+
+    // Dense node storage, indexed by internal ID
+    size_t vec_stride_;           // floats per vector slot, padded to a cache line
+    size_t code_size_;            // bytes per code: dimension_ (int8) or subspaces (pq)
+    size_t code_stride_;          // bytes per code slot; int8 slots are padded to a cache line
+    size_t links0_stride_;        // entries per level-0 slot: count + M_max0_ links
+    size_t capacity_ = 0;         // allocated slots
+    size_t num_slots_ = 0;        // highest ID ever stored + 1
+    size_t num_present_ = 0;      // occupied slots, including tombstones
+    size_t num_deleted_ = 0;
+    AlignedBuffer<float> vectors_;   // empty once quantized unless rerank_
+    AlignedBuffer<uint8_t> codes_;   // only while quantized_
+    MappedFile raw_file_;            // float vectors for rerank_ with a rerank_path_
+    mutable bool rerank_file_saved_ = false;  // a snapshot names raw_file_; never write it
+    AlignedBuffer<LinkId> links0_;
+    AlignedBuffer<uint64_t> upper_offsets_;  // block of levels 1..L in upper_pool_
+    LinkPool upper_pool_;                    // (M_ + 1) entries per list
+    AlignedBuffer<int> levels_;              // -1 marks an empty slot
+    AlignedBuffer<uint8_t> deleted_;
+
+    // After open_mmap() the arrays above, and the pool's slab, are views into
+    // index_file_ until they grow.
+    MappedFile index_file_;
+
+    // Insert-time synchronization; only resized between batches
+    mutable LockTable node_locks_;
+    MemberMutex entry_mutex_;       // serializes inserts that raise the top level
+    mutable MemberMutex top_mutex_;  // entry_point_ and max_level_, while linking
+    mutable SharedMutex graph_mutex_;
+    MemberCounter linking_;  // inserts linking under the shared lock
+
+    // Reusable visited markers, one checked out per search_layer call
+    mutable VisitedListPool visited_pool_;
+
+    mutable StatsTotals totals_;  // only added to when built with VECDB_STATS
+
+    // Last calibrate() curve, ascending in ef_search, and the options it used
+    std::vector<CalibrationPoint> calibration_;
+    SearchOptions calibration_options_;
+    mutable MemberMutex calibration_mutex_;
 };
 
 } // namespace vecdb
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vecdb {
+
+// Allow-list of internal IDs for filtered search, one bit per ID. IDs at or
+// past size() are not allowed.
+class IdFilter {
+public:
+    explicit IdFilter(size_t size = 0) : words_((size + 63) / 64, 0), size_(size) {}
+
+    // A filter allowing each i < n with mask[i] != 0.
+    static IdFilter from_mask(const uint8_t* mask, size_t n) {
+        IdFilter filter(n);
+        for (size_t i = 0; i < n; ++i) {
+            if (mask[i]) filter.allow(i);
+        }
+        return filter;
+    }
+
+    void allow(size_t id) {
+        uint64_t bit = uint64_t(1) << (id % 64);
+        if (!(words_[id / 64] & bit)) ++count_;
+        words_[id / 64] |= bit;
+    }
+
+    bool allows(size_t id) const { return id < size_ && (words_[id / 64] >> (id % 64)) & 1; }
+
+    // Call fn(id) for each allowed ID below `end`, in increasing order.
+    template <typename Fn>
+    void for_each(size_t end, Fn&& fn) const {
+        size_t words = std::min(words_.size(), (end + 63) / 64);
+        for (size_t w = 0; w < words; ++w) {
+            for (uint64_t bits = words_[w]; bits; bits &= bits - 1) {
+                size_t id = w * 64 + static_cast<size_t>(__builtin_ctzll(bits));
+                if (id >= end) return;
+                fn(id);
+            }
+        }
+    }
+
+    size_t count() const { return count_; }  // IDs allowed
+    size_t size() const { return size_; }
+
+private:
+    std::vector<uint64_t> words_;
+    size_t size_;
+    size_t count_ = 0;
+};
+
+} // namespace vecdb
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hot-path counters are compiled in only when VECDB_STATS is defined (CMake
+// option VECDB_ENABLE_STATS). Otherwise VECDB_STAT() drops its statement, so
+// the graph walks carry no counting code.
+#if defined(VECDB_STATS)
+#define VECDB_STAT(stats, stmt) do { if (stats) (stats)->stmt; } while (0)
+#else
+#define VECDB_STAT(stats, stmt) do { (void)(stats); } while (0)
+#endif
+
+namespace vecdb {
+
+#if defined(VECDB_STATS)
+inline constexpr bool kStatsEnabled = true;
+#else
+inline constexpr bool kStatsEnabled = false;
+#endif
+
+// Work done by one search, or by the graph walks and neighbor selection of
+// one insert.
+struct SearchStats {
+    uint64_t distances = 0;        // distance computations
+    uint64_t visited = 0;          // nodes marked visited by ef-bounded walks
+    uint64_t heap_pushes = 0;      // candidates queued for expansion
+    uint64_t deleted_skipped = 0;  // removed nodes passed over for results
+    uint64_t prunes = 0;           // full link lists re-pruned (inserts only)
+    std::vector<uint64_t> hops;    // hops[l]: nodes expanded at level l
+
+    void hop(int level) {
+        size_t l = static_cast<size_t>(level);
+        if (hops.size() <= l) hops.resize(l + 1);
+        ++hops[l];
+    }
+};
+
+// Counters summed over every search and insert since construction or reset.
+struct IndexStats {
+    uint64_t searches = 0;
+    uint64_t inserts = 0;
+    SearchStats search;
+    SearchStats build;
+};
+
+// Shape of the graph, from graph_health().
+struct GraphHealth {
+    size_t nodes = 0;                      // live nodes
+    size_t deleted = 0;                    // removed nodes still linked
+    size_t unreachable = 0;                // live nodes no level-0 walk from the entry point reaches
+    std::vector<size_t> degree_histogram;  // [d]: live nodes with d level-0 links
+    std::vector<size_t> level_counts;      // [l]: nodes, live or removed, whose top level is l
+};
+
+// Running IndexStats that many threads add to at once. Copies start at zero.
+class StatsTotals {
+public:
+    StatsTotals() = default;
+    StatsTotals(const StatsTotals&) {}
+    StatsTotals& operator=(const StatsTotals&) { return *this; }
+
+    void add_search(const SearchStats& s) {
+        searches_.fetch_add(1, std::memory_order_relaxed);
+        search_.add(s);
+    }
+
+    void add_insert(const SearchStats& s) {
+        inserts_.fetch_add(1, std::memory_order_relaxed);
+        build_.add(s);
+    }
+
+    IndexStats snapshot() const {
+        IndexStats out;
+        out.searches = searches_.load(std::memory_order_relaxed);
+        out.inserts = inserts_.load(std::memory_order_relaxed);
+        search_.read(out.search);
+        build_.read(out.build);
+        return out;
+    }
+
+    void reset() {
+        searches_.store(0, std::memory_order_relaxed);
+        inserts_.store(0, std::memory_order_relaxed);
+        search_.reset();
+        build_.reset();
+    }
+
+private:
+    static constexpr size_t kLevels = 64;  // hops at deeper levels count in the last
+
+    struct Sums {
+        std::atomic<uint64_t> distances{0}, visited{0}, heap_pushes{0}, deleted_skipped{0}, prunes{0};
+        std::atomic<uint64_t> hops[kLevels] = {};
+
+        void add(const SearchStats& s) {
+            distances.fetch_add(s.distances, std::memory_order_relaxed);
+            visited.fetch_add(s.visited, std::memory_order_relaxed);
+            heap_pushes.fetch_add(s.heap_pushes, std::memory_order_relaxed);
+            deleted_skipped.fetch_add(s.deleted_skipped, std::memory_order_relaxed);
+            prunes.fetch_add(s.prunes, std::memory_order_relaxed);
+            for (size_t l = 0; l < s.hops.size(); ++l)
+                hops[std::min(l, kLevels - 1)].fetch_add(s.hops[l], std::memory_order_relaxed);
+        }
+
+        void read(SearchStats& s) const {
+            s.distances = distances.load(std::memory_order_relaxed);
+            s.visited = visited.load(std::memory_order_relaxed);
+            s.heap_pushes = heap_pushes.load(std::memory_order_relaxed);
+            s.deleted_skipped = deleted_skipped.load(std::memory_order_relaxed);
+            s.prunes = prunes.load(std::memory_order_relaxed);
+            s.hops.clear();
+            for (size_t l = 0; l < kLevels; ++l) {
+                uint64_t h = hops[l].load(std::memory_order_relaxed);
+                if (h) {
+                    s.hops.resize(l + 1);
+                    s.hops[l] = h;
+                }
+            }
+        }
+
+        void reset() {
+            for (auto* c : {&distances, &visited, &heap_pushes, &deleted_skipped, &prunes})
+                c->store(0, std::memory_order_relaxed);
+            for (auto& h : hops) h.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    std::atomic<uint64_t> searches_{0}, inserts_{0};
+    Sums search_, build_;
+};
+
+} // namespace vecdb
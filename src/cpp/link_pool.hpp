@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "aligned_buffer.hpp"
+
+namespace vecdb {
+
+// Entry of a stored link list: the list's count or a neighbor's internal ID.
+// Internal IDs are dense per index, so 32 bits halve the graph's footprint.
+using LinkId = uint32_t;
+
+// Slab of upper-layer link lists. A node at level L > 0 owns one block of L
+// lists of list_entries entries each, addressed by its offset into the slab,
+// so there is no allocation per node. Released blocks go on a free list for
+// their height and are handed out again before the slab grows; the slab
+// doubles when it does grow, which moves the blocks but keeps their offsets.
+class LinkPool {
+public:
+    LinkPool() = default;
+    explicit LinkPool(size_t list_entries) : list_entries_(list_entries) {}
+
+    // Take over a slab that is packed full of blocks, such as one read from a file.
+    void adopt(AlignedBuffer<LinkId> slab) {
+        slab_ = std::move(slab);
+        used_ = slab_.size();
+        free_.clear();
+    }
+
+    // Offset of a zeroed block of `levels` lists.
+    uint64_t allocate(int levels) {
+        size_t h = static_cast<size_t>(levels);
+        size_t entries = h * list_entries_;
+        if (h < free_.size() && !free_[h].empty()) {
+            uint64_t offset = free_[h].back();
+            free_[h].pop_back();
+            std::memset(slab_.data() + offset, 0, entries * sizeof(LinkId));
+            return offset;
+        }
+        // Entries past used_ are still zero from the resize that made them
+        if (used_ + entries > slab_.size()) slab_.resize(std::max({used_ + entries, slab_.size() * 2, kMinEntries}));
+        uint64_t offset = used_;
+        used_ += entries;
+        return offset;
+    }
+
+    void release(uint64_t offset, int levels) {
+        size_t h = static_cast<size_t>(levels);
+        if (free_.size() <= h) free_.resize(h + 1);
+        free_[h].push_back(offset);
+    }
+
+    LinkId* data() { return slab_.data(); }
+    const LinkId* data() const { return slab_.data(); }
+    size_t size() const { return slab_.size(); }  // entries addressable
+
+private:
+    static constexpr size_t kMinEntries = 4096;
+
+    AlignedBuffer<LinkId> slab_;
+    size_t list_entries_ = 0;
+    size_t used_ = 0;                           // entries handed out, free or not
+    std::vector<std::vector<uint64_t>> free_;  // released offsets by height
+};
+
+} // namespace vecdb
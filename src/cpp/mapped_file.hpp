@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vecdb {
+
+// A file mapped read-write and shared, so writes through data() land in the
+// file and the OS pages it in and out on demand, or mapped copy-on-write, so
+// writes stay private to this process. Move-only.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept { swap(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            swap(other);
+        }
+        return *this;
+    }
+
+    // Open (creating if missing) and map the whole file. With `truncate` the
+    // file starts empty.
+    void open(const std::string& path, bool truncate) {
+        close();
+        int flags = O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0);
+        fd_ = ::open(path.c_str(), flags, 0644);
+        if (fd_ < 0) throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+        path_ = path;
+        map_file();
+    }
+
+    // Create and map an empty file at `path`, shared. Returns false, leaving
+    // this closed, if something already exists there.
+    bool create(const std::string& path) {
+        close();
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd_ < 0) {
+            if (errno == EEXIST) return false;
+            throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+        }
+        path_ = path;
+        return true;
+    }
+
+    // Map an existing file copy-on-write. The file itself is never modified.
+    void open_private(const std::string& path) {
+        close();
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+        path_ = path;
+        private_ = true;
+        map_file();
+    }
+
+    // Grow or shrink the file to `bytes` and remap it. Pointers into the old
+    // mapping are invalidated. Shared mappings only.
+    void resize(size_t bytes) {
+        if (bytes == size_) return;
+        if (private_) throw std::runtime_error("Cannot resize private mapping of " + path_);
+        unmap();
+        if (::ftruncate(fd_, static_cast<off_t>(bytes)) != 0) fail("resize");
+        map(bytes);
+    }
+
+    // Write a shared mapping's dirty pages back and sync the file to disk.
+    void sync() const {
+        if (private_ || fd_ < 0) return;
+        if (data_ && ::msync(data_, size_, MS_SYNC) != 0) fail_const("sync");
+        if (::fsync(fd_) != 0) fail_const("sync");
+    }
+
+    void close() {
+        unmap();
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        private_ = false;
+        path_.clear();
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+    bool is_private() const { return private_; }
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    const std::string& path() const { return path_; }
+
+private:
+    void map_file() {
+        struct stat st;
+        if (::fstat(fd_, &st) != 0) fail("stat");
+        map(static_cast<size_t>(st.st_size));
+    }
+
+    void map(size_t bytes) {
+        size_ = bytes;
+        if (bytes == 0) return;
+        void* p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, private_ ? MAP_PRIVATE : MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            size_ = 0;
+            fail("map");
+        }
+        data_ = static_cast<uint8_t*>(p);
+    }
+
+    void unmap() {
+        if (data_) ::munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    [[noreturn]] void fail(const char* what) {
+        std::string msg = std::string("Cannot ") + what + " " + path_ + ": " + std::strerror(errno);
+        close();
+        throw std::runtime_error(msg);
+    }
+
+    [[noreturn]] void fail_const(const char* what) const {
+        throw std::runtime_error(std::string("Cannot ") + what + " " + path_ + ": " + std::strerror(errno));
+    }
+
+    void swap(MappedFile& other) noexcept {
+        std::swap(fd_, other.fd_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(path_, other.path_);
+        std::swap(private_, other.private_);
+    }
+
+    int fd_ = -1;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool private_ = false;
+    std::string path_;
+};
+
+} // namespace vecdb
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace vecdb {
+
+// A std::mutex that can be a member of a copyable class: copies and moves
+// get a fresh, unlocked mutex instead of failing to compile.
+class MemberMutex {
+public:
+    MemberMutex() = default;
+    MemberMutex(const MemberMutex&) {}
+    MemberMutex& operator=(const MemberMutex&) { return *this; }
+    void lock() { m_.lock(); }
+    void unlock() { m_.unlock(); }
+    bool try_lock() { return m_.try_lock(); }
+
+private:
+    std::mutex m_;
+};
+
+// An atomic counter that can be a member of a copyable class: copies start
+// at zero.
+class MemberCounter {
+public:
+    MemberCounter() = default;
+    MemberCounter(const MemberCounter&) {}
+    MemberCounter& operator=(const MemberCounter&) { return *this; }
+    void operator++() { n_.fetch_add(1); }
+    void operator--() { n_.fetch_sub(1); }
+    size_t load() const { return n_.load(); }
+
+private:
+    std::atomic<size_t> n_{0};
+};
+
+// Reader/writer lock for std::shared_lock and std::unique_lock. A waiting
+// writer holds back new readers, so a steady stream of searches cannot
+// starve inserts. downgrade() turns a held write lock into a read lock with
+// no writer slipping in between. Copies get a fresh, unlocked lock.
+class SharedMutex {
+public:
+    SharedMutex() = default;
+    SharedMutex(const SharedMutex&) {}
+    SharedMutex& operator=(const SharedMutex&) { return *this; }
+
+    void lock() {
+        std::unique_lock<std::mutex> lock(m_);
+        ++writers_waiting_;
+        writer_cv_.wait(lock, [this] { return !writer_ && readers_ == 0; });
+        --writers_waiting_;
+        writer_ = true;
+    }
+
+    void unlock() {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            writer_ = false;
+        }
+        writer_cv_.notify_one();
+        reader_cv_.notify_all();
+    }
+
+    void lock_shared() {
+        std::unique_lock<std::mutex> lock(m_);
+        reader_cv_.wait(lock, [this] { return !writer_ && writers_waiting_ == 0; });
+        ++readers_;
+    }
+
+    void unlock_shared() {
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            last = --readers_ == 0;
+        }
+        if (last) writer_cv_.notify_one();
+    }
+
+    // Caller holds the write lock and keeps a read lock.
+    void downgrade() {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            writer_ = false;
+            ++readers_;
+        }
+        reader_cv_.notify_all();
+    }
+
+private:
+    std::mutex m_;
+    std::condition_variable reader_cv_, writer_cv_;
+    size_t readers_ = 0, writers_waiting_ = 0;
+    bool writer_ = false;
+};
+
+// Fixed-size array of mutexes, one per graph node. Copies get fresh mutexes.
+class LockTable {
+public:
+    LockTable() = default;
+    explicit LockTable(size_t n) : locks_(n ? new std::mutex[n] : nullptr), size_(n) {}
+    LockTable(const LockTable& other) : LockTable(other.size_) {}
+    LockTable(LockTable&&) noexcept = default;
+    LockTable& operator=(LockTable other) noexcept {
+        std::swap(locks_, other.locks_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    std::mutex& operator[](size_t i) { return locks_[i]; }
+    size_t size() const { return size_; }
+
+private:
+    std::unique_ptr<std::mutex[]> locks_;
+    size_t size_ = 0;
+};
+
+// Resolve a requested thread count: 0 means one per hardware thread, and
+// there is never more than one thread per work item.
+inline size_t resolve_num_threads(size_t requested, size_t work_items) {
+    size_t n = requested ? requested : std::max<size_t>(1, std::thread::hardware_concurrency());
+    return std::max<size_t>(1, std::min(n, work_items));
+}
+
+// Run fn(i) for every i in [0, n) on a pool of worker threads. Workers pull
+// indices from a shared counter, so uneven items balance themselves. The
+// calling thread is one of the workers. The first exception thrown by any
+// item stops the remaining work and is rethrown here.
+template <typename Fn>
+void parallel_for(size_t n, size_t num_threads, Fn&& fn) {
+    num_threads = resolve_num_threads(num_threads, n);
+    if (num_threads == 1) {
+        for (size_t i = 0; i < n; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&] {
+        for (size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) error = std::current_exception();
+                next.store(n);
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(num_threads - 1);
+    for (size_t t = 1; t < num_threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool) th.join();
+    if (error) std::rethrow_exception(error);
+}
+
+// The numbers in a Linux CPU or node list such as "0-3,8,10-11".
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> out;
+    size_t i = 0;
+    while (i < list.size()) {
+        size_t end = list.find(',', i);
+        if (end == std::string::npos) end = list.size();
+        std::string item = list.substr(i, end - i);
+        i = end + 1;
+        if (item.empty() || item[0] < '0' || item[0] > '9') continue;
+        size_t dash = item.find('-');
+        int lo = std::stoi(item.substr(0, dash));
+        int hi = dash == std::string::npos ? lo : std::stoi(item.substr(dash + 1));
+        for (int c = lo; c <= hi; ++c) out.push_back(c);
+    }
+    return out;
+}
+
+// Contents of a sysfs file up to its first newline, or "" if it cannot be read.
+inline std::string read_sysfs_line(const std::string& path) {
+    std::ifstream f(path);
+    std::string line;
+    std::getline(f, line);
+    return line;
+}
+
+// The NUMA nodes this machine has online; empty where that is unknown.
+inline std::vector<int> online_numa_nodes() {
+    return parse_cpu_list(read_sysfs_line("/sys/devices/system/node/online"));
+}
+
+// The CPUs of NUMA node `node`; empty where that is unknown.
+inline std::vector<int> numa_node_cpus(int node) {
+    return parse_cpu_list(read_sysfs_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+}
+
+// Pins the calling thread to `cpus` while in scope, then restores its
+// previous affinity. Threads started meanwhile inherit the pinning. Does
+// nothing for an empty list, or off Linux.
+class ScopedAffinity {
+public:
+    explicit ScopedAffinity(const std::vector<int>& cpus) {
+#if defined(__linux__)
+        if (cpus.empty() || pthread_getaffinity_np(pthread_self(), sizeof(saved_), &saved_) != 0) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : cpus) {
+            if (c >= 0 && c < CPU_SETSIZE) CPU_SET(c, &set);
+        }
+        active_ = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpus;
+#endif
+    }
+    ~ScopedAffinity() {
+#if defined(__linux__)
+        if (active_) pthread_setaffinity_np(pthread_self(), sizeof(saved_), &saved_);
+#endif
+    }
+    ScopedAffinity(const ScopedAffinity&) = delete;
+    ScopedAffinity& operator=(const ScopedAffinity&) = delete;
+
+private:
+#if defined(__linux__)
+    cpu_set_t saved_;
+#endif
+    bool active_ = false;
+};
+
+} // namespace vecdb
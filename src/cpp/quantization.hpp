@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include "distance.hpp"
+#include "parallel.hpp"
+
+namespace vecdb {
+
+// A query prepared once per search for a quantizer's codes: distance() is
+// offset + sign * (the quantizer's sum over `values`).
+struct QuantizedQuery {
+    std::vector<float> values;
+    float offset = 0.0f;
+    float sign = 1.0f;
+};
+
+// Kernels between a prepared float query and a uint8 code. The code decodes to
+// x_i = min_i + c_i * scale_i; each kernel folds the per-dimension terms into
+// the prepared query so it never materializes x.
+//
+//   sq8_l2_sq(q - min, c, scale)  = sum_i ((q_i - min_i) - c_i * scale_i)^2
+//   sq8_dot(q * scale, c)         = sum_i c_i * q_i * scale_i
+using SQ8Kernel = float (*)(const float* prepared, const uint8_t* code, const float* scale, size_t dim);
+
+inline float sq8_l2_sq(const float* q, const uint8_t* code, const float* scale, size_t dim) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < dim; ++i) {
+        float diff = q[i] - static_cast<float>(code[i]) * scale[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+inline float sq8_dot(const float* q, const uint8_t* code, const float*, size_t dim) {
+    float dot = 0.0f;
+    for (size_t i = 0; i < dim; ++i) dot += q[i] * static_cast<float>(code[i]);
+    return dot;
+}
+
+#if defined(VECDB_X86_DISPATCH)
+
+// AVX2 + FMA: widen 8 codes at a time to float, scalar tail.
+
+__attribute__((target("avx2,fma"))) inline __m256 load_codes_avx2(const uint8_t* code) {
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(code));
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+}
+
+__attribute__((target("avx2,fma"))) inline float sq8_l2_sq_avx2(const float* q, const uint8_t* code,
+                                                               const float* scale, size_t dim) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_fnmadd_ps(load_codes_avx2(code + i), _mm256_loadu_ps(scale + i), _mm256_loadu_ps(q + i));
+        __m256 d1 = _mm256_fnmadd_ps(load_codes_avx2(code + i + 8), _mm256_loadu_ps(scale + i + 8),
+                                     _mm256_loadu_ps(q + i + 8));
+        s0 = _mm256_fmadd_ps(d0, d0, s0);
+        s1 = _mm256_fmadd_ps(d1, d1, s1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d0 = _mm256_fnmadd_ps(load_codes_avx2(code + i), _mm256_loadu_ps(scale + i), _mm256_loadu_ps(q + i));
+        s0 = _mm256_fmadd_ps(d0, d0, s0);
+    }
+    float sum = hsum_avx2(_mm256_add_ps(s0, s1));
+    for (; i < dim; ++i) {
+        float diff = q[i] - static_cast<float>(code[i]) * scale[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma"))) inline float sq8_dot_avx2(const float* q, const uint8_t* code,
+                                                             const float*, size_t dim) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        s0 = _mm256_fmadd_ps(load_codes_avx2(code + i), _mm256_loadu_ps(q + i), s0);
+        s1 = _mm256_fmadd_ps(load_codes_avx2(code + i + 8), _mm256_loadu_ps(q + i + 8), s1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        s0 = _mm256_fmadd_ps(load_codes_avx2(code + i), _mm256_loadu_ps(q + i), s0);
+    }
+    float dot = hsum_avx2(_mm256_add_ps(s0, s1));
+    for (; i < dim; ++i) dot += q[i] * static_cast<float>(code[i]);
+    return dot;
+}
+
+// AVX-512: 16 codes per step; masked byte loads need AVX512BW, so the tail is scalar.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f"))) inline __m512 load_codes_avx512(const uint8_t* code) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(code));
+    return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes));
+}
+
+__attribute__((target("avx512f"))) inline float sq8_l2_sq_avx512(const float* q, const uint8_t* code,
+                                                               const float* scale, size_t dim) {
+    __m512 s0 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 d0 = _mm512_fnmadd_ps(load_codes_avx512(code + i), _mm512_loadu_ps(scale + i), _mm512_loadu_ps(q + i));
+        s0 = _mm512_fmadd_ps(d0, d0, s0);
+    }
+    float sum = _mm512_reduce_add_ps(s0);
+    for (; i < dim; ++i) {
+        float diff = q[i] - static_cast<float>(code[i]) * scale[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f"))) inline float sq8_dot_avx512(const float* q, const uint8_t* code,
+                                                             const float*, size_t dim) {
+    __m512 s0 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        s0 = _mm512_fmadd_ps(load_codes_avx512(code + i), _mm512_loadu_ps(q + i), s0);
+    }
+    float dot = _mm512_reduce_add_ps(s0);
+    for (; i < dim; ++i) dot += q[i] * static_cast<float>(code[i]);
+    return dot;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#elif defined(VECDB_NEON)
+
+// NEON: widen 8 codes to two float32x4 per step, scalar tail.
+
+inline float sq8_l2_sq_neon(const float* q, const uint8_t* code, const float* scale, size_t dim) {
+    float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        uint16x8_t wide = vmovl_u8(vld1_u8(code + i));
+        float32x4_t c0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(wide)));
+        float32x4_t c1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(wide)));
+        float32x4_t d0 = vfmsq_f32(vld1q_f32(q + i), c0, vld1q_f32(scale + i));
+        float32x4_t d1 = vfmsq_f32(vld1q_f32(q + i + 4), c1, vld1q_f32(scale + i + 4));
+        s0 = vfmaq_f32(s0, d0, d0);
+        s1 = vfmaq_f32(s1, d1, d1);
+    }
+    float sum = vaddvq_f32(vaddq_f32(s0, s1));
+    for (; i < dim; ++i) {
+        float diff = q[i] - static_cast<float>(code[i]) * scale[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+inline float sq8_dot_neon(const float* q, const uint8_t* code, const float*, size_t dim) {
+    float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        uint16x8_t wide = vmovl_u8(vld1_u8(code + i));
+        s0 = vfmaq_f32(s0, vcvtq_f32_u32(vmovl_u16(vget_low_u16(wide))), vld1q_f32(q + i));
+        s1 = vfmaq_f32(s1, vcvtq_f32_u32(vmovl_u16(vget_high_u16(wide))), vld1q_f32(q + i + 4));
+    }
+    float dot = vaddvq_f32(vaddq_f32(s0, s1));
+    for (; i < dim; ++i) dot += q[i] * static_cast<float>(code[i]);
+    return dot;
+}
+
+#endif
+
+inline SQ8Kernel get_sq8_kernel(bool l2, SimdLevel level) {
+    switch (level) {
+#if defined(VECDB_X86_DISPATCH)
+        case SimdLevel::AVX512: return l2 ? sq8_l2_sq_avx512 : sq8_dot_avx512;
+        case SimdLevel::AVX2: return l2 ? sq8_l2_sq_avx2 : sq8_dot_avx2;
+#elif defined(VECDB_NEON)
+        case SimdLevel::NEON: return l2 ? sq8_l2_sq_neon : sq8_dot_neon;
+#endif
+        default: return l2 ? sq8_l2_sq : sq8_dot;
+    }
+}
+
+// Per-dimension min/max scalar quantizer mapping each float to one byte. It
+// produces the same ranking distances as get_index_distance_func for the
+// metric: squared L2, 1 - dot for (normalized) cosine, -dot for dot.
+class ScalarQuantizer {
+public:
+    using Query = QuantizedQuery;
+
+    ScalarQuantizer() = default;
+    ScalarQuantizer(size_t dimension, const std::string& metric, SimdLevel level)
+        : dimension_(dimension), metric_(metric), kernel_(get_sq8_kernel(metric == "l2", level)) {}
+
+    bool trained() const { return !min_.empty(); }
+    size_t dimension() const { return dimension_; }
+    const std::vector<float>& min() const { return min_; }
+    const std::vector<float>& scale() const { return scale_; }
+
+    // Fit the per-dimension range to n vectors, where row(r) returns the r-th.
+    template <typename Rows>
+    void train(size_t n, Rows&& row) {
+        std::vector<float> lo(dimension_, std::numeric_limits<float>::max());
+        std::vector<float> hi(dimension_, std::numeric_limits<float>::lowest());
+        for (size_t r = 0; r < n; ++r) {
+            const float* v = row(r);
+            for (size_t i = 0; i < dimension_; ++i) {
+                lo[i] = std::min(lo[i], v[i]);
+                hi[i] = std::max(hi[i], v[i]);
+            }
+        }
+        std::vector<float> scale(dimension_, 0.0f);
+        for (size_t i = 0; i < dimension_; ++i) {
+            if (n == 0) lo[i] = 0.0f;
+            else scale[i] = (hi[i] - lo[i]) / 255.0f;
+        }
+        set_params(std::move(lo), std::move(scale));
+    }
+
+    void set_params(std::vector<float> min, std::vector<float> scale) {
+        min_ = std::move(min);
+        scale_ = std::move(scale);
+    }
+
+    // Values outside the trained range clamp to its ends.
+    void encode(const float* v, uint8_t* code) const {
+        for (size_t i = 0; i < dimension_; ++i) {
+            float c = scale_[i] > 0.0f ? std::round((v[i] - min_[i]) / scale_[i]) : 0.0f;
+            code[i] = static_cast<uint8_t>(std::max(0.0f, std::min(255.0f, c)));
+        }
+    }
+
+    void decode(const uint8_t* code, float* v) const {
+        for (size_t i = 0; i < dimension_; ++i) v[i] = min_[i] + static_cast<float>(code[i]) * scale_[i];
+    }
+
+    // `q` is already in the index's stored form (normalized for cosine).
+    void prepare(const float* q, Query& out) const {
+        out.values.resize(dimension_);
+        if (metric_ == "l2") {
+            for (size_t i = 0; i < dimension_; ++i) out.values[i] = q[i] - min_[i];
+            out.offset = 0.0f;
+            out.sign = 1.0f;
+            return;
+        }
+        float bias = 0.0f;
+        for (size_t i = 0; i < dimension_; ++i) {
+            out.values[i] = q[i] * scale_[i];
+            bias += q[i] * min_[i];
+        }
+        // cosine: 1 - (bias + dot), dot: -(bias + dot)
+        out.offset = metric_ == "cosine" ? 1.0f - bias : -bias;
+        out.sign = -1.0f;
+    }
+
+    float distance(const Query& q, const uint8_t* code) const {
+        return q.offset + q.sign * kernel_(q.values.data(), code, scale_.data(), dimension_);
+    }
+
+private:
+    size_t dimension_ = 0;
+    std::string metric_;
+    SQ8Kernel kernel_ = sq8_l2_sq;
+    std::vector<float> min_, scale_;
+};
+
+// Product quantizer: vectors are split into m equal subspaces and each
+// sub-vector is replaced by the index of its nearest centroid in that
+// subspace's codebook (k-means, up to 256 centroids), giving m-byte codes.
+// Queries build an m x ksub table of per-subspace distances (asymmetric
+// distance computation), so ranking a code is m table lookups. Two codes are
+// compared through precomputed centroid-to-centroid tables (symmetric
+// distance), which graph construction uses. Ranking distances match
+// get_index_distance_func for the metric.
+class ProductQuantizer {
+public:
+    using Query = QuantizedQuery;
+
+    static constexpr size_t kMaxCentroids = 256;
+    static constexpr size_t kMaxPointsPerCentroid = 256;  // training sample cap
+    static constexpr int kIterations = 25;
+
+    ProductQuantizer() = default;
+    ProductQuantizer(size_t dimension, size_t m, const std::string& metric)
+        : dimension_(dimension), m_(m), dsub_(m ? dimension / m : 0), l2_(metric == "l2"),
+          // l2: sum of squared parts; cosine: 1 - dot; dot: -dot
+          offset_(metric == "cosine" ? 1.0f : 0.0f), sign_(l2_ ? 1.0f : -1.0f) {}
+
+    bool trained() const { return ksub_ > 0; }
+    size_t m() const { return m_; }
+    size_t ksub() const { return ksub_; }
+    size_t code_size() const { return m_; }
+    const std::vector<float>& centroids() const { return centroids_; }
+
+    // Run k-means per subspace over n vectors, where row(r) returns the r-th.
+    // At most kMaxPointsPerCentroid * kMaxCentroids rows are sampled.
+    template <typename Rows>
+    void train(size_t n, Rows&& row, size_t num_threads = 0) {
+        std::mt19937 rng(42);
+        std::vector<size_t> picks(n);
+        std::iota(picks.begin(), picks.end(), size_t(0));
+        std::shuffle(picks.begin(), picks.end(), rng);
+        picks.resize(std::min(n, kMaxPointsPerCentroid * kMaxCentroids));
+        size_t k = std::min(kMaxCentroids, picks.size());
+
+        std::vector<float> centroids(m_ * k * dsub_);
+        parallel_for(m_, num_threads, [&](size_t s) {
+            std::vector<float> points(picks.size() * dsub_);
+            for (size_t i = 0; i < picks.size(); ++i) {
+                const float* v = row(picks[i]) + s * dsub_;
+                std::copy(v, v + dsub_, points.data() + i * dsub_);
+            }
+            kmeans(points.data(), picks.size(), k, centroids.data() + s * k * dsub_, static_cast<uint32_t>(s));
+        });
+        set_params(k, std::move(centroids));
+    }
+
+    void set_params(size_t ksub, std::vector<float> centroids) {
+        ksub_ = ksub;
+        centroids_ = std::move(centroids);
+        sdc_.resize(m_ * ksub_ * ksub_);
+        for (size_t s = 0; s < m_; ++s) {
+            for (size_t a = 0; a < ksub_; ++a) {
+                for (size_t b = 0; b < ksub_; ++b) sdc_[(s * ksub_ + a) * ksub_ + b] = part(centroid(s, a), centroid(s, b));
+            }
+        }
+    }
+
+    void encode(const float* v, uint8_t* code) const {
+        for (size_t s = 0; s < m_; ++s) code[s] = static_cast<uint8_t>(nearest(v + s * dsub_, centroid(s, 0), ksub_));
+    }
+
+    void decode(const uint8_t* code, float* v) const {
+        for (size_t s = 0; s < m_; ++s) {
+            const float* c = centroid(s, code[s]);
+            std::copy(c, c + dsub_, v + s * dsub_);
+        }
+    }
+
+    // `q` is already in the index's stored form (normalized for cosine).
+    void prepare(const float* q, Query& out) const {
+        out.values.resize(m_ * ksub_);
+        for (size_t s = 0; s < m_; ++s) {
+            const float* qs = q + s * dsub_;
+            float* table = out.values.data() + s * ksub_;
+            for (size_t j = 0; j < ksub_; ++j) table[j] = part(qs, centroid(s, j));
+        }
+        out.offset = offset_;
+        out.sign = sign_;
+    }
+
+    // Asymmetric: prepared query vs code.
+    float distance(const Query& q, const uint8_t* code) const {
+        return q.offset + q.sign * lookup(q.values.data(), code);
+    }
+
+    // Symmetric: code vs code, each side standing for its centroids.
+    float distance(const uint8_t* a, const uint8_t* b) const {
+        float sum = 0.0f;
+        for (size_t s = 0; s < m_; ++s) sum += sdc_[(s * ksub_ + a[s]) * ksub_ + b[s]];
+        return offset_ + sign_ * sum;
+    }
+
+private:
+    const float* centroid(size_t s, size_t j) const { return centroids_.data() + (s * ksub_ + j) * dsub_; }
+
+    // This subspace's share of the metric: squared L2 or dot product.
+    float part(const float* a, const float* b) const {
+        float sum = 0.0f;
+        if (l2_) {
+            for (size_t i = 0; i < dsub_; ++i) sum += (a[i] - b[i]) * (a[i] - b[i]);
+        } else {
+            for (size_t i = 0; i < dsub_; ++i) sum += a[i] * b[i];
+        }
+        return sum;
+    }
+
+    // Sum table[s][code[s]] over subspaces, four independent chains at a time.
+    float lookup(const float* table, const uint8_t* code) const {
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+        size_t s = 0;
+        for (; s + 4 <= m_; s += 4) {
+            s0 += table[s * ksub_ + code[s]];
+            s1 += table[(s + 1) * ksub_ + code[s + 1]];
+            s2 += table[(s + 2) * ksub_ + code[s + 2]];
+            s3 += table[(s + 3) * ksub_ + code[s + 3]];
+        }
+        for (; s < m_; ++s) s0 += table[s * ksub_ + code[s]];
+        return (s0 + s1) + (s2 + s3);
+    }
+
+    size_t nearest(const float* v, const float* centroids, size_t k) const {
+        size_t best = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (size_t j = 0; j < k; ++j) {
+            const float* c = centroids + j * dsub_;
+            float d = 0.0f;
+            for (size_t i = 0; i < dsub_; ++i) d += (v[i] - c[i]) * (v[i] - c[i]);
+            if (d < best_dist) {
+                best_dist = d;
+                best = j;
+            }
+        }
+        return best;
+    }
+
+    // Lloyd's algorithm on n points of dsub_ floats, seeded with k distinct
+    // points. An emptied cluster is re-seeded with a random point.
+    void kmeans(const float* points, size_t n, size_t k, float* centroids, uint32_t seed) const {
+        std::mt19937 rng(seed);
+        for (size_t j = 0; j < k; ++j) std::copy(points + j * dsub_, points + (j + 1) * dsub_, centroids + j * dsub_);
+        std::vector<size_t> assign(n);
+        std::vector<size_t> counts(k);
+        for (int it = 0; it < kIterations; ++it) {
+            bool changed = false;
+            for (size_t i = 0; i < n; ++i) {
+                size_t j = nearest(points + i * dsub_, centroids, k);
+                changed |= (j != assign[i]) || it == 0;
+                assign[i] = j;
+            }
+            if (!changed) break;
+            std::fill(centroids, centroids + k * dsub_, 0.0f);
+            std::fill(counts.begin(), counts.end(), size_t(0));
+            for (size_t i = 0; i < n; ++i) {
+                float* c = centroids + assign[i] * dsub_;
+                const float* p = points + i * dsub_;
+                for (size_t d = 0; d < dsub_; ++d) c[d] += p[d];
+                ++counts[assign[i]];
+            }
+            for (size_t j = 0; j < k; ++j) {
+                float* c = centroids + j * dsub_;
+                if (counts[j] == 0) {
+                    const float* p = points + (rng() % n) * dsub_;
+                    std::copy(p, p + dsub_, c);
+                    continue;
+                }
+                float inv = 1.0f / static_cast<float>(counts[j]);
+                for (size_t d = 0; d < dsub_; ++d) c[d] *= inv;
+            }
+        }
+    }
+
+    size_t dimension_ = 0;
+    size_t m_ = 0;
+    size_t dsub_ = 0;
+    bool l2_ = true;
+    float offset_ = 0.0f, sign_ = 1.0f;
+    size_t ksub_ = 0;
+    std::vector<float> centroids_;  // m_ x ksub_ x dsub_
+    std::vector<float> sdc_;        // m_ x ksub_ x ksub_
+};
+
+} // namespace vecdb
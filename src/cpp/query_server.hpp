@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "collection.hpp"
+#include "parallel.hpp"
+#include "sharded_collection.hpp"
+
+namespace vecdb {
+
+// Serves single queries submitted one at a time by many callers through the
+// batched search path. submit() queues a copy of the query and returns a
+// ticket at once; a pool of worker threads takes the queue in micro-batches
+// of up to max_batch queries sharing the oldest query's k and ef_search,
+// waiting at most max_wait_us past that query's arrival for a batch to fill,
+// and runs each batch with one search_batch() call.
+//
+// Finished queries are collected by take_completed(). An event loop can wait
+// on notify_fd(), which turns readable whenever completions are waiting, in
+// place of a thread per caller; take_completed() drains it.
+//
+// close() stops taking queries and returns once the queued ones are done.
+class QueryServer {
+public:
+    static constexpr size_t kDefaultMaxBatch = 64;
+    static constexpr uint64_t kDefaultMaxWaitUs = 200;
+
+    // Search n row-major queries for k results each at one ef_search,
+    // writing n x k IDs and distances padded with -1 and +inf.
+    using BatchSearch = std::function<void(const float* queries, size_t n, size_t k, size_t ef_search,
+                                           int64_t* ids, float* distances)>;
+
+    // A finished query: its results, closest first, or the error it failed with.
+    struct Completion {
+        uint64_t ticket = 0;
+        std::vector<std::pair<int64_t, float>> results;
+        std::string error;
+    };
+
+    // Serve `search` over queries of `dimension` floats on num_threads
+    // workers (0 = all cores).
+    QueryServer(size_t dimension, BatchSearch search, size_t max_batch = kDefaultMaxBatch,
+                uint64_t max_wait_us = kDefaultMaxWaitUs, size_t num_threads = 0)
+        : dimension_(dimension), search_(std::move(search)), max_batch_(max_batch),
+          max_wait_(std::chrono::microseconds(max_wait_us)) {
+        if (max_batch_ < 1) throw std::invalid_argument("max_batch must be >= 1");
+        int fds[2];
+        if (::pipe(fds) != 0) throw std::runtime_error(std::string("Failed to create pipe: ") + std::strerror(errno));
+        for (int fd : fds) {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        read_fd_ = fds[0];
+        write_fd_ = fds[1];
+        num_threads_ = resolve_num_threads(num_threads, SIZE_MAX);
+        try {
+            for (size_t i = 0; i < num_threads_; ++i) workers_.emplace_back([this] { run(); });
+        } catch (...) {
+            close();
+            close_fds();
+            throw;
+        }
+    }
+
+    // Serve a collection's search_batch(), one thread per batch.
+    QueryServer(std::shared_ptr<const Collection> collection, size_t max_batch = kDefaultMaxBatch,
+                uint64_t max_wait_us = kDefaultMaxWaitUs, size_t num_threads = 0)
+        : QueryServer(collection->dimension(),
+                      [collection](const float* q, size_t n, size_t k, size_t ef, int64_t* ids, float* dists) {
+                          collection->search_batch(q, n, k, ef, 1, ids, dists);
+                      },
+                      max_batch, max_wait_us, num_threads) {}
+
+    // Serve a sharded collection's search_batch(), its shards searched in
+    // turn by the worker running the batch.
+    QueryServer(std::shared_ptr<const ShardedCollection> collection, size_t max_batch = kDefaultMaxBatch,
+                uint64_t max_wait_us = kDefaultMaxWaitUs, size_t num_threads = 0)
+        : QueryServer(collection->dimension(),
+                      [collection](const float* q, size_t n, size_t k, size_t ef, int64_t* ids, float* dists) {
+                          collection->search_batch(q, n, k, ef, 1, ids, dists);
+                      },
+                      max_batch, max_wait_us, num_threads) {}
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    ~QueryServer() {
+        close();
+        close_fds();
+    }
+
+    // Queue a query of dimension() floats for its k nearest neighbours,
+    // returning the ticket its Completion will carry.
+    uint64_t submit(const float* query, size_t k, size_t ef_search) {
+        if (k < 1) throw std::invalid_argument("k must be >= 1");
+        std::vector<float> vec(query, query + dimension_);
+        uint64_t ticket;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            if (closed_) throw std::runtime_error("Query server is closed");
+            ticket = next_ticket_++;
+            queue_.push_back(Request{ticket, k, ef_search, std::move(vec), Clock::now()});
+        }
+        queued_.notify_one();
+        return ticket;
+    }
+
+    // Move every completion not yet taken into `out`, returning how many.
+    size_t take_completed(std::vector<Completion>& out) {
+        // Drain the pipe first: a completion landing after the swap below
+        // writes a fresh byte, so none is left waiting without a wakeup.
+        char buf[64];
+        while (::read(read_fd_, buf, sizeof(buf)) > 0) {
+        }
+        std::vector<Completion> done;
+        {
+            std::lock_guard<std::mutex> lock(done_mutex_);
+            done.swap(done_);
+        }
+        out.insert(out.end(), std::make_move_iterator(done.begin()), std::make_move_iterator(done.end()));
+        return done.size();
+    }
+
+    // Stop taking queries and wait for the queued ones to finish. Their
+    // completions can still be taken afterwards.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            closed_ = true;
+        }
+        queued_.notify_all();
+        std::lock_guard<std::mutex> lock(join_mutex_);
+        for (auto& t : workers_) {
+            if (t.joinable()) t.join();
+        }
+        workers_.clear();
+    }
+
+    // Readable while completions are waiting to be taken.
+    int notify_fd() const { return read_fd_; }
+    size_t dimension() const { return dimension_; }
+    size_t max_batch() const { return max_batch_; }
+    uint64_t max_wait_us() const { return static_cast<uint64_t>(max_wait_.count()); }
+    size_t num_threads() const { return num_threads_; }
+
+    // Queries submitted and not yet taken into a batch.
+    size_t queued() const {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        return queue_.size();
+    }
+
+    // Batches run and the queries they held, for judging how well queries
+    // coalesce.
+    size_t batches() const { return batches_.load(); }
+    size_t batched_queries() const { return batched_queries_.load(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        uint64_t ticket;
+        size_t k;
+        size_t ef_search;
+        std::vector<float> query;
+        Clock::time_point arrived;
+    };
+
+    void run() {
+        std::vector<Request> batch;
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        for (;;) {
+            queued_.wait(lock, [&] { return closed_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            // Hold the batch open until it fills or the oldest query's wait
+            // runs out; closing flushes at once.
+            queued_.wait_until(lock, queue_.front().arrived + max_wait_, [&] {
+                return closed_ || queue_.empty() || queue_.size() >= max_batch_;
+            });
+            if (queue_.empty()) continue;  // another worker took them
+            take_batch(batch);
+            // Leftovers may already be due; wake another worker for them.
+            if (!queue_.empty()) queued_.notify_one();
+            lock.unlock();
+            run_batch(batch);
+            lock.lock();
+        }
+    }
+
+    // Move up to max_batch queued requests with the oldest one's k and
+    // ef_search into `batch`, in arrival order.
+    void take_batch(std::vector<Request>& batch) {
+        batch.clear();
+        size_t k = queue_.front().k, ef = queue_.front().ef_search;
+        auto keep = queue_.begin();
+        for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+            if (batch.size() < max_batch_ && it->k == k && it->ef_search == ef) {
+                batch.push_back(std::move(*it));
+            } else {
+                if (keep != it) *keep = std::move(*it);
+                ++keep;
+            }
+        }
+        queue_.erase(keep, queue_.end());
+    }
+
+    void run_batch(const std::vector<Request>& batch) {
+        size_t n = batch.size(), k = batch[0].k;
+        std::vector<Completion> done(n);
+        for (size_t i = 0; i < n; ++i) done[i].ticket = batch[i].ticket;
+        try {
+            std::vector<float> queries(n * dimension_);
+            for (size_t i = 0; i < n; ++i)
+                std::memcpy(queries.data() + i * dimension_, batch[i].query.data(), dimension_ * sizeof(float));
+            std::vector<int64_t> ids(n * k);
+            std::vector<float> dists(n * k);
+            search_(queries.data(), n, k, batch[0].ef_search, ids.data(), dists.data());
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = i * k; j < (i + 1) * k && ids[j] >= 0; ++j) done[i].results.emplace_back(ids[j], dists[j]);
+            }
+        } catch (const std::exception& e) {
+            for (auto& c : done) {
+                c.results.clear();
+                c.error = e.what();
+            }
+        }
+        batches_.fetch_add(1);
+        batched_queries_.fetch_add(n);
+
+        bool was_empty;
+        {
+            std::lock_guard<std::mutex> lock(done_mutex_);
+            was_empty = done_.empty();
+            done_.insert(done_.end(), std::make_move_iterator(done.begin()), std::make_move_iterator(done.end()));
+        }
+        // One byte per empty-to-waiting change; a full pipe is already readable.
+        if (was_empty) {
+            char byte = 1;
+            ssize_t written = ::write(write_fd_, &byte, 1);
+            (void)written;
+        }
+    }
+
+    void close_fds() {
+        if (read_fd_ >= 0) ::close(read_fd_);
+        if (write_fd_ >= 0) ::close(write_fd_);
+        read_fd_ = write_fd_ = -1;
+    }
+
+    size_t dimension_;
+    BatchSearch search_;
+    size_t max_batch_;
+    std::chrono::microseconds max_wait_;
+    size_t num_threads_ = 0;
+
+    mutable std::mutex queue_mutex_;  // queue_, closed_, next_ticket_
+    std::condition_variable queued_;
+    std::deque<Request> queue_;
+    bool closed_ = false;
+    uint64_t next_ticket_ = 1;
+
+    std::mutex done_mutex_;
+    std::vector<Completion> done_;
+    std::atomic<size_t> batches_{0};
+    std::atomic<size_t> batched_queries_{0};
+
+    std::mutex join_mutex_;
+    std::vector<std::thread> workers_;
+    int read_fd_ = -1;
+    int write_fd_ = -1;
+};
+
+}  // namespace vecdb
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "collection.hpp"
+#include "flat_hash_map.hpp"
+#include "id_filter.hpp"
+#include "parallel.hpp"
+
+namespace vecdb {
+
+// One logical collection split across independent Collections, each over
+// its own HNSWIndex. A user ID always lives in shard shard_of(id), a fixed
+// hash of the ID, so shards never share an ID and each can be built, saved,
+// logged and loaded on its own. Inserts are split by shard and the shards
+// built in parallel; a search asks every shard for its top k in parallel
+// and merges them.
+//
+// set_numa_nodes() pins the threads working on each shard to the CPUs of a
+// NUMA node. Threads started while pinned, such as an index build's
+// workers, inherit the pinning, so a shard's memory is first touched, and
+// placed, on its node.
+//
+// Inserts run one at a time; everything else synchronizes within the shard
+// it touches, as in Collection. set_numa_nodes() is not synchronized.
+class ShardedCollection {
+public:
+    // Shards of equal dimension, each holding only the IDs shard_of() routes to it.
+    explicit ShardedCollection(std::vector<std::shared_ptr<Collection>> shards) : shards_(std::move(shards)) {
+        if (shards_.empty()) throw std::invalid_argument("A sharded collection needs at least one shard");
+        dimension_ = shards_[0]->dimension();
+        for (size_t s = 0; s < shards_.size(); ++s) {
+            if (shards_[s]->dimension() != dimension_)
+                throw std::invalid_argument("Shard " + std::to_string(s) + " has dimension " +
+                                            std::to_string(shards_[s]->dimension()) + ", expected " +
+                                            std::to_string(dimension_));
+            for (int64_t user_id : shards_[s]->user_ids()) {
+                if (shard_of(user_id) != s)
+                    throw DeserializationError("Shard " + std::to_string(s) + " holds user ID " +
+                                               std::to_string(user_id) + ", which belongs to shard " +
+                                               std::to_string(shard_of(user_id)));
+            }
+        }
+        shard_cpus_.resize(shards_.size());
+    }
+
+    // The shard of `user_id` among num_shards: the high bits of its
+    // splitmix64 hash, so shard membership does not correlate with the slot
+    // bits each shard's FlatIdMap uses. Part of the on-disk format.
+    static size_t shard_of(int64_t user_id, size_t num_shards) {
+        uint64_t x = static_cast<uint64_t>(user_id);
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        __extension__ typedef unsigned __int128 uint128;  // GCC/Clang; quiet under -Wpedantic
+        return static_cast<size_t>((static_cast<uint128>(x) * num_shards) >> 64);
+    }
+    size_t shard_of(int64_t user_id) const { return shard_of(user_id, shards_.size()); }
+
+    void insert(int64_t user_id, const float* vec) { insert_batch(&user_id, vec, 1, 1); }
+
+    // Insert n row-major vectors, building the shards they go to in parallel
+    // on up to num_threads threads in all (0 = all cores). Nothing is
+    // inserted if any user ID is already present or repeats in the batch.
+    void insert_batch(const int64_t* user_ids, const float* vectors, size_t n, size_t num_threads = 0) {
+        if (n == 0) return;
+        std::lock_guard<std::mutex> write(write_mutex_);
+        if (n > 1) {
+            FlatIdMap batch(n);
+            for (size_t i = 0; i < n; ++i) {
+                if (!batch.insert(user_ids[i], static_cast<int64_t>(i)))
+                    throw DuplicateIDError("Batch contains repeated user IDs");
+            }
+        }
+        std::vector<std::vector<size_t>> rows(shards_.size());
+        for (size_t i = 0; i < n; ++i) {
+            size_t s = shard_of(user_ids[i]);
+            if (shards_[s]->contains(user_ids[i]))
+                throw DuplicateIDError("User ID " + std::to_string(user_ids[i]) + " already exists");
+            rows[s].push_back(i);
+        }
+
+        std::vector<size_t> active;
+        for (size_t s = 0; s < shards_.size(); ++s) {
+            if (!rows[s].empty()) active.push_back(s);
+        }
+        size_t threads = resolve_num_threads(num_threads, n);
+        size_t per_shard = std::max<size_t>(1, threads / active.size());
+        parallel_for(active.size(), threads, [&](size_t j) {
+            size_t s = active[j];
+            const std::vector<size_t>& r = rows[s];
+            ScopedAffinity pin(shard_cpus_[s]);
+            if (r.size() == n) {
+                shards_[s]->insert_batch(user_ids, vectors, n, per_shard);
+                return;
+            }
+            std::vector<int64_t> ids(r.size());
+            std::vector<float> vecs(r.size() * dimension_);
+            for (size_t i = 0; i < r.size(); ++i) {
+                ids[i] = user_ids[r[i]];
+                std::memcpy(vecs.data() + i * dimension_, vectors + r[i] * dimension_, dimension_ * sizeof(float));
+            }
+            shards_[s]->insert_batch(ids.data(), vecs.data(), r.size(), per_shard);
+        });
+    }
+
+    // The k nearest user IDs to a query, closest first, among those `filter`
+    // (from allow()) lets through if given, searching the shards on up to
+    // num_threads threads (0 = one per shard). With many queries in flight
+    // at once, 1 searches the shards in turn on the calling thread and
+    // spares a thread start per shard.
+    std::vector<std::pair<int64_t, float>> search(const float* query, size_t k, size_t ef_search = 50,
+                                                  const std::vector<IdFilter>* filter = nullptr,
+                                                  const SearchOptions* options = nullptr,
+                                                  size_t num_threads = 0) const {
+        std::vector<std::vector<std::pair<int64_t, float>>> results(shards_.size());
+        parallel_for(shards_.size(), num_threads ? num_threads : shards_.size(), [&](size_t s) {
+            const IdFilter* shard_filter = filter ? &(*filter)[s] : nullptr;
+            if (shard_filter && shard_filter->count() == 0) return;
+            ScopedAffinity pin(shard_cpus_[s]);
+            results[s] = shards_[s]->search(query, k, ef_search, shard_filter, options);
+        });
+        return merge(results, k);
+    }
+
+    // The exact k nearest user IDs to each of n row-major queries, laid out
+    // as by Collection::search_exact(), scanning the shards in parallel on up
+    // to num_threads threads in all and merging their results.
+    void search_exact(const float* queries, size_t n, size_t k, size_t num_threads, int64_t* user_ids,
+                      float* distances) const {
+        if (k < 1) throw std::invalid_argument("k must be >= 1");
+        std::vector<std::vector<int64_t>> ids(shards_.size(), std::vector<int64_t>(n * k));
+        std::vector<std::vector<float>> dists(shards_.size(), std::vector<float>(n * k));
+        size_t threads = resolve_num_threads(num_threads, SIZE_MAX);
+        size_t per_shard = std::max<size_t>(1, threads / shards_.size());
+        parallel_for(shards_.size(), threads, [&](size_t s) {
+            ScopedAffinity pin(shard_cpus_[s]);
+            shards_[s]->search_exact(queries, n, k, per_shard, ids[s].data(), dists[s].data());
+        });
+        merge_rows(ids, dists, n, k, threads, user_ids, distances);
+    }
+
+    // search() for each of n row-major queries, laid out as by
+    // Collection::search_batch(), searching the shards in parallel on up to
+    // num_threads threads in all and merging their results.
+    void search_batch(const float* queries, size_t n, size_t k, size_t ef_search, size_t num_threads,
+                      int64_t* user_ids, float* distances, const std::vector<IdFilter>* filter = nullptr,
+                      const SearchOptions* options = nullptr) const {
+        if (k < 1) throw std::invalid_argument("k must be >= 1");
+        std::vector<std::vector<int64_t>> ids(shards_.size(), std::vector<int64_t>(n * k, -1));
+        std::vector<std::vector<float>> dists(shards_.size(), std::vector<float>(n * k));
+        size_t threads = resolve_num_threads(num_threads, SIZE_MAX);
+        size_t per_shard = std::max<size_t>(1, threads / shards_.size());
+        parallel_for(shards_.size(), threads, [&](size_t s) {
+            const IdFilter* shard_filter = filter ? &(*filter)[s] : nullptr;
+            if (shard_filter && shard_filter->count() == 0) return;
+            ScopedAffinity pin(shard_cpus_[s]);
+            shards_[s]->search_batch(queries, n, k, ef_search, per_shard, ids[s].data(), dists[s].data(),
+                                     shard_filter, options);
+        });
+        merge_rows(ids, dists, n, k, threads, user_ids, distances);
+    }
+
+    // Allow-lists for search(), one per shard, holding the n user IDs given;
+    // IDs not in the collection are ignored.
+    std::vector<IdFilter> allow(const int64_t* user_ids, size_t n) const {
+        std::vector<std::vector<int64_t>> ids(shards_.size());
+        for (size_t i = 0; i < n; ++i) ids[shard_of(user_ids[i])].push_back(user_ids[i]);
+        std::vector<IdFilter> filters;
+        filters.reserve(shards_.size());
+        for (size_t s = 0; s < shards_.size(); ++s) filters.push_back(shards_[s]->allow(ids[s].data(), ids[s].size()));
+        return filters;
+    }
+
+    bool remove(int64_t user_id) { return shards_[shard_of(user_id)]->remove(user_id); }
+
+    // Compact every shard (see Collection::compact()) in parallel on up to
+    // num_threads threads in all. Returns the rows reclaimed.
+    size_t compact(size_t num_threads = 0) {
+        std::vector<size_t> reclaimed(shards_.size());
+        size_t threads = resolve_num_threads(num_threads, SIZE_MAX);
+        size_t per_shard = std::max<size_t>(1, threads / shards_.size());
+        parallel_for(shards_.size(), threads, [&](size_t s) {
+            ScopedAffinity pin(shard_cpus_[s]);
+            reclaimed[s] = shards_[s]->compact(per_shard);
+        });
+        size_t total = 0;
+        for (size_t r : reclaimed) total += r;
+        return total;
+    }
+
+    // Renumber every shard by graph locality (see Collection::reorder()), in parallel.
+    void reorder() {
+        parallel_for(shards_.size(), shards_.size(), [&](size_t s) {
+            ScopedAffinity pin(shard_cpus_[s]);
+            shards_[s]->reorder();
+        });
+    }
+
+    // Allocate for n vectors in all, each shard its share plus room for the
+    // hash's imbalance (three standard deviations).
+    void reserve(size_t n) {
+        size_t share = (n + shards_.size() - 1) / shards_.size();
+        size_t cap = share + static_cast<size_t>(3 * std::sqrt(static_cast<double>(share))) + 1;
+        parallel_for(shards_.size(), shards_.size(), [&](size_t s) {
+            ScopedAffinity pin(shard_cpus_[s]);
+            shards_[s]->reserve(cap);
+        });
+    }
+
+    bool get(int64_t user_id, float* out) const { return shards_[shard_of(user_id)]->get(user_id, out); }
+    bool contains(int64_t user_id) const { return shards_[shard_of(user_id)]->contains(user_id); }
+
+    // Every user ID present, shard by shard.
+    std::vector<int64_t> user_ids() const {
+        std::vector<int64_t> ids;
+        for (const auto& shard : shards_) {
+            std::vector<int64_t> part = shard->user_ids();
+            ids.insert(ids.end(), part.begin(), part.end());
+        }
+        return ids;
+    }
+    size_t count() const {
+        size_t n = 0;
+        for (const auto& shard : shards_) n += shard->count();
+        return n;
+    }
+    size_t dimension() const { return dimension_; }
+    size_t num_shards() const { return shards_.size(); }
+    const std::vector<std::shared_ptr<Collection>>& shards() const { return shards_; }
+
+    // Pin the work on shard s to the CPUs of NUMA node nodes[s % size]; an
+    // empty list unpins. Must not run alongside other calls.
+    void set_numa_nodes(const std::vector<int>& nodes) {
+        std::vector<std::vector<int>> cpus(shards_.size());
+        for (size_t s = 0; !nodes.empty() && s < shards_.size(); ++s) {
+            cpus[s] = numa_node_cpus(nodes[s % nodes.size()]);
+            if (cpus[s].empty())
+                throw std::invalid_argument("NUMA node " + std::to_string(nodes[s % nodes.size()]) +
+                                            " has no CPUs online");
+        }
+        shard_cpus_ = std::move(cpus);
+        numa_nodes_ = nodes;
+    }
+    const std::vector<int>& numa_nodes() const { return numa_nodes_; }
+
+    // Merge per-shard results, each closest first, into the k closest
+    // overall. Ties go to the lower shard.
+    static std::vector<std::pair<int64_t, float>> merge(
+        const std::vector<std::vector<std::pair<int64_t, float>>>& lists, size_t k) {
+        using Head = std::pair<float, size_t>;  // distance, list
+        auto farther = [](const Head& a, const Head& b) {
+            return a.first > b.first || (a.first == b.first && a.second > b.second);
+        };
+        std::priority_queue<Head, std::vector<Head>, decltype(farther)> heap(farther);
+        std::vector<size_t> next(lists.size(), 0);
+        for (size_t s = 0; s < lists.size(); ++s) {
+            if (!lists[s].empty()) heap.push({lists[s][0].second, s});
+        }
+        std::vector<std::pair<int64_t, float>> merged;
+        merged.reserve(k);
+        while (merged.size() < k && !heap.empty()) {
+            size_t s = heap.top().second;
+            heap.pop();
+            merged.push_back(lists[s][next[s]]);
+            if (++next[s] < lists[s].size()) heap.push({lists[s][next[s]].second, s});
+        }
+        return merged;
+    }
+
+private:
+    // Merge the shards' n x k result rows, each padded with -1, into the
+    // n x k outputs on up to num_threads threads.
+    static void merge_rows(const std::vector<std::vector<int64_t>>& ids, const std::vector<std::vector<float>>& dists,
+                           size_t n, size_t k, size_t num_threads, int64_t* user_ids, float* distances) {
+        parallel_for(n, num_threads, [&](size_t i) {
+            std::vector<std::vector<std::pair<int64_t, float>>> lists(ids.size());
+            for (size_t s = 0; s < ids.size(); ++s) {
+                for (size_t j = i * k; j < (i + 1) * k && ids[s][j] >= 0; ++j)
+                    lists[s].emplace_back(ids[s][j], dists[s][j]);
+            }
+            auto merged = merge(lists, k);
+            for (size_t j = 0; j < k; ++j) {
+                bool found = j < merged.size();
+                user_ids[i * k + j] = found ? merged[j].first : -1;
+                distances[i * k + j] = found ? merged[j].second : std::numeric_limits<float>::infinity();
+            }
+        });
+    }
+
+    std::vector<std::shared_ptr<Collection>> shards_;
+    size_t dimension_ = 0;
+    std::vector<std::vector<int>> shard_cpus_;  // per shard; empty when unpinned
+    std::vector<int> numa_nodes_;
+    std::mutex write_mutex_;  // held by each insert throughout
+};
+
+} // namespace vecdb
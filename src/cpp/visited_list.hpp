@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "aligned_buffer.hpp"
+
+namespace vecdb {
+
+// Visited markers for one graph walk over dense node IDs. A node counts as
+// visited when its mark equals the current epoch, so starting a new walk is
+// a single increment instead of clearing the array.
+class VisitedList {
+public:
+    using Tag = uint16_t;
+
+    explicit VisitedList(size_t size) : marks_(size, 0) {}
+
+    // Forget every mark; the array is only cleared when the epoch wraps.
+    void reset() {
+        if (++epoch_ == 0) {
+            std::fill(marks_.begin(), marks_.end(), Tag(0));
+            epoch_ = 1;
+        }
+    }
+
+    // Mark `id`, returning false if it was already marked in this walk.
+    bool visit(size_t id) {
+        if (marks_[id] == epoch_) return false;
+        marks_[id] = epoch_;
+        return true;
+    }
+
+    bool visited(size_t id) const { return marks_[id] == epoch_; }
+    void prefetch_mark(size_t id) const { prefetch(&marks_[id], sizeof(Tag)); }
+    size_t size() const { return marks_.size(); }
+
+private:
+    std::vector<Tag> marks_;
+    Tag epoch_ = 0;
+};
+
+// Free list of VisitedLists shared by the threads searching one index. Each
+// walk checks a list out and returns it when the handle goes out of scope.
+// Copies of a pool start empty.
+class VisitedListPool {
+public:
+    class Handle {
+    public:
+        Handle(VisitedListPool& pool, std::unique_ptr<VisitedList> list) : pool_(pool), list_(std::move(list)) {}
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+        ~Handle() { pool_.release(std::move(list_)); }
+
+        VisitedList* operator->() { return list_.get(); }
+        VisitedList& operator*() { return *list_; }
+
+    private:
+        VisitedListPool& pool_;
+        std::unique_ptr<VisitedList> list_;
+    };
+
+    VisitedListPool() = default;
+    VisitedListPool(const VisitedListPool&) {}
+    VisitedListPool& operator=(const VisitedListPool&) { return *this; }
+
+    // A reset list covering IDs [0, size). Lists sized for a smaller index
+    // (before it grew) are dropped rather than reused.
+    Handle acquire(size_t size) {
+        std::unique_ptr<VisitedList> list;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (!free_.empty() && !list) {
+                if (free_.back()->size() >= size) list = std::move(free_.back());
+                free_.pop_back();
+            }
+        }
+        if (!list) list = std::make_unique<VisitedList>(size);
+        list->reset();
+        return Handle(*this, std::move(list));
+    }
+
+private:
+    void release(std::unique_ptr<VisitedList> list) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(list));
+    }
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<VisitedList>> free_;
+};
+
+} // namespace vecdb
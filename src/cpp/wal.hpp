@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file_io.hpp"
+#include "hnsw_index.hpp"
+
+namespace vecdb {
+
+// Append-only log of the inserts and removals made to a collection since its
+// last snapshot. Each record carries a log sequence number (LSN), one higher
+// than the record before; a snapshot notes the last LSN it includes, so
+// recovery loads the snapshot and replays only the records after it.
+//
+// Records reach the file as they are appended, so they survive the process
+// dying, and are synced to disk in groups: once sync_bytes have been appended
+// since the last sync, or on sync(). A record torn by a crash fails its
+// checksum and ends the log there.
+//
+// Format: [magic "VECDBWAL"][version u32][dimension u32][base LSN u64], then
+// records [body bytes u32][CRC-32C of body u32][body], body being
+// [LSN u64][op u32][0 u32][count u64][user IDs i64 * count] followed, for
+// inserts, by [vectors f32 * count * dimension]. LSNs start after the base.
+class WriteAheadLog {
+public:
+    static constexpr char kMagic[] = "VECDBWAL";
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kHeaderSize = 24;
+    static constexpr size_t kDefaultSyncBytes = size_t(1) << 20;
+
+    enum Op : uint32_t { kInsert = 1, kRemove = 2 };
+
+    // Open the log at `path` for appending, creating it if missing. New
+    // records are numbered after the file's last LSN, or after_lsn if that
+    // is higher. A torn record at the end of an existing log is cut off.
+    WriteAheadLog(const std::string& path, size_t dimension, size_t sync_bytes = kDefaultSyncBytes,
+                  uint64_t after_lsn = 0)
+        : path_(path), dimension_(dimension), sync_bytes_(sync_bytes) {
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) fail("open");
+        try {
+            size_t end = file_size(fd_);
+            if (end == 0) {
+                write_header(fd_, dimension_, after_lsn);
+                end = kHeaderSize;
+            } else {
+                uint64_t base = read_header(fd_, end, dimension_);
+                last_lsn_ = base;
+                end = scan(fd_, end, dimension_, [&](uint64_t lsn, uint32_t, uint64_t, const uint8_t*) {
+                    last_lsn_ = lsn;
+                });
+                if (end < file_size(fd_) && ::ftruncate(fd_, static_cast<off_t>(end)) != 0) fail("truncate");
+            }
+            last_lsn_ = std::max(last_lsn_, after_lsn);
+            end_ = end;
+            if (::lseek(fd_, static_cast<off_t>(end_), SEEK_SET) < 0) fail("seek");
+        } catch (...) {
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    // Sync anything appended since the last sync; errors are dropped here.
+    ~WriteAheadLog() {
+        if (unsynced_) ::fsync(fd_);
+        ::close(fd_);
+    }
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Log n inserts of row-major vectors; returns the last LSN written.
+    uint64_t append_insert(const int64_t* user_ids, const float* vectors, size_t n) {
+        return append(kInsert, user_ids, vectors, n);
+    }
+    // Log the removal of n user IDs; returns the last LSN written.
+    uint64_t append_remove(const int64_t* user_ids, size_t n) { return append(kRemove, user_ids, nullptr, n); }
+
+    // Sync every record appended so far to disk.
+    void sync() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sync_locked();
+    }
+
+    // Drop the records up to `through_lsn`, which a snapshot now holds. Later
+    // records are kept; the rewritten log replaces the old one by rename.
+    void truncate(uint64_t through_lsn) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sync_locked();
+        std::vector<uint8_t> kept;
+        scan(fd_, end_, dimension_, [&](uint64_t lsn, uint32_t, uint64_t, const uint8_t* record) {
+            if (lsn <= through_lsn) return;
+            uint32_t body;
+            std::memcpy(&body, record, 4);
+            kept.insert(kept.end(), record, record + 8 + body);
+        });
+        std::string tmp = path_ + ".tmp";
+        int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) fail("open");
+        try {
+            write_header(fd, dimension_, std::min(through_lsn, last_lsn_));
+            write_all(fd, kept.data(), kept.size());
+            if (::fsync(fd) != 0) fail("sync");
+            if (std::rename(tmp.c_str(), path_.c_str()) != 0) fail("rename");
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd_);
+        fd_ = fd;
+        end_ = kHeaderSize + kept.size();
+    }
+
+    uint64_t last_lsn() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return last_lsn_;
+    }
+    // Bytes of records in the log, not counting its header.
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return end_ - kHeaderSize;
+    }
+    size_t dimension() const { return dimension_; }
+    const std::string& path() const { return path_; }
+
+    // Call insert(lsn, user_ids, vectors, n) or remove(lsn, user_ids, n) for
+    // each record of the log at `path` with an LSN above after_lsn, in order.
+    // Returns the last LSN in the log, or after_lsn if that is higher.
+    template <typename Insert, typename Remove>
+    static uint64_t replay(const std::string& path, size_t dimension, uint64_t after_lsn, Insert&& insert,
+                           Remove&& remove) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+        uint64_t last;
+        std::vector<int64_t> ids;
+        std::vector<float> vectors;
+        try {
+            size_t size = file_size(fd);
+            last = std::max(read_header(fd, size, dimension), after_lsn);
+            scan(fd, size, dimension, [&](uint64_t lsn, uint32_t op, uint64_t n, const uint8_t* record) {
+                last = std::max(last, lsn);
+                if (lsn <= after_lsn) return;
+                const uint8_t* p = record + 8 + kBodyHeader;
+                ids.resize(n);
+                std::memcpy(ids.data(), p, n * 8);
+                if (op == kInsert) {
+                    vectors.resize(n * dimension);
+                    std::memcpy(vectors.data(), p + n * 8, n * dimension * sizeof(float));
+                    insert(lsn, ids.data(), vectors.data(), static_cast<size_t>(n));
+                } else {
+                    remove(lsn, ids.data(), static_cast<size_t>(n));
+                }
+            });
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        return last;
+    }
+
+private:
+    static constexpr size_t kBodyHeader = 24;  // [LSN][op][0][count]
+    static constexpr size_t kMaxRecordBytes = size_t(64) << 20;
+
+    // Batches too big for one record are split over several, so a crash
+    // while logging one can leave a prefix of it in the log.
+    uint64_t append(Op op, const int64_t* user_ids, const float* vectors, size_t n) {
+        size_t row_floats = op == kInsert ? dimension_ : 0;
+        size_t per_record = std::max<size_t>(1, kMaxRecordBytes / (8 + row_floats * sizeof(float)));
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t start = 0; start < n; start += per_record) {
+            size_t rows = std::min(per_record, n - start);
+            append_record(op, user_ids + start, row_floats ? vectors + start * row_floats : nullptr, rows);
+        }
+        if (unsynced_ >= sync_bytes_) sync_locked();
+        return last_lsn_;
+    }
+
+    void append_record(Op op, const int64_t* user_ids, const float* vectors, size_t n) {
+        size_t floats = op == kInsert ? n * dimension_ : 0;
+        size_t body = kBodyHeader + n * 8 + floats * sizeof(float);
+        if (body > UINT32_MAX) throw std::invalid_argument("Vectors too large to log");
+        uint64_t lsn = last_lsn_ + 1;
+        buf_.resize(8 + body);
+        uint8_t* p = buf_.data() + 8;
+        uint32_t op_word[2] = {op, 0};
+        uint64_t count = n;
+        std::memcpy(p, &lsn, 8);
+        std::memcpy(p + 8, op_word, 8);
+        std::memcpy(p + 16, &count, 8);
+        std::memcpy(p + kBodyHeader, user_ids, n * 8);
+        if (floats) std::memcpy(p + kBodyHeader + n * 8, vectors, floats * sizeof(float));
+        uint32_t prefix[2] = {static_cast<uint32_t>(body), crc32c(0, p, body)};
+        std::memcpy(buf_.data(), prefix, 8);
+        try {
+            write_all(fd_, buf_.data(), buf_.size());
+        } catch (...) {
+            // Cut off a partial record so the next append starts cleanly
+            if (::ftruncate(fd_, static_cast<off_t>(end_)) == 0) ::lseek(fd_, static_cast<off_t>(end_), SEEK_SET);
+            throw;
+        }
+        end_ += buf_.size();
+        last_lsn_ = lsn;
+        unsynced_ += buf_.size();
+    }
+
+    void sync_locked() {
+        if (!unsynced_) return;
+        if (::fsync(fd_) != 0) fail("sync");
+        unsynced_ = 0;
+    }
+
+    static size_t file_size(int fd) {
+        struct stat st;
+        if (::fstat(fd, &st) != 0) throw std::runtime_error(std::string("Cannot stat log: ") + std::strerror(errno));
+        return static_cast<size_t>(st.st_size);
+    }
+
+    static void write_header(int fd, size_t dimension, uint64_t base_lsn) {
+        uint8_t header[kHeaderSize];
+        uint32_t words[2] = {kVersion, static_cast<uint32_t>(dimension)};
+        std::memcpy(header, kMagic, 8);
+        std::memcpy(header + 8, words, 8);
+        std::memcpy(header + 16, &base_lsn, 8);
+        write_all(fd, header, kHeaderSize);
+    }
+
+    // The header's base LSN, after checking it belongs to a log of `dimension`.
+    static uint64_t read_header(int fd, size_t size, size_t dimension) {
+        uint8_t header[kHeaderSize];
+        if (size < kHeaderSize || !read_at(fd, 0, header, kHeaderSize) || std::memcmp(header, kMagic, 8) != 0)
+            throw DeserializationError("Not a write-ahead log");
+        uint32_t version, dim;
+        uint64_t base;
+        std::memcpy(&version, header + 8, 4);
+        std::memcpy(&dim, header + 12, 4);
+        std::memcpy(&base, header + 16, 8);
+        if (version > kVersion)
+            throw DeserializationError("Log version " + std::to_string(version) + " is newer than supported " +
+                                       std::to_string(kVersion));
+        if (dim != dimension)
+            throw DeserializationError("Log dimension mismatch: log has " + std::to_string(dim) + ", expected " +
+                                       std::to_string(dimension));
+        return base;
+    }
+
+    // Call visit(lsn, op, count, record) for each intact record in the first
+    // `size` bytes, `record` pointing at its length prefix. Returns the offset
+    // just past the last intact record.
+    template <typename Visit>
+    static size_t scan(int fd, size_t size, size_t dimension, Visit&& visit) {
+        std::vector<uint8_t> record;
+        size_t offset = kHeaderSize;
+        while (size - offset >= 8 + kBodyHeader) {
+            uint32_t prefix[2];
+            if (!read_at(fd, offset, prefix, 8)) break;
+            size_t body = prefix[0];
+            if (body < kBodyHeader || body > size - offset - 8) break;
+            record.resize(8 + body);
+            if (!read_at(fd, offset, record.data(), record.size())) break;
+            const uint8_t* p = record.data() + 8;
+            if (crc32c(0, p, body) != prefix[1]) break;
+            uint64_t lsn, count;
+            uint32_t op;
+            std::memcpy(&lsn, p, 8);
+            std::memcpy(&op, p + 8, 4);
+            std::memcpy(&count, p + 16, 8);
+            size_t expect = op == kInsert ? kBodyHeader + count * (8 + dimension * sizeof(float))
+                          : op == kRemove ? kBodyHeader + count * 8 : 0;
+            if (expect != body) break;
+            visit(lsn, op, count, record.data());
+            offset += record.size();
+        }
+        return offset;
+    }
+
+    static bool read_at(int fd, size_t at, void* data, size_t n) {
+        uint8_t* p = static_cast<uint8_t*>(data);
+        while (n > 0) {
+            ssize_t r = ::pread(fd, p, n, static_cast<off_t>(at));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            p += r;
+            at += static_cast<size_t>(r);
+            n -= static_cast<size_t>(r);
+        }
+        return true;
+    }
+
+    static void write_all(int fd, const void* data, size_t n) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        while (n > 0) {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) throw std::runtime_error(std::string("Cannot write log: ") + std::strerror(errno));
+            p += w;
+            n -= static_cast<size_t>(w);
+        }
+    }
+
+    [[noreturn]] void fail(const char* what) const {
+        throw std::runtime_error(std::string("Cannot ") + what + " " + path_ + ": " + std::strerror(errno));
+    }
+
+    std::string path_;
+    size_t dimension_;
+    size_t sync_bytes_;
+    int fd_ = -1;
+    size_t end_ = kHeaderSize;  // file offset past the last record
+    uint64_t last_lsn_ = 0;
+    size_t unsynced_ = 0;       // bytes appended since the last sync
+    std::vector<uint8_t> buf_;  // the record being appended
+    mutable std::mutex mutex_;
+};
+
+} // namespace vecdb
@@ -7,6 +7,7 @@ A vector database with HNSW indexing for efficient similarity search.
 from vecdb._version import __version__
 from vecdb.vecdb import VecDB
 from vecdb.collection import Collection
+from vecdb.serving import AsyncSearcher
 from vecdb.exceptions import (
     VecDBError,
     DimensionError,
@@ -20,6 +21,7 @@ __all__ = [
     "__version__",
     "VecDB",
     "Collection",
+    "AsyncSearcher",
     "VecDBError",
     "DimensionError",
     "DuplicateIDError",
@@ -2,17 +2,25 @@
 Mock HNSW Index using brute-force search.
 
 This module provides a functional mock of the HNSW index that uses O(N) brute-force
-search instead of the actual HNSW algorithm. It implements the exact same interface
-as the C++ HNSW module for testing and development purposes.
+search instead of the actual HNSW algorithm, and of the collection core that maps
+user IDs onto it. It implements the exact same interface as the C++ HNSW module for
+testing and development purposes.
 
-The mock stores but ignores HNSW-specific parameters (M, ef_construction, ef_search)
-to maintain interface compatibility.
+The mock stores but ignores HNSW-specific parameters (M, ef_construction, ef_search,
+the neighbor selection flags and the storage mode) to maintain interface
+compatibility. It always searches full-precision vectors. Where the C++ classes
+let searches run alongside inserts, the mock simply runs one call at a time.
 """
 
 from __future__ import annotations
 
+import functools
 import math
+import os
 import pickle
+import struct
+import threading
+import time
 from typing import List, Tuple, Union
 
 import numpy as np
@@ -24,6 +32,15 @@ from vecdb.exceptions import DimensionError, DuplicateIDError, DeserializationEr
 VectorType = Union[List[float], np.ndarray]
 
 
+def _synchronized(method):
+    """Run the method under the object's lock, as the C++ classes may be called from many threads."""
+    @functools.wraps(method)
+    def wrapper(self, *args, **kwargs):
+        with self._lock:
+            return method(self, *args, **kwargs)
+    return wrapper
+
+
 class HNSWIndex:
     """
     Mock HNSW index using brute-force search.
@@ -35,31 +52,88 @@ class HNSWIndex:
         metric: Distance metric - 'l2', 'cosine', or 'dot'
         M: Max connections per node per layer (stored but unused in mock)
         ef_construction: Search width during construction (stored but unused in mock)
+        heuristic: Pick links with the HNSW diversity heuristic instead of
+            the closest candidates (stored but unused in mock)
+        keep_pruned: Fill remaining link slots with candidates the heuristic
+            discarded (stored but unused in mock)
+        extend_candidates: Also consider candidates' neighbors when linking
+            a new node (stored but unused in mock)
+        storage: Vector storage - 'float', 'int8' or 'pq' (stored but unused in mock)
+        rerank: Re-score final candidates with float vectors when storage is
+            quantized (stored but unused in mock)
+        pq_subspaces: Sub-vectors per PQ code; must divide dimension
+            (stored but unused in mock)
+        rerank_path: File holding the float vectors for rerank instead of
+            memory (stored but unused in mock)
+        max_elements: IDs to allocate node storage for up front (0 = grow
+            as needed)
     """
 
     VALID_METRICS = {'l2', 'cosine', 'dot'}
+    VALID_STORAGE = {'float', 'int8', 'pq'}
+
+    # Vector counts at which int8 and pq storage train their quantizer automatically
+    AUTO_TRAIN_SIZE = 1000
+    PQ_AUTO_TRAIN_SIZE = 10000
+
+    # First bytes of a file written by save()
+    MMAP_MAGIC = b'VECDBHNS'
+
+    # Index size up to which unfiltered searches scan instead of walking the graph
+    DEFAULT_FLAT_THRESHOLD = 2048
+
+    # Whether search(return_stats=True) and stats() are available; the C++
+    # module needs a build with VECDB_ENABLE_STATS
+    STATS_ENABLED = True
 
     def __init__(
         self,
         dimension: int,
         metric: str,
         M: int = 16,
-        ef_construction: int = 200
+        ef_construction: int = 200,
+        heuristic: bool = True,
+        keep_pruned: bool = False,
+        extend_candidates: bool = False,
+        storage: str = 'float',
+        rerank: bool = False,
+        pq_subspaces: int = 8,
+        rerank_path: str = '',
+        max_elements: int = 0
     ) -> None:
         if dimension < 1:
             raise ValueError(f"Dimension must be >= 1, got {dimension}")
         if metric not in self.VALID_METRICS:
             raise ValueError(f"Invalid metric '{metric}'. Must be one of: {self.VALID_METRICS}")
+        if storage not in self.VALID_STORAGE:
+            raise ValueError(f"Invalid storage: {storage}")
+        if storage == 'pq' and (pq_subspaces < 1 or dimension % pq_subspaces != 0):
+            raise ValueError("pq_subspaces must divide the dimension")
 
         self.dimension = dimension
         self.metric = metric
         self.M = M  # Stored but unused in mock
         self.ef_construction = ef_construction  # Stored but unused in mock
+        self.heuristic = heuristic  # Stored but unused in mock
+        self.keep_pruned = keep_pruned  # Stored but unused in mock
+        self.extend_candidates = extend_candidates  # Stored but unused in mock
+        self.storage = storage  # Stored but unused in mock
+        self.rerank = rerank  # Stored but unused in mock
+        self.pq_subspaces = pq_subspaces  # Stored but unused in mock
+        self.rerank_path = rerank_path  # Stored but unused in mock
+        self.is_trained = False
+        # Searches always scan in the mock; kept for the interface
+        self.flat_threshold = self.DEFAULT_FLAT_THRESHOLD
 
         # Internal storage
         self._vectors: dict[int, List[float]] = {}
         self._deleted: set[int] = set()
+        self._capacity = max_elements
+        self._lock = threading.RLock()
+        self._calibration: List[Tuple[int, float]] = []
+        self.reset_stats()
 
+    @_synchronized
     def add(self, internal_id: int, vector: VectorType) -> None:
         """
         Add vector with given internal ID.
@@ -84,13 +158,64 @@ class HNSWIndex:
 
         self._vectors[internal_id] = list(vector)  # Store a copy
         self._deleted.discard(internal_id)
+        self._inserts += 1
+        self._maybe_auto_train()
 
+    @_synchronized
+    def add_batch(
+        self,
+        internal_ids: np.ndarray,
+        vectors: np.ndarray,
+        num_threads: int = 0
+    ) -> None:
+        """
+        Add many vectors at once.
+
+        The whole batch is validated before anything is inserted.
+
+        Args:
+            internal_ids: 1-D array of unique identifiers
+            vectors: Array of shape (n, dimension)
+            num_threads: Worker threads (unused in mock)
+
+        Raises:
+            DimensionError: If vectors is not of shape (n, dimension)
+            DuplicateIDError: If an ID already exists or repeats in the batch
+            ValueError: If ids and vectors differ in length
+        """
+        internal_ids = np.asarray(internal_ids, dtype=np.int64)
+        vectors = np.asarray(vectors, dtype=np.float32)
+        if vectors.ndim != 2 or vectors.shape[1] != self.dimension:
+            raise DimensionError(f"Expected vectors of shape (n, {self.dimension})")
+
+        if internal_ids.ndim != 1 or len(internal_ids) != len(vectors):
+            raise ValueError("ids and vectors must have the same length")
+
+        seen = set()
+        for internal_id in internal_ids.tolist():
+            if internal_id in seen or (internal_id in self._vectors and internal_id not in self._deleted):
+                raise DuplicateIDError(f"ID {internal_id} already exists")
+            seen.add(internal_id)
+
+        for internal_id, vector in zip(internal_ids.tolist(), vectors.tolist()):
+            self._vectors[internal_id] = vector
+            self._deleted.discard(internal_id)
+        self._inserts += len(internal_ids)
+        self._maybe_auto_train()
+
+    @_synchronized
     def search(
         self,
         query: VectorType,
         k: int,
-        ef_search: int = 50
-    ) -> List[Tuple[int, float]]:
+        ef_search: int = 50,
+        filter=None,
+        return_stats: bool = False,
+        patience: int = 0,
+        max_ef: int = 0,
+        max_distances: int = 0,
+        target_recall: float = 0.0
+    ):
         """
         Find k nearest neighbors.
 
@@ -98,14 +223,28 @@ class HNSWIndex:
             query: Query vector
             k: Number of neighbors to return
             ef_search: Search width (stored but unused in mock)
+            filter: Optional boolean mask over internal IDs; only IDs it
+                marks True are returned
+            return_stats: Also return this search's counters
+            patience: Stop once this many node expansions in a row leave
+                the top k unchanged, and widen ef up to max_ef while they
+                still change (unused in mock)
+            max_ef: Largest ef a hard query is widened to (unused in mock)
+            max_distances: Distance-computation budget (unused in mock)
+            target_recall: Use the smallest ef that reached this recall in
+                calibrate() instead of ef_search
 
         Returns:
             List of (internal_id, distance) sorted by distance ascending.
             Returns fewer than k results if index has fewer vectors.
+            With return_stats, a tuple (results, stats) where stats is a
+            dict of 'distances', 'visited', 'heap_pushes', 'deleted_skipped'
+            and 'hops' (nodes expanded per level; empty for the mock's scan).
 
         Raises:
             DimensionError: If query dimension doesn't match index dimension
             ValueError: If k < 1
+            RuntimeError: If target_recall is given before calibrate()
         """
         # Convert numpy array to list if needed
         if isinstance(query, np.ndarray):
@@ -117,23 +256,256 @@ class HNSWIndex:
         if k < 1:
             raise ValueError(f"k must be >= 1, got {k}")
 
+        if target_recall > 0:
+            self.ef_for_recall(target_recall)
+
+        stats = self._zero_stats()
+
         # Return empty list for empty index
         if len(self) == 0:
-            return []
+            return ([], stats) if return_stats else []
+
+        allowed = None if filter is None else np.asarray(filter, dtype=bool)
 
         # Brute-force: compute all distances
         results = []
         for internal_id, vec in self._vectors.items():
+            if allowed is not None and not (internal_id < len(allowed) and allowed[internal_id]):
+                continue
             if internal_id not in self._deleted:
                 dist = self._compute_distance(query, vec)
                 results.append((internal_id, dist))
+            else:
+                stats['deleted_skipped'] += 1
+        stats['distances'] = stats['visited'] = len(results)
+        self._searches += 1
+        for key in ('distances', 'visited', 'deleted_skipped'):
+            self._search_stats[key] += stats[key]
 
         # Sort by distance ascending
         results.sort(key=lambda x: x[1])
 
         # Return up to k results
-        return results[:k]
+        return (results[:k], stats) if return_stats else results[:k]
 
+    @_synchronized
+    def calibrate(
+        self,
+        queries: np.ndarray,
+        k: int = 10,
+        ef_values=(),
+        patience: int = 0,
+        max_ef: int = 0,
+        max_distances: int = 0,
+        num_threads: int = 0
+    ) -> List[Tuple[int, float]]:
+        """
+        Measure mean recall@k of sample queries for each ef_search.
+
+        The curve is kept for search(target_recall=...). The mock searches
+        exactly, so every point has recall 1.0.
+
+        Args:
+            queries: Array of shape (n, dimension)
+            k: Neighbors per query
+            ef_values: ef_search values to measure (empty: k, 2k, 4k, ...
+                up to 1024)
+            patience, max_ef, max_distances: Options every search uses
+            num_threads: Worker threads (unused in mock)
+
+        Returns:
+            List of (ef_search, recall) in ascending ef_search
+
+        Raises:
+            DimensionError: If queries is not of shape (n, dimension)
+            ValueError: If k < 1, or there are no queries or no vectors
+        """
+        queries = np.asarray(queries, dtype=np.float32)
+        if queries.ndim != 2 or queries.shape[1] != self.dimension:
+            raise DimensionError(f"Expected queries of shape (n, {self.dimension})")
+        if k < 1:
+            raise ValueError(f"k must be >= 1, got {k}")
+        if len(queries) == 0:
+            raise ValueError("Calibration requires at least one query")
+        if len(self) == 0:
+            raise ValueError("Calibration requires a non-empty index")
+        ef_values = sorted(set(ef_values))
+        if not ef_values:
+            ef = k
+            while ef <= max(1024, k):
+                ef_values.append(ef)
+                ef *= 2
+        self._calibration = [(ef, 1.0) for ef in ef_values]
+        return list(self._calibration)
+
+    @_synchronized
+    def ef_for_recall(self, target: float) -> int:
+        """
+        The smallest calibrated ef_search whose recall reached target, or the
+        largest calibrated one if none did.
+
+        Raises:
+            RuntimeError: If calibrate() has not run
+        """
+        if not self._calibration:
+            raise RuntimeError("target_recall needs calibrate() first")
+        for ef, recall in self._calibration:
+            if recall >= target:
+                return ef
+        return self._calibration[-1][0]
+
+    @_synchronized
+    def stats(self) -> dict:
+        """
+        Counters summed over all searches and inserts.
+
+        Returns:
+            Dict with 'searches', 'inserts' and the summed 'search' and
+            'build' counters; 'build' also has 'prunes'. The mock's inserts
+            do no graph work, so its 'build' counters stay zero.
+        """
+        build = self._zero_stats()
+        build['prunes'] = 0
+        return {
+            'searches': self._searches,
+            'inserts': self._inserts,
+            'search': dict(self._search_stats),
+            'build': build,
+        }
+
+    @_synchronized
+    def reset_stats(self) -> None:
+        """Zero the counters stats() reports."""
+        self._searches = 0
+        self._inserts = 0
+        self._search_stats = self._zero_stats()
+
+    @_synchronized
+    def graph_health(self) -> dict:
+        """
+        Report the shape of the graph.
+
+        Returns:
+            Dict with 'nodes' (live), 'deleted', 'unreachable' (live nodes no
+            level-0 walk from the entry point reaches), 'degree_histogram'
+            (live nodes per level-0 link count, 0 to 2 * M) and
+            'level_counts' (nodes per top level). The mock keeps no links,
+            so every node has degree 0 and level 0 and none is unreachable.
+        """
+        nodes = len(self)
+        histogram = [0] * (2 * self.M + 1)
+        histogram[0] = nodes
+        return {
+            'nodes': nodes,
+            'deleted': len(self._deleted),
+            'unreachable': 0,
+            'degree_histogram': histogram,
+            'level_counts': [len(self._vectors)] if self._vectors else [],
+        }
+
+    @staticmethod
+    def _zero_stats() -> dict:
+        return {'distances': 0, 'visited': 0, 'heap_pushes': 0, 'deleted_skipped': 0, 'hops': []}
+
+    @_synchronized
+    def search_batch(
+        self,
+        queries: np.ndarray,
+        k: int,
+        ef_search: int = 50,
+        num_threads: int = 0,
+        filter=None,
+        patience: int = 0,
+        max_ef: int = 0,
+        max_distances: int = 0,
+        target_recall: float = 0.0
+    ) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        Find k nearest neighbors for each row of a 2-D query array.
+
+        Args:
+            queries: Array of shape (n, dimension)
+            k: Number of neighbors to return per query
+            ef_search: Search width (stored but unused in mock)
+            num_threads: Worker threads (unused in mock)
+            filter: Optional boolean mask over internal IDs, as for search()
+            patience, max_ef, max_distances, target_recall: Adaptive
+                termination, as for search()
+
+        Returns:
+            Tuple (ids, distances) of arrays with shape (n, k), int64 and
+            float32. Rows are sorted by distance ascending and padded with
+            id -1 and distance inf when fewer than k vectors exist.
+
+        Raises:
+            DimensionError: If queries is not of shape (n, dimension)
+            ValueError: If k < 1
+        """
+        queries = np.asarray(queries, dtype=np.float32)
+        if queries.ndim != 2 or queries.shape[1] != self.dimension:
+            raise DimensionError(f"Expected queries of shape (n, {self.dimension})")
+
+        if k < 1:
+            raise ValueError(f"k must be >= 1, got {k}")
+
+        ids = np.full((queries.shape[0], k), -1, dtype=np.int64)
+        distances = np.full((queries.shape[0], k), np.inf, dtype=np.float32)
+        for row, query in enumerate(queries):
+            results = self.search(query, k, ef_search, filter, patience=patience, max_ef=max_ef,
+                                  max_distances=max_distances, target_recall=target_recall)
+            for col, (internal_id, dist) in enumerate(results):
+                ids[row, col] = internal_id
+                distances[row, col] = dist
+
+        return ids, distances
+
+    @_synchronized
+    def search_exact(
+        self,
+        queries: np.ndarray,
+        k: int = 10,
+        num_threads: int = 0,
+        filter=None
+    ) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        Find the exact k nearest neighbors of each query row by scanning
+        every vector; the ground truth for recall measurements.
+
+        Args:
+            queries: Array of shape (n, dimension)
+            k: Number of neighbors to return per query
+            num_threads: Worker threads (unused in mock)
+            filter: Optional boolean mask over internal IDs, as for search()
+
+        Returns:
+            Tuple (ids, distances) laid out as by search_batch()
+
+        Raises:
+            DimensionError: If queries is not of shape (n, dimension)
+            ValueError: If k < 1
+        """
+        queries = np.asarray(queries, dtype=np.float32)
+        if queries.ndim != 2 or queries.shape[1] != self.dimension:
+            raise DimensionError(f"Expected queries of shape (n, {self.dimension})")
+        if k < 1:
+            raise ValueError(f"k must be >= 1, got {k}")
+
+        allowed = None if filter is None else np.asarray(filter, dtype=bool)
+        candidates = [
+            (internal_id, vec) for internal_id, vec in self._vectors.items()
+            if internal_id not in self._deleted
+            and (allowed is None or (internal_id < len(allowed) and allowed[internal_id]))
+        ]
+        ids = np.full((queries.shape[0], k), -1, dtype=np.int64)
+        distances = np.full((queries.shape[0], k), np.inf, dtype=np.float32)
+        for row, query in enumerate(queries.tolist()):
+            results = sorted(((self._compute_distance(query, vec), internal_id) for internal_id, vec in candidates))
+            for col, (dist, internal_id) in enumerate(results[:k]):
+                ids[row, col] = internal_id
+                distances[row, col] = dist
+        return ids, distances
+
+    @_synchronized
     def remove(self, internal_id: int) -> bool:
         """
         Mark vector as deleted (lazy deletion).
@@ -149,6 +521,77 @@ class HNSWIndex:
             return True
         return False
 
+    @_synchronized
+    def compact(self, num_threads: int = 0) -> int:
+        """
+        Drop every removed vector so its ID can be added again.
+
+        Args:
+            num_threads: Worker threads (unused in mock)
+
+        Returns:
+            The number of vectors reclaimed
+        """
+        for internal_id in self._deleted:
+            del self._vectors[internal_id]
+        reclaimed = len(self._deleted)
+        self._deleted.clear()
+        return reclaimed
+
+    @_synchronized
+    def reorder(self) -> np.ndarray:
+        """
+        Renumber the stored nodes by graph locality, so neighbors sit in
+        nearby slots. The mock keeps no links, so stored IDs keep their order
+        and move ahead of the empty slots.
+
+        Returns:
+            int64 array of each slot's new ID, indexed by its old one
+        """
+        slots = self._num_slots()
+        stored = sorted(self._vectors)
+        empty = [i for i in range(slots) if i not in self._vectors]
+        new_id = np.empty(slots, dtype=np.int64)
+        new_id[stored + empty] = np.arange(slots)
+        self._vectors = {int(new_id[i]): v for i, v in self._vectors.items()}
+        self._deleted = {int(new_id[i]) for i in self._deleted}
+        return new_id
+
+    @_synchronized
+    def train(self, vectors: np.ndarray = None) -> None:
+        """
+        Fit the int8 or pq quantizer and encode every stored vector.
+
+        Args:
+            vectors: Optional sample of shape (n, dimension); defaults to the
+                vectors already stored
+
+        Raises:
+            DimensionError: If vectors is not of shape (n, dimension)
+            ValueError: If there is nothing to train on
+            RuntimeError: If storage is 'float' or already trained
+        """
+        if self.storage == 'float':
+            raise RuntimeError("train() requires int8 or pq storage")
+        if self.is_trained:
+            raise RuntimeError("Quantizer is already trained")
+        if vectors is None:
+            n = len(self._vectors)
+        else:
+            vectors = np.asarray(vectors, dtype=np.float32)
+            if vectors.ndim != 2 or vectors.shape[1] != self.dimension:
+                raise DimensionError(f"Expected vectors of shape (n, {self.dimension})")
+            n = len(vectors)
+        if n == 0:
+            raise ValueError("Training requires at least one vector")
+        self.is_trained = True
+
+    def _maybe_auto_train(self) -> None:
+        threshold = self.PQ_AUTO_TRAIN_SIZE if self.storage == 'pq' else self.AUTO_TRAIN_SIZE
+        if self.storage != 'float' and not self.is_trained and len(self._vectors) >= threshold:
+            self.is_trained = True
+
+    @_synchronized
     def serialize(self) -> bytes:
         """
         Serialize entire index to bytes for persistence.
@@ -157,11 +600,19 @@ class HNSWIndex:
             Binary representation of the index
         """
         state = {
-            'version': 1,
+            'version': 4,
             'dimension': self.dimension,
             'metric': self.metric,
             'M': self.M,
             'ef_construction': self.ef_construction,
+            'heuristic': self.heuristic,
+            'keep_pruned': self.keep_pruned,
+            'extend_candidates': self.extend_candidates,
+            'storage': self.storage,
+            'rerank': self.rerank,
+            'pq_subspaces': self.pq_subspaces,
+            'rerank_path': self.rerank_path,
+            'is_trained': self.is_trained,
             'vectors': self._vectors,
             'deleted': self._deleted,
         }
@@ -193,8 +644,16 @@ class HNSWIndex:
                 dimension=state['dimension'],
                 metric=state['metric'],
                 M=state.get('M', 16),
-                ef_construction=state.get('ef_construction', 200)
+                ef_construction=state.get('ef_construction', 200),
+                heuristic=state.get('heuristic', True),
+                keep_pruned=state.get('keep_pruned', False),
+                extend_candidates=state.get('extend_candidates', False),
+                storage=state.get('storage', 'float'),
+                rerank=state.get('rerank', False),
+                pq_subspaces=state.get('pq_subspaces', 8),
+                rerank_path=state.get('rerank_path', '')
             )
+            index.is_trained = state.get('is_trained', False)
             index._vectors = state['vectors']
             index._deleted = state['deleted']
 
@@ -205,6 +664,83 @@ class HNSWIndex:
         except (KeyError, TypeError) as e:
             raise DeserializationError(f"Invalid serialized data format: {e}")
 
+    @_synchronized
+    def save(self, path: str) -> None:
+        """
+        Write the index to a file that open_mmap() and load() read.
+
+        Args:
+            path: Destination file path
+        """
+        with open(path, 'wb') as f:
+            f.write(self.MMAP_MAGIC)
+            f.write(self.serialize())
+
+    @staticmethod
+    def load(path: str) -> 'HNSWIndex':
+        """
+        Read a file written by save() fully into memory, verifying it.
+
+        Args:
+            path: File path
+
+        Returns:
+            The index stored in the file
+
+        Raises:
+            DeserializationError: If the file is missing, corrupt or not a save() file
+        """
+        return HNSWIndex.open_mmap(path)
+
+    @staticmethod
+    def open_mmap(path: str) -> 'HNSWIndex':
+        """
+        Open a file written by save(). The mock reads it fully.
+
+        Args:
+            path: File path
+
+        Returns:
+            The index stored in the file
+
+        Raises:
+            DeserializationError: If the file is missing, corrupt or not a save() file
+        """
+        try:
+            with open(path, 'rb') as f:
+                data = f.read()
+        except OSError as e:
+            raise DeserializationError(f"Cannot open {path}: {e}")
+        if not data.startswith(HNSWIndex.MMAP_MAGIC):
+            raise DeserializationError("Not a mapped index file")
+        return HNSWIndex.deserialize(data[len(HNSWIndex.MMAP_MAGIC):])
+
+    @_synchronized
+    def reserve(self, n: int) -> None:
+        """Allocate node storage for IDs below n. Never shrinks."""
+        self._capacity = max(self._capacity, n)
+
+    @_synchronized
+    def resize_index(self, n: int) -> None:
+        """
+        Reallocate node storage for exactly n IDs.
+
+        Raises:
+            ValueError: If an ID at or above n is stored
+        """
+        if n < self._num_slots():
+            raise ValueError(f"Cannot resize to {n} slots: IDs up to {self._num_slots() - 1} are stored")
+        self._capacity = n
+
+    @property
+    def capacity(self) -> int:
+        """IDs addressable without reallocating."""
+        return max(self._capacity, self._num_slots())
+
+    def _num_slots(self) -> int:
+        return max(self._vectors) + 1 if self._vectors else 0
+
+    @_synchronized
     def __len__(self) -> int:
         """Return count of non-deleted vectors."""
         return len(self._vectors) - len(self._deleted)
@@ -280,3 +816,1020 @@ class HNSWIndex:
         for i in range(len(a)):
             dot_product += a[i] * b[i]
         return -dot_product
+
+
+def _crc32c_table() -> List[int]:
+    table = []
+    for i in range(256):
+        c = i
+        for _ in range(8):
+            c = (c >> 1) ^ (0x82F63B78 if c & 1 else 0)
+        table.append(c)
+    return table
+
+
+_CRC32C_TABLE = _crc32c_table()
+
+
+def _crc32c(data: bytes) -> int:
+    """CRC-32C (Castagnoli) of data, as the C++ module computes it."""
+    crc = 0xFFFFFFFF
+    for byte in data:
+        crc = _CRC32C_TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8)
+    return crc ^ 0xFFFFFFFF
+
+
+class WriteAheadLog:
+    """
+    Mock of the C++ write-ahead log, in the same file format.
+
+    An append-only log of the inserts and removals made to a collection
+    since its last snapshot. Each record carries a log sequence number (LSN);
+    a snapshot notes the last LSN it holds, so recovery replays only the
+    records after it. Records are written as they are appended and synced to
+    disk once sync_bytes have accumulated, or on sync(). A torn record at the
+    end of the file ends the log.
+
+    Format: [magic b'VECDBWAL'][version: uint32][dimension: uint32]
+    [base LSN: uint64], then records [body bytes: uint32][CRC-32C of body:
+    uint32][body], body being [LSN: uint64][op: uint32][0: uint32]
+    [count: uint64][user IDs: int64 * count], followed for inserts by
+    [vectors: float32 * count * dimension].
+
+    Args:
+        path: Log file, created if missing
+        dimension: Vector dimension of the collection
+        sync_bytes: Bytes appended between syncs
+        after_lsn: Number new records after this LSN if it is above the
+            file's last one
+
+    Raises:
+        DeserializationError: If the file is not a log of this dimension
+    """
+
+    MAGIC = b'VECDBWAL'
+    VERSION = 1
+    HEADER_SIZE = 24
+    DEFAULT_SYNC_BYTES = 1 << 20
+
+    INSERT = 1
+    REMOVE = 2
+
+    def __init__(self, path: str, dimension: int, sync_bytes: int = DEFAULT_SYNC_BYTES,
+                 after_lsn: int = 0) -> None:
+        self.path = path
+        self.dimension = dimension
+        self._sync_bytes = sync_bytes
+        self._unsynced = 0
+        self._lock = threading.RLock()
+        if not os.path.exists(path) or os.path.getsize(path) == 0:
+            with open(path, 'wb') as f:
+                f.write(self._header(after_lsn))
+            self._last_lsn = after_lsn
+            self._end = self.HEADER_SIZE
+        else:
+            base, records, end = WriteAheadLog._read(path, dimension)
+            self._last_lsn = max([base, after_lsn] + [r[0] for r in records])
+            self._end = end
+            if end < os.path.getsize(path):
+                os.truncate(path, end)
+        self._file = open(path, 'r+b')
+        self._file.seek(self._end)
+
+    def __del__(self) -> None:
+        file = getattr(self, '_file', None)
+        if file is not None and not file.closed:
+            file.flush()
+            os.fsync(file.fileno())
+            file.close()
+
+    @property
+    def last_lsn(self) -> int:
+        return self._last_lsn
+
+    @property
+    def size(self) -> int:
+        """Bytes of records in the log, not counting its header."""
+        return self._end - self.HEADER_SIZE
+
+    @_synchronized
+    def append_insert(self, user_ids, vectors) -> int:
+        """Log inserts of user_ids with their vectors; returns the record's LSN."""
+        vectors = np.ascontiguousarray(vectors, dtype='<f4').reshape(-1, self.dimension)
+        return self._append(self.INSERT, user_ids, vectors.tobytes())
+
+    @_synchronized
+    def append_remove(self, user_ids) -> int:
+        """Log removals of user_ids; returns the record's LSN."""
+        return self._append(self.REMOVE, user_ids, b'')
+
+    @_synchronized
+    def sync(self) -> None:
+        """Sync every record appended so far to disk."""
+        self._file.flush()
+        os.fsync(self._file.fileno())
+        self._unsynced = 0
+
+    @_synchronized
+    def truncate(self, through_lsn: int) -> None:
+        """Drop the records up to through_lsn, which a snapshot now holds."""
+        self.sync()
+        _, records, _ = WriteAheadLog._read(self.path, self.dimension)
+        kept = b''.join(r[3] for r in records if r[0] > through_lsn)
+        tmp_path = self.path + '.tmp'
+        with open(tmp_path, 'wb') as f:
+            f.write(self._header(min(through_lsn, self._last_lsn)))
+            f.write(kept)
+            f.flush()
+            os.fsync(f.fileno())
+        os.replace(tmp_path, self.path)
+        self._file.close()
+        self._file = open(self.path, 'r+b')
+        self._end = self.HEADER_SIZE + len(kept)
+        self._file.seek(self._end)
+
+    @staticmethod
+    def replay(path: str, dimension: int, after_lsn: int = 0):
+        """
+        The records of the log at path with LSNs above after_lsn, as
+        (lsn, op, user_ids, vectors) tuples, and the log's last LSN (or
+        after_lsn if that is higher).
+        """
+        base, records, _ = WriteAheadLog._read(path, dimension)
+        last = max([base, after_lsn] + [r[0] for r in records])
+        return [(lsn, op, ids, vectors) for lsn, op, (ids, vectors), _ in records if lsn > after_lsn], last
+
+    def _header(self, base_lsn: int) -> bytes:
+        return self.MAGIC + struct.pack('<IIQ', self.VERSION, self.dimension, base_lsn)
+
+    def _append(self, op: int, user_ids, payload: bytes) -> int:
+        ids = np.asarray(user_ids, dtype='<i8').reshape(-1)
+        lsn = self._last_lsn + 1
+        body = struct.pack('<QIIQ', lsn, op, 0, len(ids)) + ids.tobytes() + payload
+        self._file.write(struct.pack('<II', len(body), _crc32c(body)) + body)
+        self._file.flush()
+        self._end += 8 + len(body)
+        self._last_lsn = lsn
+        self._unsynced += 8 + len(body)
+        if self._unsynced >= self._sync_bytes:
+            self.sync()
+        return lsn
+
+    @staticmethod
+    def _read(path: str, dimension: int):
+        """The base LSN, the intact records as (lsn, op, (user_ids, vectors), raw) and where they end."""
+        with open(path, 'rb') as f:
+            data = f.read()
+        if len(data) < WriteAheadLog.HEADER_SIZE or data[:8] != WriteAheadLog.MAGIC:
+            raise DeserializationError("Not a write-ahead log")
+        version, file_dimension, base = struct.unpack('<IIQ', data[8:24])
+        if version > WriteAheadLog.VERSION:
+            raise DeserializationError(
+                f"Log version {version} is newer than supported {WriteAheadLog.VERSION}"
+            )
+        if file_dimension != dimension:
+            raise DeserializationError(
+                f"Log dimension mismatch: log has {file_dimension}, expected {dimension}"
+            )
+        records = []
+        offset = WriteAheadLog.HEADER_SIZE
+        while len(data) - offset >= 32:
+            length, crc = struct.unpack('<II', data[offset:offset + 8])
+            body = data[offset + 8:offset + 8 + length]
+            if length < 24 or len(body) < length or _crc32c(body) != crc:
+                break
+            lsn, op, _, count = struct.unpack('<QIIQ', body[:24])
+            row_bytes = 8 + 4 * dimension if op == WriteAheadLog.INSERT else 8
+            if op not in (WriteAheadLog.INSERT, WriteAheadLog.REMOVE) or length != 24 + count * row_bytes:
+                break
+            ids = np.frombuffer(body, dtype='<i8', count=count, offset=24).astype(np.int64)
+            vectors = None
+            if op == WriteAheadLog.INSERT:
+                vectors = np.frombuffer(body, dtype='<f4', offset=24 + 8 * count)
+                vectors = vectors.reshape(count, dimension).astype(np.float32)
+            records.append((lsn, op, (ids, vectors), data[offset:offset + 8 + length]))
+            offset += 8 + length
+        return base, records, offset
+
+
+class Collection:
+    """
+    Mock of the C++ collection core: user-ID mapping and original vectors
+    over an HNSWIndex.
+
+    Matches the real C++ Collection interface exactly. User IDs map onto
+    dense internal IDs handed out from 0; rows are indexed by internal ID and
+    a deleted ID's row is left in place, marked dead, until compact() drops
+    the node from the index and the row is handed out again.
+
+    Args:
+        index: The index the collection inserts into and searches
+    """
+
+    # .vectors format written by save_vectors()
+    VECTORS_VERSION = 2
+
+    # Alignment of each block in a version 2 .vectors file
+    BLOCK_ALIGNMENT = 64
+
+    def __init__(self, index: HNSWIndex) -> None:
+        self.index = index
+        self.dimension = index.dimension
+        self._user_to_internal: dict[int, int] = {}
+        self._internal_to_user = np.empty(0, dtype=np.int64)
+        self._live = np.empty(0, dtype=np.uint8)
+        self._vectors = np.empty((0, self.dimension), dtype=np.float32)
+        self._rows = 0
+        self._free_rows: List[int] = []  # reusable dead rows, highest first
+        self._log = None
+        self._lock = threading.RLock()
+
+    @property
+    def next_internal_id(self) -> int:
+        """Rows in use, including dead ones: one past the highest internal ID handed out."""
+        return self._rows
+
+    @_synchronized
+    def insert(self, user_id: int, vector: VectorType) -> None:
+        """
+        Insert one vector.
+
+        Raises:
+            DimensionError: If vector dimension doesn't match the index
+            DuplicateIDError: If user_id is already present
+        """
+        vector = np.asarray(vector, dtype=np.float32)
+        if vector.ndim != 1 or len(vector) != self.dimension:
+            raise DimensionError(f"Expected dimension {self.dimension}, got {vector.size}")
+        if user_id in self._user_to_internal:
+            raise DuplicateIDError(f"User ID {user_id} already exists")
+        if self._log is not None:
+            self._log.append_insert([user_id], vector[None, :])
+        internal_ids = self._assign_rows(1)
+        self.index.add(internal_ids[0], vector)
+        self._store_rows(internal_ids, [user_id], vector[None, :])
+
+    @_synchronized
+    def insert_batch(self, user_ids, vectors, num_threads: int = 0) -> None:
+        """
+        Insert many vectors. Nothing is inserted if any check fails.
+
+        Raises:
+            DimensionError: If vectors is not of shape (n, dimension)
+            DuplicateIDError: If a user ID is present or repeats in the batch
+            ValueError: If user_ids and vectors differ in length
+        """
+        user_ids = [int(user_id) for user_id in user_ids]
+        vectors = np.asarray(vectors, dtype=np.float32)
+        if vectors.ndim != 2 or vectors.shape[1] != self.dimension:
+            raise DimensionError(f"Expected vectors of shape (n, {self.dimension})")
+        if len(user_ids) != len(vectors):
+            raise ValueError(f"Got {len(user_ids)} user IDs for {len(vectors)} vectors")
+        if not user_ids:
+            return
+        if len(set(user_ids)) != len(user_ids):
+            raise DuplicateIDError("Batch contains repeated user IDs")
+        for user_id in user_ids:
+            if user_id in self._user_to_internal:
+                raise DuplicateIDError(f"User ID {user_id} already exists")
+
+        if self._log is not None:
+            self._log.append_insert(user_ids, vectors)
+        internal_ids = self._assign_rows(len(user_ids))
+        self.index.add_batch(np.array(internal_ids, dtype=np.int64), vectors, num_threads)
+        self._store_rows(internal_ids, user_ids, vectors)
+
+    @_synchronized
+    def search(self, query: VectorType, k: int = 10, ef_search: int = 50, filter=None,
+               patience: int = 0, max_ef: int = 0, max_distances: int = 0,
+               target_recall: float = 0.0) -> List[Tuple[int, float]]:
+        """
+        Return the k nearest (user_id, distance) pairs, closest first, among
+        the user IDs in filter if one is given. The remaining arguments are
+        HNSWIndex.search()'s adaptive termination options.
+
+        Raises:
+            DimensionError: If query dimension doesn't match the index
+            ValueError: If k < 1
+        """
+        query = np.asarray(query, dtype=np.float32)
+        if query.ndim != 1 or len(query) != self.dimension:
+            raise DimensionError(f"Expected dimension {self.dimension}, got {query.size}")
+        mask = None
+        if filter is not None:
+            mask = np.zeros(self._rows, dtype=bool)
+            for user_id in np.asarray(filter, dtype=np.int64).tolist():
+                internal_id = self._user_to_internal.get(user_id)
+                if internal_id is not None:
+                    mask[internal_id] = True
+        results = self.index.search(query, k, ef_search, mask, patience=patience, max_ef=max_ef,
+                                    max_distances=max_distances, target_recall=target_recall)
+        return [(int(self._internal_to_user[internal_id]), distance) for internal_id, distance in results]
+
+    @_synchronized
+    def search_batch(self, queries, k: int = 10, ef_search: int = 50,
+                     num_threads: int = 0) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        Return (user_ids, distances) arrays of shape (n, k) holding search()'s
+        results for each query row, padded with -1 and inf.
+
+        Raises:
+            DimensionError: If queries is not of shape (n, dimension)
+            ValueError: If k < 1
+        """
+        ids, distances = self.index.search_batch(queries, k, ef_search, num_threads)
+        found = ids >= 0
+        ids[found] = self._internal_to_user[ids[found]]
+        return ids, distances
+
+    @_synchronized
+    def search_exact(self, queries, k: int = 10, num_threads: int = 0) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        Return (user_ids, distances) arrays of shape (n, k) holding the exact
+        k nearest neighbors of each query row, padded with -1 and inf.
+
+        Raises:
+            DimensionError: If queries is not of shape (n, dimension)
+            ValueError: If k < 1
+        """
+        ids, distances = self.index.search_exact(queries, k, num_threads)
+        found = ids >= 0
+        ids[found] = self._internal_to_user[ids[found]]
+        return ids, distances
+
+    @_synchronized
+    def remove(self, user_id: int) -> bool:
+        """Delete user_id, returning False if it was not present."""
+        internal_id = self._user_to_internal.pop(user_id, None)
+        if internal_id is None:
+            return False
+        if self._log is not None:
+            self._log.append_remove([user_id])
+        self.index.remove(internal_id)
+        self._live[internal_id] = 0
+        return True
+
+    @_synchronized
+    def reserve(self, n: int) -> None:
+        """Allocate rows and index slots for n vectors in all."""
+        self.index.reserve(n)
+        self._ensure_rows(n)
+
+    @_synchronized
+    def compact(self, num_threads: int = 0) -> int:
+        """
+        Compact the index (see HNSWIndex.compact()), after which the rows of
+        deleted IDs are reused by later inserts. Returns the rows reclaimed.
+        """
+        reclaimed = self.index.compact(num_threads)
+        self._find_free_rows()
+        return reclaimed
+
+    @_synchronized
+    def set_log(self, log) -> None:
+        """Log every later insert and removal to log before applying it; None stops logging."""
+        self._log = log
+
+    @property
+    def log(self):
+        """The WriteAheadLog inserts and removals go to, or None."""
+        return self._log
+
+    @_synchronized
+    def replay_log(self, path: str, after_lsn: int = 0) -> int:
+        """
+        Apply the records of the log at path with LSNs above after_lsn, the
+        last LSN the loaded snapshot holds, without logging them again.
+        Returns the log's last LSN, or after_lsn if that is higher.
+
+        Raises:
+            DeserializationError: If the log is corrupt or an insert in it
+                repeats a present user ID
+        """
+        records, last = WriteAheadLog.replay(path, self.dimension, after_lsn)
+        log, self._log = self._log, None
+        try:
+            for lsn, op, user_ids, vectors in records:
+                if op == WriteAheadLog.INSERT:
+                    try:
+                        self.insert_batch(user_ids.tolist(), vectors)
+                    except DuplicateIDError as e:
+                        raise DeserializationError(f"Log record {lsn}: {e}") from None
+                else:
+                    for user_id in user_ids.tolist():
+                        self.remove(user_id)
+        finally:
+            self._log = log
+        return last
+
+    @_synchronized
+    def reorder(self) -> None:
+        """
+        Renumber the index by graph locality (see HNSWIndex.reorder()) and
+        move the rows with their nodes.
+        """
+        new_id = self.index.reorder()
+        moved = np.arange(self._rows)
+        moved[:len(new_id)] = new_id
+        for name in ('_internal_to_user', '_live', '_vectors'):
+            old = getattr(self, name)
+            rows = old.copy()
+            rows[moved] = old[:self._rows]
+            setattr(self, name, rows)
+        self._user_to_internal = {user_id: int(moved[internal_id])
+                                  for user_id, internal_id in self._user_to_internal.items()}
+        self._find_free_rows()
+
+    @_synchronized
+    def get(self, user_id: int):
+        """Return the vector stored for user_id as a list, or None."""
+        internal_id = self._user_to_internal.get(user_id)
+        if internal_id is None:
+            return None
+        return self._vectors[internal_id].tolist()
+
+    @_synchronized
+    def contains(self, user_id: int) -> bool:
+        """Check whether user_id is present."""
+        return user_id in self._user_to_internal
+
+    def __contains__(self, user_id: int) -> bool:
+        return self.contains(user_id)
+
+    @_synchronized
+    def __len__(self) -> int:
+        return len(self._user_to_internal)
+
+    @_synchronized
+    def user_ids(self) -> np.ndarray:
+        """Every user ID present, in internal ID order."""
+        rows = self._rows
+        return self._internal_to_user[:rows][self._live[:rows] != 0].copy()
+
+    @_synchronized
+    def rows(self) -> tuple:
+        """Copies of the (internal_to_user, live, vectors) rows."""
+        rows = self._rows
+        return (self._internal_to_user[:rows].copy(), self._live[:rows].copy(), self._vectors[:rows].copy())
+
+    @_synchronized
+    def set_rows(self, internal_to_user, live, vectors) -> None:
+        """
+        Replace every row with copies of the arrays given, for an index that
+        already holds the live ones.
+
+        Raises:
+            DimensionError: If vectors is not of shape (n, dimension)
+            ValueError: If the arrays differ in length
+        """
+        internal_to_user = np.asarray(internal_to_user, dtype=np.int64)
+        live = np.asarray(live, dtype=np.uint8)
+        vectors = np.asarray(vectors, dtype=np.float32)
+        if vectors.ndim != 2 or vectors.shape[1] != self.dimension:
+            raise DimensionError(f"Expected vectors of shape (n, {self.dimension})")
+        if not len(internal_to_user) == len(live) == len(vectors):
+            raise ValueError("internal_to_user, live and vectors must have the same length")
+        self._adopt(internal_to_user.copy(), live.copy(), vectors.copy())
+
+    @_synchronized
+    def save_vectors(self, path: str) -> None:
+        """
+        Write the rows to path as contiguous blocks.
+
+        Format (version 2), each block aligned to BLOCK_ALIGNMENT bytes so it
+        can be mapped with np.memmap:
+            Header: [version: uint32][count: uint64][dimension: uint32][rows: uint64]
+            [internal_to_user: uint64 * rows]
+            [live: uint8 * rows]              (1 if the internal ID is in use)
+            [vectors: float32 * rows * dim]
+        """
+        rows = self._rows
+        ids_offset, live_offset, vectors_offset, _ = self._vectors_layout(rows, self.dimension)
+        blocks = ((ids_offset, self._internal_to_user[:rows].astype('<i8')),
+                  (live_offset, self._live[:rows]),
+                  (vectors_offset, self._vectors[:rows].astype('<f4')))
+        with open(path, 'wb') as f:
+            f.write(struct.pack('<IQIQ', self.VECTORS_VERSION, len(self), self.dimension, rows))
+            for offset, block in blocks:
+                f.write(b'\0' * (offset - f.tell()))
+                block.tofile(f)
+            f.flush()
+            os.fsync(f.fileno())
+
+    @staticmethod
+    def open_vectors(index: HNSWIndex, path: str) -> 'Collection':
+        """
+        Open a file written by save_vectors() for index, which must hold
+        every live row of it. Version 2 blocks are mapped copy-on-write;
+        version 1 files (one record per vector) are parsed in bulk.
+
+        Raises:
+            DeserializationError: If the file is corrupt or its dimension
+                doesn't match the index
+        """
+        collection = Collection(index)
+        dimension = collection.dimension
+        try:
+            size = os.path.getsize(path)
+            with open(path, 'rb') as f:
+                header = f.read(24)
+        except OSError as e:
+            raise DeserializationError(f"Cannot open {path}: {e}")
+        if len(header) < 16:
+            raise DeserializationError("Vectors file too small")
+
+        version, count, file_dimension = struct.unpack('<IQI', header[:16])
+        if version > Collection.VECTORS_VERSION:
+            raise DeserializationError(
+                f"Vectors file version {version} is newer than supported {Collection.VECTORS_VERSION}"
+            )
+        if file_dimension != dimension:
+            raise DeserializationError(
+                f"Dimension mismatch: file has {file_dimension}, expected {dimension}"
+            )
+
+        if version < 2:
+            internal_to_user, live, vectors = Collection._read_records(path, count, dimension, size)
+        else:
+            if len(header) < 24:
+                raise DeserializationError("Vectors file too small")
+            rows, = struct.unpack('<Q', header[16:24])
+            ids_offset, live_offset, vectors_offset, expected_size = Collection._vectors_layout(rows, dimension)
+            if size < expected_size:
+                raise DeserializationError(
+                    f"Vectors file truncated: expected {expected_size} bytes, got {size}"
+                )
+            if rows == 0:
+                internal_to_user = np.empty(0, dtype=np.int64)
+                live = np.empty(0, dtype=np.uint8)
+                vectors = np.empty((0, dimension), dtype=np.float32)
+            else:
+                internal_to_user = np.memmap(path, dtype='<i8', mode='c', offset=ids_offset, shape=(rows,))
+                live = np.memmap(path, dtype=np.uint8, mode='c', offset=live_offset, shape=(rows,))
+                vectors = np.memmap(path, dtype='<f4', mode='c', offset=vectors_offset, shape=(rows, dimension))
+
+        collection._adopt(internal_to_user, live, vectors)
+        if len(collection) != count:
+            raise DeserializationError(
+                f"Vectors file corrupt: header has {count} vectors, found {len(collection)}"
+            )
+        return collection
+
+    @staticmethod
+    def _vectors_layout(rows: int, dimension: int) -> tuple:
+        """Offsets of the internal_to_user, live and vector blocks, and the file size."""
+        def align(offset: int) -> int:
+            return -(-offset // Collection.BLOCK_ALIGNMENT) * Collection.BLOCK_ALIGNMENT
+        ids_offset = align(24)
+        live_offset = align(ids_offset + 8 * rows)
+        vectors_offset = align(live_offset + rows)
+        return ids_offset, live_offset, vectors_offset, vectors_offset + 4 * rows * dimension
+
+    @staticmethod
+    def _read_records(path: str, count: int, dimension: int, size: int) -> tuple:
+        """
+        Rows of a version 1 file: after a 16-byte header, per vector
+        [user_id: uint64][internal_id: uint64][floats: float32 * dim].
+        """
+        record_size = 16 + 4 * dimension
+        expected_size = 16 + count * record_size
+        if size < expected_size:
+            raise DeserializationError(
+                f"Vectors file truncated: expected {expected_size} bytes, got {size}"
+            )
+
+        record = np.dtype([('user_id', '<i8'), ('internal_id', '<i8'), ('vector', '<f4', (dimension,))])
+        records = np.fromfile(path, dtype=record, count=count, offset=16)
+        internal_ids = records['internal_id']
+        if count and internal_ids.min() < 0:
+            raise DeserializationError("Vectors file references a missing node")
+        rows = int(internal_ids.max()) + 1 if count else 0
+        if len(np.unique(internal_ids)) != count:
+            raise DeserializationError("Vectors file repeats an internal ID")
+
+        internal_to_user = np.zeros(rows, dtype=np.int64)
+        live = np.zeros(rows, dtype=np.uint8)
+        vectors = np.zeros((rows, dimension), dtype=np.float32)
+        internal_to_user[internal_ids] = records['user_id']
+        live[internal_ids] = 1
+        vectors[internal_ids] = records['vector']
+        return internal_to_user, live, vectors
+
+    def _adopt(self, internal_to_user: np.ndarray, live: np.ndarray, vectors: np.ndarray) -> None:
+        """Take the row arrays as this collection's own and rebuild the ID map."""
+        internal_ids = np.flatnonzero(live).tolist()
+        user_ids = internal_to_user[internal_ids].tolist()
+        for internal_id in internal_ids:
+            if internal_id not in self.index._vectors or internal_id in self.index._deleted:
+                raise DeserializationError("Vectors file references a missing node")
+        user_to_internal = dict(zip(user_ids, internal_ids))
+        if len(user_to_internal) != len(user_ids):
+            raise DeserializationError("Vectors file repeats a user ID")
+        self._user_to_internal = user_to_internal
+        self._internal_to_user = internal_to_user
+        self._live = live
+        self._vectors = vectors
+        self._rows = len(vectors)
+        self._find_free_rows()
+
+    def _assign_rows(self, n: int) -> List[int]:
+        """
+        Internal IDs for n new rows: reclaimed rows first, lowest first, then
+        fresh ones. Nothing is claimed until _store_rows().
+        """
+        reused = self._free_rows[::-1][:n]
+        internal_ids = reused + list(range(self._rows, self._rows + n - len(reused)))
+        self._ensure_rows(self._rows + n - len(reused))
+        return internal_ids
+
+    def _find_free_rows(self) -> None:
+        """Dead rows whose index slot is empty, highest first so the lowest is reused first."""
+        self._free_rows = [row for row in range(self._rows - 1, -1, -1)
+                           if not self._live[row] and row not in self.index._vectors]
+
+    def _ensure_rows(self, n: int) -> None:
+        """Grow the row arrays to at least n rows, doubling their capacity."""
+        capacity = len(self._vectors)
+        if n <= capacity:
+            return
+        capacity = max(n, 2 * capacity, 16)
+        for name in ('_internal_to_user', '_live', '_vectors'):
+            old = getattr(self, name)
+            grown = np.zeros((capacity,) + old.shape[1:], dtype=old.dtype)
+            grown[:len(old)] = old
+            setattr(self, name, grown)
+
+    def _store_rows(self, internal_ids: List[int], user_ids: List[int], vectors: np.ndarray) -> None:
+        """Fill the rows from _assign_rows() with the given IDs and vectors."""
+        reused = min(len(internal_ids), len(self._free_rows))
+        del self._free_rows[len(self._free_rows) - reused:]
+        self._internal_to_user[internal_ids] = user_ids
+        self._live[internal_ids] = 1
+        self._vectors[internal_ids] = vectors
+        self._user_to_internal.update(zip(user_ids, internal_ids))
+        self._rows = max(self._rows, internal_ids[-1] + 1)
+
+
+class ShardedCollection:
+    """
+    Mock of the C++ sharded collection: one logical collection split across
+    independent Collections, each over its own HNSWIndex.
+
+    Matches the real C++ ShardedCollection interface exactly. A user ID
+    always lives in shard shard_of(id), a fixed hash of the ID; searches
+    merge every shard's top k. The mock runs the shards in turn and ignores
+    num_threads and NUMA pinning.
+
+    Args:
+        shards: Collections of equal dimension, each holding only the IDs
+            shard_of() routes to it
+
+    Raises:
+        ValueError: If there are no shards or their dimensions differ
+        DeserializationError: If a shard holds an ID routed to another
+    """
+
+    def __init__(self, shards: List[Collection]) -> None:
+        shards = list(shards)
+        if not shards:
+            raise ValueError("A sharded collection needs at least one shard")
+        self.dimension = shards[0].dimension
+        self._shards = shards
+        for s, shard in enumerate(shards):
+            if shard.dimension != self.dimension:
+                raise ValueError(f"Shard {s} has dimension {shard.dimension}, expected {self.dimension}")
+            for user_id in shard.user_ids().tolist():
+                if self.shard_of(user_id) != s:
+                    raise DeserializationError(
+                        f"Shard {s} holds user ID {user_id}, which belongs to shard {self.shard_of(user_id)}"
+                    )
+        self._numa_nodes: List[int] = []
+        self._lock = threading.RLock()
+
+    @staticmethod
+    def _shard_of(user_id: int, num_shards: int) -> int:
+        """The high bits of the splitmix64 hash of user_id, as in the C++ core."""
+        mask = (1 << 64) - 1
+        x = int(user_id) & mask
+        x = ((x ^ (x >> 30)) * 0xbf58476d1ce4e5b9) & mask
+        x = ((x ^ (x >> 27)) * 0x94d049bb133111eb) & mask
+        x ^= x >> 31
+        return (x * num_shards) >> 64
+
+    def shard_of(self, user_id: int) -> int:
+        """The shard user_id is routed to."""
+        return self._shard_of(user_id, len(self._shards))
+
+    @property
+    def shards(self) -> List[Collection]:
+        return list(self._shards)
+
+    def insert(self, user_id: int, vector: VectorType) -> None:
+        """Insert one vector into its shard."""
+        vector = np.asarray(vector, dtype=np.float32)
+        if vector.ndim != 1 or len(vector) != self.dimension:
+            raise DimensionError(f"Expected dimension {self.dimension}, got {vector.size}")
+        self.insert_batch([user_id], vector[None, :])
+
+    @_synchronized
+    def insert_batch(self, user_ids, vectors, num_threads: int = 0) -> None:
+        """
+        Insert many vectors, split by shard. Nothing is inserted if any
+        check fails.
+
+        Raises:
+            DimensionError: If vectors is not of shape (n, dimension)
+            DuplicateIDError: If a user ID is present or repeats in the batch
+            ValueError: If user_ids and vectors differ in length
+        """
+        user_ids = [int(user_id) for user_id in user_ids]
+        vectors = np.asarray(vectors, dtype=np.float32)
+        if vectors.ndim != 2 or vectors.shape[1] != self.dimension:
+            raise DimensionError(f"Expected vectors of shape (n, {self.dimension})")
+        if len(user_ids) != len(vectors):
+            raise ValueError(f"Got {len(user_ids)} user IDs for {len(vectors)} vectors")
+        if len(set(user_ids)) != len(user_ids):
+            raise DuplicateIDError("Batch contains repeated user IDs")
+        rows: List[List[int]] = [[] for _ in self._shards]
+        for i, user_id in enumerate(user_ids):
+            s = self.shard_of(user_id)
+            if user_id in self._shards[s]:
+                raise DuplicateIDError(f"User ID {user_id} already exists")
+            rows[s].append(i)
+        for shard, r in zip(self._shards, rows):
+            if r:
+                shard.insert_batch([user_ids[i] for i in r], vectors[r], num_threads)
+
+    def search(self, query: VectorType, k: int = 10, ef_search: int = 50, filter=None,
+               patience: int = 0, max_ef: int = 0, max_distances: int = 0,
+               target_recall: float = 0.0, num_threads: int = 0) -> List[Tuple[int, float]]:
+        """
+        Return the k nearest (user_id, distance) pairs over every shard,
+        closest first, among the user IDs in filter if one is given. Ties go
+        to the lower shard.
+
+        Raises:
+            DimensionError: If query dimension doesn't match the collection
+        """
+        query = np.asarray(query, dtype=np.float32)
+        if query.ndim != 1 or len(query) != self.dimension:
+            raise DimensionError(f"Expected dimension {self.dimension}, got {query.size}")
+        filters = [None] * len(self._shards)
+        if filter is not None:
+            filters = [[] for _ in self._shards]
+            for user_id in np.asarray(filter, dtype=np.int64).tolist():
+                filters[self.shard_of(user_id)].append(user_id)
+        merged = []
+        for s, shard in enumerate(self._shards):
+            if filters[s] is not None and not filters[s]:
+                continue
+            results = shard.search(query, k, ef_search, filters[s], patience=patience, max_ef=max_ef,
+                                   max_distances=max_distances, target_recall=target_recall)
+            merged.extend((distance, s, i, user_id) for i, (user_id, distance) in enumerate(results))
+        merged.sort()
+        return [(user_id, distance) for distance, _, _, user_id in merged[:k]]
+
+    def search_exact(self, queries, k: int = 10, num_threads: int = 0) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        Return (user_ids, distances) arrays of shape (n, k) holding the exact
+        k nearest neighbors of each query row over every shard, padded with
+        -1 and inf. Ties go to the lower shard.
+
+        Raises:
+            DimensionError: If queries is not of shape (n, dimension)
+            ValueError: If k < 1
+        """
+        return self._merge_rows([shard.search_exact(queries, k, num_threads) for shard in self._shards], k)
+
+    def search_batch(self, queries, k: int = 10, ef_search: int = 50,
+                     num_threads: int = 0) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        Return (user_ids, distances) arrays of shape (n, k) holding search()'s
+        results for each query row, padded with -1 and inf.
+
+        Raises:
+            DimensionError: If queries is not of shape (n, dimension)
+            ValueError: If k < 1
+        """
+        return self._merge_rows(
+            [shard.search_batch(queries, k, ef_search, num_threads) for shard in self._shards], k)
+
+    @staticmethod
+    def _merge_rows(parts, k: int) -> Tuple[np.ndarray, np.ndarray]:
+        """Merge every shard's (ids, distances) rows into the k closest per row; ties go to the lower shard."""
+        n = len(parts[0][0])
+        ids = np.full((n, k), -1, dtype=np.int64)
+        distances = np.full((n, k), np.inf, dtype=np.float32)
+        for row in range(n):
+            merged = sorted(
+                (float(part_dists[row, j]), s, j, int(part_ids[row, j]))
+                for s, (part_ids, part_dists) in enumerate(parts)
+                for j in range(k) if part_ids[row, j] >= 0)
+            for col, (dist, _, _, user_id) in enumerate(merged[:k]):
+                ids[row, col] = user_id
+                distances[row, col] = dist
+        return ids, distances
+
+    def remove(self, user_id: int) -> bool:
+        """Delete user_id from its shard, returning False if it was not present."""
+        return self._shards[self.shard_of(user_id)].remove(user_id)
+
+    def reserve(self, n: int) -> None:
+        """Allocate for n vectors in all, each shard its share plus room for imbalance."""
+        share = -(-n // len(self._shards))
+        for shard in self._shards:
+            shard.reserve(share + int(3 * math.sqrt(share)) + 1)
+
+    def compact(self, num_threads: int = 0) -> int:
+        """Compact every shard; returns the rows reclaimed."""
+        return sum(shard.compact(num_threads) for shard in self._shards)
+
+    def reorder(self) -> None:
+        """Renumber every shard by graph locality."""
+        for shard in self._shards:
+            shard.reorder()
+
+    def get(self, user_id: int):
+        """Return the vector stored for user_id as a list, or None."""
+        return self._shards[self.shard_of(user_id)].get(user_id)
+
+    def contains(self, user_id: int) -> bool:
+        """Check whether user_id is present."""
+        return self._shards[self.shard_of(user_id)].contains(user_id)
+
+    def __contains__(self, user_id: int) -> bool:
+        return self.contains(user_id)
+
+    def __len__(self) -> int:
+        return sum(len(shard) for shard in self._shards)
+
+    def user_ids(self) -> np.ndarray:
+        """Every user ID present, shard by shard."""
+        return np.concatenate([shard.user_ids() for shard in self._shards])
+
+    def set_numa_nodes(self, nodes: List[int]) -> None:
+        """Record the NUMA node of each shard (nodes[s % len(nodes)]); the mock does not pin."""
+        self._numa_nodes = list(nodes)
+
+    @property
+    def numa_nodes(self) -> List[int]:
+        return list(self._numa_nodes)
+
+    @staticmethod
+    def online_numa_nodes() -> List[int]:
+        """NUMA nodes online on this machine; the mock reports none."""
+        return []
+
+
+class QueryServer:
+    """
+    Mock of the C++ query server: coalesces single queries into micro-batches
+    for a collection's search_batch().
+
+    Matches the real C++ QueryServer interface exactly. submit() queues a
+    query and returns a ticket; worker threads take up to max_batch queued
+    queries sharing the oldest one's k and ef_search, waiting at most
+    max_wait_us past its arrival for the batch to fill. Finished queries are
+    collected by take_completed(), and notify_fd turns readable while any
+    are waiting.
+
+    Args:
+        collection: The Collection or ShardedCollection to search
+        max_batch: Most queries searched together
+        max_wait_us: Longest a query waits for its batch to fill
+        num_threads: Worker threads (0 = all cores)
+
+    Raises:
+        ValueError: If max_batch < 1
+    """
+
+    DEFAULT_MAX_BATCH = 64
+    DEFAULT_MAX_WAIT_US = 200
+
+    def __init__(self, collection, max_batch: int = DEFAULT_MAX_BATCH,
+                 max_wait_us: int = DEFAULT_MAX_WAIT_US, num_threads: int = 0) -> None:
+        if max_batch < 1:
+            raise ValueError("max_batch must be >= 1")
+        self._collection = collection
+        self.dimension = collection.dimension
+        self.max_batch = max_batch
+        self.max_wait_us = max_wait_us
+        self.num_threads = num_threads or (os.cpu_count() or 1)
+        self.batches = 0
+        self.batched_queries = 0
+        self._queue: list = []  # (ticket, k, ef_search, query, arrived)
+        self._done: list = []
+        self._next_ticket = 1
+        self._closed = False
+        self._cond = threading.Condition()
+        self._done_lock = threading.Lock()
+        self._read_fd, self._write_fd = os.pipe()
+        os.set_blocking(self._read_fd, False)
+        os.set_blocking(self._write_fd, False)
+        self._workers = [threading.Thread(target=self._run, daemon=True) for _ in range(self.num_threads)]
+        for worker in self._workers:
+            worker.start()
+
+    def __del__(self) -> None:
+        if hasattr(self, '_workers'):
+            self.close()
+            os.close(self._read_fd)
+            os.close(self._write_fd)
+
+    @property
+    def notify_fd(self) -> int:
+        return self._read_fd
+
+    @property
+    def queued(self) -> int:
+        with self._cond:
+            return len(self._queue)
+
+    def submit(self, query: VectorType, k: int = 10, ef_search: int = 50) -> int:
+        """
+        Queue a query, returning its ticket.
+
+        Raises:
+            DimensionError: If query dimension doesn't match the collection
+            ValueError: If k < 1
+            RuntimeError: If the server is closed
+        """
+        query = np.array(query, dtype=np.float32)
+        if query.ndim != 1 or len(query) != self.dimension:
+            raise DimensionError(f"Expected dimension {self.dimension}, got {query.size}")
+        if k < 1:
+            raise ValueError("k must be >= 1")
+        with self._cond:
+            if self._closed:
+                raise RuntimeError("Query server is closed")
+            ticket = self._next_ticket
+            self._next_ticket += 1
+            self._queue.append((ticket, k, ef_search, query, time.monotonic()))
+            self._cond.notify()
+        return ticket
+
+    def take_completed(self) -> list:
+        """(ticket, results, error) for each query finished since the last call."""
+        try:
+            while os.read(self._read_fd, 64):
+                pass
+        except BlockingIOError:
+            pass
+        with self._done_lock:
+            done, self._done = self._done, []
+        return done
+
+    def close(self) -> None:
+        """Stop taking queries and wait for the queued ones to finish."""
+        with self._cond:
+            self._closed = True
+            self._cond.notify_all()
+        for worker in self._workers:
+            if worker is not threading.current_thread():
+                worker.join()
+
+    def _run(self) -> None:
+        with self._cond:
+            while True:
+                self._cond.wait_for(lambda: self._closed or self._queue)
+                if not self._queue:
+                    return
+                deadline = self._queue[0][4] + self.max_wait_us / 1e6
+                self._cond.wait_for(
+                    lambda: self._closed or not self._queue or len(self._queue) >= self.max_batch,
+                    max(0.0, deadline - time.monotonic()))
+                if not self._queue:
+                    continue
+                k, ef_search = self._queue[0][1], self._queue[0][2]
+                batch, rest = [], []
+                for request in self._queue:
+                    if len(batch) < self.max_batch and request[1] == k and request[2] == ef_search:
+                        batch.append(request)
+                    else:
+                        rest.append(request)
+                self._queue = rest
+                if rest:
+                    self._cond.notify()
+                self._cond.release()
+                try:
+                    self._run_batch(batch, k, ef_search)
+                finally:
+                    self._cond.acquire()
+
+    def _run_batch(self, batch: list, k: int, ef_search: int) -> None:
+        try:
+            ids, distances = self._collection.search_batch(np.stack([r[3] for r in batch]), k, ef_search, 1)
+            done = [(r[0], [(int(i), float(d)) for i, d in zip(ids[row], distances[row]) if i >= 0], None)
+                    for row, r in enumerate(batch)]
+        except Exception as e:
+            done = [(r[0], None, str(e)) for r in batch]
+        with self._done_lock:
+            self.batches += 1
+            self.batched_queries += len(batch)
+            was_empty = not self._done
+            self._done.extend(done)
+        if was_empty:
+            try:
+                os.write(self._write_fd, b'\x01')
+            except BlockingIOError:
+                pass
@@ -1,40 +1,52 @@
 """
 VecDB Collection Manager
 
-Manages the mapping between user-provided IDs and internal HNSW indices,
-handles collection metadata, and validates inputs before passing to HNSW.
+Wraps the collection core, which maps user-provided IDs onto internal HNSW
+indices and keeps the original vectors, and handles collection metadata.
 """
 
 from __future__ import annotations
 
-from typing import Dict, List, Optional, Tuple, Union
+from typing import Callable, Dict, Iterable, List, Optional, Sequence, Tuple, Union
 
 import numpy as np
 
-from vecdb.exceptions import DimensionError, DuplicateIDError
+from vecdb.exceptions import DuplicateIDError
 
 # Type alias for vectors
 VectorType = Union[List[float], np.ndarray]
 
 # Import HNSW - try C++ first, fall back to mock
 try:
-    from vecdb._hnsw_cpp import HNSWIndex
+    from vecdb._hnsw_cpp import HNSWIndex, Collection as CollectionCore, ShardedCollection as ShardedCore
 except ImportError:
-    from vecdb._hnsw_mock import HNSWIndex
+    from vecdb._hnsw_mock import HNSWIndex, Collection as CollectionCore, ShardedCollection as ShardedCore
 
 
 class Collection:
     """
     A named collection of vectors with a fixed dimension.
 
-    Manages the mapping between user-provided IDs and internal HNSW indices,
-    validates inputs, and provides a clean interface for vector operations.
+    Vector operations run in the collection core (C++ when built), which
+    owns the user-ID mapping, the original vectors and the HNSW index, and
+    translates IDs inside each call.
 
     Args:
         name: Unique collection identifier
         dimension: Fixed vector dimension for this collection
         metric: Distance metric - 'l2', 'cosine', or 'dot'
-        hnsw_params: Optional dict with 'M' and 'ef_construction' parameters
+        hnsw_params: Optional dict with 'M', 'ef_construction' and the neighbor
+            selection flags 'heuristic' (default True), 'keep_pruned' and
+            'extend_candidates' (default False), plus 'storage' ('float',
+            'int8' or 'pq'), 'rerank', 'pq_subspaces' and 'rerank_path' for
+            quantized storage, 'max_elements', the number of vectors to
+            allocate storage for up front, and 'shards', the number of
+            independent indexes to split the vectors across (default 1).
+            Sharded collections build and search their shards in parallel;
+            'numa': True pins the shards round-robin to the NUMA nodes.
+            'flat_threshold' is the index size up to which searches scan
+            every vector exactly instead of walking the graph (default
+            HNSWIndex.DEFAULT_FLAT_THRESHOLD; 0 always walks).
     """
 
     VALID_METRICS = {'l2', 'cosine', 'dot'}
@@ -61,24 +73,46 @@ class Collection:
         hnsw_params = hnsw_params or {}
         M = hnsw_params.get('M', 16)
         ef_construction = hnsw_params.get('ef_construction', 200)
+        max_elements = hnsw_params.get('max_elements', 0)
+        shards = hnsw_params.get('shards', 1)
+        if shards < 1:
+            raise ValueError(f"Shards must be >= 1, got {shards}")
+
+        def make_index(rerank_path: str, max_elements: int) -> HNSWIndex:
+            return HNSWIndex(
+                dimension=dimension,
+                metric=metric,
+                M=M,
+                ef_construction=ef_construction,
+                heuristic=hnsw_params.get('heuristic', True),
+                keep_pruned=hnsw_params.get('keep_pruned', False),
+                extend_candidates=hnsw_params.get('extend_candidates', False),
+                storage=hnsw_params.get('storage', 'float'),
+                rerank=hnsw_params.get('rerank', False),
+                pq_subspaces=hnsw_params.get('pq_subspaces', 8),
+                rerank_path=rerank_path,
+                max_elements=max_elements
+            )
 
-        # Initialize HNSW index
-        self._hnsw_index = HNSWIndex(
-            dimension=dimension,
-            metric=metric,
-            M=M,
-            ef_construction=ef_construction
-        )
-
-        # ID mappings
-        self._user_to_internal: Dict[int, int] = {}
-        self._internal_to_user: Dict[int, int] = {}
-
-        # Store original vectors for get() retrieval
-        self._vectors: Dict[int, List[float]] = {}
-
-        # Counter for assigning internal IDs
-        self._next_internal_id: int = 0
+        # User-ID mapping, original float32 vectors (the index keeps cosine
+        # vectors normalized) and internal ID assignment
+        rerank_path = hnsw_params.get('rerank_path', '')
+        if shards == 1:
+            self._hnsw_index = make_index(rerank_path, max_elements)
+            self._core = CollectionCore(self._hnsw_index)
+        else:
+            # Each shard keeps its own rerank file
+            self._hnsw_index = None
+            self._core = ShardedCore([
+                CollectionCore(make_index(f"{rerank_path}.{s}" if rerank_path else '', 0))
+                for s in range(shards)
+            ])
+            if hnsw_params.get('numa', False):
+                self._core.set_numa_nodes(ShardedCore.online_numa_nodes())
+        if max_elements:
+            self._core.reserve(max_elements)
+        if 'flat_threshold' in hnsw_params:
+            self.flat_threshold = hnsw_params['flat_threshold']
 
     @property
     def name(self) -> str:
@@ -95,51 +129,77 @@ class Collection:
         """Get the distance metric for this collection."""
         return self._metric
 
+    @property
+    def shards(self) -> int:
+        """Get the number of independent indexes the vectors are split across."""
+        return len(self._get_shards())
+
+    @property
+    def flat_threshold(self) -> int:
+        """Get the index size up to which searches scan exactly; per shard when sharded."""
+        return self._get_shards()[0].index.flat_threshold
+
+    @flat_threshold.setter
+    def flat_threshold(self, n: int) -> None:
+        if n < 0:
+            raise ValueError(f"flat_threshold must be >= 0, got {n}")
+        for shard in self._get_shards():
+            shard.index.flat_threshold = n
+
     def insert(self, user_id: int, vector: VectorType) -> None:
         """
         Insert a vector with a user-provided ID.
 
         Args:
-            user_id: Unique user identifier for this vector
+            user_id: Unique user identifier for this vector (a 64-bit integer)
             vector: The vector to insert (list or numpy array)
 
         Raises:
             DuplicateIDError: If user_id already exists in the collection
             DimensionError: If vector dimension doesn't match collection dimension
         """
-        # Convert numpy array to list if needed
-        if isinstance(vector, np.ndarray):
-            vector = vector.tolist()
-
-        # Validate dimension
-        if len(vector) != self._dimension:
-            raise DimensionError(
-                f"Expected dimension {self._dimension}, got {len(vector)}"
-            )
-
-        # Check for duplicate user ID
-        if user_id in self._user_to_internal:
-            raise DuplicateIDError(f"User ID {user_id} already exists in collection '{self._name}'")
+        try:
+            self._core.insert(user_id, vector)
+        except DuplicateIDError as e:
+            raise DuplicateIDError(f"{e} in collection '{self._name}'") from None
 
-        # Assign internal ID
-        internal_id = self._next_internal_id
-        self._next_internal_id += 1
+    def insert_batch(
+        self,
+        user_ids: Sequence[int],
+        vectors: Union[Sequence[VectorType], np.ndarray],
+        num_threads: int = 0
+    ) -> None:
+        """
+        Insert many vectors at once, building the index on multiple threads.
 
-        # Store mappings
-        self._user_to_internal[user_id] = internal_id
-        self._internal_to_user[internal_id] = user_id
+        The whole batch is validated first; if any check fails nothing is
+        inserted.
 
-        # Store original vector
-        self._vectors[user_id] = list(vector)
+        Args:
+            user_ids: Unique user identifiers, one per vector
+            vectors: 2-D array (or sequence of vectors) of shape (n, dimension)
+            num_threads: Index build threads (default: 0, one per core)
 
-        # Add to HNSW index
-        self._hnsw_index.add(internal_id, vector)
+        Raises:
+            DuplicateIDError: If a user_id already exists or repeats in the batch
+            DimensionError: If vectors is not of shape (n, dimension)
+            ValueError: If user_ids and vectors differ in length
+        """
+        try:
+            self._core.insert_batch(user_ids, vectors, num_threads)
+        except DuplicateIDError as e:
+            raise DuplicateIDError(f"{e} in collection '{self._name}'") from None
 
     def search(
         self,
         query: VectorType,
         k: int = 10,
-        ef_search: int = 50
+        ef_search: int = 50,
+        filter: Union[Iterable[int], Callable[[int], bool], None] = None,
+        target_recall: Optional[float] = None,
+        patience: int = 0,
+        max_ef: int = 0,
+        max_distances: int = 0
     ) -> List[Tuple[int, float]]:
         """
         Search for the k nearest neighbors to a query vector.
@@ -148,6 +208,19 @@ class Collection:
             query: Query vector
             k: Number of neighbors to return (default: 10)
             ef_search: Search width parameter (default: 50)
+            filter: Restrict results to these user IDs, or to the user IDs
+                this predicate accepts. The filter is applied during the
+                graph search, so k matches come back whenever k exist;
+                very selective filters are searched exactly instead.
+            target_recall: Search with the smallest ef_search that reached
+                this recall in calibrate(), instead of ef_search
+            patience: Adaptive termination: stop once this many node
+                expansions in a row leave the top k unchanged, so easy
+                queries finish early (default: 0, off)
+            max_ef: With patience, widen ef_search up to this value for
+                queries whose top k is still changing at the ef bound
+            max_distances: Stop after this many distance computations
+                (default: 0, unlimited)
 
         Returns:
             List of (user_id, distance) tuples sorted by distance ascending.
@@ -155,27 +228,112 @@ class Collection:
 
         Raises:
             DimensionError: If query dimension doesn't match collection dimension
+            RuntimeError: If target_recall is given before calibrate()
         """
-        # Convert numpy array to list if needed
-        if isinstance(query, np.ndarray):
-            query = query.tolist()
-
-        # Validate dimension
-        if len(query) != self._dimension:
-            raise DimensionError(
-                f"Expected dimension {self._dimension}, got {len(query)}"
-            )
+        if callable(filter):
+            predicate = filter
+            filter = [user_id for user_id in self._core.user_ids().tolist() if predicate(user_id)]
+        elif filter is not None and not isinstance(filter, np.ndarray):
+            filter = list(filter)
+        return self._core.search(query, k, ef_search, filter, patience=patience, max_ef=max_ef,
+                                 max_distances=max_distances, target_recall=target_recall or 0.0)
+
+    def search_batch(
+        self,
+        queries: Union[Sequence[VectorType], np.ndarray],
+        k: int = 10,
+        ef_search: int = 50,
+        num_threads: int = 0
+    ) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        Search for the k nearest neighbors of many queries at once, in
+        parallel inside the core.
+
+        Args:
+            queries: 2-D array (or sequence of vectors) of queries
+            k: Neighbors per query (default: 10)
+            ef_search: Search width parameter (default: 50)
+            num_threads: Worker threads (default: 0, all cores)
+
+        Returns:
+            Tuple (user_ids, distances) of arrays with shape (n, k), rows
+            sorted by distance ascending and padded with user ID -1 and
+            distance inf when fewer than k results are found
+
+        Raises:
+            DimensionError: If queries is not of shape (n, dimension)
+        """
+        return self._core.search_batch(np.asarray(queries, dtype=np.float32), k, ef_search, num_threads)
+
+    def ground_truth(
+        self,
+        queries: Union[Sequence[VectorType], np.ndarray],
+        k: int = 10,
+        num_threads: int = 0
+    ) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        Find the exact k nearest neighbors of each query by scanning every
+        vector, for measuring the recall of search().
 
-        # Search HNSW index
-        internal_results = self._hnsw_index.search(query, k, ef_search)
+        Args:
+            queries: 2-D array (or sequence of vectors) of queries
+            k: Neighbors per query (default: 10)
+            num_threads: Worker threads (default: 0, all cores)
+
+        Returns:
+            Tuple (user_ids, distances) of arrays with shape (n, k), rows
+            sorted by distance ascending and padded with user ID -1 and
+            distance inf when fewer than k vectors exist
 
-        # Translate internal IDs to user IDs
-        user_results = [
-            (self._internal_to_user[internal_id], distance)
-            for internal_id, distance in internal_results
-        ]
+        Raises:
+            DimensionError: If queries is not of shape (n, dimension)
+        """
+        return self._core.search_exact(np.asarray(queries, dtype=np.float32), k, num_threads)
 
-        return user_results
+    def calibrate(
+        self,
+        queries: Union[Sequence[VectorType], np.ndarray],
+        k: int = 10,
+        ef_values: Optional[Sequence[int]] = None,
+        patience: int = 0,
+        max_ef: int = 0
+    ) -> List[Tuple[int, float]]:
+        """
+        Learn the ef_search-to-recall curve from sample queries.
+
+        Each ef_search is measured against exact results over the current
+        vectors. search(target_recall=...) then uses the smallest ef_search
+        that reached the target. The curve is not persisted; calibrate again
+        after reopening the collection or changing it substantially.
+
+        Args:
+            queries: 2-D array (or sequence of vectors) of representative queries
+            k: Neighbors per query (default: 10)
+            ef_values: ef_search values to measure (default: k, 2k, 4k, ...
+                up to 1024)
+            patience: Adaptive termination every calibrated search uses
+            max_ef: Widening limit every calibrated search uses
+
+        Returns:
+            List of (ef_search, recall) pairs in ascending ef_search; for a
+            sharded collection, each shard is calibrated and the recall is
+            the mean over shards
+        """
+        queries = np.asarray(queries, dtype=np.float32)
+        curves = [shard.index.calibrate(queries, k, list(ef_values or []), patience=patience, max_ef=max_ef)
+                  for shard in self._get_shards()]
+        return [(ef, sum(curve[i][1] for curve in curves) / len(curves))
+                for i, (ef, _) in enumerate(curves[0])]
+
+    def reserve(self, n: int) -> None:
+        """
+        Allocate storage for n vectors in all, so that ingesting up to that
+        many does not pause to grow the index.
+
+        Args:
+            n: Total number of vectors to make room for
+        """
+        self._core.reserve(n)
 
     def delete(self, user_id: int) -> bool:
         """
@@ -187,22 +345,37 @@ class Collection:
         Returns:
             True if the vector was found and deleted, False otherwise
         """
-        if user_id not in self._user_to_internal:
-            return False
+        return self._core.remove(user_id)
+
+    def compact(self, num_threads: int = 0) -> int:
+        """
+        Reclaim the space held by deleted vectors.
 
-        internal_id = self._user_to_internal[user_id]
+        Deletion only marks a vector, so deleted vectors still cost memory
+        and search time. Compacting unlinks them from the graph, reconnects
+        their neighbors and lets later inserts reuse their slots. Search
+        results are unchanged apart from graph quality; other calls on the
+        collection wait until it finishes.
 
-        # Remove from HNSW index
-        self._hnsw_index.remove(internal_id)
+        Args:
+            num_threads: Worker threads for the graph repair (0 = all cores)
 
-        # Remove from mappings
-        del self._user_to_internal[user_id]
-        del self._internal_to_user[internal_id]
+        Returns:
+            The number of deleted vectors reclaimed
+        """
+        return self._core.compact(num_threads)
 
-        # Remove stored vector
-        del self._vectors[user_id]
+    def reorder(self) -> None:
+        """
+        Renumber the index by graph locality.
 
-        return True
+        Nodes are relabeled breadth-first from the entry point and their
+        vectors and links moved to match, so neighbors sit close together in
+        memory and searches take fewer cache and TLB misses. Results are
+        unchanged. Run it after bulk loading or compaction; other calls on
+        the collection wait until it finishes.
+        """
+        self._core.reorder()
 
     def get(self, user_id: int) -> Optional[List[float]]:
         """
@@ -214,10 +387,7 @@ class Collection:
         Returns:
             The vector as a list of floats, or None if not found
         """
-        vector = self._vectors.get(user_id)
-        if vector is not None:
-            return list(vector)  # Return a copy
-        return None
+        return self._core.get(user_id)
 
     def contains(self, user_id: int) -> bool:
         """
@@ -229,7 +399,7 @@ class Collection:
         Returns:
             True if the ID exists, False otherwise
         """
-        return user_id in self._user_to_internal
+        return self._core.contains(user_id)
 
     def count(self) -> int:
         """
@@ -238,7 +408,7 @@ class Collection:
         Returns:
             Number of non-deleted vectors
         """
-        return len(self._user_to_internal)
+        return len(self._core)
 
     def __len__(self) -> int:
         """Return the number of vectors in the collection."""
@@ -254,16 +424,38 @@ class Collection:
         """Get the underlying HNSW index (for persistence)."""
         return self._hnsw_index
 
+    def _get_core(self) -> Union[CollectionCore, ShardedCore]:
+        """Get the collection core (for persistence)."""
+        return self._core
+
+    def _get_shards(self) -> List[CollectionCore]:
+        """Get the collection core of each shard; just the core when unsharded."""
+        if self._hnsw_index is None:
+            return self._core.shards
+        return [self._core]
+
+    def _get_logs(self) -> list:
+        """Get the write-ahead logs attached to the shards."""
+        return [shard.log for shard in self._get_shards() if shard.log is not None]
+
+    def _set_logs(self, logs: Optional[list]) -> None:
+        """Attach one write-ahead log per shard, or detach them for None."""
+        for s, shard in enumerate(self._get_shards()):
+            shard.set_log(logs[s] if logs is not None else None)
+
     def _get_state(self) -> dict:
-        """Get collection state for persistence."""
+        """Get collection state, with copies of the rows."""
+        internal_to_user, live, vectors = self._core.rows()
+        internal_ids = np.flatnonzero(live).tolist()
+        user_ids = internal_to_user[internal_ids].tolist()
         return {
             'name': self._name,
             'dimension': self._dimension,
             'metric': self._metric,
-            'user_to_internal': self._user_to_internal,
-            'internal_to_user': self._internal_to_user,
-            'vectors': self._vectors,
-            'next_internal_id': self._next_internal_id,
+            'user_to_internal': dict(zip(user_ids, internal_ids)),
+            'internal_to_user': dict(zip(internal_ids, user_ids)),
+            'vectors': vectors,
+            'next_internal_id': self._core.next_internal_id,
         }
 
     @classmethod
@@ -273,14 +465,25 @@ class Collection:
         hnsw_index: HNSWIndex,
         hnsw_params: Optional[Dict] = None
     ) -> 'Collection':
-        """Reconstruct collection from persisted state."""
+        """Reconstruct collection from state returned by _get_state()."""
+        rows = state['next_internal_id']
+        internal_to_user = np.zeros(rows, dtype=np.int64)
+        live = np.zeros(rows, dtype=np.uint8)
+        internal_ids = np.fromiter(state['user_to_internal'].values(), dtype=np.int64)
+        internal_to_user[internal_ids] = np.fromiter(state['user_to_internal'].keys(), dtype=np.int64)
+        live[internal_ids] = 1
+
+        core = CollectionCore(hnsw_index)
+        core.set_rows(internal_to_user, live, state['vectors'][:rows])
+        return cls._from_core(state['name'], state['metric'], core)
+
+    @classmethod
+    def _from_core(cls, name: str, metric: str, core: CollectionCore) -> 'Collection':
+        """Wrap a collection core, e.g. one opened from a .vectors file, or a sharded core."""
         collection = cls.__new__(cls)
-        collection._name = state['name']
-        collection._dimension = state['dimension']
-        collection._metric = state['metric']
-        collection._user_to_internal = state['user_to_internal']
-        collection._internal_to_user = state['internal_to_user']
-        collection._vectors = state['vectors']
-        collection._next_internal_id = state['next_internal_id']
-        collection._hnsw_index = hnsw_index
+        collection._name = name
+        collection._dimension = core.dimension
+        collection._metric = metric
+        collection._hnsw_index = None if isinstance(core, ShardedCore) else core.index
+        collection._core = core
         return collection
@@ -9,9 +9,11 @@ from __future__ import annotations
 
 import json
 import os
+import re
 import struct
+from concurrent.futures import ThreadPoolExecutor
 from pathlib import Path
-from typing import Dict, List, Optional, TYPE_CHECKING
+from typing import Callable, List, Optional, TypeVar, TYPE_CHECKING
 
 from vecdb.exceptions import DeserializationError
 
@@ -20,11 +22,13 @@ if TYPE_CHECKING:
 
 # Import HNSW - try C++ first, fall back to mock
 try:
-    from vecdb._hnsw_cpp import HNSWIndex
+    from vecdb._hnsw_cpp import HNSWIndex, Collection as CollectionCore, WriteAheadLog
 except ImportError:
-    from vecdb._hnsw_mock import HNSWIndex
+    from vecdb._hnsw_mock import HNSWIndex, Collection as CollectionCore, WriteAheadLog
 
 
+T = TypeVar('T')
+
 # File format version for compatibility checking
 FILE_FORMAT_VERSION = 1
 
@@ -39,7 +43,17 @@ class PersistenceManager:
         └── collections/
             ├── {name}.hnsw       # Serialized HNSW index (binary)
             ├── {name}.meta       # Collection metadata (JSON)
-            └── {name}.vectors    # Original vectors + ID mappings (binary)
+            ├── {name}.vectors    # Original vectors + ID mappings (binary)
+            └── {name}.wal        # Inserts and removals since the snapshot (optional)
+
+    A sharded collection keeps one .meta file and, for each shard s, the
+    files {name}.{s}.hnsw, {name}.{s}.vectors and {name}.{s}.wal.
+
+    The .hnsw, .meta and .vectors files are a snapshot of the collection.
+    With a write-ahead log attached (open_log()), its inserts and removals
+    are also logged as they happen; the snapshot records the last log
+    sequence number it holds, and load_collection() replays the records
+    after it.
 
     Args:
         db_path: Directory path for database storage.
@@ -54,44 +68,109 @@ class PersistenceManager:
         self.db_path.mkdir(parents=True, exist_ok=True)
         self.collections_path.mkdir(parents=True, exist_ok=True)
 
-    def save_collection(self, collection: 'Collection') -> None:
+    def save_collection(self, collection: 'Collection', reorder: bool = False) -> None:
         """
         Save a single collection to disk.
 
-        Uses atomic writes (write to .tmp, then rename) for safety.
+        Uses atomic writes (write to .tmp, then rename) for safety. The
+        index is written with HNSWIndex.save() so load_collection() can map it.
+        The shards of a sharded collection are written concurrently.
 
         Args:
             collection: The Collection object to save
+            reorder: Renumber the index by graph locality first (see
+                Collection.reorder()); a rerank file is permuted into a new
+                generation, leaving the current snapshot intact
         """
+        if reorder:
+            collection.reorder()
         name = collection.name
-        state = collection._get_state()
-        hnsw_index = collection._get_hnsw_index()
-
-        # Save HNSW index (binary)
-        hnsw_path = self.collections_path / f"{name}.hnsw"
-        hnsw_data = hnsw_index.serialize()
-        self._atomic_write(hnsw_path, hnsw_data, binary=True)
+        core = collection._get_core()
+        shards = collection._get_shards()
+        prefixes = self._shard_prefixes(name, len(shards))
+        logs = [shard.log for shard in shards]
+        log_lsns = [log.last_lsn if log is not None else 0 for log in logs]
+
+        # Save HNSW indexes (binary). A loaded index may still be mapped from
+        # hnsw_path; the rename leaves that mapping on the old file.
+        def save_hnsw(s: int) -> None:
+            hnsw_path = self.collections_path / f"{prefixes[s]}.hnsw"
+            tmp_path = hnsw_path.with_suffix(hnsw_path.suffix + '.tmp')
+            shards[s].index.save(str(tmp_path))
+            tmp_path.rename(hnsw_path)
+            self._remove_stale_rerank_files(shards[s].index.rerank_path)
+        self._for_each_shard(len(shards), save_hnsw)
 
         # Save collection metadata (JSON)
         meta_path = self.collections_path / f"{name}.meta"
         meta = {
             'version': FILE_FORMAT_VERSION,
-            'name': state['name'],
-            'dimension': state['dimension'],
-            'metric': state['metric'],
-            'count': len(state['vectors']),
-            'next_internal_id': state['next_internal_id'],
+            'name': name,
+            'dimension': collection.dimension,
+            'metric': collection.metric,
+            'count': len(core),
+            'flat_threshold': collection.flat_threshold,
         }
+        if len(shards) == 1:
+            meta['next_internal_id'] = core.next_internal_id
+            meta['wal_lsn'] = log_lsns[0]
+        else:
+            meta['shards'] = len(shards)
+            meta['next_internal_id'] = [shard.next_internal_id for shard in shards]
+            meta['wal_lsn'] = log_lsns
         self._atomic_write(meta_path, json.dumps(meta, indent=2).encode('utf-8'), binary=True)
 
-        # Save vectors and ID mappings (binary)
-        vectors_path = self.collections_path / f"{name}.vectors"
-        vectors_data = self._serialize_vectors(state)
-        self._atomic_write(vectors_path, vectors_data, binary=True)
+        # Save vectors and ID mappings (binary), in the format of
+        # CollectionCore.save_vectors()
+        def save_vectors(s: int) -> None:
+            vectors_path = self.collections_path / f"{prefixes[s]}.vectors"
+            tmp_path = vectors_path.with_suffix(vectors_path.suffix + '.tmp')
+            shards[s].save_vectors(str(tmp_path))
+            tmp_path.rename(vectors_path)
+        self._for_each_shard(len(shards), save_vectors)
+
+        # The snapshot now holds every logged record
+        for prefix, log, log_lsn in zip(prefixes, logs, log_lsns):
+            wal_path = self.collections_path / f"{prefix}.wal"
+            if log is not None:
+                log.truncate(log_lsn)
+            elif wal_path.exists():
+                wal_path.unlink()
+
+    def open_log(self, collection: 'Collection',
+                 sync_bytes: int = WriteAheadLog.DEFAULT_SYNC_BYTES):
+        """
+        Attach a write-ahead log to a saved or loaded collection, so its
+        inserts and removals are logged before they are applied. An existing
+        log is appended to. Each shard of a sharded collection gets its own.
+
+        Args:
+            collection: The collection to log
+            sync_bytes: Bytes logged between syncs to disk; sync() on the
+                log makes everything logged so far durable
+
+        Returns:
+            The attached log, or the list of them for a sharded collection
+        """
+        name = collection.name
+        shards = collection._get_shards()
+        meta_path = self.collections_path / f"{name}.meta"
+        after_lsns = [0] * len(shards)
+        if meta_path.exists():
+            with open(meta_path, 'r', encoding='utf-8') as f:
+                wal_lsn = json.load(f).get('wal_lsn', 0)
+            after_lsns = wal_lsn if isinstance(wal_lsn, list) else [wal_lsn]
+        logs = [
+            WriteAheadLog(str(self.collections_path / f"{prefix}.wal"), collection.dimension, sync_bytes, after_lsn)
+            for prefix, after_lsn in zip(self._shard_prefixes(name, len(shards)), after_lsns)
+        ]
+        collection._set_logs(logs)
+        return logs[0] if len(logs) == 1 else logs
 
     def load_collection(self, name: str) -> Optional['Collection']:
         """
-        Load a collection by name.
+        Load a collection by name. The shards of a sharded collection are
+        loaded concurrently.
 
         Args:
             name: The collection name to load
@@ -102,14 +181,10 @@ class PersistenceManager:
         Raises:
             DeserializationError: If files are corrupt or incompatible
         """
-        from vecdb.collection import Collection
+        from vecdb.collection import Collection, ShardedCore
 
         meta_path = self.collections_path / f"{name}.meta"
-        hnsw_path = self.collections_path / f"{name}.hnsw"
-        vectors_path = self.collections_path / f"{name}.vectors"
-
-        # Check if all files exist
-        if not all(p.exists() for p in [meta_path, hnsw_path, vectors_path]):
+        if not meta_path.exists():
             return None
 
         try:
@@ -123,40 +198,67 @@ class PersistenceManager:
                     f"File format version {meta.get('version')} is newer than supported {FILE_FORMAT_VERSION}"
                 )
 
-            # Load HNSW index
-            with open(hnsw_path, 'rb') as f:
-                hnsw_data = f.read()
-            hnsw_index = HNSWIndex.deserialize(hnsw_data)
-
-            # Load vectors and mappings
-            with open(vectors_path, 'rb') as f:
-                vectors_data = f.read()
-            vectors_state = self._deserialize_vectors(vectors_data, meta['dimension'])
-
-            # Reconstruct collection state
-            state = {
-                'name': meta['name'],
-                'dimension': meta['dimension'],
-                'metric': meta['metric'],
-                'user_to_internal': vectors_state['user_to_internal'],
-                'internal_to_user': vectors_state['internal_to_user'],
-                'vectors': vectors_state['vectors'],
-                'next_internal_id': meta['next_internal_id'],
-            }
-
-            return Collection._from_state(state, hnsw_index)
-
+            # Check if all files exist
+            shards = meta.get('shards', 1)
+            prefixes = self._shard_prefixes(name, shards)
+            wal_lsns = meta.get('wal_lsn', 0)
+            if not isinstance(wal_lsns, list):
+                wal_lsns = [wal_lsns]
+            if not all((self.collections_path / f"{prefix}.{suffix}").exists()
+                       for prefix in prefixes for suffix in ('hnsw', 'vectors')):
+                return None
+            if len(wal_lsns) != shards:
+                raise DeserializationError(f"Metadata has {len(wal_lsns)} log positions for {shards} shards")
+
+            cores = self._for_each_shard(shards, lambda s: self._load_core(name, prefixes[s], wal_lsns[s]))
+            core = cores[0] if shards == 1 else ShardedCore(cores)
+            collection = Collection._from_core(meta['name'], meta['metric'], core)
+            if 'flat_threshold' in meta:
+                collection.flat_threshold = meta['flat_threshold']
+            return collection
+
+        except DeserializationError:
+            raise
         except json.JSONDecodeError as e:
             raise DeserializationError(f"Corrupt metadata file for collection '{name}': {e}")
         except (KeyError, TypeError) as e:
             raise DeserializationError(f"Invalid data format for collection '{name}': {e}")
-        except struct.error as e:
+        except (struct.error, ValueError) as e:
             raise DeserializationError(f"Corrupt vectors file for collection '{name}': {e}")
-        except Exception as e:
-            # Catch C++ DeserializationError and convert to Python exception
-            if 'DeserializationError' in type(e).__name__ or 'Unsupported' in str(e):
-                raise DeserializationError(f"Corrupt HNSW file for collection '{name}': {e}")
-            raise
+
+    def _load_core(self, name: str, prefix: str, wal_lsn: int) -> CollectionCore:
+        """Open the index and vectors saved under prefix and replay their log."""
+        hnsw_path = self.collections_path / f"{prefix}.hnsw"
+        vectors_path = self.collections_path / f"{prefix}.vectors"
+
+        # Load HNSW index: map files written by save(), parse older
+        # serialize() files
+        try:
+            with open(hnsw_path, 'rb') as f:
+                magic = f.read(len(HNSWIndex.MMAP_MAGIC))
+            if magic == HNSWIndex.MMAP_MAGIC:
+                hnsw_index = HNSWIndex.open_mmap(str(hnsw_path))
+            else:
+                with open(hnsw_path, 'rb') as f:
+                    hnsw_data = f.read()
+                hnsw_index = HNSWIndex.deserialize(hnsw_data)
+        except DeserializationError as e:
+            raise DeserializationError(f"Corrupt HNSW file for collection '{name}': {e}") from None
+
+        # Load vectors and mappings over the index
+        try:
+            core = CollectionCore.open_vectors(hnsw_index, str(vectors_path))
+        except DeserializationError as e:
+            raise DeserializationError(f"Corrupt vectors file for collection '{name}': {e}") from None
+
+        # Replay the inserts and removals logged since the snapshot
+        wal_path = self.collections_path / f"{prefix}.wal"
+        if wal_path.exists():
+            try:
+                core.replay_log(str(wal_path), wal_lsn)
+            except DeserializationError as e:
+                raise DeserializationError(f"Corrupt log for collection '{name}': {e}") from None
+        return core
 
     def delete_collection(self, name: str) -> bool:
         """
@@ -171,15 +273,51 @@ class PersistenceManager:
         meta_path = self.collections_path / f"{name}.meta"
         hnsw_path = self.collections_path / f"{name}.hnsw"
         vectors_path = self.collections_path / f"{name}.vectors"
+        wal_path = self.collections_path / f"{name}.wal"
+        shard_file = re.compile(re.escape(name) + r"\.\d+\.(hnsw|vectors|wal)")
+        shard_paths = [path for path in self.collections_path.iterdir() if shard_file.fullmatch(path.name)]
 
         deleted_any = False
-        for path in [meta_path, hnsw_path, vectors_path]:
+        for path in [meta_path, hnsw_path, vectors_path, wal_path] + shard_paths:
             if path.exists():
                 path.unlink()
                 deleted_any = True
 
         return deleted_any
 
+    @staticmethod
+    def _shard_prefixes(name: str, shards: int) -> List[str]:
+        """File name stems of each shard: {name} unsharded, {name}.{s} otherwise."""
+        if shards == 1:
+            return [name]
+        return [f"{name}.{s}" for s in range(shards)]
+
+    @staticmethod
+    def _remove_stale_rerank_files(rerank_path: str) -> None:
+        """
+        Delete the generations of a rerank file ({base} and {base}.v{N}, as
+        HNSWIndex names them) other than rerank_path, the one the snapshot
+        just written names. Earlier snapshots were the only other users.
+        """
+        if not rerank_path:
+            return
+        current = Path(rerank_path)
+        base = re.sub(r"\.v\d+$", "", current.name)
+        generation = re.compile(re.escape(base) + r"(\.v\d+)?")
+        if not current.parent.is_dir():
+            return
+        for path in current.parent.iterdir():
+            if path.name != current.name and generation.fullmatch(path.name):
+                path.unlink()
+
+    @staticmethod
+    def _for_each_shard(shards: int, fn: Callable[[int], T]) -> List[T]:
+        """Run fn(s) for every shard, concurrently when there are several."""
+        if shards == 1:
+            return [fn(0)]
+        with ThreadPoolExecutor(max_workers=shards) as pool:
+            return list(pool.map(fn, range(shards)))
+
     def list_collections(self) -> List[str]:
         """
         List all persisted collection names.
@@ -247,95 +385,3 @@ class PersistenceManager:
 
         # Atomic rename
         tmp_path.rename(path)
-
-    def _serialize_vectors(self, state: dict) -> bytes:
-        """
-        Serialize vectors and ID mappings to binary format.
-
-        Format:
-            Header: [version: uint32][count: uint64][dimension: uint32]
-            Per vector: [user_id: uint64][internal_id: uint64][floats: float32 * dim]
-
-        Args:
-            state: Collection state dict
-
-        Returns:
-            Binary serialized data
-        """
-        vectors = state['vectors']
-        user_to_internal = state['user_to_internal']
-        dimension = state['dimension']
-
-        # Header
-        data = struct.pack('<IQI', FILE_FORMAT_VERSION, len(vectors), dimension)
-
-        # Per-vector data
-        for user_id, vector in vectors.items():
-            internal_id = user_to_internal[user_id]
-            # Pack user_id, internal_id, then vector floats
-            data += struct.pack('<QQ', user_id, internal_id)
-            data += struct.pack(f'<{dimension}f', *vector)
-
-        return data
-
-    def _deserialize_vectors(self, data: bytes, expected_dimension: int) -> dict:
-        """
-        Deserialize vectors and ID mappings from binary format.
-
-        Args:
-            data: Binary data from _serialize_vectors
-            expected_dimension: Expected vector dimension for validation
-
-        Returns:
-            Dict with 'vectors', 'user_to_internal', 'internal_to_user'
-
-        Raises:
-            DeserializationError: If data is corrupt or dimension mismatch
-        """
-        if len(data) < 16:  # Minimum header size
-            raise DeserializationError("Vectors file too small")
-
-        # Read header
-        version, count, dimension = struct.unpack('<IQI', data[:16])
-
-        if version > FILE_FORMAT_VERSION:
-            raise DeserializationError(
-                f"Vectors file version {version} is newer than supported {FILE_FORMAT_VERSION}"
-            )
-
-        if dimension != expected_dimension:
-            raise DeserializationError(
-                f"Dimension mismatch: file has {dimension}, expected {expected_dimension}"
-            )
-
-        # Calculate expected size
-        vector_size = 16 + (dimension * 4)  # 2 uint64 + dimension floats
-        expected_size = 16 + (count * vector_size)
-
-        if len(data) < expected_size:
-            raise DeserializationError(
-                f"Vectors file truncated: expected {expected_size} bytes, got {len(data)}"
-            )
-
-        # Read vectors
-        vectors: Dict[int, List[float]] = {}
-        user_to_internal: Dict[int, int] = {}
-        internal_to_user: Dict[int, int] = {}
-
-        offset = 16
-        for _ in range(count):
-            user_id, internal_id = struct.unpack('<QQ', data[offset:offset + 16])
-            offset += 16
-
-            vector = list(struct.unpack(f'<{dimension}f', data[offset:offset + dimension * 4]))
-            offset += dimension * 4
-
-            vectors[user_id] = vector
-            user_to_internal[user_id] = internal_id
-            internal_to_user[internal_id] = user_id
-
-        return {
-            'vectors': vectors,
-            'user_to_internal': user_to_internal,
-            'internal_to_user': internal_to_user,
-        }
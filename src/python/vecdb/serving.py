@@ -0,0 +1,148 @@
+"""
+VecDB Query Serving
+
+Serves searches to asyncio code without a thread per request: queries are
+queued in the native query server, which coalesces them into micro-batches
+for the batched search path, and completions wake the event loop through a
+file descriptor.
+"""
+
+from __future__ import annotations
+
+import asyncio
+from typing import Dict, List, Optional, Tuple, TYPE_CHECKING, Union
+
+import numpy as np
+
+if TYPE_CHECKING:
+    from vecdb.collection import Collection
+
+# Import HNSW - try C++ first, fall back to mock
+try:
+    from vecdb._hnsw_cpp import QueryServer
+except ImportError:
+    from vecdb._hnsw_mock import QueryServer
+
+VectorType = Union[List[float], np.ndarray]
+
+
+class AsyncSearcher:
+    """
+    Asynchronous search over a collection, for serving many concurrent
+    callers on one event loop.
+
+    Each submitted query is copied into the native queue and returns at
+    once. Worker threads take queued queries in batches of up to max_batch
+    that share k and ef_search, holding a batch open at most max_wait_us past
+    its oldest query's arrival for more to arrive, and search each batch in
+    one call. A larger max_wait_us trades latency for fuller batches under
+    light load; under heavy load batches fill before the wait runs out.
+
+    The searcher binds to the running event loop on first use and must be
+    used and closed from that loop's thread.
+
+    Args:
+        collection: The Collection to search
+        max_batch: Most queries searched together (default 64)
+        max_wait_us: Longest a query waits for its batch to fill, in
+            microseconds (default 200)
+        num_threads: Worker threads (default: 0, all cores)
+
+    Example:
+        async with AsyncSearcher(collection) as searcher:
+            results = await asyncio.gather(*(searcher.search(q, k=10) for q in queries))
+    """
+
+    def __init__(
+        self,
+        collection: Collection,
+        max_batch: int = QueryServer.DEFAULT_MAX_BATCH,
+        max_wait_us: int = QueryServer.DEFAULT_MAX_WAIT_US,
+        num_threads: int = 0
+    ) -> None:
+        self._server = QueryServer(collection._get_core(), max_batch, max_wait_us, num_threads)
+        self._loop: Optional[asyncio.AbstractEventLoop] = None
+        self._pending: Dict[int, asyncio.Future] = {}
+        self._closed = False
+
+    @property
+    def max_batch(self) -> int:
+        return self._server.max_batch
+
+    @property
+    def max_wait_us(self) -> int:
+        return self._server.max_wait_us
+
+    @property
+    def pending(self) -> int:
+        """Queries submitted and not yet resolved."""
+        return len(self._pending)
+
+    @property
+    def batches(self) -> Tuple[int, int]:
+        """(batches run, queries they held), for judging how well queries coalesce."""
+        return self._server.batches, self._server.batched_queries
+
+    def submit(self, query: VectorType, k: int = 10, ef_search: int = 50) -> asyncio.Future:
+        """
+        Queue a query, returning a future for its list of (user_id,
+        distance) tuples, sorted by distance ascending as from
+        Collection.search(). Cancelling the future discards its result; the
+        query itself still runs.
+
+        Raises:
+            DimensionError: If query dimension doesn't match the collection
+            ValueError: If k < 1
+            RuntimeError: If called outside a running event loop, from
+                another loop than the first, or after close()
+        """
+        if self._closed:
+            raise RuntimeError("AsyncSearcher is closed")
+        loop = asyncio.get_running_loop()
+        if self._loop is None:
+            loop.add_reader(self._server.notify_fd, self._drain)
+            self._loop = loop
+        elif loop is not self._loop:
+            raise RuntimeError("AsyncSearcher is bound to another event loop")
+        ticket = self._server.submit(query, k, ef_search)
+        future = loop.create_future()
+        self._pending[ticket] = future
+        return future
+
+    async def search(self, query: VectorType, k: int = 10, ef_search: int = 50) -> List[Tuple[int, float]]:
+        """Search for the k nearest neighbors to a query; see submit()."""
+        return await self.submit(query, k, ef_search)
+
+    def close(self) -> None:
+        """
+        Stop taking queries, wait for the queued ones to finish and resolve
+        their futures. Safe to call more than once.
+        """
+        if self._closed:
+            return
+        self._closed = True
+        self._server.close()
+        if self._loop is not None:
+            self._drain()
+            self._loop.remove_reader(self._server.notify_fd)
+        for future in self._pending.values():
+            if not future.done():
+                future.set_exception(RuntimeError("AsyncSearcher closed before the query finished"))
+        self._pending.clear()
+
+    async def __aenter__(self) -> 'AsyncSearcher':
+        return self
+
+    async def __aexit__(self, *exc) -> None:
+        self.close()
+
+    def _drain(self) -> None:
+        """Resolve the futures of every query the server has finished."""
+        for ticket, results, error in self._server.take_completed():
+            future = self._pending.pop(ticket, None)
+            if future is None or future.done():
+                continue
+            if error is None:
+                future.set_result(results)
+            else:
+                future.set_exception(RuntimeError(error))
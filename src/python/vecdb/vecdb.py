@@ -25,6 +25,14 @@ class VecDB:
         path: Directory path for database storage (default: './vecdb_data').
               Creates the directory if it doesn't exist.
               Loads existing collections from disk if present.
+        wal: Log every insert and removal to a per-collection write-ahead
+             log, so changes since the last snapshot survive a crash
+             (default: False)
+        wal_sync_bytes: Bytes logged between syncs to disk in WAL mode;
+             save() syncs whatever remains (default: 1 MiB)
+        checkpoint_bytes: In WAL mode, save() writes a full snapshot of a
+             collection only once its log holds this many bytes, and
+             otherwise just syncs the log (default: 64 MiB)
 
     Example:
         >>> from vecdb import VecDB
@@ -56,10 +64,19 @@ class VecDB:
         >>> print(collection.count())  # Still has the vectors
     """
 
-    def __init__(self, path: str = './vecdb_data') -> None:
+    def __init__(
+        self,
+        path: str = './vecdb_data',
+        wal: bool = False,
+        wal_sync_bytes: int = 1 << 20,
+        checkpoint_bytes: int = 64 << 20
+    ) -> None:
         self._path = path
         self._persistence = PersistenceManager(path)
         self._collections: Dict[str, Collection] = {}
+        self._wal = wal
+        self._wal_sync_bytes = wal_sync_bytes
+        self._checkpoint_bytes = checkpoint_bytes
 
         # Load existing collections from disk
         self._load_existing_collections()
@@ -71,6 +88,8 @@ class VecDB:
         for name in collection_names:
             collection = self._persistence.load_collection(name)
             if collection is not None:
+                if self._wal:
+                    self._persistence.open_log(collection, self._wal_sync_bytes)
                 self._collections[name] = collection
 
     def create_collection(
@@ -87,7 +106,10 @@ class VecDB:
             name: Unique collection identifier
             dimension: Fixed vector dimension for this collection
             metric: Distance metric - 'l2', 'cosine', or 'dot' (default: 'l2')
-            hnsw_params: Optional dict with 'M' and 'ef_construction' parameters
+            hnsw_params: Optional dict with 'M', 'ef_construction', 'heuristic',
+                'keep_pruned', 'extend_candidates', 'storage', 'rerank',
+                'pq_subspaces', 'rerank_path', 'max_elements', 'shards' and
+                'numa' parameters
 
         Returns:
             The newly created Collection object
@@ -105,6 +127,10 @@ class VecDB:
             metric=metric,
             hnsw_params=hnsw_params
         )
+        if self._wal:
+            # The log only holds changes, so start it from an empty snapshot
+            self._persistence.save_collection(collection)
+            self._persistence.open_log(collection, self._wal_sync_bytes)
 
         self._collections[name] = collection
         return collection
@@ -141,7 +167,7 @@ class VecDB:
             # Still try to delete from disk in case of orphaned files
             return self._persistence.delete_collection(name)
 
-        del self._collections[name]
+        self._collections.pop(name)._set_logs(None)
         self._persistence.delete_collection(name)
         return True
 
@@ -154,11 +180,17 @@ class VecDB:
         """
         return sorted(self._collections.keys())
 
-    def save(self) -> None:
+    def save(self, reorder: bool = False) -> None:
         """
         Persist all collections to disk.
 
         Saves all collections regardless of whether they've been modified.
+        In WAL mode, a collection whose log is under checkpoint_bytes only
+        has its log synced.
+
+        Args:
+            reorder: Renumber each index by graph locality before writing it
+                (see Collection.reorder())
         """
         # Save metadata
         self._persistence.save_metadata({
@@ -167,7 +199,12 @@ class VecDB:
 
         # Save all collections
         for collection in self._collections.values():
-            self._persistence.save_collection(collection)
+            logs = collection._get_logs()
+            if logs and not reorder and sum(log.size for log in logs) < self._checkpoint_bytes:
+                for log in logs:
+                    log.sync()
+            else:
+                self._persistence.save_collection(collection, reorder=reorder)
 
     def close(self) -> None:
         """
@@ -4,6 +4,8 @@ Unit tests for Collection Manager.
 Tests the Collection class that manages user ID mappings and HNSW interactions.
 """
 
+import threading
+
 import pytest
 import numpy as np
 
@@ -34,6 +36,28 @@ class TestCollectionInit:
         assert col.dimension == 64
         assert col.metric == 'cosine'
 
+    def test_init_with_selection_params(self):
+        """Test that neighbor selection flags reach the index."""
+        col = Collection(
+            'test',
+            dimension=8,
+            metric='l2',
+            hnsw_params={'heuristic': True, 'keep_pruned': True, 'extend_candidates': True}
+        )
+        index = col._get_hnsw_index()
+        assert index.heuristic is True
+        assert index.keep_pruned is True
+        assert index.extend_candidates is True
+
+    def test_init_with_capacity_hint(self):
+        """Test that max_elements preallocates the index."""
+        col = Collection('test', dimension=4, metric='l2', hnsw_params={'max_elements': 1000})
+        assert col._get_hnsw_index().capacity >= 1000
+        col.insert_batch(list(range(10)), np.eye(10, 4, dtype=np.float32))
+        assert col.count() == 10
+        col.reserve(5000)
+        assert col._get_hnsw_index().capacity >= 5000
+
     def test_init_invalid_name(self):
         """Test that empty name raises ValueError."""
         with pytest.raises(ValueError, match="name cannot be empty"):
@@ -98,6 +122,50 @@ class TestInsertAndGet:
         assert col.get(1) == [1.0, 2.0, 3.0]
 
 
+class TestInsertBatch:
+    """Tests for bulk insert."""
+
+    def test_insert_batch_and_get(self):
+        """Test that batch-inserted vectors are retrievable and searchable."""
+        col = Collection('test', dimension=3, metric='l2')
+        col.insert_batch([10, 20, 30], [[1.0, 0.0, 0.0], [0.0, 1.0, 0.0], [0.0, 0.0, 1.0]])
+
+        assert col.count() == 3
+        assert col.get(20) == [0.0, 1.0, 0.0]
+        assert col.search([0.0, 0.0, 1.0], k=1)[0][0] == 30
+
+    def test_insert_batch_after_insert(self):
+        """Test that batch and single inserts share the ID space."""
+        np.random.seed(3)
+        col = Collection('test', dimension=8, metric='cosine')
+        col.insert(1, np.random.randn(8))
+        col.insert_batch(np.arange(2, 52), np.random.randn(50, 8), num_threads=2)
+
+        assert col.count() == 51
+        assert all(col.contains(i) for i in range(1, 52))
+        query = col.get(25)
+        assert col.search(query, k=1)[0][0] == 25
+
+    def test_insert_batch_duplicate_is_atomic(self):
+        """Test that a duplicate ID rejects the whole batch."""
+        col = Collection('test', dimension=3, metric='l2')
+        col.insert(1, [1.0, 2.0, 3.0])
+
+        with pytest.raises(DuplicateIDError):
+            col.insert_batch([2, 1], [[0.0, 0.0, 0.0], [1.0, 1.0, 1.0]])
+        with pytest.raises(DuplicateIDError):
+            col.insert_batch([5, 5], [[0.0, 0.0, 0.0], [1.0, 1.0, 1.0]])
+
+        assert col.count() == 1
+        assert not col.contains(2)
+
+    def test_insert_batch_dimension_mismatch(self):
+        """Test that wrongly shaped vectors raise DimensionError."""
+        col = Collection('test', dimension=3, metric='l2')
+        with pytest.raises(DimensionError):
+            col.insert_batch([1, 2], [[1.0, 2.0], [3.0, 4.0]])
+
+
 class TestSearch:
     """Tests for search operation."""
 
@@ -143,6 +211,119 @@ class TestSearch:
         results = col.search([0.0, 0.0, 0.0], k=100)
         assert len(results) == 2
 
+    def test_search_filter_returns_k_matches(self):
+        """Test that a filter still yields k results when matches are far away."""
+        np.random.seed(3)
+        col = Collection('test', dimension=4, metric='l2')
+        col.insert_batch(list(range(500)), np.random.randn(500, 4).astype(np.float32))
+        allowed = set(range(0, 500, 25))
+
+        results = col.search(np.zeros(4), k=10, filter=allowed)
+        assert len(results) == 10
+        assert all(user_id in allowed for user_id, _ in results)
+
+        vectors = {user_id: np.array(col.get(user_id)) for user_id in allowed}
+        expected = sorted(allowed, key=lambda user_id: np.linalg.norm(vectors[user_id]))[:10]
+        assert [user_id for user_id, _ in results] == expected
+
+    def test_search_filter_predicate(self):
+        """Test that a predicate on user IDs filters the results."""
+        col = Collection('test', dimension=2, metric='l2')
+        col.insert_batch([1, 2, 3, 4], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0], [3.0, 0.0]])
+        results = col.search([0.0, 0.0], k=2, filter=lambda user_id: user_id % 2 == 0)
+        assert [r[0] for r in results] == [2, 4]
+
+    def test_search_during_insert(self):
+        """Test that searches from other threads run while a batch is inserted."""
+        np.random.seed(5)
+        col = Collection('test', dimension=8, metric='l2', hnsw_params={'flat_threshold': 0})
+        col.insert_batch(list(range(200)), np.random.randn(200, 8).astype(np.float32))
+        query = np.random.randn(8).astype(np.float32)
+        errors = []
+
+        def searcher():
+            try:
+                for _ in range(50):
+                    results = col.search(query, k=5)
+                    assert len(results) == 5
+                    assert all(col.contains(user_id) for user_id, _ in results)
+            except Exception as e:  # reported below, threads swallow them
+                errors.append(e)
+
+        threads = [threading.Thread(target=searcher) for _ in range(4)]
+        for t in threads:
+            t.start()
+        col.insert_batch(list(range(200, 2200)), np.random.randn(2000, 8).astype(np.float32))
+        for t in threads:
+            t.join()
+
+        assert not errors
+        assert len(col) == 2200
+
+    def test_search_adaptive_termination(self):
+        """Test that patience and a distance budget still return k results."""
+        np.random.seed(6)
+        col = Collection('test', dimension=8, metric='l2', hnsw_params={'flat_threshold': 0})
+        col.insert_batch(list(range(1000)), np.random.randn(1000, 8).astype(np.float32))
+        query = np.random.randn(8).astype(np.float32)
+        exact = col.search(query, k=5, ef_search=1000)
+
+        results = col.search(query, k=5, ef_search=10, patience=200, max_ef=1000)
+        assert len({r[0] for r in results} & {r[0] for r in exact}) >= 4
+        assert len(col.search(query, k=5, max_distances=50)) == 5
+
+    def test_calibrate_target_recall(self):
+        """Test that calibration learns a recall curve that target_recall uses."""
+        np.random.seed(7)
+        col = Collection('test', dimension=8, metric='l2', hnsw_params={'flat_threshold': 0})
+        col.insert_batch(list(range(1000)), np.random.randn(1000, 8).astype(np.float32))
+        queries = np.random.randn(20, 8).astype(np.float32)
+        with pytest.raises(RuntimeError):
+            col.search(queries[0], k=5, target_recall=0.9)
+
+        curve = col.calibrate(queries, k=5, ef_values=[5, 20, 200])
+        assert [ef for ef, _ in curve] == [5, 20, 200]
+        assert all(0.0 <= recall <= 1.0 for _, recall in curve)
+        assert curve[-1][1] >= 0.9
+        assert len(col.search(queries[0], k=5, target_recall=0.9)) == 5
+
+    def test_ground_truth(self):
+        """Test that the exact scan matches a flat search and recall can be scored against it."""
+        np.random.seed(3)
+        vectors = np.random.randn(500, 8).astype(np.float32)
+        flat = Collection('flat', dimension=8, metric='cosine')
+        graph = Collection('graph', dimension=8, metric='cosine', hnsw_params={'flat_threshold': 0})
+        assert flat.flat_threshold > 500 and graph.flat_threshold == 0
+        for col in (flat, graph):
+            col.insert_batch(list(range(100, 600)), vectors)
+        queries = np.random.randn(10, 8).astype(np.float32)
+
+        ids, distances = graph.ground_truth(queries, k=5)
+        assert ids.shape == (10, 5) and distances.shape == (10, 5)
+        for row, query in enumerate(queries):
+            assert ids[row].tolist() == [r[0] for r in flat.search(query, k=5)]
+            found = {r[0] for r in graph.search(query, k=5)}
+            assert len(found & set(ids[row].tolist())) >= 4
+
+    def test_search_batch(self):
+        """Test that batched search returns search()'s results row by row, sharded or not."""
+        np.random.seed(4)
+        vectors = np.random.randn(300, 8).astype(np.float32)
+        queries = np.random.randn(6, 8).astype(np.float32)
+        for shards in (1, 3):
+            col = Collection('test', dimension=8, metric='l2', hnsw_params={'shards': shards})
+            col.insert_batch(list(range(1000, 1300)), vectors)
+            ids, distances = col.search_batch(queries, k=4)
+            assert ids.shape == (6, 4) and distances.shape == (6, 4)
+            for row, query in enumerate(queries):
+                assert ids[row].tolist() == [r[0] for r in col.search(query, k=4)]
+
+        small = Collection('small', dimension=8, metric='l2')
+        small.insert(7, vectors[0])
+        ids, distances = small.search_batch(queries[:2], k=3)
+        assert ids[:, 0].tolist() == [7, 7]
+        assert (ids[:, 1:] == -1).all() and np.isinf(distances[:, 1:]).all()
+
 
 class TestDelete:
     """Tests for delete operation."""
@@ -194,6 +375,71 @@ class TestDelete:
         assert col.contains(1) is False
         assert 1 not in col
 
+    def test_compact_after_delete(self):
+        """Test that compact reclaims deleted vectors without changing results."""
+        col = Collection('test', dimension=2, metric='l2')
+        col.insert_batch(list(range(10)), [[float(i), 0.0] for i in range(10)])
+        for user_id in range(0, 10, 2):
+            col.delete(user_id)
+        assert col.compact() == 5
+        assert col.count() == 5
+        assert {r[0] for r in col.search([4.0, 0.0], k=2)} == {3, 5}
+
+        col.insert(0, [4.1, 0.0])
+        assert col.search([4.0, 0.0], k=1)[0][0] == 0
+        assert col.get(0) == pytest.approx([4.1, 0.0])
+
+    def test_reorder_keeps_results(self):
+        """Test that reorder leaves search results and stored vectors unchanged."""
+        col = Collection('test', dimension=4, metric='l2', hnsw_params={'flat_threshold': 0})
+        rng = np.random.default_rng(3)
+        vectors = rng.standard_normal((200, 4)).astype(np.float32)
+        col.insert_batch(list(range(200)), vectors)
+        col.delete(7)
+        query = vectors[50]
+        before = col.search(query, k=10)
+        col.reorder()
+        assert col.search(query, k=10) == before
+        assert col.get(120) == pytest.approx(vectors[120].tolist())
+        assert 7 not in col
+
+
+class TestSharding:
+    """Tests for collections split across several indexes."""
+
+    def test_sharded_matches_unsharded(self):
+        """Test that a sharded collection returns what one index would."""
+        rng = np.random.default_rng(5)
+        vectors = rng.standard_normal((300, 4)).astype(np.float32)
+        single = Collection('single', dimension=4, metric='l2')
+        sharded = Collection('sharded', dimension=4, metric='l2', hnsw_params={'shards': 3})
+        for col in (single, sharded):
+            col.insert_batch(list(range(300)), vectors)
+            col.delete(42)
+        assert sharded.shards == 3 and single.shards == 1
+        assert sharded.count() == 299
+        assert all(len(shard) > 0 for shard in sharded._get_shards())
+
+        query = vectors[42]
+        assert [r[0] for r in sharded.search(query, k=10)] == [r[0] for r in single.search(query, k=10)]
+        assert sharded.search(query, k=3, filter=lambda i: i % 2 == 1) == \
+            single.search(query, k=3, filter=lambda i: i % 2 == 1)
+        assert sharded.get(100) == pytest.approx(vectors[100].tolist())
+        with pytest.raises(DuplicateIDError):
+            sharded.insert_batch([1000, 5], vectors[:2])
+        assert 1000 not in sharded
+
+        queries = vectors[:4] + 0.01
+        sharded_ids, sharded_dists = sharded.ground_truth(queries, k=5)
+        single_ids, single_dists = single.ground_truth(queries, k=5)
+        assert sharded_ids.tolist() == single_ids.tolist()
+        assert np.allclose(sharded_dists, single_dists)
+
+    def test_invalid_shards(self):
+        """Test that a shard count below one is rejected."""
+        with pytest.raises(ValueError, match="Shards"):
+            Collection('test', dimension=3, hnsw_params={'shards': 0})
+
 
 class TestContains:
     """Tests for contains operation."""
@@ -238,6 +484,16 @@ class TestErrorHandling:
         with pytest.raises(DimensionError, match="Expected dimension 3"):
             col.search([1.0, 2.0], k=1)  # Wrong dimension
 
+    def test_dimension_validation_2d_array(self):
+        """Test that a 2-D array is not accepted as a single vector."""
+        col = Collection('test', dimension=3, metric='l2')
+        col.insert(1, np.array([1.0, 2.0, 3.0], dtype=np.float32))
+
+        with pytest.raises(DimensionError, match="Expected dimension 3"):
+            col.insert(2, np.ones((1, 3), dtype=np.float32))
+        with pytest.raises(DimensionError, match="Expected dimension 3"):
+            col.search(np.ones((3, 1), dtype=np.float32), k=1)
+
 
 class TestDistanceMetrics:
     """Tests for different distance metrics."""
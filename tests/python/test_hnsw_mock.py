@@ -5,10 +5,13 @@ Tests the brute-force mock implementation that matches the C++ interface.
 """
 
 import math
+import os
+import select
+import tempfile
 import pytest
 import numpy as np
 
-from vecdb._hnsw_mock import HNSWIndex
+from vecdb._hnsw_mock import HNSWIndex, Collection, QueryServer, ShardedCollection, WriteAheadLog
 from vecdb.exceptions import DimensionError, DuplicateIDError, DeserializationError
 
 
@@ -22,6 +25,9 @@ class TestHNSWIndexInit:
         assert index.metric == 'l2'
         assert index.M == 16  # Default
         assert index.ef_construction == 200  # Default
+        assert index.heuristic is True  # Default
+        assert index.keep_pruned is False  # Default
+        assert index.extend_candidates is False  # Default
         assert len(index) == 0
 
     def test_init_with_params(self):
@@ -45,6 +51,21 @@ class TestHNSWIndexInit:
         with pytest.raises(ValueError, match="Invalid metric"):
             HNSWIndex(dimension=128, metric='invalid')
 
+    def test_capacity(self):
+        """Test that max_elements, reserve and resize_index set the capacity."""
+        index = HNSWIndex(dimension=2, metric='l2', max_elements=100)
+        assert index.capacity >= 100
+        index.reserve(50)
+        assert index.capacity >= 100
+        index.add_batch([0, 9], [[0.0, 0.0], [1.0, 0.0]])
+        index.resize_index(10)
+        assert index.capacity == 10
+        with pytest.raises(ValueError):
+            index.resize_index(9)
+        index.add(10, [2.0, 0.0])
+        assert index.capacity >= 11
+        assert [r[0] for r in index.search([2.0, 0.0], k=3)] == [10, 9, 0]
+
 
 class TestDistanceL2:
     """Tests for L2 (Euclidean) distance calculation."""
@@ -212,6 +233,121 @@ class TestAddAndSearch:
         assert recall == 1.0
 
 
+class TestSearchBatch:
+    """Tests for batched search."""
+
+    def test_search_batch_matches_search(self):
+        """Test that each batch row equals the single-query result."""
+        np.random.seed(7)
+        index = HNSWIndex(dimension=8, metric='l2')
+        vectors = np.random.randn(50, 8).astype(np.float32)
+        for i, vec in enumerate(vectors):
+            index.add(i, vec)
+
+        queries = np.random.randn(5, 8).astype(np.float32)
+        ids, distances = index.search_batch(queries, k=4)
+
+        assert ids.shape == (5, 4) and ids.dtype == np.int64
+        assert distances.shape == (5, 4) and distances.dtype == np.float32
+        for row, query in enumerate(queries):
+            expected = index.search(query, k=4)
+            assert ids[row].tolist() == [r[0] for r in expected]
+            assert np.allclose(distances[row], [r[1] for r in expected], atol=1e-5)
+
+    def test_search_batch_filter(self):
+        """Test that a filter mask applies to every query of a batch."""
+        index = HNSWIndex(dimension=2, metric='l2')
+        index.add_batch([0, 1, 2], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0]])
+        mask = np.array([False, True, True])
+        ids, _ = index.search_batch(np.zeros((2, 2), dtype=np.float32), k=3, filter=mask)
+        assert ids.tolist() == [[1, 2, -1], [1, 2, -1]]
+
+    def test_search_batch_pads_missing_results(self):
+        """Test that rows are padded with -1 / inf beyond the index size."""
+        index = HNSWIndex(dimension=2, metric='l2')
+        index.add(0, [0.0, 0.0])
+        ids, distances = index.search_batch(np.zeros((2, 2), dtype=np.float32), k=3)
+        assert ids.tolist() == [[0, -1, -1], [0, -1, -1]]
+        assert np.isinf(distances[:, 1:]).all()
+
+    def test_search_batch_dimension_mismatch(self):
+        """Test that a wrongly shaped query array raises DimensionError."""
+        index = HNSWIndex(dimension=3, metric='l2')
+        with pytest.raises(DimensionError):
+            index.search_batch(np.zeros((2, 4), dtype=np.float32), k=1)
+
+    def test_search_exact(self):
+        """Test that the exact scan skips removed and filtered IDs and pads rows."""
+        index = HNSWIndex(dimension=2, metric='l2')
+        index.add_batch([0, 1, 2, 3], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0], [3.0, 0.0]])
+        index.remove(1)
+        assert index.flat_threshold == HNSWIndex.DEFAULT_FLAT_THRESHOLD
+        ids, distances = index.search_exact(np.array([[0.9, 0.0]], dtype=np.float32), k=4)
+        assert ids.tolist() == [[0, 2, 3, -1]]
+        assert np.allclose(distances[0, :3], [0.9, 1.1, 2.1]) and np.isinf(distances[0, 3])
+        ids, _ = index.search_exact(np.zeros((1, 2), dtype=np.float32), k=2,
+                                    filter=np.array([False, True, False, True]))
+        assert ids.tolist() == [[3, -1]]
+
+
+class TestQuantizedStorage:
+    """Tests for int8 storage mode."""
+
+    def test_invalid_storage(self):
+        """Test that an unknown storage mode raises ValueError."""
+        with pytest.raises(ValueError, match="Invalid storage"):
+            HNSWIndex(dimension=4, metric='l2', storage='int4')
+
+    def test_train_explicit(self):
+        """Test training from a sample, then adding and searching."""
+        index = HNSWIndex(dimension=4, metric='l2', storage='int8')
+        assert not index.is_trained
+        index.train(np.random.rand(50, 4).astype(np.float32))
+        assert index.is_trained
+        index.add(0, [0.1, 0.2, 0.3, 0.4])
+        assert index.search([0.1, 0.2, 0.3, 0.4], k=1)[0][0] == 0
+
+        with pytest.raises(RuntimeError, match="already trained"):
+            index.train()
+
+    def test_pq_subspaces_must_divide_dimension(self):
+        """Test that PQ rejects a subspace count not dividing the dimension."""
+        with pytest.raises(ValueError, match="pq_subspaces"):
+            HNSWIndex(dimension=10, metric='l2', storage='pq', pq_subspaces=4)
+
+    def test_pq_train_and_roundtrip(self):
+        """Test PQ training and that its settings survive serialization."""
+        index = HNSWIndex(dimension=8, metric='l2', storage='pq', pq_subspaces=4, rerank=True)
+        index.add_batch(np.arange(20), np.random.rand(20, 8))
+        index.train()
+        assert index.is_trained
+
+        index2 = HNSWIndex.deserialize(index.serialize())
+        assert index2.storage == 'pq'
+        assert index2.pq_subspaces == 4
+        assert index2.rerank is True
+        assert index2.is_trained
+
+    def test_train_requires_int8(self):
+        """Test that training float storage raises RuntimeError."""
+        index = HNSWIndex(dimension=4, metric='l2')
+        with pytest.raises(RuntimeError):
+            index.train(np.zeros((1, 4), dtype=np.float32))
+
+    def test_auto_train(self):
+        """Test that int8 storage trains once enough vectors are stored."""
+        index = HNSWIndex(dimension=4, metric='l2', storage='int8')
+        n = HNSWIndex.AUTO_TRAIN_SIZE
+        index.add_batch(np.arange(n - 1), np.random.rand(n - 1, 4))
+        assert not index.is_trained
+        index.add(n - 1, [0.5, 0.5, 0.5, 0.5])
+        assert index.is_trained
+
+        index2 = HNSWIndex.deserialize(index.serialize())
+        assert index2.storage == 'int8'
+        assert index2.is_trained
+
+
 class TestRemove:
     """Tests for remove operation."""
 
@@ -252,6 +388,73 @@ class TestRemove:
         index.add(0, [4.0, 5.0, 6.0])  # Should not raise
         assert len(index) == 1
 
+    def test_compact_reclaims_removed(self):
+        """Test that compact drops removed vectors and keeps the rest searchable."""
+        index = HNSWIndex(dimension=2, metric='l2')
+        index.add_batch([0, 1, 2], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0]])
+        index.remove(0)
+        index.remove(2)
+        assert index.compact() == 2
+        assert index.compact() == 0
+        assert len(index) == 1
+        assert index.search([0.0, 0.0], k=3) == [(1, 1.0)]
+        index.add(2, [3.0, 0.0])
+        assert [r[0] for r in index.search([3.0, 0.0], k=1)] == [2]
+
+    def test_reorder_renumbers_stored_nodes(self):
+        """Test that reorder packs stored nodes first and returns the mapping."""
+        index = HNSWIndex(dimension=2, metric='l2')
+        index.add_batch([0, 3, 5], [[0.0, 0.0], [3.0, 0.0], [5.0, 0.0]])
+        index.remove(3)
+        new_id = index.reorder()
+        assert sorted(new_id[[0, 3, 5]].tolist()) == [0, 1, 2]
+        assert sorted(new_id.tolist()) == list(range(6))
+        assert index.search([5.0, 0.0], k=1)[0][0] == new_id[5]
+        assert {r[0] for r in index.search([3.0, 0.0], k=3)} == {new_id[0], new_id[5]}
+        assert len(index) == 2
+
+
+class TestStats:
+    """Tests for search counters and the graph-health report."""
+
+    def test_search_return_stats(self):
+        """Test that return_stats adds this search's counters to the results."""
+        index = HNSWIndex(dimension=2, metric='l2')
+        index.add_batch([0, 1, 2], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0]])
+        index.remove(2)
+        results, stats = index.search([0.0, 0.0], k=2, return_stats=True)
+        assert results == index.search([0.0, 0.0], k=2)
+        assert stats['distances'] >= 2
+        assert stats['deleted_skipped'] == 1
+        assert set(stats) == {'distances', 'visited', 'heap_pushes', 'deleted_skipped', 'hops'}
+
+    def test_index_stats_accumulate(self):
+        """Test that stats() sums searches and inserts until reset_stats()."""
+        index = HNSWIndex(dimension=2, metric='l2')
+        index.add_batch([0, 1], [[0.0, 0.0], [1.0, 0.0]])
+        index.search([0.0, 0.0], k=1)
+        index.search_batch(np.zeros((3, 2), dtype=np.float32), k=1)
+        stats = index.stats()
+        assert stats['searches'] == 4
+        assert stats['inserts'] == 2
+        assert stats['search']['distances'] >= 4
+        assert 'prunes' in stats['build']
+        index.reset_stats()
+        assert index.stats()['searches'] == 0
+
+    def test_graph_health(self):
+        """Test the graph-health report's counts."""
+        index = HNSWIndex(dimension=2, metric='l2', M=4)
+        index.add_batch([0, 1, 2], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0]])
+        index.remove(1)
+        health = index.graph_health()
+        assert health['nodes'] == 2
+        assert health['deleted'] == 1
+        assert health['unreachable'] == 0
+        assert len(health['degree_histogram']) == 9
+        assert sum(health['degree_histogram']) == 2
+        assert sum(health['level_counts']) == 3
+
 
 class TestSerializeDeserialize:
     """Tests for serialization and deserialization."""
@@ -283,11 +486,55 @@ class TestSerializeDeserialize:
         results2 = index2.search(query, k=3)
         assert results1 == results2
 
+    def test_serialize_preserves_selection_flags(self):
+        """Test that neighbor selection flags survive a roundtrip."""
+        index = HNSWIndex(dimension=3, metric='l2', heuristic=False,
+                          keep_pruned=True, extend_candidates=True)
+        index2 = HNSWIndex.deserialize(index.serialize())
+        assert index2.heuristic is False
+        assert index2.keep_pruned is True
+        assert index2.extend_candidates is True
+
     def test_deserialize_corrupt_data(self):
         """Test that corrupt data raises DeserializationError."""
         with pytest.raises(DeserializationError):
             HNSWIndex.deserialize(b'corrupt data')
 
+    def test_save_open_mmap_roundtrip(self):
+        """Test that an index written by save() opens with open_mmap()."""
+        index = HNSWIndex(dimension=3, metric='l2')
+        index.add(0, [1.0, 0.0, 0.0])
+        index.add(1, [0.0, 1.0, 0.0])
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'index.hnsw')
+            index.save(path)
+
+            with open(path, 'rb') as f:
+                assert f.read(len(HNSWIndex.MMAP_MAGIC)) == HNSWIndex.MMAP_MAGIC
+            index2 = HNSWIndex.open_mmap(path)
+            assert len(index2) == 2
+            assert index2.search([1.0, 0.0, 0.0], k=1) == index.search([1.0, 0.0, 0.0], k=1)
+
+    def test_load_reads_saved_file(self):
+        """Test that load() reads a file written by save()."""
+        index = HNSWIndex(dimension=3, metric='cosine')
+        index.add(0, [1.0, 2.0, 3.0])
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'index.hnsw')
+            index.save(path)
+            index2 = HNSWIndex.load(path)
+            assert len(index2) == 1
+            assert index2.metric == 'cosine'
+
+    def test_open_mmap_rejects_serialized_bytes(self):
+        """Test that open_mmap() refuses files not written by save()."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'index.hnsw')
+            with open(path, 'wb') as f:
+                f.write(HNSWIndex(dimension=3, metric='l2').serialize())
+            with pytest.raises(DeserializationError):
+                HNSWIndex.open_mmap(path)
+
     def test_serialize_empty_index(self):
         """Test serialization of empty index."""
         index = HNSWIndex(dimension=3, metric='l2')
@@ -298,6 +545,245 @@ class TestSerializeDeserialize:
         assert index2.metric == 'l2'
 
 
+class TestCollectionCore:
+    """Tests for the mock collection core."""
+
+    def test_search_returns_user_ids(self):
+        """Test that search translates internal IDs to user IDs."""
+        core = Collection(HNSWIndex(dimension=2, metric='l2'))
+        core.insert(100, [0.0, 0.0])
+        core.insert_batch([200, 300], np.array([[1.0, 0.0], [5.0, 5.0]], dtype=np.float32))
+        assert core.next_internal_id == 3
+        assert [r[0] for r in core.search([0.9, 0.0], k=2)] == [200, 100]
+        assert core.get(300) == [5.0, 5.0]
+
+    def test_remove_keeps_row(self):
+        """Test that a removed ID's row stays in place, marked dead."""
+        core = Collection(HNSWIndex(dimension=2, metric='l2'))
+        core.insert_batch([1, 2], [[1.0, 0.0], [0.0, 1.0]])
+        assert core.remove(1)
+        assert not core.remove(1)
+        assert 1 not in core and len(core) == 1
+        internal_to_user, live, vectors = core.rows()
+        assert internal_to_user.tolist() == [1, 2]
+        assert live.tolist() == [0, 1]
+        assert vectors.shape == (2, 2)
+
+    def test_compact_reuses_rows(self):
+        """Test that rows freed by compact are handed out again, lowest first."""
+        core = Collection(HNSWIndex(dimension=2, metric='l2'))
+        core.insert_batch([1, 2, 3, 4], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0], [3.0, 0.0]])
+        core.remove(2)
+        core.remove(3)
+        core.insert(5, [5.0, 0.0])
+        assert core.next_internal_id == 5
+        assert core.compact() == 2
+        core.insert_batch([6, 7, 8], [[6.0, 0.0], [7.0, 0.0], [8.0, 0.0]])
+        internal_to_user, live, _ = core.rows()
+        assert internal_to_user.tolist() == [1, 6, 7, 4, 5, 8]
+        assert live.tolist() == [1] * 6
+        assert core.search([7.1, 0.0], k=1)[0][0] == 7
+        assert core.get(6) == [6.0, 0.0]
+
+    def test_reorder_moves_rows(self):
+        """Test that reorder keeps every user ID's vector and search results."""
+        core = Collection(HNSWIndex(dimension=2, metric='l2'))
+        core.insert_batch([1, 2, 3, 4], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0], [3.0, 0.0]])
+        core.remove(2)
+        core.compact()
+        before = core.search([2.9, 0.0], k=3)
+        core.reorder()
+        assert core.search([2.9, 0.0], k=3) == before
+        assert core.get(4) == [3.0, 0.0]
+        assert 2 not in core and len(core) == 3
+        core.insert(2, [1.0, 0.0])
+        assert core.search([1.1, 0.0], k=1)[0][0] == 2
+
+    def test_search_filter_by_user_id(self):
+        """Test that a filtered search returns only listed, present user IDs."""
+        core = Collection(HNSWIndex(dimension=2, metric='l2'))
+        core.insert_batch([10, 20, 30, 40], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0], [3.0, 0.0]])
+        core.remove(20)
+        results = core.search([0.0, 0.0], k=3, filter=[20, 40, 30, 99])
+        assert [r[0] for r in results] == [30, 40]
+        assert core.search([0.0, 0.0], k=3, filter=[]) == []
+        assert core.user_ids().tolist() == [10, 30, 40]
+
+    def test_batch_rejects_present_id(self):
+        """Test that a batch with a present user ID inserts nothing."""
+        core = Collection(HNSWIndex(dimension=2, metric='l2'))
+        core.insert(1, [1.0, 0.0])
+        with pytest.raises(DuplicateIDError, match="User ID 1 already exists"):
+            core.insert_batch([2, 1], [[0.0, 1.0], [1.0, 1.0]])
+        assert len(core) == 1 and core.next_internal_id == 1
+
+    def test_save_open_vectors_roundtrip(self):
+        """Test that open_vectors() restores what save_vectors() wrote."""
+        index = HNSWIndex(dimension=3, metric='l2')
+        core = Collection(index)
+        core.insert_batch([10, 20, 30], [[1.0, 0.0, 0.0], [0.0, 1.0, 0.0], [0.0, 0.0, 1.0]])
+        core.remove(20)
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'test.vectors')
+            core.save_vectors(path)
+            loaded = Collection.open_vectors(index, path)
+            assert len(loaded) == 2
+            assert loaded.next_internal_id == 3
+            assert loaded.get(30) == [0.0, 0.0, 1.0]
+            assert loaded.get(20) is None
+
+            with pytest.raises(DeserializationError, match="Dimension mismatch"):
+                Collection.open_vectors(HNSWIndex(dimension=2, metric='l2'), path)
+
+    def test_open_vectors_requires_indexed_rows(self):
+        """Test that open_vectors() rejects rows the index does not hold."""
+        core = Collection(HNSWIndex(dimension=2, metric='l2'))
+        core.insert(1, [1.0, 2.0])
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'test.vectors')
+            core.save_vectors(path)
+            with pytest.raises(DeserializationError, match="missing node"):
+                Collection.open_vectors(HNSWIndex(dimension=2, metric='l2'), path)
+
+    def test_replay_log(self):
+        """Test that replay_log() applies only the records after the snapshot's LSN."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'test.wal')
+            core = Collection(HNSWIndex(dimension=2, metric='l2'))
+            core.set_log(WriteAheadLog(path, 2))
+            core.insert(1, [1.0, 0.0])
+            lsn = core.log.last_lsn
+            core.insert_batch([2, 3], [[2.0, 0.0], [3.0, 0.0]])
+            core.remove(1)
+            core.log.sync()
+
+            loaded = Collection(HNSWIndex(dimension=2, metric='l2'))
+            loaded.insert(1, [1.0, 0.0])
+            assert loaded.replay_log(path, lsn) == 3
+            assert loaded.user_ids().tolist() == [2, 3]
+            assert loaded.get(3) == [3.0, 0.0]
+            assert loaded.log is None
+
+            with pytest.raises(DeserializationError, match="Log record 2"):
+                loaded.replay_log(path, 1)
+
+
+class TestShardedCollection:
+    """Tests for the mock sharded collection core."""
+
+    def test_routes_by_hash(self):
+        """Test that each user ID goes to the shard shard_of() names."""
+        shards = [Collection(HNSWIndex(dimension=2, metric='l2')) for _ in range(4)]
+        sharded = ShardedCollection(shards)
+        sharded.insert_batch(list(range(40)), np.arange(80, dtype=np.float32).reshape(40, 2))
+        assert len(sharded) == 40
+        assert [sharded.shard_of(i) for i in (25506, -4965, 0, 1, -1)] == [1, 3, 0, 1, 2]
+        for s, shard in enumerate(shards):
+            assert all(sharded.shard_of(i) == s for i in shard.user_ids().tolist())
+        assert sharded.remove(7) and not sharded.remove(7)
+        assert 7 not in sharded and sharded.get(8) == [16.0, 17.0]
+
+    def test_search_merges_shards(self):
+        """Test that search merges every shard's top k, closest first."""
+        sharded = ShardedCollection([Collection(HNSWIndex(dimension=1, metric='l2')) for _ in range(3)])
+        sharded.insert_batch(list(range(10)), [[float(i)] for i in range(10)])
+        assert [r[0] for r in sharded.search([4.2], k=4)] == [4, 5, 3, 6]
+        assert [r[0] for r in sharded.search([4.2], k=2, filter=[0, 9, 99])] == [0, 9]
+        assert sharded.search([4.2], k=2, filter=[]) == []
+
+    def test_rejects_misrouted_shards(self):
+        """Test that shards holding IDs routed elsewhere are rejected."""
+        shards = [Collection(HNSWIndex(dimension=2, metric='l2')) for _ in range(2)]
+        ShardedCollection(shards).insert_batch(list(range(10)), np.zeros((10, 2)))
+        with pytest.raises(DeserializationError, match="belongs to shard"):
+            ShardedCollection(shards[::-1])
+        with pytest.raises(ValueError):
+            ShardedCollection([shards[0], Collection(HNSWIndex(dimension=3, metric='l2'))])
+
+
+class TestQueryServer:
+    """Tests for the mock query server."""
+
+    def test_coalesces_and_notifies(self):
+        """Test that queued queries run in shared batches and wake notify_fd."""
+        col = Collection(HNSWIndex(dimension=1, metric='l2'))
+        col.insert_batch(list(range(10, 20)), [[float(i)] for i in range(10)])
+        server = QueryServer(col, max_batch=4, max_wait_us=100000, num_threads=1)
+        tickets = [server.submit([float(i)], k=2) for i in range(8)]
+        odd = server.submit([0.0], k=1)
+        done = {}
+        while len(done) < 9:
+            assert select.select([server.notify_fd], [], [], 5)[0]
+            done.update((ticket, (results, error)) for ticket, results, error in server.take_completed())
+        assert [done[t][0][0][0] for t in tickets] == list(range(10, 18))
+        assert done[odd] == ([(10, 0.0)], None)
+        assert server.batches == 3 and server.batched_queries == 9
+        assert server.take_completed() == []
+        server.close()
+        with pytest.raises(RuntimeError):
+            server.submit([0.0])
+        with pytest.raises(ValueError):
+            QueryServer(col, max_batch=0)
+
+
+class TestWriteAheadLog:
+    """Tests for the mock write-ahead log."""
+
+    def test_reopen_continues_lsns(self):
+        """Test that a reopened log keeps its records and numbering."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'test.wal')
+            log = WriteAheadLog(path, 2, after_lsn=10)
+            assert log.append_insert([1, 2], [[1.0, 0.0], [0.0, 1.0]]) == 11
+            assert log.append_remove([1]) == 12
+            log.sync()
+            del log
+
+            log = WriteAheadLog(path, 2)
+            assert log.last_lsn == 12
+            records, last = WriteAheadLog.replay(path, 2, 11)
+            assert last == 12
+            assert [(lsn, op, ids.tolist()) for lsn, op, ids, _ in records] == \
+                [(12, WriteAheadLog.REMOVE, [1])]
+
+            with pytest.raises(DeserializationError, match="dimension mismatch"):
+                WriteAheadLog(path, 3)
+
+    def test_torn_tail_is_dropped(self):
+        """Test that a partly written last record is cut off on open."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'test.wal')
+            log = WriteAheadLog(path, 2)
+            log.append_insert([1], [[1.0, 0.0]])
+            log.append_insert([2], [[2.0, 0.0]])
+            log.sync()
+            size = log.size
+            del log
+            os.truncate(path, os.path.getsize(path) - 5)
+
+            log = WriteAheadLog(path, 2)
+            assert log.last_lsn == 1
+            assert log.size < size
+            assert log.append_remove([1]) == 2
+            records, _ = WriteAheadLog.replay(path, 2)
+            assert [r[0] for r in records] == [1, 2]
+
+    def test_truncate_keeps_later_records(self):
+        """Test that truncate() drops the records a snapshot holds."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'test.wal')
+            log = WriteAheadLog(path, 2)
+            log.append_insert([1], [[1.0, 0.0]])
+            log.append_insert([2], [[2.0, 0.0]])
+            log.truncate(1)
+            assert log.append_remove([2]) == 3
+            records, last = WriteAheadLog.replay(path, 2)
+            assert [r[0] for r in records] == [2, 3]
+            log.truncate(last)
+            assert log.size == 0
+            assert WriteAheadLog.replay(path, 2) == ([], 3)
+
+
 class TestErrorHandling:
     """Tests for error handling."""
 
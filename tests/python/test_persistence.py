@@ -6,7 +6,9 @@ Tests the PersistenceManager class for saving and loading collections.
 
 import json
 import os
+import struct
 import tempfile
+import numpy as np
 import pytest
 
 from vecdb.collection import Collection
@@ -98,6 +100,132 @@ class TestSaveLoadCollection:
             results_after = loaded.search(query, k=3)
             assert results_before == results_after
 
+    def test_save_reordered(self):
+        """Test that saving with reorder keeps user IDs and search results."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            pm = PersistenceManager(tmpdir)
+
+            col = Collection('test', dimension=2, metric='l2')
+            col.insert_batch([10, 20, 30, 40], [[0.0, 0.0], [1.0, 0.0], [2.0, 0.0], [3.0, 0.0]])
+            col.delete(20)
+            query = [1.1, 0.0]
+            results_before = col.search(query, k=3)
+
+            pm.save_collection(col, reorder=True)
+            loaded = pm.load_collection('test')
+
+            assert loaded.search(query, k=3) == results_before
+            assert loaded.get(40) == pytest.approx([3.0, 0.0])
+            assert 20 not in loaded
+
+    def test_load_replays_log(self):
+        """Test that loading applies the changes logged since the last save."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            pm = PersistenceManager(tmpdir)
+
+            col = Collection('test', dimension=2, metric='l2')
+            col.insert(1, [1.0, 0.0])
+            pm.save_collection(col)
+            log = pm.open_log(col, sync_bytes=0)
+            col.insert_batch([2, 3], [[2.0, 0.0], [3.0, 0.0]])
+            col.delete(1)
+
+            loaded = pm.load_collection('test')
+            assert sorted(loaded.search([0.0, 0.0], k=3)) == sorted(col.search([0.0, 0.0], k=3))
+            assert 1 not in loaded and loaded.count() == 2
+
+            pm.save_collection(col)
+            with open(os.path.join(tmpdir, 'collections', 'test.meta')) as f:
+                assert json.load(f)['wal_lsn'] == log.last_lsn
+            assert log.size == 0
+            col.insert(4, [4.0, 0.0])
+            assert pm.load_collection('test').count() == 3
+
+    def test_save_load_sharded(self):
+        """Test that each shard is saved and loaded with its own files and log."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            pm = PersistenceManager(tmpdir)
+
+            col = Collection('test', dimension=2, metric='l2', hnsw_params={'shards': 3, 'flat_threshold': 5})
+            col.insert_batch(list(range(30)), [[float(i), 0.0] for i in range(30)])
+            pm.save_collection(col)
+            logs = pm.open_log(col, sync_bytes=0)
+            assert len(logs) == 3
+            col.insert(30, [30.0, 0.0])
+            col.delete(0)
+
+            files = os.listdir(os.path.join(tmpdir, 'collections'))
+            assert sorted(f for f in files if f.endswith('.hnsw')) == ['test.0.hnsw', 'test.1.hnsw', 'test.2.hnsw']
+            loaded = pm.load_collection('test')
+            assert loaded.shards == 3 and loaded.count() == 30
+            assert loaded.flat_threshold == 5
+            assert loaded.search([29.9, 0.0], k=2) == col.search([29.9, 0.0], k=2)
+            assert 0 not in loaded
+
+            assert pm.delete_collection('test')
+            assert os.listdir(os.path.join(tmpdir, 'collections')) == []
+
+    def test_load_serialized_hnsw_file(self):
+        """Test that .hnsw files in the older serialize() format still load."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            pm = PersistenceManager(tmpdir)
+
+            col = Collection('test', dimension=3, metric='l2')
+            col.insert(1, [1.0, 2.0, 3.0])
+            pm.save_collection(col)
+
+            hnsw_path = os.path.join(tmpdir, 'collections', 'test.hnsw')
+            with open(hnsw_path, 'wb') as f:
+                f.write(col._get_hnsw_index().serialize())
+
+            loaded = pm.load_collection('test')
+            assert loaded.count() == 1
+            assert loaded.search([1.0, 2.0, 3.0], k=1)[0][0] == 1
+
+    def test_load_maps_vectors_as_array(self):
+        """Test that loaded vectors are one array, with deleted IDs skipped."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            pm = PersistenceManager(tmpdir)
+
+            col = Collection('test', dimension=3, metric='l2')
+            col.insert_batch([10, 20, 30], [[1.0, 0.0, 0.0], [0.0, 1.0, 0.0], [0.0, 0.0, 1.0]])
+            col.delete(20)
+            pm.save_collection(col)
+
+            loaded = pm.load_collection('test')
+            state = loaded._get_state()
+            assert isinstance(state['vectors'], np.ndarray)
+            assert state['vectors'].dtype == np.float32
+            assert loaded.count() == 2
+            assert loaded.get(20) is None
+            assert loaded.get(30) == [0.0, 0.0, 1.0]
+
+            # The loaded collection keeps growing past the mapped rows
+            loaded.insert(40, [1.0, 1.0, 1.0])
+            assert loaded.get(40) == [1.0, 1.0, 1.0]
+            assert loaded.search([1.0, 1.0, 1.0], k=1)[0][0] == 40
+
+    def test_load_version_1_vectors_file(self):
+        """Test that .vectors files with one record per vector still load."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            pm = PersistenceManager(tmpdir)
+
+            col = Collection('test', dimension=2, metric='l2')
+            col.insert(7, [1.0, 2.0])
+            col.insert(8, [3.0, 4.0])
+            pm.save_collection(col)
+
+            vectors_path = os.path.join(tmpdir, 'collections', 'test.vectors')
+            with open(vectors_path, 'wb') as f:
+                f.write(struct.pack('<IQI', 1, 2, 2))
+                f.write(struct.pack('<QQ2f', 8, 1, 3.0, 4.0))
+                f.write(struct.pack('<QQ2f', 7, 0, 1.0, 2.0))
+
+            loaded = pm.load_collection('test')
+            assert loaded.count() == 2
+            assert loaded.get(7) == [1.0, 2.0]
+            assert loaded.get(8) == [3.0, 4.0]
+
     def test_save_overwrites_existing(self):
         """Test that saving overwrites existing collection files."""
         with tempfile.TemporaryDirectory() as tmpdir:
@@ -316,6 +444,15 @@ class TestAtomicWrites:
             tmp_files = [f for f in files if f.endswith('.tmp')]
             assert tmp_files == []
 
+    def test_stale_rerank_generations_removed(self):
+        """Test that saving drops the rerank file generations the new snapshot does not name."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            names = ['r.f32', 'r.f32.v1', 'r.f32.v2', 'r.f32.0', 'r.f32.v2.bak', 'other']
+            for name in names:
+                open(os.path.join(tmpdir, name), 'wb').close()
+            PersistenceManager._remove_stale_rerank_files(os.path.join(tmpdir, 'r.f32.v2'))
+            assert sorted(os.listdir(tmpdir)) == ['other', 'r.f32.0', 'r.f32.v2', 'r.f32.v2.bak']
+
 
 class TestLargeCollections:
     """Tests for larger collections."""
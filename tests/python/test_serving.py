@@ -0,0 +1,90 @@
+"""
+Unit tests for asynchronous query serving.
+
+Tests the AsyncSearcher, which coalesces concurrent queries into batches in
+the native query server.
+"""
+
+import asyncio
+
+import pytest
+import numpy as np
+
+from vecdb.collection import Collection
+from vecdb.exceptions import DimensionError
+from vecdb.serving import AsyncSearcher
+
+
+@pytest.fixture
+def collection():
+    np.random.seed(5)
+    col = Collection('test', dimension=8, metric='l2', hnsw_params={'shards': 2})
+    col.insert_batch(list(range(100, 500)), np.random.randn(400, 8).astype(np.float32))
+    return col
+
+
+class TestAsyncSearcher:
+    """Tests for AsyncSearcher."""
+
+    def test_matches_search(self, collection):
+        """Test that concurrent queries resolve to search()'s results and share batches."""
+        queries = np.random.randn(40, 8).astype(np.float32)
+
+        async def run():
+            async with AsyncSearcher(collection, max_batch=16, max_wait_us=50000, num_threads=2) as searcher:
+                results = await asyncio.gather(*(searcher.search(q, k=5) for q in queries))
+                return results, searcher.batches
+
+        results, (batches, batched) = asyncio.run(run())
+        for query, result in zip(queries, results):
+            assert [r[0] for r in result] == [r[0] for r in collection.search(query, k=5)]
+        assert batched == 40
+        assert batches < 40
+
+    def test_mixed_parameters(self, collection):
+        """Test that queries with different k are batched apart."""
+        query = np.random.randn(8).astype(np.float32)
+
+        async def run():
+            async with AsyncSearcher(collection, max_wait_us=1000) as searcher:
+                return await asyncio.gather(searcher.search(query, k=2), searcher.search(query, k=7),
+                                            searcher.search(query, k=7, ef_search=100))
+
+        short, long, wide = asyncio.run(run())
+        assert len(short) == 2 and len(long) == 7 and len(wide) == 7
+        assert short == long[:2]
+
+    def test_invalid_queries(self, collection):
+        """Test that bad queries fail at submit and leave the searcher usable."""
+        async def run():
+            async with AsyncSearcher(collection) as searcher:
+                with pytest.raises(DimensionError):
+                    searcher.submit([1.0, 2.0])
+                with pytest.raises(ValueError):
+                    searcher.submit(np.zeros(8), k=0)
+                return await searcher.search(np.zeros(8), k=3)
+
+        assert len(asyncio.run(run())) == 3
+
+    def test_close(self, collection):
+        """Test that close() resolves queued queries and refuses new ones."""
+        async def run():
+            searcher = AsyncSearcher(collection, max_wait_us=10_000_000)
+            futures = [searcher.submit(np.random.randn(8), k=3) for _ in range(4)]
+            cancelled = searcher.submit(np.zeros(8), k=3)
+            cancelled.cancel()
+            searcher.close()
+            searcher.close()
+            assert all(len(f.result()) == 3 for f in futures)
+            assert searcher.pending == 0
+            with pytest.raises(RuntimeError):
+                searcher.submit(np.zeros(8))
+
+        asyncio.run(run())
+
+    def test_needs_running_loop(self, collection):
+        """Test that submitting outside an event loop fails."""
+        searcher = AsyncSearcher(collection)
+        with pytest.raises(RuntimeError):
+            searcher.submit(np.zeros(8))
+        searcher.close()
@@ -208,6 +208,26 @@ class TestSave:
             db2 = VecDB(tmpdir)
             assert db2.list_collections() == ['a', 'b', 'c']
 
+    def test_wal_recovers_unsaved_changes(self):
+        """Test that in WAL mode changes survive without a save."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            db = VecDB(tmpdir, wal=True, wal_sync_bytes=0)
+            col = db.create_collection('test', dimension=3)
+            col.insert(1, [1.0, 2.0, 3.0])
+            col.insert(2, [4.0, 5.0, 6.0])
+            col.delete(1)
+
+            db2 = VecDB(tmpdir)
+            col2 = db2.get_collection('test')
+            assert col2.count() == 1
+            assert col2.get(2) == [4.0, 5.0, 6.0]
+            assert os.path.exists(os.path.join(tmpdir, 'collections', 'test.wal'))
+
+            db.save()
+            db3 = VecDB(tmpdir, wal=True)
+            db3.get_collection('test').insert(3, [7.0, 8.0, 9.0])
+            assert VecDB(tmpdir).get_collection('test').count() == 2
+
 
 class TestContextManager:
     """Tests for context manager support."""